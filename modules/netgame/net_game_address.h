@@ -0,0 +1,58 @@
+#ifndef NET_GAME_ADDRESS_H
+#define NET_GAME_ADDRESS_H
+
+#include "io/ip_address.h"
+
+// IPv4 addresses are kept IPv4-mapped, every host is 16 bytes
+#define ADDRESS_SIZE 16
+#define ADDRESS_WIRE_MAX (1 + ADDRESS_SIZE + 2)
+
+/**
+ * Peer addresses on the wire: [host length (4 or 16)][host][port 2].
+ * IPv4 peers (also on a dual stack socket) send the short form.
+ * In memory hosts are always compared as 16 bytes, a fixed size memcmp.
+ */
+class NetGameAddress {
+public:
+
+	static bool equals(const IP_Address &a, int a_port,
+				const IP_Address &b, int b_port) {
+		return a_port == b_port &&
+			memcmp(a.get_ipv6(), b.get_ipv6(), ADDRESS_SIZE) == 0;
+	}
+
+	static int get_size(const IP_Address &host) {
+		return host.is_ipv4() ? 7 : ADDRESS_WIRE_MAX;
+	}
+
+	static int encode(const IP_Address &host, int port, uint8_t *out) {
+		int len = host.is_ipv4() ? 4 : ADDRESS_SIZE;
+
+		out[0] = len;
+		memcpy(out + 1, len == 4 ? host.get_ipv4() : host.get_ipv6(), len);
+		out[len + 1] = port >> 8;
+		out[len + 2] = port;
+		return len + 3;
+	}
+
+	/*
+	 * Returns the encoded length, 0 if the address is invalid
+	 */
+	static int decode(const uint8_t *buf, int len, IP_Address &r_host,
+				int &r_port) {
+		if(len < 1 || (buf[0] != 4 && buf[0] != ADDRESS_SIZE) ||
+				len < buf[0] + 3) {
+			return 0;
+		}
+		if(buf[0] == 4) {
+			r_host.set_ipv4(buf + 1);
+		}
+		else {
+			r_host.set_ipv6(buf + 1);
+		}
+		r_port = (buf[buf[0] + 1] << 8) | buf[buf[0] + 2];
+		return buf[0] + 3;
+	}
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef NET_GAME_BITS_H
+#define NET_GAME_BITS_H
+
+#include "typedefs.h"
+#include "math/math_funcs.h"
+
+/**
+ * Bit packing helpers.
+ * Values are written LSB first, byte by byte, so the wire format does
+ * not depend on the host endianness.
+ */
+class NetGameBitWriter {
+
+	uint8_t *buf;
+	int max_bits;
+	int pos;
+	bool overflow;
+
+public:
+	_FORCE_INLINE_ void write_bits(uint32_t v, int bits) {
+		if(pos + bits > max_bits) {
+			overflow = true;
+			return;
+		}
+		while(bits > 0) {
+			int byte = pos >> 3;
+			int shift = pos & 7;
+			int n = MIN(8 - shift, bits);
+			uint8_t mask = ((1 << n) - 1) << shift;
+			buf[byte] = (buf[byte] & ~mask) |
+				((uint8_t)(v << shift) & mask);
+			v >>= n;
+			bits -= n;
+			pos += n;
+		}
+	}
+
+	_FORCE_INLINE_ void write_bool(bool v) {
+		write_bits(v ? 1 : 0, 1);
+	}
+
+	_FORCE_INLINE_ void write_int(int32_t v, int bits) {
+		write_bits((uint32_t)v, bits);
+	}
+
+	_FORCE_INLINE_ void write_float(float v) {
+		union { float f; uint32_t u; } c;
+		c.f = v;
+		write_bits(c.u, 32);
+	}
+
+	_FORCE_INLINE_ void write_quantized(float v, float min, float max,
+						int bits) {
+		uint32_t steps = (1u << bits) - 1;
+		float r = (CLAMP(v, min, max) - min) / (max - min);
+		write_bits((uint32_t)Math::floor(r * steps + 0.5), bits);
+	}
+
+	_FORCE_INLINE_ void write_bytes(const uint8_t *p, int len) {
+		int i;
+		for(i = 0; i < len; i++) {
+			write_bits(p[i], 8);
+		}
+	}
+
+	_FORCE_INLINE_ int get_pos() const { return pos; }
+	_FORCE_INLINE_ int get_byte_size() const { return (pos + 7) >> 3; }
+	_FORCE_INLINE_ bool has_overflow() const { return overflow; }
+
+	// Rollback to a previous position (drops a partially written entry)
+	_FORCE_INLINE_ void set_pos(int p) {
+		pos = p;
+		overflow = false;
+	}
+
+	NetGameBitWriter(uint8_t *p_buf, int p_size) {
+		buf = p_buf;
+		max_bits = p_size * 8;
+		pos = 0;
+		overflow = false;
+	}
+};
+
+class NetGameBitReader {
+
+	const uint8_t *buf;
+	int max_bits;
+	int pos;
+	bool error;
+
+public:
+	_FORCE_INLINE_ uint32_t read_bits(int bits) {
+		uint32_t v = 0;
+		int got = 0;
+		if(pos + bits > max_bits) {
+			error = true;
+			return 0;
+		}
+		while(got < bits) {
+			int byte = pos >> 3;
+			int shift = pos & 7;
+			int n = MIN(8 - shift, bits - got);
+			v |= ((uint32_t)((buf[byte] >> shift) &
+					((1 << n) - 1))) << got;
+			got += n;
+			pos += n;
+		}
+		return v;
+	}
+
+	_FORCE_INLINE_ bool read_bool() {
+		return read_bits(1) != 0;
+	}
+
+	_FORCE_INLINE_ int32_t read_int(int bits) {
+		ERR_FAIL_COND_V(bits < 1 || bits > 32, 0);
+		uint32_t v = read_bits(bits);
+		// Sign extend
+		if(bits < 32 && (v & (1u << (bits - 1)))) {
+			v |= ~((1u << bits) - 1);
+		}
+		return (int32_t)v;
+	}
+
+	_FORCE_INLINE_ float read_float() {
+		union { float f; uint32_t u; } c;
+		c.u = read_bits(32);
+		return c.f;
+	}
+
+	_FORCE_INLINE_ float read_quantized(float min, float max, int bits) {
+		uint32_t steps = (1u << bits) - 1;
+		return min + (max - min) * ((float)read_bits(bits) / steps);
+	}
+
+	_FORCE_INLINE_ void read_bytes(uint8_t *p, int len) {
+		int i;
+		for(i = 0; i < len; i++) {
+			p[i] = read_bits(8);
+		}
+	}
+
+	_FORCE_INLINE_ int get_pos() const { return pos; }
+	_FORCE_INLINE_ int get_remaining() const { return max_bits - pos; }
+	_FORCE_INLINE_ bool has_error() const { return error; }
+
+	NetGameBitReader(const uint8_t *p_buf, int p_size) {
+		buf = p_buf;
+		max_bits = p_size * 8;
+		pos = 0;
+		error = false;
+	}
+};
+
+#endif
@@ -0,0 +1,413 @@
+#include "modules/netgame/net_game_bridge.h"
+#include "os/os.h"
+#include "io/marshalls.h"
+#include "modules/netgame/net_game_crypto.h"
+#include "modules/netgame/net_game_session.h"
+
+CID NetGameBridge::_get_id() const {
+	int i;
+
+	for(i = 1; i <= BRIDGE_PEERS_MAX; i++) {
+		if(peers.find(i) == -1) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+NetGameBridge::Peer *NetGameBridge::_add_peer(
+				const Ref<StreamPeerTCP> &stream, bool outgoing,
+				uint64_t time) {
+	Peer *p = memnew(Peer);
+	p->id = _get_id();
+	p->stream = stream;
+	p->tcp = Ref<PacketPeerStream>( memnew(PacketPeerStream) );
+	p->tcp->set_stream_peer(stream);
+	p->outgoing = outgoing;
+	p->hello_sent = false;
+	p->has_hello = false;
+	p->ready = false;
+	p->closing = false;
+	p->queued = 0;
+	p->start = time;
+	p->recv_time = time;
+	p->send_time = time;
+	if(NetGameCrypto::random_bytes(p->nonce, BRIDGE_NONCE_SIZE) != OK) {
+		WARN_PRINT("Unable to get random bridge nonce");
+		int i;
+		for(i = 0; i < BRIDGE_NONCE_SIZE; i++) {
+			p->nonce[i] = rand() % 256;
+		}
+	}
+	peers.insert(p->id, p);
+	return p;
+}
+
+/*
+ * Proof of the key for a nonce, the role (who connected) is part of it
+ * so a peer can not send our own proof back
+ */
+uint64_t NetGameBridge::_mac(bool outgoing,
+				const uint8_t nonce[BRIDGE_NONCE_SIZE]) const {
+	uint8_t buf[1 + BRIDGE_NONCE_SIZE];
+
+	buf[0] = outgoing;
+	memcpy(buf + 1, nonce, BRIDGE_NONCE_SIZE);
+	return NetGameCrypto::siphash24(key, buf, sizeof(buf));
+}
+
+/*
+ * Both ends send [magic][role][nonce] first, then the proof for the
+ * nonce of the other end
+ */
+bool NetGameBridge::_handshake(Peer *p, const DVector<uint8_t> &pkt,
+				Vector<BridgeMessage> &r_events) {
+	DVector<uint8_t>::Read r = pkt.read();
+	uint8_t mac[BRIDGE_MAC_SIZE];
+
+	if(!p->has_hello) {
+		if(pkt.size() != BRIDGE_HELLO_SIZE ||
+				decode_uint32(r.ptr()) != BRIDGE_MAGIC ||
+				(bool)r[4] == p->outgoing) {
+			return false;
+		}
+		memcpy(p->peer_nonce, r.ptr() + 5, BRIDGE_NONCE_SIZE);
+		p->has_hello = true;
+
+		uint64_t m = _mac(p->outgoing, p->peer_nonce);
+		encode_uint32(m & 0xFFFFFFFF, mac);
+		encode_uint32(m >> 32, mac + 4);
+		return p->tcp->put_packet(mac, BRIDGE_MAC_SIZE) == OK;
+	}
+
+	if(pkt.size() != BRIDGE_MAC_SIZE) {
+		return false;
+	}
+	uint64_t m = _mac(!p->outgoing, p->nonce);
+	encode_uint32(m & 0xFFFFFFFF, mac);
+	encode_uint32(m >> 32, mac + 4);
+	if(!NetGameCrypto::equals(mac, r.ptr(), BRIDGE_MAC_SIZE)) {
+		WARN_PRINT("Bridge peer does not know the bridge key");
+		return false;
+	}
+	p->ready = true;
+
+	BridgeMessage ev;
+	ev.peer = p->id;
+	ev.op = BRIDGE_CONNECTED;
+	ev.id = 0;
+	ev.cmd = 0;
+	r_events.push_back(ev);
+	return true;
+}
+
+bool NetGameBridge::_parse(Peer *p, const DVector<uint8_t> &pkt,
+				Vector<BridgeMessage> &r_events) {
+	DVector<uint8_t>::Read r = pkt.read();
+	int ofs = 0;
+
+	while(ofs < pkt.size()) {
+		if(ofs + BRIDGE_HEADER > pkt.size() ||
+				r[ofs] >= BRIDGE_CONNECTED) {
+			return false;
+		}
+		uint32_t len = decode_uint32(r.ptr() + ofs + 4);
+		if(len > (uint32_t)(pkt.size() - ofs - BRIDGE_HEADER)) {
+			return false;
+		}
+		if(r[ofs] != BRIDGE_PING) {
+			BridgeMessage m;
+			m.peer = p->id;
+			m.op = (BridgeOp)r[ofs];
+			m.id = r[ofs + 1];
+			m.cmd = r[ofs + 2] | (r[ofs + 3] << 8);
+			m.data.resize(len);
+			if(len > 0) {
+				DVector<uint8_t>::Write w = m.data.write();
+				memcpy(w.ptr(), r.ptr() + ofs + BRIDGE_HEADER, len);
+			}
+			r_events.push_back(m);
+		}
+		ofs += BRIDGE_HEADER + len;
+	}
+	return true;
+}
+
+/*
+ * Socket work of one peer, returns false once it must be removed
+ */
+bool NetGameBridge::_update(Peer *p, uint64_t time,
+				Vector<BridgeMessage> &r_events) {
+	StreamPeerTCP::Status status = p->stream->get_status();
+	int i;
+
+	if(status == StreamPeerTCP::STATUS_CONNECTING) {
+		return !p->closing && time - p->start < BRIDGE_HELLO_TIMEOUT;
+	}
+	if(status != StreamPeerTCP::STATUS_CONNECTED) {
+		return false;
+	}
+
+	if(!p->hello_sent) {
+		uint8_t hello[BRIDGE_HELLO_SIZE];
+		encode_uint32(BRIDGE_MAGIC, hello);
+		hello[4] = p->outgoing;
+		memcpy(hello + 5, p->nonce, BRIDGE_NONCE_SIZE);
+		if(p->tcp->put_packet(hello, BRIDGE_HELLO_SIZE) != OK) {
+			return false;
+		}
+		p->hello_sent = true;
+	}
+
+	while(p->tcp->get_available_packet_count() > 0) {
+		DVector<uint8_t> pkt;
+		if(p->tcp->get_packet_buffer(pkt) != OK) {
+			return false;
+		}
+		p->recv_time = time;
+		if(!(p->ready ? _parse(p, pkt, r_events) :
+				_handshake(p, pkt, r_events))) {
+			return false;
+		}
+	}
+
+	if(!p->ready) {
+		return !p->closing && time - p->start < BRIDGE_HELLO_TIMEOUT;
+	}
+	if(time - p->recv_time > TIMEOUT) {
+		return false;
+	}
+
+	// Keep the link alive when there is nothing to send
+	if(p->queued == 0 && time - p->send_time >= TCP_PING) {
+		_queue(p, BRIDGE_PING, 0, 0, NULL, 0);
+	}
+	if(p->batch.size() > 0) {
+		p->batches.push_back(p->batch);
+		p->batch = DVector<uint8_t>();
+	}
+	for(i = 0; i < p->batches.size(); i++) {
+		if(p->tcp->put_packet_buffer(p->batches[i]) != OK) {
+			return false;
+		}
+		p->send_time = time;
+	}
+	p->batches.clear();
+	p->queued = 0;
+	return !p->closing;
+}
+
+Error NetGameBridge::_queue(Peer *p, BridgeOp op, CID id, int cmd,
+				const uint8_t *data, int len) {
+	if(p->closing || p->queued + BRIDGE_HEADER + len > BRIDGE_QUEUE_SIZE) {
+		return ERR_OUT_OF_MEMORY;
+	}
+	if(p->batch.size() > 0 &&
+			p->batch.size() + BRIDGE_HEADER + len > BRIDGE_BATCH_SIZE) {
+		p->batches.push_back(p->batch);
+		p->batch = DVector<uint8_t>();
+	}
+
+	int pos = p->batch.size();
+	p->batch.resize(pos + BRIDGE_HEADER + len);
+	DVector<uint8_t>::Write w = p->batch.write();
+	w[pos] = op;
+	w[pos + 1] = id;
+	w[pos + 2] = cmd & 0xFF;
+	w[pos + 3] = cmd >> 8;
+	encode_uint32(len, w.ptr() + pos + 4);
+	if(len > 0) {
+		memcpy(w.ptr() + pos + BRIDGE_HEADER, data, len);
+	}
+	p->queued += BRIDGE_HEADER + len;
+	return OK;
+}
+
+void NetGameBridge::set_key(const String &p_key) {
+	uint8_t psk[32];
+
+	mutex->lock();
+	has_key = !p_key.empty();
+	if(has_key) {
+		NetGameSession::derive_psk(p_key, psk);
+		memcpy(key, psk, 16);
+	}
+	mutex->unlock();
+}
+
+Error NetGameBridge::listen(int port, const IP_Address &bind) {
+	ERR_FAIL_COND_V(!has_key, ERR_UNCONFIGURED);
+	mutex->lock();
+	server->stop();
+	Error err = server->listen(port, bind);
+	listening = err == OK;
+	mutex->unlock();
+	return err;
+}
+
+/*
+ * Returns the peer id, -1 on failure. The peer is usable once
+ * connected (BRIDGE_CONNECTED), messages queued before are kept.
+ */
+int NetGameBridge::connect_to(const IP_Address &host, int port) {
+	ERR_FAIL_COND_V(!has_key, -1);
+	Ref<StreamPeerTCP> stream = StreamPeerTCP::create_ref();
+
+	mutex->lock();
+	if(peers.size() >= BRIDGE_PEERS_MAX ||
+			stream->connect(host, port) != OK) {
+		mutex->unlock();
+		return -1;
+	}
+	Peer *p = _add_peer(stream, true,
+				OS::get_singleton()->get_ticks_msec());
+	int out = p->id;
+	mutex->unlock();
+	return out;
+}
+
+/*
+ * Closed once the messages already queued are sent
+ */
+void NetGameBridge::disconnect(int peer) {
+	mutex->lock();
+	int index = peers.find(peer);
+	if(index != -1) {
+		peers.getv(index)->closing = true;
+	}
+	mutex->unlock();
+}
+
+bool NetGameBridge::is_ready(int peer) {
+	mutex->lock();
+	int index = peers.find(peer);
+	bool out = index != -1 && peers.getv(index)->ready;
+	mutex->unlock();
+	return out;
+}
+
+Array NetGameBridge::get_peers() {
+	Array out;
+	int i;
+
+	mutex->lock();
+	for(i = 0; i < peers.size(); i++) {
+		if(peers.getv(i)->ready) {
+			out.push_back(peers.getk(i));
+		}
+	}
+	mutex->unlock();
+	return out;
+}
+
+/*
+ * Up to BRIDGE_MESSAGE_MAX bytes, a batch is one stream packet
+ */
+Error NetGameBridge::send(int peer, BridgeOp op, CID id, int cmd,
+				const uint8_t *data, int len) {
+	ERR_FAIL_COND_V(len > BRIDGE_MESSAGE_MAX, ERR_INVALID_PARAMETER);
+	mutex->lock();
+	int index = peers.find(peer);
+	if(index == -1) {
+		mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	Error err = _queue(peers.getv(index), op, id, cmd, data, len);
+	mutex->unlock();
+	return err;
+}
+
+Error NetGameBridge::send(int peer, BridgeOp op, CID id, int cmd,
+				const DVector<uint8_t> &data) {
+	DVector<uint8_t>::Read r = data.read();
+	return send(peer, op, id, cmd, r.ptr(), data.size());
+}
+
+/*
+ * To every connected peer
+ */
+Error NetGameBridge::broadcast(BridgeOp op, CID id, int cmd,
+				const DVector<uint8_t> &data) {
+	DVector<uint8_t>::Read r = data.read();
+	Error out = OK;
+	int i;
+
+	ERR_FAIL_COND_V(data.size() > BRIDGE_MESSAGE_MAX, ERR_INVALID_PARAMETER);
+	mutex->lock();
+	for(i = 0; i < peers.size(); i++) {
+		Peer *p = peers.getv(i);
+		if(p->ready &&
+				_queue(p, op, id, cmd, r.ptr(), data.size()) != OK) {
+			out = ERR_OUT_OF_MEMORY;
+		}
+	}
+	mutex->unlock();
+	return out;
+}
+
+/*
+ * Accept, read and write every peer. Received messages and peer
+ * changes are appended to r_events.
+ */
+void NetGameBridge::poll(uint64_t time, Vector<BridgeMessage> &r_events) {
+	int i;
+
+	mutex->lock();
+	while(listening && server->is_connection_available()) {
+		Ref<StreamPeerTCP> stream = server->take_connection();
+		if(stream.is_null()) {
+			break;
+		}
+		if(peers.size() >= BRIDGE_PEERS_MAX) {
+			stream->disconnect();
+			continue;
+		}
+		_add_peer(stream, false, time);
+	}
+
+	i = 0;
+	while(i < peers.size()) {
+		Peer *p = peers.getv(i);
+		if(_update(p, time, r_events)) {
+			i++;
+			continue;
+		}
+		BridgeMessage ev;
+		ev.peer = p->id;
+		ev.op = BRIDGE_DISCONNECTED;
+		ev.id = 0;
+		ev.cmd = 0;
+		r_events.push_back(ev);
+		p->stream->disconnect();
+		peers.erase(p->id);
+		memdelete(p);
+	}
+	mutex->unlock();
+}
+
+void NetGameBridge::clear() {
+	int i;
+
+	mutex->lock();
+	for(i = 0; i < peers.size(); i++) {
+		peers.getv(i)->stream->disconnect();
+		memdelete(peers.getv(i));
+	}
+	peers.clear();
+	server->stop();
+	listening = false;
+	mutex->unlock();
+}
+
+NetGameBridge::NetGameBridge() {
+	mutex = Mutex::create();
+	server = TCP_Server::create_ref();
+	listening = false;
+	has_key = false;
+	memset(key, 0, sizeof(key));
+}
+
+NetGameBridge::~NetGameBridge() {
+	clear();
+	memdelete(mutex);
+}
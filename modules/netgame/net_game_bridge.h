@@ -0,0 +1,124 @@
+#ifndef NET_GAME_BRIDGE_H
+#define NET_GAME_BRIDGE_H
+
+#include "vmap.h"
+#include "dvector.h"
+#include "os/mutex.h"
+#include "io/tcp_server.h"
+#include "io/packet_peer.h"
+#include "modules/netgame/net_game_server_data.h"
+
+// Peer ids are 1 to BRIDGE_PEERS_MAX
+#define BRIDGE_PEERS_MAX 64
+#define BRIDGE_NONCE_SIZE 16
+#define BRIDGE_MAC_SIZE 8
+// [magic 4][role][nonce]
+#define BRIDGE_HELLO_SIZE (5 + BRIDGE_NONCE_SIZE)
+#define BRIDGE_MAGIC 0x4E474231
+#define BRIDGE_HELLO_TIMEOUT 5000
+// [op][id][cmd 2][len 4][data]
+#define BRIDGE_HEADER 8
+// Batches are closed past this size (PacketPeerStream takes packets up
+// to 64 KB with its 4 byte length), a peer may have this much queued
+#define BRIDGE_BATCH_SIZE 65532
+// Messages are never split across batches
+#define BRIDGE_MESSAGE_MAX (BRIDGE_BATCH_SIZE - BRIDGE_HEADER)
+#define BRIDGE_QUEUE_SIZE (1 << 22)
+
+enum BridgeOp {
+	// Signalled as bridge_packet
+	BRIDGE_PACKET,
+	// Sent as is to the client with the message id (UDP)
+	BRIDGE_TO_CLIENT,
+	// Session migration: offer, reply and the session itself
+	BRIDGE_MIGRATE_OFFER,
+	BRIDGE_MIGRATE_ACCEPT,
+	BRIDGE_MIGRATE_REJECT,
+	BRIDGE_MIGRATE,
+	BRIDGE_PING,
+	// Local events, never sent
+	BRIDGE_CONNECTED,
+	BRIDGE_DISCONNECTED
+};
+
+struct BridgeMessage {
+	CID peer;
+	BridgeOp op;
+	CID id;
+	int cmd;
+	DVector<uint8_t> data;
+};
+
+/**
+ * Server to server link (cluster bridge), TCP with the module's packet
+ * framing. Messages queued for a peer are packed in batches, the network
+ * thread of the server writes each batch as one packet.
+ * Both ends prove they know the bridge key before anything else is
+ * exchanged (SipHash of the other end's nonce). Messages are not
+ * encrypted, bridges are meant for a private network.
+ * Queueing is done by the game thread, poll() by the network thread.
+ */
+class NetGameBridge {
+
+	struct Peer {
+		CID id;
+		Ref<StreamPeerTCP> stream;
+		Ref<PacketPeerStream> tcp;
+		bool outgoing;
+		bool hello_sent;
+		bool has_hello;
+		bool ready;
+		bool closing;
+		uint8_t nonce[BRIDGE_NONCE_SIZE];
+		uint8_t peer_nonce[BRIDGE_NONCE_SIZE];
+		// Closed batches, then the open one
+		Vector<DVector<uint8_t> > batches;
+		DVector<uint8_t> batch;
+		int queued;
+		uint64_t start;
+		uint64_t recv_time;
+		uint64_t send_time;
+	};
+
+	Mutex *mutex;
+	Ref<TCP_Server> server;
+	bool listening;
+	VMap<CID, Peer*> peers;
+	bool has_key;
+	uint8_t key[16];
+
+	CID _get_id() const;
+	Peer *_add_peer(const Ref<StreamPeerTCP> &stream, bool outgoing,
+			uint64_t time);
+	uint64_t _mac(bool outgoing, const uint8_t nonce[BRIDGE_NONCE_SIZE]) const;
+	bool _handshake(Peer *p, const DVector<uint8_t> &pkt,
+			Vector<BridgeMessage> &r_events);
+	bool _parse(Peer *p, const DVector<uint8_t> &pkt,
+			Vector<BridgeMessage> &r_events);
+	bool _update(Peer *p, uint64_t time, Vector<BridgeMessage> &r_events);
+	Error _queue(Peer *p, BridgeOp op, CID id, int cmd,
+			const uint8_t *data, int len);
+
+public:
+	void set_key(const String &p_key);
+	Error listen(int port, const IP_Address &bind);
+	int connect_to(const IP_Address &host, int port);
+	void disconnect(int peer);
+	bool is_ready(int peer);
+	Array get_peers();
+
+	Error send(int peer, BridgeOp op, CID id, int cmd,
+			const uint8_t *data, int len);
+	Error send(int peer, BridgeOp op, CID id, int cmd,
+			const DVector<uint8_t> &data);
+	Error broadcast(BridgeOp op, CID id, int cmd,
+			const DVector<uint8_t> &data);
+
+	void poll(uint64_t time, Vector<BridgeMessage> &r_events);
+	void clear();
+
+	NetGameBridge();
+	~NetGameBridge();
+};
+
+#endif
@@ -1,486 +1,383 @@
 
-#include <modules/netgame/net_game_client.h>
+#include "modules/netgame/net_game_client.h"
 
-void NetGameClient::set_signal_mode(SignalsMode p_mode) {
-	if(!quit)
-	{
-		_update_signal_mode();
-	}
-	signal_mode = p_mode;
-}
-
-void NetGameClient::_update_signal_mode()
-{
-	set_process(false);
-	set_fixed_process(false);
-	switch(signal_mode)
-	{
-		case PROCESS:
-			set_process(true);
-			break;
-		case FIXED:
-			set_fixed_process(true);
-			break;
-		case THREADED:
-			// noop
-			break;
-	}
-}
-
-SignalsMode NetGameClient::get_signal_mode() const{
-	return signal_mode;
+void NetGameClient::_update_signal_mode() {
+	set_process(core->get_signal_mode() == PROCESS);
+	set_fixed_process(core->get_signal_mode() == FIXED);
 }
 
 void NetGameClient::_notification(int p_what) {
 	if (
-		(p_what==NOTIFICATION_PROCESS && signal_mode == PROCESS) ||
-		(p_what==NOTIFICATION_FIXED_PROCESS && signal_mode == FIXED)) {
-		// Flush signals
-		while(signal_queue.size() > 0) {
-			// Only this thread removes from the queue
-			// it is safe to lock here
-			signal_mutex->lock();
-			QueuedSignal *qs = signal_queue.get(0);
-			signal_queue.remove(0);
-			signal_mutex->unlock();
-			if(qs->has_pkt)
-				emit_signal(qs->signal, qs->id,
-						qs->cmd, qs->packet);
-			else
-				emit_signal(qs->signal, qs->id);
-			memdelete(qs);
-		}
+		(p_what==NOTIFICATION_PROCESS && core->get_signal_mode() == PROCESS) ||
+		(p_what==NOTIFICATION_FIXED_PROCESS && core->get_signal_mode() == FIXED)) {
+		core->poll();
 	}
 }
 
-/**
- * Main UDP/TCP server loop
- */
-void NetGameClient::_thread_start(void*s) {
-
-	int time = OS::get_singleton()->get_ticks_msec();
-	int t_udp = time;
-	int t_tcp = time;
-	int t_udp_ping = time;
-	int t_tcp_ping = time;
-	NetGameClient *self = (NetGameClient*) s;
-	StreamPeerTCP::Status status;
-
-	while (!self->quit && self->state != DISCONNECTED) {
-		// Check streams state
-		time = OS::get_singleton()->get_ticks_msec();
-		if(self->tcp->get_available_packet_count()) {
-			t_tcp = time;
-			self->_handle_tcp();
-		}
-		if(self->udp->get_available_packet_count()) {
-			t_udp = time;
-			self->_handle_udp();
-		}
-		// Skip udp timeout while in pre-auth mode
-		if(self->state == WAIT_AUTH) {
-			t_udp = time;
-		}
-		// Check timeout
-		if(t_udp + TIMEOUT < time || t_tcp + TIMEOUT < time) {
-			self->state = DISCONNECTED;
-			break;
-		}
-		// Send UDP ping
-		if(t_udp_ping + UDP_PING < time) {
-			self->_send_udp_ping();
-			t_udp_ping = time;
-		}
-		// Send TCP ping
-		if(t_tcp_ping + TCP_PING < time) {
-			self->_send_tcp_ping();
-			t_tcp_ping = time;
-		}
-
-		self->_flush_packets();
-
-		// Break if we got disconnected
-		status = self->tcp_stream->get_status();
-		if(status == StreamPeerTCP::STATUS_NONE ||
-			status == StreamPeerTCP::STATUS_ERROR) {
-			self->state = DISCONNECTED;
-			break;
-		}
-
-		// Sleep a bit
-		OS::get_singleton()->delay_usec(CLIENT_SLEEP_USEC);
-	}
+Ref<NetGameClientCore> NetGameClient::get_core() const {
+	return core;
+}
 
-	// Notify disconnection
-	self->_queue_signal(SIGNAL_CLIENT_DISCONNECT, self->client_id);
+void NetGameClient::connect_to(const String &host, int tcp_port, int udp_port) {
+	core->connect_to(host, tcp_port, udp_port);
+	_update_signal_mode();
 }
 
-void NetGameClient::_clear_queues() {
-	// Clear TCP queue
-	tcp_mutex->lock();
-	while(tcp_queue.size() > 0) {
-		QueuedPacket *qp = tcp_queue.get(0);
-		tcp_queue.remove(0);
-		memdelete(qp);
-	}
-	tcp_mutex->unlock();
-
-	// Clear UDP queue
-	udp_mutex->lock();
-	while(udp_queue.size() > 0) {
-		QueuedPacket *qp = udp_queue.get(0);
-		udp_queue.remove(0);
-		memdelete(qp);
-	}
-	udp_mutex->unlock();
-
-	// Clear Signal queue
-	signal_mutex->lock();
-	while(signal_queue.size() > 0) {
-		QueuedSignal *qs = signal_queue.get(0);
-		signal_queue.remove(0);
-		memdelete(qs);
-	}
-	signal_mutex->unlock();
-}
-
-void NetGameClient::_flush_packets() {
-	// Flush tcp
-	while(tcp_queue.size() > 0) {
-		// Only this thread removes from the queue
-		// it is safe to lock here
-		tcp_mutex->lock();
-		QueuedPacket *qp = tcp_queue.get(0);
-		tcp_queue.remove(0);
-		tcp_mutex->unlock();
-		tcp->put_packet_buffer(qp->packet);
-		memdelete(qp);
-	}
+void NetGameClient::connect_udp_only(const String &host, int udp_port) {
+	core->connect_udp_only(host, udp_port);
+	_update_signal_mode();
+}
 
-	// Flush udp
-	while(udp_queue.size() > 0) {
-		// Only this thread removes from the queue
-		// it is safe to lock here
-		udp_mutex->lock();
-		QueuedPacket *qp = udp_queue.get(0);
-		udp_queue.remove(0);
-		udp_mutex->unlock();
-		udp->put_packet_buffer(qp->packet);
-		memdelete(qp);
-	}
+bool NetGameClient::is_udp_only() const {
+	return core->is_udp_only();
 }
 
-/***
- * Manage TCP packets
- */
-void NetGameClient::_handle_tcp() {
-	uint8_t cmd, scmd;
-	DVector<uint8_t> pkt;
-	tcp->get_packet_buffer(pkt);
+void NetGameClient::close() {
+	core->close();
+}
 
-	if(pkt.size() < 2)
-		return;
+Error NetGameClient::put_tcp_packet(const DVector<uint8_t> &pkt, int cmd) {
+	return core->put_tcp_packet(pkt, cmd);
+}
 
-	cmd = pkt.get(0);
-	scmd = pkt.get(1);
-	pkt.remove(0);
-	pkt.remove(0);
+Error NetGameClient::put_udp_packet(const DVector<uint8_t> &pkt,
+			int cmd, bool timed) {
+	return core->put_udp_packet(pkt, cmd, timed);
+}
 
-	if(cmd == CMD_MAX) {
-		_handle_tcp_pcmd(pkt, scmd);
-	}
-	else if(state == WAIT_AUTH) {
-		_queue_signal(SIGNAL_AUTH_PACKET, client_id, pkt, cmd);
-	}
-	else if(state == READY) {
-		_queue_signal(SIGNAL_TCP_PACKET, client_id, pkt, cmd);
-	}
+void NetGameClient::set_signal_mode(SignalsMode p_mode) {
+	core->set_signal_mode(p_mode);
+	_update_signal_mode();
 }
 
+SignalsMode NetGameClient::get_signal_mode() const {
+	return core->get_signal_mode();
+}
 
-void NetGameClient::_handle_tcp_pcmd(DVector<uint8_t> pkt, uint8_t pcmd) {
-	if(pcmd == PCMD_AUTH) {
-		if(pkt.size() != 2) {
-			// Invalid auth packet
-			return;
-		}
+void NetGameClient::set_recorder(const Ref<NetGameRecorder> &p_recorder) {
+	core->set_recorder(p_recorder);
+}
 
-		// Auth received
-		client_id = pkt.get(0);
-		client_secret = pkt.get(1);
-		has_id = true;
-		state = WAIT_ACK;
-		_queue_signal(SIGNAL_CLIENT_CONNECT, client_id);
-	}
+Ref<NetGameRecorder> NetGameClient::get_recorder() const {
+	return core->get_recorder();
 }
 
-/***
- * Manage UDP packets
- */
-void NetGameClient::_handle_udp() {
-	uint8_t cmd, time;
-	DVector<uint8_t> pkt;
+void NetGameClient::set_secure(bool p_secure) {
+	core->set_secure(p_secure);
+}
 
-	udp->get_packet_buffer(pkt);
+bool NetGameClient::is_secure() const {
+	return core->is_secure();
+}
 
-	// Invalid packet
-	if(pkt.size() < 2) {
-		return;
-	}
-	cmd = pkt.get(0);
-	time = pkt.get(1);
-	pkt.remove(0);
-	pkt.remove(0);
-
-	// Protocol command
-	if(cmd == CMD_MAX) {
-		_handle_udp_pcmd(pkt, time);
-		return;
-	}
+void NetGameClient::set_secure_key(const String &p_key) {
+	core->set_secure_key(p_key);
+}
 
-	// Check size and time
-	if(pkt.size() < 1 || !_is_valid_time(cmd, time)) {
-		return;
-	}
+Error NetGameClient::register_message(int cmd, const Array &layout) {
+	return core->register_message(cmd, layout);
+}
 
-	if(time != 0) {
-		server_time[cmd] = time;
-	}
+void NetGameClient::unregister_message(int cmd) {
+	core->unregister_message(cmd);
+}
 
-	// Queue signal
-	_queue_signal(SIGNAL_UDP_PACKET, client_id, pkt, cmd);
+Error NetGameClient::put_tcp_message(int cmd, const Variant &args) {
+	return core->put_tcp_message(cmd, args);
 }
 
-void NetGameClient::_handle_udp_pcmd(DVector<uint8_t> pkt, uint8_t pcmd) {
-	if(pcmd == PCMD_AUTH && state != READY) {
-		if(pkt.size() != 6) {
-			// Auth failed, disconnecting
-			state = DISCONNECTED;
-			return;
-		}
+Error NetGameClient::put_udp_message(int cmd, const Variant &args, bool timed) {
+	return core->put_udp_message(cmd, args, timed);
+}
 
-		// Send reply
-		DVector<uint8_t> out;
-		out.append(CMD_MAX);
-		out.append(PCMD_AUTH);
-		out.append_array(pkt);
-		tcp->put_packet_buffer(out);
+bool NetGameClient::replica_has(int oid) {
+	return core->replica_has(oid);
+}
 
-		// Authed
-		_queue_signal(SIGNAL_CLIENT_READY, client_id);
-		state = READY;
-	}
+Variant NetGameClient::replica_get(int oid, const String &field) {
+	return core->replica_get(oid, field);
 }
 
-bool NetGameClient::_is_valid_time(uint8_t cmd, uint8_t time) {
-	return time == 0 || server_time[cmd] == 0 ||
-		(server_time[cmd] < time && (time - server_time[cmd]) < 128) ||
-		(time < server_time[cmd] && (server_time[cmd] - time) > 128);
+Dictionary NetGameClient::replica_get_fields(int oid) {
+	return core->replica_get_fields(oid);
 }
 
-void NetGameClient::_send_tcp_ping() {
-	uint8_t raw[2];
+Array NetGameClient::get_replica_ids() {
+	return core->get_replica_ids();
+}
 
-	raw[0] = CMD_MAX;
-	raw[1] = PCMD_PING;
-	tcp->put_packet(raw, 2);
+int NetGameClient::get_disconnect_reason() const {
+	return core->get_disconnect_reason();
 }
 
-void NetGameClient::_send_udp_ping() {
-	if(!has_id) return;
+void NetGameClient::set_keepalive_interval(int p_msec) {
+	core->set_keepalive_interval(p_msec);
+}
 
-	uint8_t raw[4];
+int NetGameClient::get_keepalive_interval() const {
+	return core->get_keepalive_interval();
+}
 
-	raw[0] = client_id;
-	raw[1] = client_secret;
-	raw[2] = CMD_MAX;
-	raw[3] = PCMD_PING;
-	udp->put_packet(raw, 4);
+void NetGameClient::set_tcp_keepalive_interval(int p_msec) {
+	core->set_tcp_keepalive_interval(p_msec);
 }
 
-void NetGameClient::_queue_signal(const char *sig, CID id)
-{
-	if(signal_mode == THREADED) {
-		emit_signal(sig, id);
-	}
-	else {
-		if(signal_queue.size() >= SIG_QUEUE_SIZE) {
-			WARN_PRINT("SIGNAL QUEUE SIZE EXCEEDED");
-			return;
-		}
-		QueuedSignal *qs = (QueuedSignal *) memnew(QueuedSignal);
-		qs->id = id;
-		qs->signal = sig;
-		qs->cmd = -1;
-		qs->has_pkt = false;
-		signal_mutex->lock();
-		signal_queue.insert(signal_queue.size(), qs);
-		signal_mutex->unlock();
-	}
+int NetGameClient::get_tcp_keepalive_interval() const {
+	return core->get_tcp_keepalive_interval();
 }
 
-void NetGameClient::_queue_signal(const char *sig, CID id,
-				const DVector<uint8_t> pkt, int cmd)
-{
-	if(signal_mode == THREADED) {
-		emit_signal(sig, id, cmd, pkt);
-	}
-	else {
-		QueuedSignal *qs = (QueuedSignal *) memnew(QueuedSignal);
-		qs->id = id;
-		qs->signal = sig;
-		qs->packet = pkt;
-		qs->cmd = cmd;
-		qs->has_pkt = true;
-		signal_mutex->lock();
-		signal_queue.insert(signal_queue.size(), qs);
-		signal_mutex->unlock();
-	}
+void NetGameClient::set_keepalive_timeout(int p_msec) {
+	core->set_keepalive_timeout(p_msec);
 }
-void NetGameClient::connect_to(const String &host, int tcp_port, int udp_port) {
-	int i;
-	for(i = 0; i < 256; i++) {
-		server_time[i] = 0;
-		client_time[i] = 1;
-	}
 
-	IP_Address addr = IP_Address(host);
+int NetGameClient::get_keepalive_timeout() const {
+	return core->get_keepalive_timeout();
+}
 
-	close();
-	_update_signal_mode();
-	tcp_stream->connect(addr, tcp_port);
-	udp->set_send_address(addr, udp_port);
-	quit = false;
-	thread = Thread::create(_thread_start, this);
+void NetGameClient::set_keepalive_min_timeout(int p_msec) {
+	core->set_keepalive_min_timeout(p_msec);
 }
 
-void NetGameClient::close() {
+int NetGameClient::get_keepalive_min_timeout() const {
+	return core->get_keepalive_min_timeout();
+}
 
-	if (thread != NULL) {
-		quit = true;
-		Thread::wait_to_finish(thread);
-		memdelete(thread);
-		tcp_stream->disconnect();
-		udp->close();
-		_clear_queues();
-	}
-	thread = NULL;
+int NetGameClient::get_rtt() const {
+	return core->get_rtt();
 }
 
-DVector<uint8_t> NetGameClient::_build_tcp(DVector<uint8_t> pkt, uint8_t cmd) {
-	DVector<uint8_t> out;
+Dictionary NetGameClient::get_udp_stats(int cmd) {
+	return core->get_udp_stats(cmd);
+}
 
-	out.append(cmd);
-	out.append(0);
-	out.append_array(pkt);
+Ref<NetGameCall> NetGameClient::rpc_call(int method, const Variant &args) {
+	return core->rpc_call(method, args);
+}
 
-	return out;
+Error NetGameClient::rpc_reply(int rid, const Variant &result) {
+	return core->rpc_reply(rid, result);
 }
 
-DVector<uint8_t> NetGameClient::_build_udp(DVector<uint8_t> pkt,
-						uint8_t cmd, bool timed) {
-	DVector<uint8_t> out;
+void NetGameClient::set_rpc_timeout(int p_msec) {
+	core->set_rpc_timeout(p_msec);
+}
 
-	out.append(client_id);
-	out.append(client_secret);
-	out.append(cmd);
+int NetGameClient::get_rpc_timeout() const {
+	return core->get_rpc_timeout();
+}
 
-	if(timed) {
-		out.append(client_time[cmd]);
-		client_time[cmd] += 1;
-		if(client_time[cmd] == 0) {
-			client_time[cmd] = 1;
-		}
-	}
-	else {
-		out.append(0);
-	}
-	out.append_array(pkt);
+int NetGameClient::stream_file(const String &path, const String &name) {
+	return core->stream_file(path, name);
+}
 
-	return out;
+int NetGameClient::stream_buffer(const DVector<uint8_t> &buf, const String &name) {
+	return core->stream_buffer(buf, name);
 }
 
-Error NetGameClient::put_tcp_packet(const DVector<uint8_t> &pkt, int cmd) {
-	if(state == DISCONNECTED) {
-		return ERR_CONNECTION_ERROR;
-	}
-	if(tcp_queue.size() >= PKT_QUEUE_SIZE) {
-		WARN_PRINT("TCP QUEUE SIZE EXCEEDED");
-		return ERR_OUT_OF_MEMORY;
-	}
+Error NetGameClient::accept_stream(int sid, const String &path, int offset) {
+	return core->accept_stream(sid, path, offset);
+}
 
-	DVector<uint8_t> out;
+Error NetGameClient::cancel_stream(int sid) {
+	return core->cancel_stream(sid);
+}
 
-	QueuedPacket *qp = (QueuedPacket *) memnew(QueuedPacket);
-	qp->packet = _build_tcp(pkt, cmd);
-	tcp_mutex->lock();
-	tcp_queue.insert(tcp_queue.size(), qp);
-	tcp_mutex->unlock();
+Error NetGameClient::reject_stream(int sid) {
+	return core->reject_stream(sid);
+}
 
-	return OK;
+Error NetGameClient::put_input(int tick, const DVector<uint8_t> &input) {
+	return core->put_input(tick, input);
 }
 
-Error NetGameClient::put_udp_packet(const DVector<uint8_t> &pkt,
-					int cmd, bool timed) {
-	if(state != READY) {
-		return ERR_CONNECTION_ERROR;
-	}
-	if(udp_queue.size() >= PKT_QUEUE_SIZE) {
-		WARN_PRINT("UDP QUEUE SIZE EXCEEDED");
-		return ERR_OUT_OF_MEMORY;
-	}
+void NetGameClient::set_input_redundancy(int p_count) {
+	core->set_input_redundancy(p_count);
+}
 
-	QueuedPacket *qp = (QueuedPacket *) memnew(QueuedPacket);
-	qp->packet = _build_udp(pkt, cmd, timed);
-	udp_mutex->lock();
-	udp_queue.insert(udp_queue.size(), qp);
-	udp_mutex->unlock();
+int NetGameClient::get_input_redundancy() const {
+	return core->get_input_redundancy();
+}
+
+Error NetGameClient::set_predicted_state(int tick, const Variant &state) {
+	return core->set_predicted_state(tick, state);
+}
+
+Variant NetGameClient::get_predicted_state(int tick) {
+	return core->get_predicted_state(tick);
+}
+
+Array NetGameClient::get_unacked_inputs() {
+	return core->get_unacked_inputs();
+}
 
-	return OK;
+int NetGameClient::get_unacked_input_count() {
+	return core->get_unacked_input_count();
+}
+
+int NetGameClient::get_input_ack() const {
+	return core->get_input_ack();
+}
+
+Error NetGameClient::relay_udp(int id, const DVector<uint8_t> &pkt, int cmd) {
+	return core->relay_udp(id, pkt, cmd);
+}
+
+Error NetGameClient::relay_udp_group(const String &group, const DVector<uint8_t> &pkt, int cmd) {
+	return core->relay_udp_group(group, pkt, cmd);
+}
+
+Error NetGameClient::set_media_target(int stream, int id) {
+	return core->set_media_target(stream, id);
+}
+
+Error NetGameClient::set_media_target_group(int stream, const String &group) {
+	return core->set_media_target_group(stream, group);
+}
+
+Error NetGameClient::media_send(int stream, const DVector<uint8_t> &frame, int timestamp) {
+	return core->media_send(stream, frame, timestamp);
+}
+
+void NetGameClient::media_flush(int stream) {
+	core->media_flush(stream);
+}
+
+void NetGameClient::set_media_bundle(int p_frames) {
+	core->set_media_bundle(p_frames);
+}
+
+int NetGameClient::get_media_bundle() const {
+	return core->get_media_bundle();
+}
+
+void NetGameClient::set_media_jitter(int p_msec) {
+	core->set_media_jitter(p_msec);
+}
+
+int NetGameClient::get_media_jitter() const {
+	return core->get_media_jitter();
+}
+
+Dictionary NetGameClient::get_media_stats(int id, int stream) {
+	return core->get_media_stats(id, stream);
 }
 
 void NetGameClient::_bind_methods() {
 	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_CONNECT,PropertyInfo( Variant::INT,"id")));
 	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_READY,PropertyInfo( Variant::INT,"id")));
 	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_DISCONNECT,PropertyInfo( Variant::INT,"id")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_RESUME,PropertyInfo( Variant::INT,"id")));
 
 	ADD_SIGNAL(MethodInfo(SIGNAL_UDP_PACKET,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"cmd"), PropertyInfo( Variant::RAW_ARRAY,"pkt")));
 	ADD_SIGNAL(MethodInfo(SIGNAL_TCP_PACKET,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"cmd"), PropertyInfo( Variant::RAW_ARRAY,"pkt")));
 	ADD_SIGNAL(MethodInfo(SIGNAL_AUTH_PACKET,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"cmd"), PropertyInfo( Variant::RAW_ARRAY,"pkt")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_UDP_MESSAGE,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"cmd"), PropertyInfo( Variant::DICTIONARY,"msg")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_TCP_MESSAGE,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"cmd"), PropertyInfo( Variant::DICTIONARY,"msg")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_RPC_REQUEST,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"rid"), PropertyInfo( Variant::INT,"method"), PropertyInfo( Variant::NIL,"args")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_STREAM_OFFER,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"sid"), PropertyInfo( Variant::INT,"size"), PropertyInfo( Variant::STRING,"name")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_STREAM_PROGRESS,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"sid"), PropertyInfo( Variant::INT,"offset"), PropertyInfo( Variant::INT,"size")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_STREAM_COMPLETED,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"sid"), PropertyInfo( Variant::INT,"error"), PropertyInfo( Variant::INT,"offset")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_RELAY_PACKET,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"cmd"), PropertyInfo( Variant::RAW_ARRAY,"pkt")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_MEDIA_FRAME,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"stream"), PropertyInfo( Variant::REAL,"timestamp"), PropertyInfo( Variant::RAW_ARRAY,"frame")));
 
 	BIND_CONSTANT(PROCESS);
 	BIND_CONSTANT(FIXED);
 	BIND_CONSTANT(THREADED);
 
+	BIND_CONSTANT(DISCONNECT_NONE);
+	BIND_CONSTANT(DISCONNECT_CLOSE);
+	BIND_CONSTANT(DISCONNECT_KICK);
+	BIND_CONSTANT(DISCONNECT_SHUTDOWN);
+	BIND_CONSTANT(DISCONNECT_RESTART);
+	BIND_CONSTANT(DISCONNECT_MIGRATE);
+
+	BIND_CONSTANT(MSG_BOOL);
+	BIND_CONSTANT(MSG_INT);
+	BIND_CONSTANT(MSG_UINT);
+	BIND_CONSTANT(MSG_FLOAT);
+	BIND_CONSTANT(MSG_VECTOR2);
+	BIND_CONSTANT(MSG_VECTOR3);
+	BIND_CONSTANT(MSG_STRING);
+
+	ObjectTypeDB::bind_method(_MD("get_core:NetGameClientCore"), &NetGameClient::get_core);
 	ObjectTypeDB::bind_method("connect_to", &NetGameClient::connect_to);
+	ObjectTypeDB::bind_method(_MD("connect_udp_only", "host", "udp_port"), &NetGameClient::connect_udp_only);
+	ObjectTypeDB::bind_method(_MD("is_udp_only"), &NetGameClient::is_udp_only);
 	ObjectTypeDB::bind_method("close", &NetGameClient::close);
 	ObjectTypeDB::bind_method(_MD("put_udp_packet:Error", "pkt", "cmd", "rt"),&NetGameClient::put_udp_packet,DEFVAL(0),DEFVAL(false));
 	ObjectTypeDB::bind_method(_MD("put_tcp_packet:Error", "pkt", "cmd"),&NetGameClient::put_tcp_packet,DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("register_message:Error", "cmd", "layout"),&NetGameClient::register_message);
+	ObjectTypeDB::bind_method(_MD("unregister_message", "cmd"),&NetGameClient::unregister_message);
+	ObjectTypeDB::bind_method(_MD("put_tcp_message:Error", "cmd", "args"),&NetGameClient::put_tcp_message);
+	ObjectTypeDB::bind_method(_MD("put_udp_message:Error", "cmd", "args", "rt"),&NetGameClient::put_udp_message,DEFVAL(false));
+	ObjectTypeDB::bind_method(_MD("replica_has", "oid"),&NetGameClient::replica_has);
+	ObjectTypeDB::bind_method(_MD("replica_get", "oid", "field"),&NetGameClient::replica_get);
+	ObjectTypeDB::bind_method(_MD("replica_get_fields", "oid"),&NetGameClient::replica_get_fields);
+	ObjectTypeDB::bind_method(_MD("get_replica_ids"),&NetGameClient::get_replica_ids);
+	ObjectTypeDB::bind_method(_MD("get_disconnect_reason"),&NetGameClient::get_disconnect_reason);
+	ObjectTypeDB::bind_method(_MD("set_secure","enabled"),&NetGameClient::set_secure);
+	ObjectTypeDB::bind_method(_MD("is_secure"),&NetGameClient::is_secure);
+	ObjectTypeDB::bind_method(_MD("set_secure_key","key"),&NetGameClient::set_secure_key);
 	ObjectTypeDB::bind_method(_MD("set_signal_mode","mode"),&NetGameClient::set_signal_mode);
 	ObjectTypeDB::bind_method(_MD("get_signal_mode"),&NetGameClient::get_signal_mode);
-	ADD_PROPERTYNZ( PropertyInfo(Variant::INT,"signal_mode",PROPERTY_HINT_ENUM,"Process,Fixed,Threaded"),_SCS("set_signal_mode"),_SCS("get_signal_mode"));}
+	ObjectTypeDB::bind_method(_MD("set_recorder","recorder:NetGameRecorder"),&NetGameClient::set_recorder);
+	ObjectTypeDB::bind_method(_MD("get_recorder:NetGameRecorder"),&NetGameClient::get_recorder);
+	ObjectTypeDB::bind_method(_MD("set_keepalive_interval","msec"),&NetGameClient::set_keepalive_interval);
+	ObjectTypeDB::bind_method(_MD("get_keepalive_interval"),&NetGameClient::get_keepalive_interval);
+	ObjectTypeDB::bind_method(_MD("set_tcp_keepalive_interval","msec"),&NetGameClient::set_tcp_keepalive_interval);
+	ObjectTypeDB::bind_method(_MD("get_tcp_keepalive_interval"),&NetGameClient::get_tcp_keepalive_interval);
+	ObjectTypeDB::bind_method(_MD("set_keepalive_timeout","msec"),&NetGameClient::set_keepalive_timeout);
+	ObjectTypeDB::bind_method(_MD("get_keepalive_timeout"),&NetGameClient::get_keepalive_timeout);
+	ObjectTypeDB::bind_method(_MD("set_keepalive_min_timeout","msec"),&NetGameClient::set_keepalive_min_timeout);
+	ObjectTypeDB::bind_method(_MD("get_keepalive_min_timeout"),&NetGameClient::get_keepalive_min_timeout);
+	ObjectTypeDB::bind_method(_MD("get_rtt"),&NetGameClient::get_rtt);
+	ObjectTypeDB::bind_method(_MD("get_udp_stats","cmd"),&NetGameClient::get_udp_stats,DEFVAL(-1));
+	ObjectTypeDB::bind_method(_MD("rpc_call:NetGameCall","method","args"),&NetGameClient::rpc_call,DEFVAL(Variant()));
+	ObjectTypeDB::bind_method(_MD("rpc_reply:Error","rid","result"),&NetGameClient::rpc_reply,DEFVAL(Variant()));
+	ObjectTypeDB::bind_method(_MD("set_rpc_timeout","msec"),&NetGameClient::set_rpc_timeout);
+	ObjectTypeDB::bind_method(_MD("get_rpc_timeout"),&NetGameClient::get_rpc_timeout);
+	ObjectTypeDB::bind_method(_MD("stream_file","path","name"),&NetGameClient::stream_file,DEFVAL(""));
+	ObjectTypeDB::bind_method(_MD("stream_buffer","buffer","name"),&NetGameClient::stream_buffer,DEFVAL(""));
+	ObjectTypeDB::bind_method(_MD("accept_stream:Error","sid","path","offset"),&NetGameClient::accept_stream,DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("cancel_stream:Error","sid"),&NetGameClient::cancel_stream);
+	ObjectTypeDB::bind_method(_MD("reject_stream:Error","sid"),&NetGameClient::reject_stream);
+	ObjectTypeDB::bind_method(_MD("put_input:Error","tick","input"),&NetGameClient::put_input);
+	ObjectTypeDB::bind_method(_MD("set_input_redundancy","count"),&NetGameClient::set_input_redundancy);
+	ObjectTypeDB::bind_method(_MD("get_input_redundancy"),&NetGameClient::get_input_redundancy);
+	ObjectTypeDB::bind_method(_MD("set_predicted_state:Error","tick","state"),&NetGameClient::set_predicted_state);
+	ObjectTypeDB::bind_method(_MD("get_predicted_state","tick"),&NetGameClient::get_predicted_state);
+	ObjectTypeDB::bind_method(_MD("get_unacked_inputs"),&NetGameClient::get_unacked_inputs);
+	ObjectTypeDB::bind_method(_MD("get_unacked_input_count"),&NetGameClient::get_unacked_input_count);
+	ObjectTypeDB::bind_method(_MD("get_input_ack"),&NetGameClient::get_input_ack);
+	ObjectTypeDB::bind_method(_MD("relay_udp:Error", "id", "pkt", "cmd"),&NetGameClient::relay_udp,DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("relay_udp_group:Error", "group", "pkt", "cmd"),&NetGameClient::relay_udp_group,DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("set_media_target:Error", "stream", "id"),&NetGameClient::set_media_target);
+	ObjectTypeDB::bind_method(_MD("set_media_target_group:Error", "stream", "group"),&NetGameClient::set_media_target_group);
+	ObjectTypeDB::bind_method(_MD("media_send:Error", "stream", "frame", "timestamp"),&NetGameClient::media_send);
+	ObjectTypeDB::bind_method(_MD("media_flush", "stream"),&NetGameClient::media_flush,DEFVAL(-1));
+	ObjectTypeDB::bind_method(_MD("set_media_bundle", "frames"),&NetGameClient::set_media_bundle);
+	ObjectTypeDB::bind_method(_MD("get_media_bundle"),&NetGameClient::get_media_bundle);
+	ObjectTypeDB::bind_method(_MD("set_media_jitter", "msec"),&NetGameClient::set_media_jitter);
+	ObjectTypeDB::bind_method(_MD("get_media_jitter"),&NetGameClient::get_media_jitter);
+	ObjectTypeDB::bind_method(_MD("get_media_stats", "id", "stream"),&NetGameClient::get_media_stats);
+	ADD_PROPERTYNZ( PropertyInfo(Variant::INT,"signal_mode",PROPERTY_HINT_ENUM,"Process,Fixed,Threaded"),_SCS("set_signal_mode"),_SCS("get_signal_mode"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"keepalive_interval",PROPERTY_HINT_RANGE,"50,10000,50"),_SCS("set_keepalive_interval"),_SCS("get_keepalive_interval"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"tcp_keepalive_interval",PROPERTY_HINT_RANGE,"100,30000,100"),_SCS("set_tcp_keepalive_interval"),_SCS("get_tcp_keepalive_interval"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"keepalive_timeout",PROPERTY_HINT_RANGE,"1000,120000,100"),_SCS("set_keepalive_timeout"),_SCS("get_keepalive_timeout"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"keepalive_min_timeout",PROPERTY_HINT_RANGE,"500,120000,100"),_SCS("set_keepalive_min_timeout"),_SCS("get_keepalive_min_timeout"));
+	ADD_PROPERTY( PropertyInfo(Variant::BOOL,"secure"),_SCS("set_secure"),_SCS("is_secure"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"rpc_timeout",PROPERTY_HINT_RANGE,"100,120000,100"),_SCS("set_rpc_timeout"),_SCS("get_rpc_timeout"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"input_redundancy",PROPERTY_HINT_RANGE,"1,8,1"),_SCS("set_input_redundancy"),_SCS("get_input_redundancy"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"media_bundle",PROPERTY_HINT_RANGE,"1,8,1"),_SCS("set_media_bundle"),_SCS("get_media_bundle"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"media_jitter",PROPERTY_HINT_RANGE,"0,1000,1"),_SCS("set_media_jitter"),_SCS("get_media_jitter"));
+}
 
 NetGameClient::NetGameClient() {
-	signal_mode = PROCESS;
-	state = WAIT_AUTH;
-	client_id = 0;
-	client_secret = 0;
-	quit = true;
-	has_id = false;
-	udp_mutex = Mutex::create();
-	tcp_mutex = Mutex::create();
-	signal_mutex = Mutex::create();
-	tcp_stream = StreamPeerTCP::create_ref();
-	tcp = Ref<PacketPeerStream>( memnew(PacketPeerStream) );
-	tcp->set_stream_peer(tcp_stream);
-	udp = PacketPeerUDP::create_ref();
-	thread = NULL;
+	core = Ref<NetGameClientCore>(memnew(NetGameClientCore));
+	core->set_signal_target(this);
 }
 
-
 NetGameClient::~NetGameClient() {
-	close();
-	memdelete(signal_mutex);
-	memdelete(udp_mutex);
-	memdelete(tcp_mutex);
+	core->close();
+	core->set_signal_target(NULL);
 }
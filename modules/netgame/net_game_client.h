@@ -1,79 +1,92 @@
 #ifndef UDPCLIENT_H
 #define UDPCLIENT_H
 
-#include "reference.h"
-#include "os/thread.h"
-#include "io/tcp_server.h"
 #include "scene/main/node.h"
-#include "io/packet_peer_udp.h"
-#include "modules/netgame/net_game_server_data.h"
+#include "modules/netgame/net_game_client_core.h"
 
+/**
+ * Scene node around NetGameClientCore: forwards the API, re-emits the
+ * signals from the node and polls them in process/fixed process.
+ */
 class NetGameClient: public Node {
 	OBJ_TYPE(NetGameClient,Node);
 
-	typedef uint8_t ClientID;
-	typedef uint8_t ClientSecret;
+	Ref<NetGameClientCore> core;
 
-	enum ClientState {
-		WAIT_AUTH, WAIT_ACK, READY, DISCONNECTED
-	};
-
-	ClientID client_id;
-	ClientSecret client_secret;
-	ClientState state;
-
-	Mutex *udp_mutex;
-	Mutex *tcp_mutex;
-	Mutex *signal_mutex;
-	Ref<StreamPeerTCP> tcp_stream;
-	Ref<PacketPeerStream> tcp;
-	Ref<PacketPeerUDP> udp;
-	Vector<QueuedPacket*> udp_queue;
-	Vector<QueuedPacket*> tcp_queue;
-	Vector<QueuedSignal*> signal_queue;
-	Thread *thread;
-	bool quit;
-	bool has_id;
-	uint8_t client_time[256];
-	uint8_t server_time[256];
-
-
-	void _check_connection();
-	void _send_udp_ping();
-	void _send_tcp_ping();
-	void _handle_udp();
-	void _handle_tcp();
-	void _handle_udp_pcmd(DVector<uint8_t> pkt, uint8_t pcmd);
-	void _handle_tcp_pcmd(DVector<uint8_t> pkt, uint8_t pcmd);
 	void _update_signal_mode();
-	void _flush_packets();
-	void _clear_queues();
-
-	void _queue_signal(const char *sig, CID id);
-	void _queue_signal(const char *sig, CID id,
-				const DVector<uint8_t> pkt, int cmd);
-
-	DVector<uint8_t> _build_tcp(DVector<uint8_t> pkt, uint8_t cmd);
-	DVector<uint8_t> _build_udp(DVector<uint8_t> pkt,
-					uint8_t cmd, bool timed);
 
 protected:
 	void _notification(int p_what);
 	static void _bind_methods();
 
 public:
-	SignalsMode signal_mode;
+	Ref<NetGameClientCore> get_core() const;
 
 	void connect_to(const String &host, int tcp_port, int udp_port);
-	bool _is_valid_time(uint8_t cmd, uint8_t time);
+	void connect_udp_only(const String &host, int udp_port);
+	bool is_udp_only() const;
 	void close();
 	Error put_tcp_packet(const DVector<uint8_t> &pkt, int cmd=0);
 	Error put_udp_packet(const DVector<uint8_t> &pkt,
 				int cmd=0, bool timed=false);
 	void set_signal_mode(SignalsMode p_mode);
 	SignalsMode get_signal_mode() const;
+	void set_recorder(const Ref<NetGameRecorder> &p_recorder);
+	Ref<NetGameRecorder> get_recorder() const;
+	void set_secure(bool p_secure);
+	bool is_secure() const;
+	void set_secure_key(const String &p_key);
+
+	Error register_message(int cmd, const Array &layout);
+	void unregister_message(int cmd);
+	Error put_tcp_message(int cmd, const Variant &args);
+	Error put_udp_message(int cmd, const Variant &args, bool timed=false);
+
+	bool replica_has(int oid);
+	Variant replica_get(int oid, const String &field);
+	Dictionary replica_get_fields(int oid);
+	Array get_replica_ids();
+	int get_disconnect_reason() const;
+
+	void set_keepalive_interval(int p_msec);
+	int get_keepalive_interval() const;
+	void set_tcp_keepalive_interval(int p_msec);
+	int get_tcp_keepalive_interval() const;
+	void set_keepalive_timeout(int p_msec);
+	int get_keepalive_timeout() const;
+	void set_keepalive_min_timeout(int p_msec);
+	int get_keepalive_min_timeout() const;
+	int get_rtt() const;
+	Dictionary get_udp_stats(int cmd=-1);
+	Ref<NetGameCall> rpc_call(int method, const Variant &args=Variant());
+	Error rpc_reply(int rid, const Variant &result=Variant());
+	void set_rpc_timeout(int p_msec);
+	int get_rpc_timeout() const;
+	int stream_file(const String &path, const String &name="");
+	int stream_buffer(const DVector<uint8_t> &buf, const String &name="");
+	Error accept_stream(int sid, const String &path, int offset=0);
+	Error cancel_stream(int sid);
+	Error reject_stream(int sid);
+	Error put_input(int tick, const DVector<uint8_t> &input);
+	void set_input_redundancy(int p_count);
+	int get_input_redundancy() const;
+	Error set_predicted_state(int tick, const Variant &state);
+	Variant get_predicted_state(int tick);
+	Array get_unacked_inputs();
+	int get_unacked_input_count();
+	int get_input_ack() const;
+	Error relay_udp(int id, const DVector<uint8_t> &pkt, int cmd=0);
+	Error relay_udp_group(const String &group, const DVector<uint8_t> &pkt, int cmd=0);
+	Error set_media_target(int stream, int id);
+	Error set_media_target_group(int stream, const String &group);
+	Error media_send(int stream, const DVector<uint8_t> &frame, int timestamp);
+	void media_flush(int stream=-1);
+	void set_media_bundle(int p_frames);
+	int get_media_bundle() const;
+	void set_media_jitter(int p_msec);
+	int get_media_jitter() const;
+	Dictionary get_media_stats(int id, int stream);
 
-	static void _thread_start(void*s);
 	NetGameClient();
 	~NetGameClient();
 };
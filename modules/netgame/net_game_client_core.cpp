@@ -0,0 +1,1900 @@
+
+#include <modules/netgame/net_game_client_core.h>
+#include "io/marshalls.h"
+#include "modules/netgame/net_game_relay.h"
+
+/*
+ * PROCESS and FIXED queue the signals until poll(), THREADED emits them
+ * from the network thread
+ */
+void NetGameClientCore::set_signal_mode(SignalsMode p_mode) {
+	signal_mode = p_mode;
+}
+
+SignalsMode NetGameClientCore::get_signal_mode() const{
+	return signal_mode;
+}
+
+void NetGameClientCore::set_secure(bool p_secure) {
+	ERR_FAIL_COND(!quit);
+	secure = p_secure;
+}
+
+bool NetGameClientCore::is_secure() const {
+	return secure;
+}
+
+void NetGameClientCore::set_secure_key(const String &p_key) {
+	ERR_FAIL_COND(!quit);
+	has_psk = !p_key.empty();
+	if(has_psk) {
+		NetGameSession::derive_psk(p_key, psk);
+	}
+}
+
+void NetGameClientCore::set_signal_target(Object *p_target) {
+	signal_target = p_target;
+}
+
+Object *NetGameClientCore::_get_signal_target() {
+	return signal_target != NULL ? signal_target : this;
+}
+
+/*
+ * The recorder itself can be started and stopped at any time
+ */
+void NetGameClientCore::set_recorder(const Ref<NetGameRecorder> &p_recorder) {
+	ERR_FAIL_COND(!quit);
+	recorder = p_recorder;
+}
+
+Ref<NetGameRecorder> NetGameClientCore::get_recorder() const {
+	return recorder;
+}
+
+/*
+ * Emit the queued signals, for at most max_usec (0 means all of them).
+ * Returns the number of signals emitted.
+ */
+int NetGameClientCore::poll(int max_usec) {
+	int count = 0;
+	uint64_t start = OS::get_singleton()->get_ticks_usec();
+	Object *target = _get_signal_target();
+
+	while(signal_queue.size() > 0) {
+		if(max_usec > 0 && count > 0 &&
+			OS::get_singleton()->get_ticks_usec() - start >= (uint64_t)max_usec) {
+			break;
+		}
+		// Only this thread removes from the queue
+		// it is safe to lock here
+		signal_mutex->lock();
+		QueuedSignal *qs = signal_queue.get(0);
+		signal_queue.remove(0);
+		signal_mutex->unlock();
+		if(qs->has_msg)
+			target->emit_signal(qs->signal, qs->id,
+					qs->cmd, qs->msg);
+		else if(qs->has_pkt)
+			target->emit_signal(qs->signal, qs->id,
+					qs->cmd, qs->packet);
+		else if(qs->has_args)
+			target->emit_signal(qs->signal, qs->id,
+					qs->rid, qs->cmd, qs->args);
+		else if(qs->has_frame)
+			target->emit_signal(qs->signal, qs->id,
+					qs->rid, qs->timestamp, qs->packet);
+		else
+			target->emit_signal(qs->signal, qs->id);
+		memdelete(qs);
+		count++;
+	}
+	if(signal_mode != THREADED) {
+		count += rpc.dispatch(OS::get_singleton()->get_ticks_msec());
+	}
+	return count;
+}
+
+/**
+ * Main UDP/TCP server loop
+ */
+void NetGameClientCore::_thread_start(void*s) {
+
+	int time = OS::get_singleton()->get_ticks_msec();
+	int t_udp = time;
+	int t_tcp = time;
+	int t_hello = 0;
+	NetGameClientCore *self = (NetGameClientCore*) s;
+	StreamPeerTCP::Status status;
+
+	while (!self->quit && self->state != DISCONNECTED) {
+		// Check streams state
+		time = OS::get_singleton()->get_ticks_msec();
+		if(!self->udp_only && self->tcp->get_available_packet_count()) {
+			t_tcp = time;
+			self->_handle_tcp();
+		}
+		if(self->udp->get_available_packet_count()) {
+			t_udp = time;
+			self->_handle_udp();
+		}
+		// Skip udp timeout while in pre-auth mode or resuming
+		if((self->state == WAIT_AUTH && !self->udp_only) ||
+				self->resuming) {
+			t_udp = time;
+		}
+		if(self->resuming || self->udp_only) {
+			t_tcp = time;
+		}
+		// UDP only handshake, repeated until welcomed
+		if(self->udp_only && !self->has_cookie &&
+				t_hello + HELLO_RETRY < time) {
+			self->_send_hello();
+			t_hello = time;
+		}
+		// Resend unacked reliable packets
+		if(self->udp_only && self->has_cookie) {
+			Vector<DVector<uint8_t> > resend;
+			int i;
+			self->reliable.get_resends(time, resend);
+			for(i = 0; i < resend.size(); i++) {
+				self->_put_udp_body(resend[i]);
+			}
+		}
+		// Check timeout (adapts to the RTT once measured)
+		if(t_udp + self->keepalive.get_udp_timeout() < time ||
+				t_tcp + self->keepalive.get_tcp_timeout() < time) {
+			self->state = DISCONNECTED;
+			break;
+		}
+		// Send pings, only when nothing else went out for an interval
+		if(self->keepalive.udp_ping_due(time)) {
+			self->_send_udp_ping(time);
+		}
+		if(self->keepalive.tcp_ping_due(time)) {
+			self->_send_tcp_ping();
+		}
+
+		// Media bundles left open, frames held for late packets
+		self->_media_tick(time);
+
+		self->_flush_packets();
+		self->_pump_streams();
+
+		if(self->signal_mode == THREADED) {
+			self->rpc.dispatch(time);
+		}
+
+		status = self->tcp_stream->get_status();
+		bool tcp_lost = !self->udp_only &&
+				(status == StreamPeerTCP::STATUS_NONE ||
+				status == StreamPeerTCP::STATUS_ERROR);
+
+		if(self->resuming) {
+			// Give up once the server forgot us, else retry
+			if(self->resume_time + self->resume_grace < time) {
+				self->state = DISCONNECTED;
+				break;
+			}
+			if(tcp_lost && self->resume_retry + RESUME_RETRY < time) {
+				self->resume_retry = time;
+				self->_reconnect_tcp();
+			}
+		}
+		// TCP lost or silent, resume the session on a new socket
+		else if(self->state == READY && self->has_token &&
+				(tcp_lost || t_tcp + RESUME_SILENCE < time)) {
+			self->_start_resume(time);
+		}
+		// Break if we got disconnected
+		else if(tcp_lost) {
+			self->state = DISCONNECTED;
+			break;
+		}
+
+		// Sleep a bit
+		OS::get_singleton()->delay_usec(CLIENT_SLEEP_USEC);
+	}
+
+	// Notify disconnection, the calls and streams still pending can not
+	// complete
+	Vector<TransferEvent> streams;
+	self->transfer.clear(streams);
+	self->_queue_events(streams);
+	self->rpc.clear();
+	if(self->signal_mode == THREADED) {
+		self->rpc.dispatch(OS::get_singleton()->get_ticks_msec());
+	}
+	self->_queue_signal(SIGNAL_CLIENT_DISCONNECT, self->client_id);
+}
+
+void NetGameClientCore::_clear_queues() {
+	// Clear TCP queue
+	tcp_mutex->lock();
+	while(tcp_queue.size() > 0) {
+		QueuedPacket *qp = tcp_queue.get(0);
+		tcp_queue.remove(0);
+		memdelete(qp);
+	}
+	tcp_mutex->unlock();
+
+	// Clear UDP queue
+	udp_mutex->lock();
+	while(udp_queue.size() > 0) {
+		QueuedPacket *qp = udp_queue.get(0);
+		udp_queue.remove(0);
+		memdelete(qp);
+	}
+	udp_mutex->unlock();
+
+	// Clear Signal queue
+	signal_mutex->lock();
+	while(signal_queue.size() > 0) {
+		QueuedSignal *qs = signal_queue.get(0);
+		signal_queue.remove(0);
+		memdelete(qs);
+	}
+	signal_mutex->unlock();
+}
+
+/*
+ * Bulk streams only fill the gaps, a few chunks per loop once the
+ * queued packets are out
+ */
+void NetGameClientCore::_pump_streams() {
+	Vector<TransferEvent> events;
+	DVector<uint8_t> pkt;
+	int chunk = udp_only ? TRANSFER_CHUNK_RELIABLE : TRANSFER_CHUNK;
+	int i;
+
+	if(state != READY || resuming || tcp_queue.size() > 0 ||
+			(secure && !session.is_ready())) {
+		return;
+	}
+	for(i = 0; i < TRANSFER_BURST; i++) {
+		if((udp_only && !reliable.can_send()) ||
+				!transfer.pump(chunk, pkt, events)) {
+			break;
+		}
+		_put_tcp(pkt);
+	}
+	_queue_events(events);
+}
+
+void NetGameClientCore::_queue_events(const Vector<TransferEvent> &events) {
+	int i;
+
+	for(i = 0; i < events.size(); i++) {
+		_queue_signal(events[i].signal, client_id, events[i].sid,
+				events[i].value, events[i].arg);
+	}
+}
+
+void NetGameClientCore::_flush_packets() {
+	// Flush tcp (once the cookie is echoed and, in secure mode,
+	// the session is ready)
+	while(tcp_queue.size() > 0 && has_cookie && !resuming &&
+			(!secure || session.is_ready()) &&
+			(!udp_only || reliable.can_send())) {
+		// Only this thread removes from the queue
+		// it is safe to lock here
+		tcp_mutex->lock();
+		QueuedPacket *qp = tcp_queue.get(0);
+		tcp_queue.remove(0);
+		tcp_mutex->unlock();
+		_put_tcp(qp->packet);
+		memdelete(qp);
+	}
+
+	// Flush udp
+	while(udp_queue.size() > 0) {
+		// Only this thread removes from the queue
+		// it is safe to lock here
+		udp_mutex->lock();
+		QueuedPacket *qp = udp_queue.get(0);
+		udp_queue.remove(0);
+		udp_mutex->unlock();
+		_put_udp(qp->packet);
+		memdelete(qp);
+	}
+}
+
+/***
+ * Manage TCP packets
+ */
+void NetGameClientCore::_handle_tcp() {
+	DVector<uint8_t> pkt;
+	tcp->get_packet_buffer(pkt);
+
+	// The server first asks for its connection cookie
+	if(!has_cookie) {
+		_handle_cookie(pkt);
+		return;
+	}
+
+	if(secure) {
+		// First packet must be the server key, then all encrypted
+		if(!session.is_ready()) {
+			_handle_key(pkt);
+			return;
+		}
+		DVector<uint8_t> raw = pkt;
+		DVector<uint8_t>::Read r = raw.read();
+		if(session.open(CHANNEL_TCP, r.ptr(), raw.size(), 0, pkt) != OK) {
+			WARN_PRINT("Invalid encrypted TCP packet");
+			state = DISCONNECTED;
+			return;
+		}
+	}
+
+	_handle_tcp_packet(pkt);
+}
+
+/*
+ * A TCP packet, or a reliable packet in UDP only mode
+ */
+void NetGameClientCore::_handle_tcp_packet(DVector<uint8_t> &pkt) {
+	uint8_t scmd;
+	int cmd, hdr;
+	bool proto;
+
+	{
+		DVector<uint8_t>::Read r = pkt.read();
+		hdr = NetGameCommand::read_header(r.ptr(), pkt.size(),
+						proto, cmd, scmd);
+	}
+	if(hdr == 0) {
+		return;
+	}
+	NetGameCommand::strip(pkt, hdr);
+
+	if(proto) {
+		_handle_tcp_pcmd(pkt, scmd);
+	}
+	else if(state == WAIT_AUTH) {
+		_queue_packet(SIGNAL_AUTH_PACKET, NULL, client_id, pkt, cmd);
+	}
+	else if(state == READY) {
+		_queue_packet(SIGNAL_TCP_PACKET, SIGNAL_TCP_MESSAGE,
+				client_id, pkt, cmd);
+	}
+}
+
+
+/*
+ * UDP only handshake replies (see NetGameServer::_handle_udp_handshake)
+ */
+void NetGameClientCore::_handle_udp_handshake(const DVector<uint8_t> &pkt) {
+	if(pkt.size() < 2 || pkt[0] != CMD_MAX) {
+		return;
+	}
+
+	DVector<uint8_t>::Read r = pkt.read();
+	if(pkt[1] == PCMD_COOKIE && pkt.size() == 2 + COOKIE_SIZE) {
+		memcpy(hello_cookie, r.ptr() + 2, COOKIE_SIZE);
+		has_hello_cookie = true;
+		_send_hello();
+	}
+	else if(pkt[1] == PCMD_WELCOME && has_hello_cookie &&
+			pkt.size() == 4 + (secure ? 32 : 0)) {
+		if(secure) {
+			if(session.setup(kx_priv, kx_pub, r.ptr() + 4, false,
+					has_psk ? psk : NULL) != OK) {
+				state = DISCONNECTED;
+				return;
+			}
+			memset(kx_priv, 0, 32);
+		}
+		client_id = pkt[2];
+		client_secret = pkt[3];
+		has_id = true;
+		has_cookie = true;
+	}
+}
+
+void NetGameClientCore::_send_hello() {
+	uint8_t raw[HELLO_SIZE];
+	int len = HELLO_SIZE;
+
+	memset(raw, 0, HELLO_SIZE);
+	raw[0] = HANDSHAKE_ID;
+	raw[1] = 0;
+	raw[2] = CMD_MAX;
+	raw[3] = PCMD_HELLO;
+	if(has_hello_cookie) {
+		raw[3] = PCMD_COOKIE;
+		memcpy(raw + 4, hello_cookie, COOKIE_SIZE);
+		len = 4 + COOKIE_SIZE;
+		if(secure) {
+			memcpy(raw + len, kx_pub, 32);
+			len += 32;
+		}
+	}
+	udp->put_packet(raw, len);
+}
+
+void NetGameClientCore::_send_disconnect() {
+	uint8_t raw[5];
+
+	if(!udp_only) {
+		raw[0] = CMD_MAX;
+		raw[1] = PCMD_DISCONNECT;
+		raw[2] = DISCONNECT_CLOSE;
+		_put_tcp(raw, 3);
+		return;
+	}
+	raw[0] = client_id;
+	raw[1] = client_secret;
+	raw[2] = CMD_MAX;
+	raw[3] = PCMD_DISCONNECT;
+	raw[4] = DISCONNECT_CLOSE;
+	_put_udp(raw, 5);
+}
+
+/*
+ * Reason sent by the server, DISCONNECT_NONE on timeouts
+ */
+void NetGameClientCore::_handle_disconnect(int reason) {
+	disconnect_reason = reason <= DISCONNECT_MIGRATE ?
+				(DisconnectReason)reason : DISCONNECT_NONE;
+
+	// The new server process takes the session over, resume on it
+	if((disconnect_reason == DISCONNECT_RESTART ||
+			disconnect_reason == DISCONNECT_MIGRATE) && state == READY &&
+			has_token && !udp_only && !resuming) {
+		_start_resume(OS::get_singleton()->get_ticks_msec());
+		return;
+	}
+	state = DISCONNECTED;
+}
+
+void NetGameClientCore::_handle_cookie(const DVector<uint8_t> &pkt) {
+	if(pkt.size() != 2 + COOKIE_SIZE || pkt[0] != CMD_MAX ||
+			pkt[1] != PCMD_COOKIE) {
+		WARN_PRINT("Invalid connection cookie");
+		state = DISCONNECTED;
+		return;
+	}
+
+	has_cookie = true;
+	if(!resuming) {
+		// Echo it back as is (always in clear)
+		tcp->put_packet_buffer(pkt);
+		return;
+	}
+
+	// Resume: [CMD_MAX][PCMD_RESUME][cookie][id][token] (in clear,
+	// the token is single use)
+	uint8_t raw[3 + COOKIE_SIZE + RESUME_TOKEN_SIZE];
+	DVector<uint8_t>::Read r = pkt.read();
+	raw[0] = CMD_MAX;
+	raw[1] = PCMD_RESUME;
+	memcpy(raw + 2, r.ptr() + 2, COOKIE_SIZE);
+	raw[2 + COOKIE_SIZE] = client_id;
+	memcpy(raw + 3 + COOKIE_SIZE, resume_token, RESUME_TOKEN_SIZE);
+	tcp->put_packet(raw, sizeof(raw));
+}
+
+/*
+ * Keep id, sequences, session and queues, only the TCP socket is replaced
+ */
+void NetGameClientCore::_start_resume(int time) {
+	resuming = true;
+	resume_time = time;
+	resume_retry = time;
+	_reconnect_tcp();
+}
+
+void NetGameClientCore::_reconnect_tcp() {
+	tcp_stream->disconnect();
+	tcp = Ref<PacketPeerStream>( memnew(PacketPeerStream) );
+	tcp->set_stream_peer(tcp_stream);
+	has_cookie = false;
+	tcp_stream->connect(server_addr, server_tcp_port);
+}
+
+void NetGameClientCore::_handle_key(const DVector<uint8_t> &pkt) {
+	uint8_t priv[32];
+	uint8_t raw[34];
+	uint8_t peer[32];
+
+	if(pkt.size() != 34 || pkt[0] != CMD_MAX || pkt[1] != PCMD_KEY) {
+		WARN_PRINT("Server is not in secure mode");
+		state = DISCONNECTED;
+		return;
+	}
+
+	DVector<uint8_t>::Read r = pkt.read();
+	memcpy(peer, r.ptr() + 2, 32);
+
+	if(NetGameSession::generate_keypair(priv, raw + 2) != OK ||
+		session.setup(priv, raw + 2, peer, false,
+				has_psk ? psk : NULL) != OK) {
+		state = DISCONNECTED;
+		return;
+	}
+	memset(priv, 0, 32);
+
+	// Our public key goes in clear, everything after is encrypted
+	raw[0] = CMD_MAX;
+	raw[1] = PCMD_KEY;
+	tcp->put_packet(raw, 34);
+}
+
+void NetGameClientCore::_handle_tcp_pcmd(DVector<uint8_t> pkt, uint8_t pcmd) {
+	if(pcmd == PCMD_DISCONNECT && !udp_only) {
+		_handle_disconnect(pkt.size() > 0 ? pkt[0] : DISCONNECT_NONE);
+	}
+	else if(pcmd == PCMD_AUTH) {
+		if(pkt.size() != 2 && pkt.size() != 4 + RESUME_TOKEN_SIZE) {
+			// Invalid auth packet
+			return;
+		}
+
+		// Auth received (with a resume token and grace if the server
+		// allows it)
+		client_id = pkt.get(0);
+		client_secret = pkt.get(1);
+		has_id = true;
+		has_token = pkt.size() > 2;
+		if(has_token) {
+			DVector<uint8_t>::Read r = pkt.read();
+			memcpy(resume_token, r.ptr() + 2, RESUME_TOKEN_SIZE);
+			resume_grace = (r[2 + RESUME_TOKEN_SIZE] << 8) |
+					r[3 + RESUME_TOKEN_SIZE];
+		}
+		state = WAIT_ACK;
+		_queue_signal(SIGNAL_CLIENT_CONNECT, client_id);
+
+		// The address was bound by the handshake in UDP only mode
+		if(udp_only) {
+			state = READY;
+			_queue_signal(SIGNAL_CLIENT_READY, client_id);
+		}
+	}
+	else if(pcmd == PCMD_RESUME && resuming) {
+		if(pkt.size() != RESUME_TOKEN_SIZE + 2) {
+			return;
+		}
+
+		// Resumed, the next token is for the next resume
+		DVector<uint8_t>::Read r = pkt.read();
+		memcpy(resume_token, r.ptr(), RESUME_TOKEN_SIZE);
+		resume_grace = (r[RESUME_TOKEN_SIZE] << 8) | r[RESUME_TOKEN_SIZE + 1];
+		resuming = false;
+		// A new server process starts its sequences again
+		udp_mutex->lock();
+		sequence.reset_rx();
+		udp_mutex->unlock();
+		_queue_signal(SIGNAL_CLIENT_RESUME, client_id);
+	}
+	else if(pcmd == PCMD_MIGRATE && state == READY && has_token &&
+			!udp_only && !resuming) {
+		// Moved to another server: [id][address][udp port 2], resume
+		// there with the id it gave
+		IP_Address host;
+		int port;
+		DVector<uint8_t>::Read r = pkt.read();
+		int len = pkt.size() < 1 ? 0 :
+			NetGameAddress::decode(r.ptr() + 1, pkt.size() - 1, host, port);
+		if(len == 0 || r[0] == HANDSHAKE_ID || pkt.size() != 1 + len + 2) {
+			WARN_PRINT("Invalid migration packet");
+			return;
+		}
+		udp_mutex->lock();
+		client_id = r[0];
+		udp_mutex->unlock();
+		server_addr = host;
+		server_tcp_port = port;
+		udp->set_send_address(host, (r[1 + len] << 8) | r[2 + len]);
+		_start_resume(OS::get_singleton()->get_ticks_msec());
+	}
+	else if(pcmd == PCMD_CALL && state == READY) {
+		uint32_t rid;
+		int method;
+		Variant args;
+		if(NetGameRPC::parse_call(pkt, rid, method, args) != OK) {
+			WARN_PRINT("Invalid RPC call received");
+			return;
+		}
+		_queue_signal(SIGNAL_RPC_REQUEST, client_id, rid, method, args);
+	}
+	else if(pcmd == PCMD_RESULT && state == READY) {
+		rpc.complete(0, pkt);
+	}
+	else if(pcmd == PCMD_STREAM && state == READY) {
+		Vector<DVector<uint8_t> > replies;
+		Vector<TransferEvent> events;
+		int i;
+		transfer.handle(pkt, replies, events);
+		for(i = 0; i < replies.size(); i++) {
+			_put_pcmd(replies[i], PCMD_STREAM);
+		}
+		_queue_events(events);
+	}
+}
+
+/***
+ * Manage UDP packets
+ */
+void NetGameClientCore::_handle_udp() {
+	// flags is the pcmd for protocol commands
+	uint8_t flags;
+	int cmd, hdr;
+	bool proto;
+	DVector<uint8_t> pkt;
+
+	udp->get_packet_buffer(pkt);
+
+	if(udp_only && !has_cookie) {
+		_handle_udp_handshake(pkt);
+		return;
+	}
+
+	if(secure) {
+		if(!session.is_ready()) {
+			return;
+		}
+		DVector<uint8_t> raw = pkt;
+		DVector<uint8_t>::Read r = raw.read();
+		if(session.open(CHANNEL_UDP, r.ptr(), raw.size(), 0, pkt) != OK) {
+			return;
+		}
+	}
+
+	{
+		DVector<uint8_t>::Read r = pkt.read();
+		hdr = NetGameCommand::read_header(r.ptr(), pkt.size(),
+						proto, cmd, flags);
+	}
+	// Invalid packet
+	if(hdr == 0) {
+		return;
+	}
+	NetGameCommand::strip(pkt, hdr);
+
+	// Protocol command
+	if(proto) {
+		_handle_udp_pcmd(pkt, flags);
+		return;
+	}
+
+	// Check size and order
+	bool timed = flags & UDP_FLAG_TIMED;
+	if(pkt.size() < (timed ? 3 : 1)) {
+		return;
+	}
+
+	if(timed) {
+		udp_mutex->lock();
+		SeqResult res = sequence.receive(cmd, pkt[0] | (pkt[1] << 8));
+		udp_mutex->unlock();
+		if(res != SEQ_NEW) {
+			return;
+		}
+		pkt.remove(0);
+		pkt.remove(0);
+	}
+
+	// Queue signal
+	_queue_packet(SIGNAL_UDP_PACKET, SIGNAL_UDP_MESSAGE, client_id, pkt, cmd);
+}
+
+/*
+ * [address][cookie], the address (IPv4 or IPv6) is echoed as is
+ */
+bool NetGameClientCore::_is_address_packet(const DVector<uint8_t> &pkt) {
+	IP_Address host;
+	int port;
+	DVector<uint8_t>::Read r = pkt.read();
+	int len = NetGameAddress::decode(r.ptr(), pkt.size(), host, port);
+
+	return len > 0 && pkt.size() == len + COOKIE_SIZE;
+}
+
+void NetGameClientCore::_handle_udp_pcmd(DVector<uint8_t> pkt, uint8_t pcmd) {
+	if(udp_only && pcmd == PCMD_RELIABLE) {
+		if(pkt.size() < 2) {
+			return;
+		}
+		DVector<uint8_t>::Read r = pkt.read();
+		if(!reliable.receive(r[0] | (r[1] << 8), r.ptr() + 2,
+					pkt.size() - 2)) {
+			return;
+		}
+
+		uint8_t raw[6];
+		uint16_t next = reliable.get_ack();
+		raw[0] = client_id;
+		raw[1] = client_secret;
+		raw[2] = CMD_MAX;
+		raw[3] = PCMD_ACK;
+		raw[4] = next & 0xFF;
+		raw[5] = next >> 8;
+		_put_udp(raw, 6);
+
+		DVector<uint8_t> inner;
+		while(state != DISCONNECTED && reliable.pop(inner)) {
+			_handle_tcp_packet(inner);
+		}
+	}
+	else if(udp_only && pcmd == PCMD_ACK) {
+		if(pkt.size() < 2) {
+			return;
+		}
+		reliable.ack(pkt[0] | (pkt[1] << 8));
+	}
+	else if(pcmd == PCMD_PING && pkt.size() == 2 && has_id) {
+		uint8_t raw[6];
+		raw[0] = client_id;
+		raw[1] = client_secret;
+		raw[2] = CMD_MAX;
+		raw[3] = PCMD_PONG;
+		raw[4] = pkt[0];
+		raw[5] = pkt[1];
+		_put_udp(raw, 6);
+	}
+	else if(pcmd == PCMD_PONG && pkt.size() == 2) {
+		keepalive.pong(pkt[0] | (pkt[1] << 8),
+				OS::get_singleton()->get_ticks_msec());
+	}
+	else if(pcmd == PCMD_INPUT_ACK && pkt.size() == 4 && state == READY) {
+		DVector<uint8_t>::Read r = pkt.read();
+		history.set_ack(decode_uint32(r.ptr()));
+	}
+	else if(pcmd == PCMD_RELAY && pkt.size() >= RELAY_HEADER &&
+			state == READY) {
+		CID from = pkt[0];
+		int cmd = pkt[1] | (pkt[2] << 8);
+		NetGameCommand::strip(pkt, RELAY_HEADER);
+		_queue_signal(SIGNAL_RELAY_PACKET, from, pkt, cmd);
+	}
+	else if(pcmd == PCMD_MEDIA && pkt.size() > 1 && state == READY) {
+		Vector<MediaFrame> frames;
+		DVector<uint8_t>::Read r = pkt.read();
+		udp_mutex->lock();
+		bool valid = media.receive(r[0], r.ptr() + 1, pkt.size() - 1,
+				OS::get_singleton()->get_ticks_msec(), frames);
+		udp_mutex->unlock();
+		if(!valid) {
+			WARN_PRINT("Invalid media packet");
+			return;
+		}
+		_queue_media(frames);
+	}
+	else if(udp_only && pcmd == PCMD_DISCONNECT) {
+		if(pkt.size() > 0 && pkt[0] == client_secret) {
+			_handle_disconnect(pkt.size() > 1 ? pkt[1] : DISCONNECT_NONE);
+		}
+	}
+	else if(udp_only && pcmd == PCMD_AUTH && state == READY) {
+		// Our address changed, echo the cookie from the new address
+		if(!_is_address_packet(pkt)) {
+			return;
+		}
+		DVector<uint8_t> out;
+		out.append(client_id);
+		out.append(client_secret);
+		out.append(CMD_MAX);
+		out.append(PCMD_AUTH);
+		out.append_array(pkt);
+		_put_udp(out);
+	}
+	else if(pcmd == PCMD_AUTH && state != READY && !udp_only) {
+		if(!_is_address_packet(pkt)) {
+			// Auth failed, disconnecting
+			state = DISCONNECTED;
+			return;
+		}
+
+		// Send reply
+		DVector<uint8_t> out;
+		out.append(CMD_MAX);
+		out.append(PCMD_AUTH);
+		out.append_array(pkt);
+		_put_tcp(out);
+
+		// Authed
+		_queue_signal(SIGNAL_CLIENT_READY, client_id);
+		state = READY;
+	}
+	else if(pcmd == PCMD_AUTH && state == READY) {
+		// Our address changed, echo the cookie to rebind it
+		if(!_is_address_packet(pkt) || resuming) {
+			return;
+		}
+		DVector<uint8_t> out;
+		out.append(CMD_MAX);
+		out.append(PCMD_AUTH);
+		out.append_array(pkt);
+		_put_tcp(out);
+	}
+	else if(pcmd == PCMD_REPLICA && state == READY) {
+		uint16_t seq;
+		if(replica.apply(pkt, seq) != OK) {
+			return;
+		}
+
+		// Ack so the server stops resending these changes
+		uint8_t raw[6];
+		raw[0] = client_id;
+		raw[1] = client_secret;
+		raw[2] = CMD_MAX;
+		raw[3] = PCMD_REPLICA;
+		raw[4] = seq & 0xFF;
+		raw[5] = seq >> 8;
+		_put_udp(raw, 6);
+	}
+}
+
+void NetGameClientCore::_send_tcp_ping() {
+	if(!has_cookie || resuming || udp_only) return;
+
+	uint8_t raw[2];
+
+	raw[0] = CMD_MAX;
+	raw[1] = PCMD_PING;
+	_put_tcp(raw, 2);
+}
+
+/*
+ * Probes carry a timestamp for the server to echo back (RTT)
+ */
+void NetGameClientCore::_send_udp_ping(int time) {
+	if(!has_id) return;
+
+	uint8_t raw[6];
+	int len = 4;
+
+	raw[0] = client_id;
+	raw[1] = client_secret;
+	raw[2] = CMD_MAX;
+	raw[3] = PCMD_PING;
+	if(state == READY && keepalive.probe_due(time)) {
+		raw[4] = time & 0xFF;
+		raw[5] = (time >> 8) & 0xFF;
+		len = 6;
+		keepalive.probe_sent(time);
+	}
+	_put_udp(raw, len);
+}
+
+Error NetGameClientCore::_put_tcp(const uint8_t *p_buf, int p_len) {
+	if(udp_only) {
+		DVector<uint8_t> body;
+		Error err = reliable.send(p_buf, p_len,
+				OS::get_singleton()->get_ticks_msec(), body);
+		if(err != OK) {
+			return err;
+		}
+		return _put_udp_body(body);
+	}
+
+	keepalive.sent_tcp(OS::get_singleton()->get_ticks_msec());
+	if(!secure) {
+		return tcp->put_packet(p_buf, p_len);
+	}
+
+	DVector<uint8_t> out;
+	Error err = session.seal(CHANNEL_TCP, p_buf, p_len, 0, out);
+	if(err != OK) {
+		return err;
+	}
+	return tcp->put_packet_buffer(out);
+}
+
+Error NetGameClientCore::_put_tcp(const DVector<uint8_t> &pkt) {
+	DVector<uint8_t>::Read r = pkt.read();
+	return _put_tcp(r.ptr(), pkt.size());
+}
+
+/*
+ * Protocol datagram, prefixed with our id and secret
+ */
+Error NetGameClientCore::_put_udp_body(const DVector<uint8_t> &body) {
+	DVector<uint8_t> out;
+	out.append(client_id);
+	out.append(client_secret);
+	out.append_array(body);
+	return _put_udp(out);
+}
+
+/*
+ * Client id and secret stay in clear so the server can find the session
+ */
+Error NetGameClientCore::_put_udp(const uint8_t *p_buf, int p_len) {
+	keepalive.sent_udp(OS::get_singleton()->get_ticks_msec());
+	if(!secure) {
+		return udp->put_packet(p_buf, p_len);
+	}
+
+	DVector<uint8_t> out;
+	Error err = session.seal(CHANNEL_UDP, p_buf, p_len, 2, out);
+	if(err != OK) {
+		return err;
+	}
+	return udp->put_packet_buffer(out);
+}
+
+Error NetGameClientCore::_put_udp(const DVector<uint8_t> &pkt) {
+	DVector<uint8_t>::Read r = pkt.read();
+	return _put_udp(r.ptr(), pkt.size());
+}
+
+void NetGameClientCore::_queue_signal(const char *sig, CID id)
+{
+	if(recorder.is_valid()) {
+		recorder->record(RECORD_SIGNAL, NetGameRecorder::signal_index(sig), id, 0);
+	}
+	if(signal_mode == THREADED) {
+		_get_signal_target()->emit_signal(sig, id);
+	}
+	else {
+		if(signal_queue.size() >= SIG_QUEUE_SIZE) {
+			WARN_PRINT("SIGNAL QUEUE SIZE EXCEEDED");
+			return;
+		}
+		QueuedSignal *qs = (QueuedSignal *) memnew(QueuedSignal);
+		qs->id = id;
+		qs->signal = sig;
+		qs->cmd = -1;
+		qs->has_pkt = false;
+		qs->has_msg = false;
+		signal_mutex->lock();
+		signal_queue.insert(signal_queue.size(), qs);
+		signal_mutex->unlock();
+	}
+}
+
+void NetGameClientCore::_queue_signal(const char *sig, CID id,
+				const DVector<uint8_t> pkt, int cmd)
+{
+	if(signal_mode == THREADED) {
+		_get_signal_target()->emit_signal(sig, id, cmd, pkt);
+	}
+	else {
+		QueuedSignal *qs = (QueuedSignal *) memnew(QueuedSignal);
+		qs->id = id;
+		qs->signal = sig;
+		qs->packet = pkt;
+		qs->cmd = cmd;
+		qs->has_pkt = true;
+		qs->has_msg = false;
+		signal_mutex->lock();
+		signal_queue.insert(signal_queue.size(), qs);
+		signal_mutex->unlock();
+	}
+}
+
+void NetGameClientCore::_queue_signal(const char *sig, CID id,
+				const Dictionary &msg, int cmd)
+{
+	if(signal_mode == THREADED) {
+		_get_signal_target()->emit_signal(sig, id, cmd, msg);
+	}
+	else {
+		QueuedSignal *qs = (QueuedSignal *) memnew(QueuedSignal);
+		qs->id = id;
+		qs->signal = sig;
+		qs->msg = msg;
+		qs->cmd = cmd;
+		qs->has_pkt = false;
+		qs->has_msg = true;
+		signal_mutex->lock();
+		signal_queue.insert(signal_queue.size(), qs);
+		signal_mutex->unlock();
+	}
+}
+
+void NetGameClientCore::_queue_signal(const char *sig, CID id, uint32_t rid,
+				int cmd, const Variant &args)
+{
+	if(signal_mode == THREADED) {
+		_get_signal_target()->emit_signal(sig, id, rid, cmd, args);
+	}
+	else {
+		QueuedSignal *qs = (QueuedSignal *) memnew(QueuedSignal);
+		qs->id = id;
+		qs->signal = sig;
+		qs->cmd = cmd;
+		qs->rid = rid;
+		qs->args = args;
+		qs->has_args = true;
+		signal_mutex->lock();
+		signal_queue.insert(signal_queue.size(), qs);
+		signal_mutex->unlock();
+	}
+}
+
+/*
+ * media_frame, the timestamp goes out as a float (an int would turn
+ * negative past 2^31)
+ */
+void NetGameClientCore::_queue_frame(CID id, int stream, uint32_t timestamp,
+				const DVector<uint8_t> &frame)
+{
+	if(signal_mode == THREADED) {
+		_get_signal_target()->emit_signal(SIGNAL_MEDIA_FRAME, id, stream,
+					(double)timestamp, frame);
+	}
+	else {
+		QueuedSignal *qs = (QueuedSignal *) memnew(QueuedSignal);
+		qs->id = id;
+		qs->signal = SIGNAL_MEDIA_FRAME;
+		qs->rid = stream;
+		qs->timestamp = timestamp;
+		qs->packet = frame;
+		qs->has_frame = true;
+		signal_mutex->lock();
+		signal_queue.insert(signal_queue.size(), qs);
+		signal_mutex->unlock();
+	}
+}
+
+/*
+ * Queue a received packet, decoding it first if its command has a
+ * registered message layout (invalid messages are dropped here).
+ * No msg_sig: never decoded (auth packets)
+ */
+void NetGameClientCore::_queue_packet(const char *sig, const char *msg_sig,
+				CID id, const DVector<uint8_t> &pkt, int cmd)
+{
+	if(recorder.is_valid()) {
+		recorder->record(RECORD_PACKET, NetGameRecorder::signal_index(sig),
+					id, cmd, pkt);
+	}
+	if(msg_sig == NULL || !schema.has_message(cmd)) {
+		_queue_signal(sig, id, pkt, cmd);
+		return;
+	}
+
+	Dictionary msg;
+	if(schema.decode(cmd, pkt, msg) != OK) {
+		WARN_PRINT("Invalid message received");
+		return;
+	}
+	_queue_signal(msg_sig, id, msg, cmd);
+}
+
+void NetGameClientCore::_start(const IP_Address &addr) {
+	close();
+	udp_mutex->lock();
+	sequence.reset();
+	media.clear();
+	udp_mutex->unlock();
+
+	replica.clear();
+	input_count = 0;
+	history.clear();
+	session.reset();
+	reliable.reset();
+	state = WAIT_AUTH;
+	has_id = false;
+	has_cookie = false;
+	has_token = false;
+	has_hello_cookie = false;
+	resuming = false;
+	disconnect_reason = DISCONNECT_NONE;
+	keepalive.reset(OS::get_singleton()->get_ticks_msec());
+	server_addr = addr;
+}
+
+void NetGameClientCore::connect_to(const String &host, int tcp_port, int udp_port) {
+	IP_Address addr = IP_Address(host);
+
+	_start(addr);
+	udp_only = false;
+	server_tcp_port = tcp_port;
+	tcp_stream->connect(addr, tcp_port);
+	udp->set_send_address(addr, udp_port);
+	quit = false;
+	thread = Thread::create(_thread_start, this);
+}
+
+/*
+ * Single UDP socket, see NetGameServer::start_udp_only
+ */
+void NetGameClientCore::connect_udp_only(const String &host, int udp_port) {
+	IP_Address addr = IP_Address(host);
+
+	_start(addr);
+	udp_only = true;
+	if(secure && NetGameSession::generate_keypair(kx_priv, kx_pub) != OK) {
+		ERR_PRINT("Unable to generate session key");
+		return;
+	}
+	udp->set_send_address(addr, udp_port);
+	quit = false;
+	thread = Thread::create(_thread_start, this);
+}
+
+bool NetGameClientCore::is_udp_only() const {
+	return udp_only;
+}
+
+void NetGameClientCore::close() {
+
+	if (thread != NULL) {
+		quit = true;
+		Thread::wait_to_finish(thread);
+		memdelete(thread);
+		// Tell the server, so it does not wait for us to resume
+		if(has_id && state != DISCONNECTED && !resuming) {
+			_send_disconnect();
+			disconnect_reason = DISCONNECT_CLOSE;
+		}
+		tcp_stream->disconnect();
+		udp->close();
+		_clear_queues();
+	}
+	thread = NULL;
+	rpc.clear();
+	if(signal_mode == THREADED) {
+		rpc.dispatch(OS::get_singleton()->get_ticks_msec());
+	}
+}
+
+DVector<uint8_t> NetGameClientCore::_build_tcp(DVector<uint8_t> pkt, int cmd) {
+	DVector<uint8_t> out;
+
+	NetGameCommand::write_header(out, cmd, 0);
+	out.append_array(pkt);
+
+	return out;
+}
+
+DVector<uint8_t> NetGameClientCore::_build_udp(DVector<uint8_t> pkt,
+						int cmd, bool timed) {
+	DVector<uint8_t> out;
+
+	out.append(client_id);
+	out.append(client_secret);
+
+	if(timed) {
+		uint16_t seq = sequence.next(cmd);
+		NetGameCommand::write_header(out, cmd, UDP_FLAG_TIMED);
+		out.append(seq & 0xFF);
+		out.append(seq >> 8);
+	}
+	else {
+		NetGameCommand::write_header(out, cmd, 0);
+	}
+	out.append_array(pkt);
+
+	return out;
+}
+
+Error NetGameClientCore::put_tcp_packet(const DVector<uint8_t> &pkt, int cmd) {
+	ERR_FAIL_INDEX_V(cmd, CMD_LIMIT, ERR_INVALID_PARAMETER);
+	if(state == DISCONNECTED) {
+		return ERR_CONNECTION_ERROR;
+	}
+	if(udp_only && pkt.size() + NetGameCommand::get_size(cmd) + 1 >
+			RELIABLE_MAX_SIZE) {
+		return ERR_INVALID_PARAMETER;
+	}
+	if(tcp_queue.size() >= PKT_QUEUE_SIZE) {
+		WARN_PRINT("TCP QUEUE SIZE EXCEEDED");
+		return ERR_OUT_OF_MEMORY;
+	}
+
+	DVector<uint8_t> out;
+
+	QueuedPacket *qp = (QueuedPacket *) memnew(QueuedPacket);
+	qp->packet = _build_tcp(pkt, cmd);
+	tcp_mutex->lock();
+	tcp_queue.insert(tcp_queue.size(), qp);
+	tcp_mutex->unlock();
+	if(recorder.is_valid()) {
+		recorder->record(RECORD_SEND_TCP, 0, client_id, cmd, pkt);
+	}
+
+	return OK;
+}
+
+/***
+ * Call "method" on the server, it answers with rpc_reply from its
+ * rpc_request handler. Sent in order with the TCP packets.
+ */
+Ref<NetGameCall> NetGameClientCore::rpc_call(int method, const Variant &args) {
+	DVector<uint8_t> body;
+	Ref<NetGameCall> call = rpc.begin(0, method, args,
+				OS::get_singleton()->get_ticks_msec(), body);
+	if(call->is_done()) {
+		return call;
+	}
+	Error err = _put_pcmd(body, PCMD_CALL);
+	if(err != OK) {
+		rpc.fail(call, err);
+	}
+	return call;
+}
+
+Error NetGameClientCore::rpc_reply(int rid, const Variant &result) {
+	DVector<uint8_t> body;
+	Error err = NetGameRPC::build_result(rid, result, body);
+	if(err != OK) {
+		return err;
+	}
+	return _put_pcmd(body, PCMD_RESULT);
+}
+
+void NetGameClientCore::set_rpc_timeout(int p_msec) {
+	rpc.set_timeout(p_msec);
+}
+
+int NetGameClientCore::get_rpc_timeout() const {
+	return rpc.get_timeout();
+}
+
+/***
+ * Input for a server tick, sent unreliably along with the previous
+ * inputs (input_redundancy in total) so a lost datagram costs nothing.
+ * The server reads them back with get_inputs_for_tick.
+ */
+Error NetGameClientCore::put_input(int tick, const DVector<uint8_t> &input) {
+	ERR_FAIL_COND_V(input.size() > INPUT_MAX_SIZE, ERR_INVALID_PARAMETER);
+	int i, count;
+
+	if(state != READY) {
+		return ERR_CONNECTION_ERROR;
+	}
+	if(udp_queue.size() >= PKT_QUEUE_SIZE) {
+		WARN_PRINT("UDP QUEUE SIZE EXCEEDED");
+		return ERR_OUT_OF_MEMORY;
+	}
+
+	for(i = INPUT_REDUNDANCY_MAX - 1; i > 0; i--) {
+		input_history[i] = input_history[i - 1];
+		input_ticks[i] = input_ticks[i - 1];
+	}
+	input_history[0] = input;
+	input_ticks[0] = tick;
+	input_count = MIN(input_count + 1, INPUT_REDUNDANCY_MAX);
+	history.put_input(tick, input);
+
+	// Only the inputs of the previous ticks are repeated
+	for(count = 1; count < input_redundancy && count < input_count &&
+			input_ticks[count] == (uint32_t)tick - count; count++);
+
+	QueuedPacket *qp = (QueuedPacket *) memnew(QueuedPacket);
+	qp->packet.append(client_id);
+	qp->packet.append(client_secret);
+	qp->packet.append(CMD_MAX);
+	qp->packet.append(PCMD_INPUT);
+	NetGameInputBuffer::build_packet(tick, input_history, count, qp->packet);
+	udp_mutex->lock();
+	udp_queue.insert(udp_queue.size(), qp);
+	udp_mutex->unlock();
+
+	return OK;
+}
+
+void NetGameClientCore::set_input_redundancy(int p_count) {
+	ERR_FAIL_COND(p_count < 1 || p_count > INPUT_REDUNDANCY_MAX);
+	input_redundancy = p_count;
+}
+
+int NetGameClientCore::get_input_redundancy() const {
+	return input_redundancy;
+}
+
+/*
+ * Prediction history, see NetGameHistory. Every put_input adds an entry,
+ * the state predicted for its tick can be attached to it.
+ */
+Error NetGameClientCore::set_predicted_state(int tick, const Variant &state) {
+	return history.set_state(tick, state);
+}
+
+Variant NetGameClientCore::get_predicted_state(int tick) {
+	return history.get_state(tick);
+}
+
+Array NetGameClientCore::get_unacked_inputs() {
+	return history.get_unacked();
+}
+
+int NetGameClientCore::get_unacked_input_count() {
+	return history.get_unacked_count();
+}
+
+int NetGameClientCore::get_input_ack() const {
+	return history.get_ack();
+}
+
+/***
+ * Bulk transfers, see NetGameTransfer. Returns the stream id, or -1 when
+ * not connected, the file can not be opened or too many streams are open.
+ */
+int NetGameClientCore::stream_file(const String &path, const String &name) {
+	DVector<uint8_t> body;
+	Error err;
+
+	if(state != READY) {
+		return -1;
+	}
+	int sid = transfer.send_file(path, name, body, err);
+	if(sid >= 0 && _put_pcmd(body, PCMD_STREAM) != OK) {
+		transfer.cancel(sid, body);
+		return -1;
+	}
+	return sid;
+}
+
+int NetGameClientCore::stream_buffer(const DVector<uint8_t> &buf,
+					const String &name) {
+	DVector<uint8_t> body;
+	Error err;
+
+	if(state != READY) {
+		return -1;
+	}
+	int sid = transfer.send_buffer(buf, name, body, err);
+	if(sid >= 0 && _put_pcmd(body, PCMD_STREAM) != OK) {
+		transfer.cancel(sid, body);
+		return -1;
+	}
+	return sid;
+}
+
+/*
+ * Accept a "stream_offer" into path, offset resumes a partial file
+ */
+Error NetGameClientCore::accept_stream(int sid, const String &path,
+					int offset) {
+	DVector<uint8_t> body;
+	Error err = transfer.accept(sid, path, offset, body);
+	if(err != OK) {
+		return err;
+	}
+	return _put_pcmd(body, PCMD_STREAM);
+}
+
+Error NetGameClientCore::cancel_stream(int sid) {
+	DVector<uint8_t> body;
+	Error err = transfer.cancel(sid, body);
+	if(err != OK) {
+		return err;
+	}
+	return _put_pcmd(body, PCMD_STREAM);
+}
+
+Error NetGameClientCore::reject_stream(int sid) {
+	DVector<uint8_t> body;
+	Error err = transfer.reject(sid, body);
+	if(err != OK) {
+		return err;
+	}
+	return _put_pcmd(body, PCMD_STREAM);
+}
+
+Error NetGameClientCore::_put_pcmd(const DVector<uint8_t> &pkt, uint8_t pcmd) {
+	if(state != READY) {
+		return ERR_CONNECTION_ERROR;
+	}
+	if(udp_only && pkt.size() + 2 > RELIABLE_MAX_SIZE) {
+		return ERR_INVALID_PARAMETER;
+	}
+	if(tcp_queue.size() >= PKT_QUEUE_SIZE) {
+		WARN_PRINT("TCP QUEUE SIZE EXCEEDED");
+		return ERR_OUT_OF_MEMORY;
+	}
+
+	QueuedPacket *qp = (QueuedPacket *) memnew(QueuedPacket);
+	qp->packet.append(CMD_MAX);
+	qp->packet.append(pcmd);
+	qp->packet.append_array(pkt);
+	tcp_mutex->lock();
+	tcp_queue.insert(tcp_queue.size(), qp);
+	tcp_mutex->unlock();
+
+	return OK;
+}
+
+Error NetGameClientCore::put_udp_packet(const DVector<uint8_t> &pkt,
+					int cmd, bool timed) {
+	ERR_FAIL_INDEX_V(cmd, CMD_LIMIT, ERR_INVALID_PARAMETER);
+	if(state != READY) {
+		return ERR_CONNECTION_ERROR;
+	}
+	if(udp_queue.size() >= PKT_QUEUE_SIZE) {
+		WARN_PRINT("UDP QUEUE SIZE EXCEEDED");
+		return ERR_OUT_OF_MEMORY;
+	}
+
+	QueuedPacket *qp = (QueuedPacket *) memnew(QueuedPacket);
+	udp_mutex->lock();
+	qp->packet = _build_udp(pkt, cmd, timed);
+	udp_queue.insert(udp_queue.size(), qp);
+	udp_mutex->unlock();
+	if(recorder.is_valid()) {
+		recorder->record(RECORD_SEND_UDP, timed, client_id, cmd, pkt);
+	}
+
+	return OK;
+}
+
+Error NetGameClientCore::register_message(int cmd, const Array &layout) {
+	ERR_FAIL_INDEX_V(cmd, CMD_LIMIT, ERR_INVALID_PARAMETER);
+	return schema.register_message(cmd, layout);
+}
+
+void NetGameClientCore::unregister_message(int cmd) {
+	schema.unregister_message(cmd);
+}
+
+Error NetGameClientCore::put_tcp_message(int cmd, const Variant &args) {
+	DVector<uint8_t> pkt;
+	Error err = schema.encode(cmd, args, pkt);
+	if(err != OK) {
+		return err;
+	}
+	return put_tcp_packet(pkt, cmd);
+}
+
+Error NetGameClientCore::put_udp_message(int cmd, const Variant &args,
+					bool timed) {
+	DVector<uint8_t> pkt;
+	Error err = schema.encode(cmd, args, pkt);
+	if(err != OK) {
+		return err;
+	}
+	return put_udp_packet(pkt, cmd, timed);
+}
+
+/*
+ * Relayed packet: [id][secret][CMD_MAX][PCMD_RELAY][target][cmd 2][pkt],
+ * see NetGameRelay
+ */
+Error NetGameClientCore::_relay_udp(const uint8_t *target, int len,
+				const DVector<uint8_t> &pkt, int cmd) {
+	ERR_FAIL_INDEX_V(cmd, CMD_LIMIT, ERR_INVALID_PARAMETER);
+	if(state != READY) {
+		return ERR_CONNECTION_ERROR;
+	}
+	if(udp_queue.size() >= PKT_QUEUE_SIZE) {
+		WARN_PRINT("UDP QUEUE SIZE EXCEEDED");
+		return ERR_OUT_OF_MEMORY;
+	}
+
+	QueuedPacket *qp = (QueuedPacket *) memnew(QueuedPacket);
+	qp->packet.resize(4 + len + 2 + pkt.size());
+	{
+		DVector<uint8_t>::Write w = qp->packet.write();
+		DVector<uint8_t>::Read r = pkt.read();
+		w[0] = client_id;
+		w[1] = client_secret;
+		w[2] = CMD_MAX;
+		w[3] = PCMD_RELAY;
+		memcpy(w.ptr() + 4, target, len);
+		w[4 + len] = cmd & 0xFF;
+		w[5 + len] = cmd >> 8;
+		memcpy(w.ptr() + 6 + len, r.ptr(), pkt.size());
+	}
+	udp_mutex->lock();
+	udp_queue.insert(udp_queue.size(), qp);
+	udp_mutex->unlock();
+	return OK;
+}
+
+/*
+ * Sent to another client through the server, it gets relay_packet with
+ * our id. Dropped if the server does not allow it (relay_rate).
+ */
+Error NetGameClientCore::relay_udp(int id, const DVector<uint8_t> &pkt,
+				int cmd) {
+	ERR_FAIL_INDEX_V(id, 256, ERR_INVALID_PARAMETER);
+	uint8_t target[2];
+	target[0] = RELAY_TO_CLIENT;
+	target[1] = id;
+	return _relay_udp(target, 2, pkt, cmd);
+}
+
+/*
+ * Sent to every other member of a server group (join_group), we must
+ * be one of them
+ */
+Error NetGameClientCore::relay_udp_group(const String &group,
+				const DVector<uint8_t> &pkt, int cmd) {
+	CharString name = group.utf8();
+	ERR_FAIL_COND_V(name.length() > 255, ERR_INVALID_PARAMETER);
+	uint8_t target[2 + 255];
+	target[0] = RELAY_TO_GROUP;
+	target[1] = name.length();
+	memcpy(target + 2, name.get_data(), name.length());
+	return _relay_udp(target, 2 + name.length(), pkt, cmd);
+}
+
+/***
+ * Media streams, see NetGameMedia. Frames are bundled per stream, each
+ * bundle is one queued packet: [id][secret][CMD_MAX][PCMD_MEDIA][target]
+ * [stream packet]. Received frames are signalled as media_frame(id,
+ * stream, timestamp, frame), id 0 for the server, empty for a lost frame.
+ * udp_mutex guards the media state.
+ */
+void NetGameClientCore::_queue_bundles(const Vector<DVector<uint8_t> > &bundles) {
+	int i;
+
+	for(i = 0; i < bundles.size(); i++) {
+		if(udp_queue.size() >= PKT_QUEUE_SIZE) {
+			WARN_PRINT("UDP QUEUE SIZE EXCEEDED");
+			return;
+		}
+		QueuedPacket *qp = (QueuedPacket *) memnew(QueuedPacket);
+		qp->packet.resize(4 + bundles[i].size());
+		{
+			DVector<uint8_t>::Write w = qp->packet.write();
+			DVector<uint8_t>::Read r = bundles[i].read();
+			w[0] = client_id;
+			w[1] = client_secret;
+			w[2] = CMD_MAX;
+			w[3] = PCMD_MEDIA;
+			memcpy(w.ptr() + 4, r.ptr(), bundles[i].size());
+		}
+		udp_queue.insert(udp_queue.size(), qp);
+	}
+}
+
+void NetGameClientCore::_queue_media(const Vector<MediaFrame> &frames) {
+	int i;
+
+	for(i = 0; i < frames.size(); i++) {
+		const MediaFrame &f = frames[i];
+		_queue_frame(f.id, f.stream, f.timestamp, f.data);
+	}
+}
+
+void NetGameClientCore::_media_tick(int time) {
+	Vector<DVector<uint8_t> > bundles;
+	Vector<MediaFrame> frames;
+
+	udp_mutex->lock();
+	if(state == READY) {
+		media.flush_due(time, bundles);
+		_queue_bundles(bundles);
+	}
+	media.release(time, frames);
+	udp_mutex->unlock();
+	_queue_media(frames);
+}
+
+Error NetGameClientCore::_media_target(int stream, const uint8_t *target,
+				int len) {
+	Vector<DVector<uint8_t> > bundles;
+
+	ERR_FAIL_INDEX_V(stream, 256, ERR_INVALID_PARAMETER);
+	udp_mutex->lock();
+	media.set_target(stream, target, len, bundles);
+	if(state == READY) {
+		_queue_bundles(bundles);
+	}
+	udp_mutex->unlock();
+	return OK;
+}
+
+/*
+ * Where the frames of a stream go: a client id, 0 for the server (the
+ * default). Frames to clients are relayed, see relay_rate.
+ */
+Error NetGameClientCore::set_media_target(int stream, int id) {
+	ERR_FAIL_INDEX_V(id, 256, ERR_INVALID_PARAMETER);
+	uint8_t target[2];
+	if(id == 0) {
+		target[0] = MEDIA_TO_SERVER;
+		return _media_target(stream, target, 1);
+	}
+	target[0] = RELAY_TO_CLIENT;
+	target[1] = id;
+	return _media_target(stream, target, 2);
+}
+
+/*
+ * Every other member of a server group, we must be one of them
+ */
+Error NetGameClientCore::set_media_target_group(int stream,
+				const String &group) {
+	CharString name = group.utf8();
+	ERR_FAIL_COND_V(name.length() > 255, ERR_INVALID_PARAMETER);
+	uint8_t target[2 + 255];
+	target[0] = RELAY_TO_GROUP;
+	target[1] = name.length();
+	memcpy(target + 2, name.get_data(), name.length());
+	return _media_target(stream, target, 2 + name.length());
+}
+
+/*
+ * One encoded frame (an Opus packet) with the sender's timestamp.
+ * It leaves once media_bundle frames are queued, after
+ * MEDIA_BUNDLE_WAIT msec or on media_flush.
+ */
+Error NetGameClientCore::media_send(int stream, const DVector<uint8_t> &frame,
+				int timestamp) {
+	Vector<DVector<uint8_t> > bundles;
+
+	if(state != READY) {
+		return ERR_CONNECTION_ERROR;
+	}
+	udp_mutex->lock();
+	Error err = media.push(stream, frame, timestamp,
+			OS::get_singleton()->get_ticks_msec(), bundles);
+	_queue_bundles(bundles);
+	udp_mutex->unlock();
+	return err;
+}
+
+void NetGameClientCore::media_flush(int stream) {
+	Vector<DVector<uint8_t> > bundles;
+
+	udp_mutex->lock();
+	media.flush(stream, bundles);
+	if(state == READY) {
+		_queue_bundles(bundles);
+	}
+	udp_mutex->unlock();
+}
+
+void NetGameClientCore::set_media_bundle(int p_frames) {
+	udp_mutex->lock();
+	media.set_bundle(p_frames);
+	udp_mutex->unlock();
+}
+
+int NetGameClientCore::get_media_bundle() const {
+	return media.get_bundle();
+}
+
+void NetGameClientCore::set_media_jitter(int p_msec) {
+	udp_mutex->lock();
+	media.set_jitter(p_msec);
+	udp_mutex->unlock();
+}
+
+int NetGameClientCore::get_media_jitter() const {
+	return media.get_jitter();
+}
+
+Dictionary NetGameClientCore::get_media_stats(int id, int stream) {
+	udp_mutex->lock();
+	Dictionary out = media.get_stats(id, stream);
+	udp_mutex->unlock();
+	return out;
+}
+
+bool NetGameClientCore::replica_has(int oid) {
+	return replica.has(oid);
+}
+
+Variant NetGameClientCore::replica_get(int oid, const String &field) {
+	return replica.get(oid, field);
+}
+
+Dictionary NetGameClientCore::replica_get_fields(int oid) {
+	return replica.get_fields(oid);
+}
+
+int NetGameClientCore::get_disconnect_reason() const {
+	return disconnect_reason;
+}
+
+void NetGameClientCore::_update_keepalive() {
+	keepalive.configure(keepalive_interval, tcp_keepalive_interval,
+				keepalive_timeout, keepalive_min_timeout);
+}
+
+void NetGameClientCore::set_keepalive_interval(int p_msec) {
+	ERR_FAIL_COND(p_msec <= 0);
+	keepalive_interval = p_msec;
+	_update_keepalive();
+}
+
+int NetGameClientCore::get_keepalive_interval() const {
+	return keepalive_interval;
+}
+
+void NetGameClientCore::set_tcp_keepalive_interval(int p_msec) {
+	ERR_FAIL_COND(p_msec <= 0);
+	tcp_keepalive_interval = p_msec;
+	_update_keepalive();
+}
+
+int NetGameClientCore::get_tcp_keepalive_interval() const {
+	return tcp_keepalive_interval;
+}
+
+void NetGameClientCore::set_keepalive_timeout(int p_msec) {
+	ERR_FAIL_COND(p_msec <= 0);
+	keepalive_timeout = p_msec;
+	_update_keepalive();
+}
+
+int NetGameClientCore::get_keepalive_timeout() const {
+	return keepalive_timeout;
+}
+
+void NetGameClientCore::set_keepalive_min_timeout(int p_msec) {
+	ERR_FAIL_COND(p_msec <= 0);
+	keepalive_min_timeout = p_msec;
+	_update_keepalive();
+}
+
+int NetGameClientCore::get_keepalive_min_timeout() const {
+	return keepalive_min_timeout;
+}
+
+/*
+ * Smoothed RTT in msec, -1 until measured
+ */
+int NetGameClientCore::get_rtt() const {
+	return keepalive.get_rtt();
+}
+
+/*
+ * Timed packets received from the server: received, lost, late and
+ * duplicate counts, for one command or all of them (-1)
+ */
+Dictionary NetGameClientCore::get_udp_stats(int cmd) {
+	udp_mutex->lock();
+	Dictionary out = sequence.get_stats(cmd);
+	udp_mutex->unlock();
+	return out;
+}
+
+Array NetGameClientCore::get_replica_ids() {
+	return replica.get_ids();
+}
+
+void NetGameClientCore::_bind_methods() {
+	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_CONNECT,PropertyInfo( Variant::INT,"id")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_READY,PropertyInfo( Variant::INT,"id")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_DISCONNECT,PropertyInfo( Variant::INT,"id")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_RESUME,PropertyInfo( Variant::INT,"id")));
+
+	ADD_SIGNAL(MethodInfo(SIGNAL_UDP_PACKET,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"cmd"), PropertyInfo( Variant::RAW_ARRAY,"pkt")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_TCP_PACKET,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"cmd"), PropertyInfo( Variant::RAW_ARRAY,"pkt")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_AUTH_PACKET,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"cmd"), PropertyInfo( Variant::RAW_ARRAY,"pkt")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_UDP_MESSAGE,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"cmd"), PropertyInfo( Variant::DICTIONARY,"msg")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_TCP_MESSAGE,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"cmd"), PropertyInfo( Variant::DICTIONARY,"msg")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_RPC_REQUEST,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"rid"), PropertyInfo( Variant::INT,"method"), PropertyInfo( Variant::NIL,"args")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_STREAM_OFFER,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"sid"), PropertyInfo( Variant::INT,"size"), PropertyInfo( Variant::STRING,"name")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_STREAM_PROGRESS,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"sid"), PropertyInfo( Variant::INT,"offset"), PropertyInfo( Variant::INT,"size")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_STREAM_COMPLETED,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"sid"), PropertyInfo( Variant::INT,"error"), PropertyInfo( Variant::INT,"offset")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_RELAY_PACKET,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"cmd"), PropertyInfo( Variant::RAW_ARRAY,"pkt")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_MEDIA_FRAME,PropertyInfo( Variant::INT,"id"), PropertyInfo( Variant::INT,"stream"), PropertyInfo( Variant::REAL,"timestamp"), PropertyInfo( Variant::RAW_ARRAY,"frame")));
+
+	BIND_CONSTANT(PROCESS);
+	BIND_CONSTANT(FIXED);
+	BIND_CONSTANT(THREADED);
+
+	BIND_CONSTANT(DISCONNECT_NONE);
+	BIND_CONSTANT(DISCONNECT_CLOSE);
+	BIND_CONSTANT(DISCONNECT_KICK);
+	BIND_CONSTANT(DISCONNECT_SHUTDOWN);
+	BIND_CONSTANT(DISCONNECT_RESTART);
+	BIND_CONSTANT(DISCONNECT_MIGRATE);
+
+	BIND_CONSTANT(MSG_BOOL);
+	BIND_CONSTANT(MSG_INT);
+	BIND_CONSTANT(MSG_UINT);
+	BIND_CONSTANT(MSG_FLOAT);
+	BIND_CONSTANT(MSG_VECTOR2);
+	BIND_CONSTANT(MSG_VECTOR3);
+	BIND_CONSTANT(MSG_STRING);
+
+	ObjectTypeDB::bind_method("connect_to", &NetGameClientCore::connect_to);
+	ObjectTypeDB::bind_method(_MD("connect_udp_only", "host", "udp_port"), &NetGameClientCore::connect_udp_only);
+	ObjectTypeDB::bind_method(_MD("is_udp_only"), &NetGameClientCore::is_udp_only);
+	ObjectTypeDB::bind_method("close", &NetGameClientCore::close);
+	ObjectTypeDB::bind_method(_MD("put_udp_packet:Error", "pkt", "cmd", "rt"),&NetGameClientCore::put_udp_packet,DEFVAL(0),DEFVAL(false));
+	ObjectTypeDB::bind_method(_MD("put_tcp_packet:Error", "pkt", "cmd"),&NetGameClientCore::put_tcp_packet,DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("register_message:Error", "cmd", "layout"),&NetGameClientCore::register_message);
+	ObjectTypeDB::bind_method(_MD("unregister_message", "cmd"),&NetGameClientCore::unregister_message);
+	ObjectTypeDB::bind_method(_MD("put_tcp_message:Error", "cmd", "args"),&NetGameClientCore::put_tcp_message);
+	ObjectTypeDB::bind_method(_MD("put_udp_message:Error", "cmd", "args", "rt"),&NetGameClientCore::put_udp_message,DEFVAL(false));
+	ObjectTypeDB::bind_method(_MD("rpc_call:NetGameCall", "method", "args"),&NetGameClientCore::rpc_call,DEFVAL(Variant()));
+	ObjectTypeDB::bind_method(_MD("rpc_reply:Error", "rid", "result"),&NetGameClientCore::rpc_reply,DEFVAL(Variant()));
+	ObjectTypeDB::bind_method(_MD("set_rpc_timeout","msec"),&NetGameClientCore::set_rpc_timeout);
+	ObjectTypeDB::bind_method(_MD("get_rpc_timeout"),&NetGameClientCore::get_rpc_timeout);
+	ObjectTypeDB::bind_method(_MD("relay_udp:Error", "id", "pkt", "cmd"),&NetGameClientCore::relay_udp,DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("relay_udp_group:Error", "group", "pkt", "cmd"),&NetGameClientCore::relay_udp_group,DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("set_media_target:Error", "stream", "id"),&NetGameClientCore::set_media_target);
+	ObjectTypeDB::bind_method(_MD("set_media_target_group:Error", "stream", "group"),&NetGameClientCore::set_media_target_group);
+	ObjectTypeDB::bind_method(_MD("media_send:Error", "stream", "frame", "timestamp"),&NetGameClientCore::media_send);
+	ObjectTypeDB::bind_method(_MD("media_flush", "stream"),&NetGameClientCore::media_flush,DEFVAL(-1));
+	ObjectTypeDB::bind_method(_MD("set_media_bundle", "frames"),&NetGameClientCore::set_media_bundle);
+	ObjectTypeDB::bind_method(_MD("get_media_bundle"),&NetGameClientCore::get_media_bundle);
+	ObjectTypeDB::bind_method(_MD("set_media_jitter", "msec"),&NetGameClientCore::set_media_jitter);
+	ObjectTypeDB::bind_method(_MD("get_media_jitter"),&NetGameClientCore::get_media_jitter);
+	ObjectTypeDB::bind_method(_MD("get_media_stats", "id", "stream"),&NetGameClientCore::get_media_stats);
+	ObjectTypeDB::bind_method(_MD("put_input:Error", "tick", "input"),&NetGameClientCore::put_input);
+	ObjectTypeDB::bind_method(_MD("set_input_redundancy","count"),&NetGameClientCore::set_input_redundancy);
+	ObjectTypeDB::bind_method(_MD("get_input_redundancy"),&NetGameClientCore::get_input_redundancy);
+	ObjectTypeDB::bind_method(_MD("set_predicted_state:Error", "tick", "state"),&NetGameClientCore::set_predicted_state);
+	ObjectTypeDB::bind_method(_MD("get_predicted_state", "tick"),&NetGameClientCore::get_predicted_state);
+	ObjectTypeDB::bind_method(_MD("get_unacked_inputs"),&NetGameClientCore::get_unacked_inputs);
+	ObjectTypeDB::bind_method(_MD("get_unacked_input_count"),&NetGameClientCore::get_unacked_input_count);
+	ObjectTypeDB::bind_method(_MD("get_input_ack"),&NetGameClientCore::get_input_ack);
+	ObjectTypeDB::bind_method(_MD("stream_file", "path", "name"),&NetGameClientCore::stream_file,DEFVAL(""));
+	ObjectTypeDB::bind_method(_MD("stream_buffer", "buffer", "name"),&NetGameClientCore::stream_buffer,DEFVAL(""));
+	ObjectTypeDB::bind_method(_MD("accept_stream:Error", "sid", "path", "offset"),&NetGameClientCore::accept_stream,DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("cancel_stream:Error", "sid"),&NetGameClientCore::cancel_stream);
+	ObjectTypeDB::bind_method(_MD("reject_stream:Error", "sid"),&NetGameClientCore::reject_stream);
+	ObjectTypeDB::bind_method(_MD("replica_has", "oid"),&NetGameClientCore::replica_has);
+	ObjectTypeDB::bind_method(_MD("replica_get", "oid", "field"),&NetGameClientCore::replica_get);
+	ObjectTypeDB::bind_method(_MD("replica_get_fields", "oid"),&NetGameClientCore::replica_get_fields);
+	ObjectTypeDB::bind_method(_MD("get_replica_ids"),&NetGameClientCore::get_replica_ids);
+	ObjectTypeDB::bind_method(_MD("get_disconnect_reason"),&NetGameClientCore::get_disconnect_reason);
+	ObjectTypeDB::bind_method(_MD("set_keepalive_interval","msec"),&NetGameClientCore::set_keepalive_interval);
+	ObjectTypeDB::bind_method(_MD("get_keepalive_interval"),&NetGameClientCore::get_keepalive_interval);
+	ObjectTypeDB::bind_method(_MD("set_tcp_keepalive_interval","msec"),&NetGameClientCore::set_tcp_keepalive_interval);
+	ObjectTypeDB::bind_method(_MD("get_tcp_keepalive_interval"),&NetGameClientCore::get_tcp_keepalive_interval);
+	ObjectTypeDB::bind_method(_MD("set_keepalive_timeout","msec"),&NetGameClientCore::set_keepalive_timeout);
+	ObjectTypeDB::bind_method(_MD("get_keepalive_timeout"),&NetGameClientCore::get_keepalive_timeout);
+	ObjectTypeDB::bind_method(_MD("set_keepalive_min_timeout","msec"),&NetGameClientCore::set_keepalive_min_timeout);
+	ObjectTypeDB::bind_method(_MD("get_keepalive_min_timeout"),&NetGameClientCore::get_keepalive_min_timeout);
+	ObjectTypeDB::bind_method(_MD("get_rtt"),&NetGameClientCore::get_rtt);
+	ObjectTypeDB::bind_method(_MD("get_udp_stats","cmd"),&NetGameClientCore::get_udp_stats,DEFVAL(-1));
+	ObjectTypeDB::bind_method(_MD("set_secure","enabled"),&NetGameClientCore::set_secure);
+	ObjectTypeDB::bind_method(_MD("is_secure"),&NetGameClientCore::is_secure);
+	ObjectTypeDB::bind_method(_MD("set_secure_key","key"),&NetGameClientCore::set_secure_key);
+	ObjectTypeDB::bind_method(_MD("set_signal_mode","mode"),&NetGameClientCore::set_signal_mode);
+	ObjectTypeDB::bind_method(_MD("get_signal_mode"),&NetGameClientCore::get_signal_mode);
+	ObjectTypeDB::bind_method(_MD("poll","max_usec"),&NetGameClientCore::poll,DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("set_recorder","recorder:NetGameRecorder"),&NetGameClientCore::set_recorder);
+	ObjectTypeDB::bind_method(_MD("get_recorder:NetGameRecorder"),&NetGameClientCore::get_recorder);
+	ADD_PROPERTYNZ( PropertyInfo(Variant::INT,"signal_mode",PROPERTY_HINT_ENUM,"Process,Fixed,Threaded"),_SCS("set_signal_mode"),_SCS("get_signal_mode"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"keepalive_interval",PROPERTY_HINT_RANGE,"50,10000,50"),_SCS("set_keepalive_interval"),_SCS("get_keepalive_interval"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"tcp_keepalive_interval",PROPERTY_HINT_RANGE,"100,30000,100"),_SCS("set_tcp_keepalive_interval"),_SCS("get_tcp_keepalive_interval"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"keepalive_timeout",PROPERTY_HINT_RANGE,"1000,120000,100"),_SCS("set_keepalive_timeout"),_SCS("get_keepalive_timeout"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"keepalive_min_timeout",PROPERTY_HINT_RANGE,"500,120000,100"),_SCS("set_keepalive_min_timeout"),_SCS("get_keepalive_min_timeout"));
+	ADD_PROPERTY( PropertyInfo(Variant::BOOL,"secure"),_SCS("set_secure"),_SCS("is_secure"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"rpc_timeout",PROPERTY_HINT_RANGE,"100,120000,100"),_SCS("set_rpc_timeout"),_SCS("get_rpc_timeout"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"input_redundancy",PROPERTY_HINT_RANGE,"1,8,1"),_SCS("set_input_redundancy"),_SCS("get_input_redundancy"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"media_bundle",PROPERTY_HINT_RANGE,"1,8,1"),_SCS("set_media_bundle"),_SCS("get_media_bundle"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"media_jitter",PROPERTY_HINT_RANGE,"0,1000,1"),_SCS("set_media_jitter"),_SCS("get_media_jitter"));
+}
+
+NetGameClientCore::NetGameClientCore() {
+	signal_mode = PROCESS;
+	signal_target = NULL;
+	state = WAIT_AUTH;
+	client_id = 0;
+	client_secret = 0;
+	quit = true;
+	has_id = false;
+	has_cookie = false;
+	has_token = false;
+	resuming = false;
+	resume_time = 0;
+	resume_retry = 0;
+	resume_grace = RESUME_GRACE;
+	disconnect_reason = DISCONNECT_NONE;
+	keepalive_interval = UDP_PING;
+	tcp_keepalive_interval = TCP_PING;
+	keepalive_timeout = TIMEOUT;
+	keepalive_min_timeout = KEEPALIVE_MIN_TIMEOUT;
+	_update_keepalive();
+	server_tcp_port = 0;
+	udp_only = false;
+	has_hello_cookie = false;
+	input_count = 0;
+	input_redundancy = INPUT_REDUNDANCY;
+	secure = false;
+	has_psk = false;
+	udp_mutex = Mutex::create();
+	tcp_mutex = Mutex::create();
+	signal_mutex = Mutex::create();
+	tcp_stream = StreamPeerTCP::create_ref();
+	tcp = Ref<PacketPeerStream>( memnew(PacketPeerStream) );
+	tcp->set_stream_peer(tcp_stream);
+	udp = PacketPeerUDP::create_ref();
+	thread = NULL;
+}
+
+
+NetGameClientCore::~NetGameClientCore() {
+	close();
+	memdelete(signal_mutex);
+	memdelete(udp_mutex);
+	memdelete(tcp_mutex);
+}
@@ -0,0 +1,231 @@
+#ifndef NET_GAME_CLIENT_CORE_H
+#define NET_GAME_CLIENT_CORE_H
+
+#include "reference.h"
+#include "os/thread.h"
+#include "io/tcp_server.h"
+#include "io/packet_peer_udp.h"
+#include "modules/netgame/net_game_server_data.h"
+#include "modules/netgame/net_game_command.h"
+#include "modules/netgame/net_game_address.h"
+#include "modules/netgame/net_game_replica.h"
+#include "modules/netgame/net_game_schema.h"
+#include "modules/netgame/net_game_session.h"
+#include "modules/netgame/net_game_reliable.h"
+#include "modules/netgame/net_game_keepalive.h"
+#include "modules/netgame/net_game_sequence.h"
+#include "modules/netgame/net_game_record.h"
+#include "modules/netgame/net_game_rpc.h"
+#include "modules/netgame/net_game_transfer.h"
+#include "modules/netgame/net_game_input.h"
+#include "modules/netgame/net_game_history.h"
+#include "modules/netgame/net_game_media.h"
+
+class NetGameClientCore: public Reference {
+	OBJ_TYPE(NetGameClientCore,Reference);
+
+	// Feeds recorded events to the signal queue
+	friend class NetGameReplay;
+
+	typedef uint8_t ClientID;
+	typedef uint8_t ClientSecret;
+
+	enum ClientState {
+		WAIT_AUTH, WAIT_ACK, READY, DISCONNECTED
+	};
+
+	ClientID client_id;
+	ClientSecret client_secret;
+	ClientState state;
+
+	Mutex *udp_mutex;
+	Mutex *tcp_mutex;
+	Mutex *signal_mutex;
+	Ref<StreamPeerTCP> tcp_stream;
+	Ref<PacketPeerStream> tcp;
+	Ref<PacketPeerUDP> udp;
+	Vector<QueuedPacket*> udp_queue;
+	Vector<QueuedPacket*> tcp_queue;
+	Vector<QueuedSignal*> signal_queue;
+	Thread *thread;
+	Ref<NetGameRecorder> recorder;
+	bool quit;
+	bool has_id;
+	bool has_cookie;
+	bool has_token;
+	bool resuming;
+	int resume_time;
+	int resume_retry;
+	// Sent by the server with the token
+	int resume_grace;
+	DisconnectReason disconnect_reason;
+	NetGameKeepalive keepalive;
+	int keepalive_interval;
+	int tcp_keepalive_interval;
+	int keepalive_timeout;
+	int keepalive_min_timeout;
+	uint8_t resume_token[RESUME_TOKEN_SIZE];
+	IP_Address server_addr;
+	int server_tcp_port;
+	bool udp_only;
+	bool has_hello_cookie;
+	uint8_t hello_cookie[COOKIE_SIZE];
+	uint8_t kx_priv[32];
+	uint8_t kx_pub[32];
+	NetGameReliable reliable;
+	NetGameSequence sequence;
+	NetGameReplicaClient replica;
+	NetGameRPC rpc;
+	NetGameTransfer transfer;
+	// Last inputs, newest first
+	DVector<uint8_t> input_history[INPUT_REDUNDANCY_MAX];
+	uint32_t input_ticks[INPUT_REDUNDANCY_MAX];
+	int input_count;
+	int input_redundancy;
+	NetGameHistory history;
+	NetGameMedia media;
+	NetGameSchema schema;
+	NetGameSession session;
+	bool secure;
+	bool has_psk;
+	uint8_t psk[32];
+
+	void _check_connection();
+	void _start_resume(int time);
+	void _reconnect_tcp();
+	void _send_hello();
+	void _send_disconnect();
+	void _handle_disconnect(int reason);
+	void _handle_udp_handshake(const DVector<uint8_t> &pkt);
+	void _handle_tcp_packet(DVector<uint8_t> &pkt);
+	Error _put_udp_body(const DVector<uint8_t> &body);
+	void _start(const IP_Address &addr);
+	void _send_udp_ping(int time);
+	void _update_keepalive();
+	void _send_tcp_ping();
+	void _handle_udp();
+	void _handle_tcp();
+	static bool _is_address_packet(const DVector<uint8_t> &pkt);
+	void _handle_udp_pcmd(DVector<uint8_t> pkt, uint8_t pcmd);
+	void _handle_tcp_pcmd(DVector<uint8_t> pkt, uint8_t pcmd);
+	void _handle_key(const DVector<uint8_t> &pkt);
+	void _handle_cookie(const DVector<uint8_t> &pkt);
+	Error _put_tcp(const uint8_t *p_buf, int p_len);
+	Error _put_tcp(const DVector<uint8_t> &pkt);
+	Error _put_udp(const uint8_t *p_buf, int p_len);
+	Error _put_udp(const DVector<uint8_t> &pkt);
+	Error _relay_udp(const uint8_t *target, int len,
+				const DVector<uint8_t> &pkt, int cmd);
+	Error _media_target(int stream, const uint8_t *target, int len);
+	void _queue_bundles(const Vector<DVector<uint8_t> > &bundles);
+	void _queue_media(const Vector<MediaFrame> &frames);
+	void _media_tick(int time);
+	void _flush_packets();
+	void _clear_queues();
+
+	void _queue_signal(const char *sig, CID id);
+	void _queue_signal(const char *sig, CID id,
+				const DVector<uint8_t> pkt, int cmd);
+	void _queue_signal(const char *sig, CID id,
+				const Dictionary &msg, int cmd);
+	void _queue_packet(const char *sig, const char *msg_sig, CID id,
+				const DVector<uint8_t> &pkt, int cmd);
+	void _queue_frame(CID id, int stream, uint32_t timestamp,
+				const DVector<uint8_t> &frame);
+	void _queue_signal(const char *sig, CID id, uint32_t rid, int cmd,
+				const Variant &args);
+	Error _put_pcmd(const DVector<uint8_t> &pkt, uint8_t pcmd);
+	void _pump_streams();
+	void _queue_events(const Vector<TransferEvent> &events);
+
+	DVector<uint8_t> _build_tcp(DVector<uint8_t> pkt, int cmd);
+	DVector<uint8_t> _build_udp(DVector<uint8_t> pkt,
+					int cmd, bool timed);
+
+	Object *signal_target;
+
+	Object *_get_signal_target();
+
+protected:
+	static void _bind_methods();
+
+public:
+	SignalsMode signal_mode;
+
+	void connect_to(const String &host, int tcp_port, int udp_port);
+	void connect_udp_only(const String &host, int udp_port);
+	bool is_udp_only() const;
+	void close();
+	Error put_tcp_packet(const DVector<uint8_t> &pkt, int cmd=0);
+	Error put_udp_packet(const DVector<uint8_t> &pkt,
+				int cmd=0, bool timed=false);
+	void set_signal_mode(SignalsMode p_mode);
+	SignalsMode get_signal_mode() const;
+	void set_signal_target(Object *p_target);
+	int poll(int max_usec=0);
+	void set_recorder(const Ref<NetGameRecorder> &p_recorder);
+	Ref<NetGameRecorder> get_recorder() const;
+	void set_secure(bool p_secure);
+	bool is_secure() const;
+	void set_secure_key(const String &p_key);
+
+	Error register_message(int cmd, const Array &layout);
+	void unregister_message(int cmd);
+	Error put_tcp_message(int cmd, const Variant &args);
+	Error put_udp_message(int cmd, const Variant &args, bool timed=false);
+	Error relay_udp(int id, const DVector<uint8_t> &pkt, int cmd=0);
+	Error relay_udp_group(const String &group, const DVector<uint8_t> &pkt,
+				int cmd=0);
+
+	Error set_media_target(int stream, int id);
+	Error set_media_target_group(int stream, const String &group);
+	Error media_send(int stream, const DVector<uint8_t> &frame, int timestamp);
+	void media_flush(int stream=-1);
+	void set_media_bundle(int p_frames);
+	int get_media_bundle() const;
+	void set_media_jitter(int p_msec);
+	int get_media_jitter() const;
+	Dictionary get_media_stats(int id, int stream);
+
+	Ref<NetGameCall> rpc_call(int method, const Variant &args=Variant());
+	Error rpc_reply(int rid, const Variant &result=Variant());
+	void set_rpc_timeout(int p_msec);
+	int get_rpc_timeout() const;
+
+	Error put_input(int tick, const DVector<uint8_t> &input);
+	void set_input_redundancy(int p_count);
+	int get_input_redundancy() const;
+	Error set_predicted_state(int tick, const Variant &state);
+	Variant get_predicted_state(int tick);
+	Array get_unacked_inputs();
+	int get_unacked_input_count();
+	int get_input_ack() const;
+
+	int stream_file(const String &path, const String &name="");
+	int stream_buffer(const DVector<uint8_t> &buf, const String &name="");
+	Error accept_stream(int sid, const String &path, int offset=0);
+	Error cancel_stream(int sid);
+	Error reject_stream(int sid);
+
+	bool replica_has(int oid);
+	Variant replica_get(int oid, const String &field);
+	Dictionary replica_get_fields(int oid);
+	Array get_replica_ids();
+	int get_disconnect_reason() const;
+	void set_keepalive_interval(int p_msec);
+	int get_keepalive_interval() const;
+	void set_tcp_keepalive_interval(int p_msec);
+	int get_tcp_keepalive_interval() const;
+	void set_keepalive_timeout(int p_msec);
+	int get_keepalive_timeout() const;
+	void set_keepalive_min_timeout(int p_msec);
+	int get_keepalive_min_timeout() const;
+	int get_rtt() const;
+	Dictionary get_udp_stats(int cmd=-1);
+
+	static void _thread_start(void*s);
+	NetGameClientCore();
+	~NetGameClientCore();
+};
+
+#endif
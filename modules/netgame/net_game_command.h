@@ -0,0 +1,73 @@
+#ifndef NET_GAME_COMMAND_H
+#define NET_GAME_COMMAND_H
+
+#include "dvector.h"
+#include "modules/netgame/net_game_server_data.h"
+
+// Commands below CMD_SHORT take one byte, the others two
+#define CMD_SHORT 128
+#define CMD_LIMIT (CMD_SHORT + 127 * 256)
+
+/**
+ * Packet header: [cmd][flags], cmd is a prefix varint.
+ * 0xxxxxxx                 commands 0 to 127
+ * 1xxxxxxx xxxxxxxx        commands 128 to CMD_LIMIT - 1 (first byte
+ *                          below CMD_MAX)
+ * CMD_MAX  pcmd            protocol commands, their own namespace
+ * For protocol commands the flags byte is the pcmd.
+ */
+class NetGameCommand {
+public:
+
+	static int get_size(int cmd) {
+		return cmd < CMD_SHORT ? 1 : 2;
+	}
+
+	static void write_header(DVector<uint8_t> &out, int cmd, uint8_t flags) {
+		if(cmd < CMD_SHORT) {
+			out.append(cmd);
+		}
+		else {
+			out.append(0x80 | ((cmd - CMD_SHORT) >> 8));
+			out.append((cmd - CMD_SHORT) & 0xFF);
+		}
+		out.append(flags);
+	}
+
+	/*
+	 * Returns the header length, 0 if the packet is too short
+	 */
+	static int read_header(const uint8_t *buf, int len, bool &r_proto,
+				int &r_cmd, uint8_t &r_flags) {
+		if(len < 2) {
+			return 0;
+		}
+		r_proto = buf[0] == CMD_MAX;
+		if(r_proto || buf[0] < CMD_SHORT) {
+			r_cmd = buf[0];
+			r_flags = buf[1];
+			return 2;
+		}
+		if(len < 3) {
+			return 0;
+		}
+		r_cmd = CMD_SHORT + (((buf[0] & 0x7F) << 8) | buf[1]);
+		r_flags = buf[2];
+		return 3;
+	}
+
+	static void strip(DVector<uint8_t> &pkt, int len) {
+		int size = pkt.size() - len;
+		if(size <= 0) {
+			pkt.resize(0);
+			return;
+		}
+		{
+			DVector<uint8_t>::Write w = pkt.write();
+			memmove(w.ptr(), w.ptr() + len, size);
+		}
+		pkt.resize(size);
+	}
+};
+
+#endif
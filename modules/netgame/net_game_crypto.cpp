@@ -0,0 +1,567 @@
+
+#include "modules/netgame/net_game_crypto.h"
+
+#if defined(WINDOWS_ENABLED)
+#include <windows.h>
+#include <wincrypt.h>
+#else
+#include <stdio.h>
+#endif
+
+#define U8TO32(p) \
+	(((uint32_t)((p)[0])) | ((uint32_t)((p)[1]) << 8) | \
+	((uint32_t)((p)[2]) << 16) | ((uint32_t)((p)[3]) << 24))
+
+#define U32TO8(p, v) do { \
+	(p)[0] = (uint8_t)(v); (p)[1] = (uint8_t)((v) >> 8); \
+	(p)[2] = (uint8_t)((v) >> 16); (p)[3] = (uint8_t)((v) >> 24); \
+} while(0)
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d) \
+	a += b; d ^= a; d = ROTL32(d, 16); \
+	c += d; b ^= c; b = ROTL32(b, 12); \
+	a += b; d ^= a; d = ROTL32(d, 8); \
+	c += d; b ^= c; b = ROTL32(b, 7);
+
+/***
+ * ChaCha20
+ */
+static void _chacha20_init(uint32_t s[16], const uint8_t key[32]) {
+	int i;
+	s[0] = 0x61707865;
+	s[1] = 0x3320646e;
+	s[2] = 0x79622d32;
+	s[3] = 0x6b206574;
+	for(i = 0; i < 8; i++) {
+		s[4 + i] = U8TO32(key + i * 4);
+	}
+}
+
+static void _chacha20_rounds(uint32_t x[16]) {
+	int i;
+	for(i = 0; i < 10; i++) {
+		QUARTERROUND(x[0], x[4], x[8], x[12])
+		QUARTERROUND(x[1], x[5], x[9], x[13])
+		QUARTERROUND(x[2], x[6], x[10], x[14])
+		QUARTERROUND(x[3], x[7], x[11], x[15])
+		QUARTERROUND(x[0], x[5], x[10], x[15])
+		QUARTERROUND(x[1], x[6], x[11], x[12])
+		QUARTERROUND(x[2], x[7], x[8], x[13])
+		QUARTERROUND(x[3], x[4], x[9], x[14])
+	}
+}
+
+void NetGameCrypto::chacha20_block(const uint8_t key[32], uint32_t counter,
+				const uint8_t nonce[12], uint8_t out[64]) {
+	uint32_t s[16], x[16];
+	int i;
+
+	_chacha20_init(s, key);
+	s[12] = counter;
+	s[13] = U8TO32(nonce);
+	s[14] = U8TO32(nonce + 4);
+	s[15] = U8TO32(nonce + 8);
+
+	for(i = 0; i < 16; i++) {
+		x[i] = s[i];
+	}
+	_chacha20_rounds(x);
+	for(i = 0; i < 16; i++) {
+		uint32_t v = x[i] + s[i];
+		U32TO8(out + i * 4, v);
+	}
+}
+
+void NetGameCrypto::chacha20_xor(const uint8_t key[32], uint32_t counter,
+				const uint8_t nonce[12], const uint8_t *in,
+				uint8_t *out, int len) {
+	uint8_t block[64];
+	int i, n;
+
+	while(len > 0) {
+		chacha20_block(key, counter++, nonce, block);
+		n = MIN(len, 64);
+		for(i = 0; i < n; i++) {
+			out[i] = in[i] ^ block[i];
+		}
+		in += n;
+		out += n;
+		len -= n;
+	}
+}
+
+void NetGameCrypto::hchacha20(const uint8_t key[32], const uint8_t in[16],
+				uint8_t out[32]) {
+	uint32_t x[16];
+	int i;
+
+	_chacha20_init(x, key);
+	for(i = 0; i < 4; i++) {
+		x[12 + i] = U8TO32(in + i * 4);
+	}
+	_chacha20_rounds(x);
+	for(i = 0; i < 4; i++) {
+		U32TO8(out + i * 4, x[i]);
+		U32TO8(out + 16 + i * 4, x[12 + i]);
+	}
+}
+
+/***
+ * Poly1305 (26 bit limbs, after poly1305-donna)
+ */
+void NetGameCrypto::_poly1305_init(Poly1305 &p, const uint8_t key[32]) {
+	int i;
+
+	p.r[0] = (U8TO32(key + 0)) & 0x3ffffff;
+	p.r[1] = (U8TO32(key + 3) >> 2) & 0x3ffff03;
+	p.r[2] = (U8TO32(key + 6) >> 4) & 0x3ffc0ff;
+	p.r[3] = (U8TO32(key + 9) >> 6) & 0x3f03fff;
+	p.r[4] = (U8TO32(key + 12) >> 8) & 0x00fffff;
+	for(i = 0; i < 5; i++) {
+		p.h[i] = 0;
+	}
+	for(i = 0; i < 4; i++) {
+		p.pad[i] = U8TO32(key + 16 + i * 4);
+	}
+	p.leftover = 0;
+}
+
+void NetGameCrypto::_poly1305_blocks(Poly1305 &p, const uint8_t *m,
+					int bytes, bool final) {
+	const uint32_t hibit = final ? 0 : (1 << 24);
+	uint32_t r0 = p.r[0], r1 = p.r[1], r2 = p.r[2], r3 = p.r[3], r4 = p.r[4];
+	uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+	uint32_t h0 = p.h[0], h1 = p.h[1], h2 = p.h[2], h3 = p.h[3], h4 = p.h[4];
+	uint64_t d0, d1, d2, d3, d4;
+	uint32_t c;
+
+	while(bytes >= 16) {
+		h0 += (U8TO32(m + 0)) & 0x3ffffff;
+		h1 += (U8TO32(m + 3) >> 2) & 0x3ffffff;
+		h2 += (U8TO32(m + 6) >> 4) & 0x3ffffff;
+		h3 += (U8TO32(m + 9) >> 6) & 0x3ffffff;
+		h4 += (U8TO32(m + 12) >> 8) | hibit;
+
+		d0 = ((uint64_t)h0 * r0) + ((uint64_t)h1 * s4) + ((uint64_t)h2 * s3) + ((uint64_t)h3 * s2) + ((uint64_t)h4 * s1);
+		d1 = ((uint64_t)h0 * r1) + ((uint64_t)h1 * r0) + ((uint64_t)h2 * s4) + ((uint64_t)h3 * s3) + ((uint64_t)h4 * s2);
+		d2 = ((uint64_t)h0 * r2) + ((uint64_t)h1 * r1) + ((uint64_t)h2 * r0) + ((uint64_t)h3 * s4) + ((uint64_t)h4 * s3);
+		d3 = ((uint64_t)h0 * r3) + ((uint64_t)h1 * r2) + ((uint64_t)h2 * r1) + ((uint64_t)h3 * r0) + ((uint64_t)h4 * s4);
+		d4 = ((uint64_t)h0 * r4) + ((uint64_t)h1 * r3) + ((uint64_t)h2 * r2) + ((uint64_t)h3 * r1) + ((uint64_t)h4 * r0);
+
+		c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+		d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+		d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+		d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+		d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+		h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+		h1 += c;
+
+		m += 16;
+		bytes -= 16;
+	}
+
+	p.h[0] = h0; p.h[1] = h1; p.h[2] = h2; p.h[3] = h3; p.h[4] = h4;
+}
+
+void NetGameCrypto::_poly1305_update(Poly1305 &p, const uint8_t *m,
+					int bytes) {
+	int i;
+
+	if(p.leftover) {
+		int want = MIN(16 - p.leftover, bytes);
+		for(i = 0; i < want; i++) {
+			p.buffer[p.leftover + i] = m[i];
+		}
+		bytes -= want;
+		m += want;
+		p.leftover += want;
+		if(p.leftover < 16) {
+			return;
+		}
+		_poly1305_blocks(p, p.buffer, 16, false);
+		p.leftover = 0;
+	}
+
+	if(bytes >= 16) {
+		int want = bytes & ~15;
+		_poly1305_blocks(p, m, want, false);
+		m += want;
+		bytes -= want;
+	}
+
+	for(i = 0; i < bytes; i++) {
+		p.buffer[p.leftover + i] = m[i];
+	}
+	p.leftover += bytes;
+}
+
+// Zero pad to a 16 byte boundary (AEAD construction)
+void NetGameCrypto::_poly1305_pad(Poly1305 &p) {
+	static const uint8_t zero[16] = { 0 };
+	if(p.leftover) {
+		_poly1305_update(p, zero, 16 - p.leftover);
+	}
+}
+
+void NetGameCrypto::_poly1305_finish(Poly1305 &p, uint8_t tag[16]) {
+	uint32_t h0, h1, h2, h3, h4, c;
+	uint32_t g0, g1, g2, g3, g4;
+	uint64_t f;
+	uint32_t mask;
+	int i;
+
+	if(p.leftover) {
+		i = p.leftover;
+		p.buffer[i++] = 1;
+		for(; i < 16; i++) {
+			p.buffer[i] = 0;
+		}
+		_poly1305_blocks(p, p.buffer, 16, true);
+	}
+
+	h0 = p.h[0]; h1 = p.h[1]; h2 = p.h[2]; h3 = p.h[3]; h4 = p.h[4];
+
+	c = h1 >> 26; h1 &= 0x3ffffff;
+	h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+	h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+	h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+	h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+	h1 += c;
+
+	// h - p
+	g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+	g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+	g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+	g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+	g4 = h4 + c - (1UL << 26);
+
+	// Select h if h < p, or h - p if h >= p
+	mask = (g4 >> 31) - 1;
+	g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+	mask = ~mask;
+	h0 = (h0 & mask) | g0;
+	h1 = (h1 & mask) | g1;
+	h2 = (h2 & mask) | g2;
+	h3 = (h3 & mask) | g3;
+	h4 = (h4 & mask) | g4;
+
+	h0 = (h0 | (h1 << 26));
+	h1 = ((h1 >> 6) | (h2 << 20));
+	h2 = ((h2 >> 12) | (h3 << 14));
+	h3 = ((h3 >> 18) | (h4 << 8));
+
+	f = (uint64_t)h0 + p.pad[0]; h0 = (uint32_t)f;
+	f = (uint64_t)h1 + p.pad[1] + (f >> 32); h1 = (uint32_t)f;
+	f = (uint64_t)h2 + p.pad[2] + (f >> 32); h2 = (uint32_t)f;
+	f = (uint64_t)h3 + p.pad[3] + (f >> 32); h3 = (uint32_t)f;
+
+	U32TO8(tag + 0, h0);
+	U32TO8(tag + 4, h1);
+	U32TO8(tag + 8, h2);
+	U32TO8(tag + 12, h3);
+}
+
+/***
+ * ChaCha20-Poly1305 AEAD
+ */
+void NetGameCrypto::_aead_tag(const uint8_t key[32], const uint8_t nonce[12],
+				const uint8_t *aad, int aad_len,
+				const uint8_t *ct, int len, uint8_t tag[16]) {
+	uint8_t block[64];
+	uint8_t lens[16];
+	Poly1305 p;
+
+	chacha20_block(key, 0, nonce, block);
+	_poly1305_init(p, block);
+	_poly1305_update(p, aad, aad_len);
+	_poly1305_pad(p);
+	_poly1305_update(p, ct, len);
+	_poly1305_pad(p);
+	U32TO8(lens, (uint32_t)aad_len);
+	U32TO8(lens + 4, 0);
+	U32TO8(lens + 8, (uint32_t)len);
+	U32TO8(lens + 12, 0);
+	_poly1305_update(p, lens, 16);
+	_poly1305_finish(p, tag);
+}
+
+void NetGameCrypto::aead_seal(const uint8_t key[32], const uint8_t nonce[12],
+				const uint8_t *aad, int aad_len,
+				const uint8_t *in, int len,
+				uint8_t *out, uint8_t tag[16]) {
+	chacha20_xor(key, 1, nonce, in, out, len);
+	_aead_tag(key, nonce, aad, aad_len, out, len, tag);
+}
+
+bool NetGameCrypto::aead_open(const uint8_t key[32], const uint8_t nonce[12],
+				const uint8_t *aad, int aad_len,
+				const uint8_t *in, int len,
+				const uint8_t tag[16], uint8_t *out) {
+	uint8_t check[16];
+
+	_aead_tag(key, nonce, aad, aad_len, in, len, check);
+	if(!equals(check, tag, 16)) {
+		return false;
+	}
+	chacha20_xor(key, 1, nonce, in, out, len);
+	return true;
+}
+
+/***
+ * X25519 (after TweetNaCl)
+ */
+typedef int64_t gf[16];
+
+static const gf _121665 = { 0xDB41, 1 };
+
+static void _car25519(gf o) {
+	int i;
+	int64_t c;
+	for(i = 0; i < 16; i++) {
+		o[i] += ((int64_t)1 << 16);
+		c = o[i] >> 16;
+		o[(i + 1) * (i < 15)] += c - 1 + 37 * (c - 1) * (i == 15);
+		o[i] -= c * ((int64_t)1 << 16);
+	}
+}
+
+static void _sel25519(gf p, gf q, int b) {
+	int i;
+	int64_t t, c = ~(b - 1);
+	for(i = 0; i < 16; i++) {
+		t = c & (p[i] ^ q[i]);
+		p[i] ^= t;
+		q[i] ^= t;
+	}
+}
+
+static void _pack25519(uint8_t *o, const gf n) {
+	int i, j, b;
+	gf m, t;
+	for(i = 0; i < 16; i++) {
+		t[i] = n[i];
+	}
+	_car25519(t);
+	_car25519(t);
+	_car25519(t);
+	for(j = 0; j < 2; j++) {
+		m[0] = t[0] - 0xffed;
+		for(i = 1; i < 15; i++) {
+			m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+			m[i - 1] &= 0xffff;
+		}
+		m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+		b = (m[15] >> 16) & 1;
+		m[14] &= 0xffff;
+		_sel25519(t, m, 1 - b);
+	}
+	for(i = 0; i < 16; i++) {
+		o[2 * i] = t[i] & 0xff;
+		o[2 * i + 1] = t[i] >> 8;
+	}
+}
+
+static void _unpack25519(gf o, const uint8_t *n) {
+	int i;
+	for(i = 0; i < 16; i++) {
+		o[i] = n[2 * i] + ((int64_t)n[2 * i + 1] << 8);
+	}
+	o[15] &= 0x7fff;
+}
+
+static void _add25519(gf o, const gf a, const gf b) {
+	int i;
+	for(i = 0; i < 16; i++) {
+		o[i] = a[i] + b[i];
+	}
+}
+
+static void _sub25519(gf o, const gf a, const gf b) {
+	int i;
+	for(i = 0; i < 16; i++) {
+		o[i] = a[i] - b[i];
+	}
+}
+
+static void _mul25519(gf o, const gf a, const gf b) {
+	int i, j;
+	int64_t t[31];
+	for(i = 0; i < 31; i++) {
+		t[i] = 0;
+	}
+	for(i = 0; i < 16; i++) {
+		for(j = 0; j < 16; j++) {
+			t[i + j] += a[i] * b[j];
+		}
+	}
+	for(i = 0; i < 15; i++) {
+		t[i] += 38 * t[i + 16];
+	}
+	for(i = 0; i < 16; i++) {
+		o[i] = t[i];
+	}
+	_car25519(o);
+	_car25519(o);
+}
+
+static void _inv25519(gf o, const gf in) {
+	gf c;
+	int a;
+	for(a = 0; a < 16; a++) {
+		c[a] = in[a];
+	}
+	for(a = 253; a >= 0; a--) {
+		_mul25519(c, c, c);
+		if(a != 2 && a != 4) {
+			_mul25519(c, c, in);
+		}
+	}
+	for(a = 0; a < 16; a++) {
+		o[a] = c[a];
+	}
+}
+
+void NetGameCrypto::x25519(uint8_t out[32], const uint8_t scalar[32],
+				const uint8_t point[32]) {
+	uint8_t z[32];
+	int64_t x[80];
+	int64_t r;
+	int i;
+	gf a, b, c, d, e, f;
+
+	for(i = 0; i < 31; i++) {
+		z[i] = scalar[i];
+	}
+	z[31] = (scalar[31] & 127) | 64;
+	z[0] &= 248;
+	_unpack25519(x, point);
+	for(i = 0; i < 16; i++) {
+		b[i] = x[i];
+		d[i] = a[i] = c[i] = 0;
+	}
+	a[0] = d[0] = 1;
+	for(i = 254; i >= 0; --i) {
+		r = (z[i >> 3] >> (i & 7)) & 1;
+		_sel25519(a, b, r);
+		_sel25519(c, d, r);
+		_add25519(e, a, c);
+		_sub25519(a, a, c);
+		_add25519(c, b, d);
+		_sub25519(b, b, d);
+		_mul25519(d, e, e);
+		_mul25519(f, a, a);
+		_mul25519(a, c, a);
+		_mul25519(c, b, e);
+		_add25519(e, a, c);
+		_sub25519(a, a, c);
+		_mul25519(b, a, a);
+		_sub25519(c, d, f);
+		_mul25519(a, c, _121665);
+		_add25519(a, a, d);
+		_mul25519(c, c, a);
+		_mul25519(a, d, f);
+		_mul25519(d, b, x);
+		_mul25519(b, e, e);
+		_sel25519(a, b, r);
+		_sel25519(c, d, r);
+	}
+	for(i = 0; i < 16; i++) {
+		x[i + 16] = a[i];
+		x[i + 32] = c[i];
+	}
+	_inv25519(x + 32, x + 32);
+	_mul25519(x + 16, x + 16, x + 32);
+	_pack25519(out, x + 16);
+}
+
+void NetGameCrypto::x25519_base(uint8_t out[32], const uint8_t scalar[32]) {
+	static const uint8_t base[32] = { 9 };
+	x25519(out, scalar, base);
+}
+
+/***
+ * SipHash-2-4, short keyed hash used for stateless handshake cookies
+ */
+#define ROTL64(v, n) (((v) << (n)) | ((v) >> (64 - (n))))
+
+#define SIPROUND \
+	v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+	v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+	v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+	v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32);
+
+static uint64_t _u8to64(const uint8_t *p) {
+	return ((uint64_t)U8TO32(p)) | ((uint64_t)U8TO32(p + 4) << 32);
+}
+
+uint64_t NetGameCrypto::siphash24(const uint8_t key[16], const uint8_t *in,
+					int len) {
+	uint64_t k0 = _u8to64(key);
+	uint64_t k1 = _u8to64(key + 8);
+	uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+	uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+	uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+	uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+	uint64_t b = ((uint64_t)len) << 56;
+	uint64_t m;
+	int i;
+
+	for(i = 0; i + 8 <= len; i += 8) {
+		m = _u8to64(in + i);
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+
+	for(int j = 0; i + j < len; j++) {
+		b |= ((uint64_t)in[i + j]) << (8 * j);
+	}
+
+	v3 ^= b;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= b;
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/***
+ * Utils
+ */
+bool NetGameCrypto::equals(const uint8_t *a, const uint8_t *b, int len) {
+	// Constant time
+	uint8_t d = 0;
+	int i;
+	for(i = 0; i < len; i++) {
+		d |= a[i] ^ b[i];
+	}
+	return d == 0;
+}
+
+Error NetGameCrypto::random_bytes(uint8_t *out, int len) {
+#if defined(WINDOWS_ENABLED)
+	HCRYPTPROV prov;
+	if(!CryptAcquireContext(&prov, NULL, NULL, PROV_RSA_FULL,
+				CRYPT_VERIFYCONTEXT | CRYPT_SILENT)) {
+		return ERR_UNAVAILABLE;
+	}
+	BOOL ok = CryptGenRandom(prov, len, out);
+	CryptReleaseContext(prov, 0);
+	return ok ? OK : ERR_UNAVAILABLE;
+#else
+	FILE *f = fopen("/dev/urandom", "rb");
+	if(f == NULL) {
+		return ERR_UNAVAILABLE;
+	}
+	int got = fread(out, 1, len, f);
+	fclose(f);
+	return got == len ? OK : ERR_UNAVAILABLE;
+#endif
+}
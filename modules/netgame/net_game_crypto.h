@@ -0,0 +1,64 @@
+#ifndef NET_GAME_CRYPTO_H
+#define NET_GAME_CRYPTO_H
+
+#include "typedefs.h"
+
+#define CRYPTO_KEY_SIZE 32
+#define CRYPTO_NONCE_SIZE 12
+#define CRYPTO_TAG_SIZE 16
+
+/**
+ * Small, portable crypto primitives used by the secure transport:
+ * ChaCha20-Poly1305 AEAD (RFC 8439), X25519 key agreement (RFC 7748)
+ * and SipHash-2-4 for handshake cookies.
+ */
+class NetGameCrypto {
+
+	struct Poly1305 {
+		uint32_t r[5];
+		uint32_t h[5];
+		uint32_t pad[4];
+		uint8_t buffer[16];
+		int leftover;
+	};
+
+	static void _poly1305_init(Poly1305 &p, const uint8_t key[32]);
+	static void _poly1305_blocks(Poly1305 &p, const uint8_t *m, int bytes,
+					bool final);
+	static void _poly1305_update(Poly1305 &p, const uint8_t *m, int bytes);
+	static void _poly1305_pad(Poly1305 &p);
+	static void _poly1305_finish(Poly1305 &p, uint8_t tag[16]);
+	static void _aead_tag(const uint8_t key[32], const uint8_t nonce[12],
+				const uint8_t *aad, int aad_len,
+				const uint8_t *ct, int len, uint8_t tag[16]);
+
+public:
+	static void chacha20_block(const uint8_t key[32], uint32_t counter,
+				const uint8_t nonce[12], uint8_t out[64]);
+	static void chacha20_xor(const uint8_t key[32], uint32_t counter,
+				const uint8_t nonce[12], const uint8_t *in,
+				uint8_t *out, int len);
+	static void hchacha20(const uint8_t key[32], const uint8_t in[16],
+				uint8_t out[32]);
+
+	static void aead_seal(const uint8_t key[32], const uint8_t nonce[12],
+				const uint8_t *aad, int aad_len,
+				const uint8_t *in, int len,
+				uint8_t *out, uint8_t tag[16]);
+	static bool aead_open(const uint8_t key[32], const uint8_t nonce[12],
+				const uint8_t *aad, int aad_len,
+				const uint8_t *in, int len,
+				const uint8_t tag[16], uint8_t *out);
+
+	static void x25519(uint8_t out[32], const uint8_t scalar[32],
+				const uint8_t point[32]);
+	static void x25519_base(uint8_t out[32], const uint8_t scalar[32]);
+
+	static uint64_t siphash24(const uint8_t key[16], const uint8_t *in,
+				int len);
+
+	static bool equals(const uint8_t *a, const uint8_t *b, int len);
+	static Error random_bytes(uint8_t *out, int len);
+};
+
+#endif
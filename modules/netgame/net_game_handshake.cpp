@@ -0,0 +1,135 @@
+#include "modules/netgame/net_game_handshake.h"
+#include "modules/netgame/net_game_crypto.h"
+
+/*
+ * IPv4 hosts get a bucket each, IPv6 ones share it per /64 (what a
+ * single host is usually given)
+ */
+uint32_t NetGameHandshake::_host_key(const IP_Address &host) {
+	const uint8_t *a = host.get_ipv6();
+	int off = host.is_ipv4() ? 12 : 0;
+	uint32_t hi = ((uint32_t)a[off] << 24) | ((uint32_t)a[off + 1] << 16) |
+		((uint32_t)a[off + 2] << 8) | (uint32_t)a[off + 3];
+
+	if(off) {
+		return hi;
+	}
+	uint32_t lo = ((uint32_t)a[4] << 24) | ((uint32_t)a[5] << 16) |
+		((uint32_t)a[6] << 8) | (uint32_t)a[7];
+	return hi ^ (lo * 2654435761U);
+}
+
+uint64_t NetGameHandshake::_mac(CookieType type, const IP_Address &host,
+				int port, CID id, CSE secret,
+				uint32_t epoch) const {
+	uint8_t buf[1 + ADDRESS_SIZE + 8];
+	uint8_t *w = buf + 1 + ADDRESS_SIZE;
+	buf[0] = type;
+	memcpy(buf + 1, host.get_ipv6(), ADDRESS_SIZE);
+	w[0] = port >> 8;
+	w[1] = port;
+	w[2] = id;
+	w[3] = secret;
+	w[4] = epoch;
+	w[5] = epoch >> 8;
+	w[6] = epoch >> 16;
+	w[7] = epoch >> 24;
+	return NetGameCrypto::siphash24(key, buf, sizeof(buf));
+}
+
+/*
+ * Keyed, so peers can not pick addresses that collide
+ */
+uint64_t NetGameHandshake::peer_key(const IP_Address &host, int port) const {
+	uint8_t buf[ADDRESS_SIZE + 2];
+	memcpy(buf, host.get_ipv6(), ADDRESS_SIZE);
+	buf[ADDRESS_SIZE] = port >> 8;
+	buf[ADDRESS_SIZE + 1] = port;
+	return NetGameCrypto::siphash24(key, buf, sizeof(buf));
+}
+
+/*
+ * Pick a new cookie key (invalidates all cookies) and forget all buckets
+ */
+void NetGameHandshake::reset() {
+	if(NetGameCrypto::random_bytes(key, 16) != OK) {
+		WARN_PRINT("Unable to get random cookie key");
+		int i;
+		for(i = 0; i < 16; i++) {
+			key[i] = rand() % 256;
+		}
+	}
+	memset(buckets, 0, sizeof(buckets));
+}
+
+void NetGameHandshake::set_rate(int p_rate) {
+	rate = p_rate;
+}
+
+int NetGameHandshake::get_rate() const {
+	return rate;
+}
+
+/*
+ * Token bucket per IP: "rate" handshakes per second, bursts of 2 * rate.
+ * Tokens are stored in thousandths so refill is exact in milliseconds.
+ */
+bool NetGameHandshake::allow(const IP_Address &host, uint64_t time) {
+	if(rate <= 0) {
+		return true;
+	}
+
+	uint32_t h = _host_key(host);
+	uint32_t burst = rate * 2000;
+	Bucket &b = buckets[(h * 2654435761U) >> 22];
+
+	uint64_t refill = (time - b.time) * rate;
+	b.tokens = refill >= burst - b.tokens ? burst : b.tokens + refill;
+	b.time = time;
+
+	// The slot is free once it is full again, otherwise share it
+	if(b.host != h && b.tokens == burst) {
+		b.host = h;
+	}
+
+	if(b.tokens < 1000) {
+		return false;
+	}
+	b.tokens -= 1000;
+	return true;
+}
+
+void NetGameHandshake::make_cookie(CookieType type, const IP_Address &host,
+				int port, CID id, CSE secret, uint64_t time,
+				uint8_t out[COOKIE_SIZE]) const {
+	uint64_t mac = _mac(type, host, port, id, secret, time / COOKIE_EPOCH);
+	int i;
+	for(i = 0; i < COOKIE_SIZE; i++) {
+		out[i] = mac >> (8 * i);
+	}
+}
+
+/*
+ * Cookies from the current and the previous epoch are accepted
+ */
+bool NetGameHandshake::check_cookie(CookieType type, const IP_Address &host,
+				int port, CID id, CSE secret, uint64_t time,
+				const uint8_t cookie[COOKIE_SIZE]) const {
+	uint8_t expected[COOKIE_SIZE];
+
+	make_cookie(type, host, port, id, secret, time, expected);
+	if(NetGameCrypto::equals(expected, cookie, COOKIE_SIZE)) {
+		return true;
+	}
+	if(time < COOKIE_EPOCH) {
+		return false;
+	}
+	make_cookie(type, host, port, id, secret, time - COOKIE_EPOCH, expected);
+	return NetGameCrypto::equals(expected, cookie, COOKIE_SIZE);
+}
+
+NetGameHandshake::NetGameHandshake() {
+	rate = HANDSHAKE_RATE;
+	memset(key, 0, sizeof(key));
+	memset(buckets, 0, sizeof(buckets));
+}
@@ -0,0 +1,61 @@
+#ifndef NET_GAME_HANDSHAKE_H
+#define NET_GAME_HANDSHAKE_H
+
+#include "variant.h"
+#include "io/ip_address.h"
+#include "modules/netgame/net_game_server_data.h"
+#include "modules/netgame/net_game_address.h"
+
+#define COOKIE_EPOCH 5000
+#define HANDSHAKE_RATE 5
+#define HANDSHAKE_BUCKETS 1024
+
+enum CookieType {
+	COOKIE_TCP,
+	COOKIE_UDP,
+	COOKIE_HELLO
+};
+
+/**
+ * Stateless handshake guard.
+ * Cookies are a keyed hash of the peer address and the current epoch, so
+ * the server can check an echoed cookie without remembering it.
+ * Handshake replies are rate limited per IP (per /64 for IPv6) with a
+ * fixed table of token buckets (colliding addresses share a bucket while
+ * it is in use).
+ * Only used by the server network thread.
+ */
+class NetGameHandshake {
+
+	struct Bucket {
+		uint32_t host;
+		uint32_t tokens;
+		uint64_t time;
+	};
+
+	uint8_t key[16];
+	Bucket buckets[HANDSHAKE_BUCKETS];
+	int rate;
+
+	static uint32_t _host_key(const IP_Address &host);
+	uint64_t _mac(CookieType type, const IP_Address &host, int port,
+			CID id, CSE secret, uint32_t epoch) const;
+
+public:
+	void reset();
+	void set_rate(int p_rate);
+	int get_rate() const;
+
+	bool allow(const IP_Address &host, uint64_t time);
+	uint64_t peer_key(const IP_Address &host, int port) const;
+	void make_cookie(CookieType type, const IP_Address &host, int port,
+			CID id, CSE secret, uint64_t time,
+			uint8_t out[COOKIE_SIZE]) const;
+	bool check_cookie(CookieType type, const IP_Address &host, int port,
+			CID id, CSE secret, uint64_t time,
+			const uint8_t cookie[COOKIE_SIZE]) const;
+
+	NetGameHandshake();
+};
+
+#endif
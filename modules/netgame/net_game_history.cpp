@@ -0,0 +1,155 @@
+#include "modules/netgame/net_game_history.h"
+
+bool NetGameHistory::_read_ack(uint32_t &r_ack) const {
+	mutex->lock();
+	bool out = has_ack;
+	r_ack = ack;
+	mutex->unlock();
+	return out;
+}
+
+/*
+ * Release the entries the server already simulated, their buffers are
+ * just unreferenced
+ */
+void NetGameHistory::_drop_acked() {
+	int i;
+	uint32_t a;
+
+	if(!_read_ack(a)) {
+		return;
+	}
+	for(i = 0; i < HISTORY_SIZE; i++) {
+		Entry &e = entries[i];
+		if(e.has && (int32_t)(e.tick - a) <= 0) {
+			e.has = false;
+			e.input = DVector<uint8_t>();
+			e.state = Variant();
+		}
+	}
+}
+
+uint32_t NetGameHistory::_first_unacked() const {
+	uint32_t first = newest - (HISTORY_SIZE - 1);
+	uint32_t a;
+
+	if(_read_ack(a) && (int32_t)(a + 1 - first) > 0) {
+		first = a + 1;
+	}
+	return first;
+}
+
+/*
+ * Only moves forward, acks can be reordered
+ */
+void NetGameHistory::set_ack(uint32_t tick) {
+	mutex->lock();
+	if(!has_ack || (int32_t)(tick - ack) > 0) {
+		ack = tick;
+		has_ack = true;
+	}
+	mutex->unlock();
+}
+
+void NetGameHistory::put_input(uint32_t tick, const DVector<uint8_t> &input) {
+	Entry &e = entries[tick % HISTORY_SIZE];
+
+	_drop_acked();
+	e.tick = tick;
+	e.has = true;
+	e.input = input;
+	e.state = Variant();
+	if(!has_newest || (int32_t)(tick - newest) > 0) {
+		newest = tick;
+		has_newest = true;
+	}
+}
+
+Error NetGameHistory::set_state(uint32_t tick, const Variant &state) {
+	Entry &e = entries[tick % HISTORY_SIZE];
+
+	if(!e.has || e.tick != tick) {
+		return ERR_DOES_NOT_EXIST;
+	}
+	e.state = state;
+	return OK;
+}
+
+Variant NetGameHistory::get_state(uint32_t tick) {
+	const Entry &e = entries[tick % HISTORY_SIZE];
+
+	if(!e.has || e.tick != tick) {
+		return Variant();
+	}
+	return e.state;
+}
+
+/*
+ * Inputs to replay after a correction, oldest first:
+ * [tick, input, tick, input, ...]
+ */
+Array NetGameHistory::get_unacked() {
+	Array out;
+	uint32_t t;
+
+	_drop_acked();
+	if(!has_newest) {
+		return out;
+	}
+	for(t = _first_unacked(); (int32_t)(t - newest) <= 0; t++) {
+		const Entry &e = entries[t % HISTORY_SIZE];
+		if(e.has && e.tick == t) {
+			out.push_back(t);
+			out.push_back(e.input);
+		}
+	}
+	return out;
+}
+
+int NetGameHistory::get_unacked_count() {
+	int count = 0;
+	uint32_t t;
+
+	_drop_acked();
+	if(!has_newest) {
+		return 0;
+	}
+	for(t = _first_unacked(); (int32_t)(t - newest) <= 0; t++) {
+		const Entry &e = entries[t % HISTORY_SIZE];
+		if(e.has && e.tick == t) {
+			count++;
+		}
+	}
+	return count;
+}
+
+int NetGameHistory::get_ack() const {
+	uint32_t a;
+
+	return _read_ack(a) ? (int)a : -1;
+}
+
+void NetGameHistory::clear() {
+	int i;
+
+	for(i = 0; i < HISTORY_SIZE; i++) {
+		entries[i].has = false;
+		entries[i].input = DVector<uint8_t>();
+		entries[i].state = Variant();
+	}
+	newest = 0;
+	has_newest = false;
+	mutex->lock();
+	ack = 0;
+	has_ack = false;
+	mutex->unlock();
+}
+
+NetGameHistory::NetGameHistory() {
+	mutex = Mutex::create();
+	clear();
+}
+
+NetGameHistory::~NetGameHistory() {
+	memdelete(mutex);
+}
@@ -0,0 +1,58 @@
+#ifndef NET_GAME_HISTORY_H
+#define NET_GAME_HISTORY_H
+
+#include "variant.h"
+#include "dvector.h"
+#include "os/mutex.h"
+#include "modules/netgame/net_game_server_data.h"
+
+// Ticks of inputs and predicted states kept by the client
+#define HISTORY_SIZE 128
+
+/**
+ * Client side prediction history, a fixed ring keyed by input tick.
+ * Each entry holds the input sent for the tick and the state the client
+ * predicted with it. The server echoes the last tick it simulated
+ * (PCMD_INPUT_ACK), entries up to it are dropped and the rest are the
+ * inputs to replay on top of a correction.
+ * The ack is set by the network thread (under the mutex), everything
+ * else is used by the game thread only.
+ */
+class NetGameHistory {
+
+	struct Entry {
+		uint32_t tick;
+		bool has;
+		DVector<uint8_t> input;
+		Variant state;
+	};
+
+	Entry entries[HISTORY_SIZE];
+	uint32_t newest;
+	bool has_newest;
+	Mutex *mutex;
+	uint32_t ack;
+	bool has_ack;
+
+	bool _read_ack(uint32_t &r_ack) const;
+	void _drop_acked();
+	uint32_t _first_unacked() const;
+
+public:
+	// Network thread
+	void set_ack(uint32_t tick);
+
+	// Game thread
+	void put_input(uint32_t tick, const DVector<uint8_t> &input);
+	Error set_state(uint32_t tick, const Variant &state);
+	Variant get_state(uint32_t tick);
+	Array get_unacked();
+	int get_unacked_count();
+	int get_ack() const;
+	void clear();
+
+	NetGameHistory();
+	~NetGameHistory();
+};
+
+#endif
@@ -0,0 +1,209 @@
+#include "modules/netgame/net_game_input.h"
+#include "io/marshalls.h"
+
+NetGameInputBuffer::ClientInputs *NetGameInputBuffer::_get_or_add(CID id) {
+	int index = clients.find(id);
+	if(index == -1) {
+		int i;
+		ClientInputs *ci = memnew(ClientInputs);
+		for(i = 0; i < INPUT_BUFFER; i++) {
+			ci->slots[i].tick = 0;
+			ci->slots[i].has = false;
+			ci->slots[i].missed = false;
+		}
+		ci->newest = 0;
+		ci->has_newest = false;
+		ci->received = 0;
+		ci->late = 0;
+		ci->missing = 0;
+		ci->dropped = 0;
+		index = clients.insert(id, ci);
+	}
+	return clients.getv(index);
+}
+
+void NetGameInputBuffer::_store(ClientInputs *ci, uint32_t tick,
+				const uint8_t *data, int len) {
+	Slot &s = ci->slots[tick % INPUT_BUFFER];
+
+	// Ticks are compared in serial arithmetic, they may wrap
+	if(has_consumed && (int32_t)(tick - consumed) <= 0) {
+		// Too late, counted once for the tick it missed
+		if(s.missed && s.tick == tick) {
+			s.missed = false;
+			ci->late++;
+		}
+		return;
+	}
+	if(has_consumed && (int32_t)(tick - consumed) > INPUT_BUFFER) {
+		ci->dropped++;
+		return;
+	}
+	if(s.has && s.tick == tick) {
+		// Redundant copy
+		return;
+	}
+
+	s.tick = tick;
+	s.has = true;
+	s.missed = false;
+	s.input.resize(len);
+	if(len > 0) {
+		DVector<uint8_t>::Write w = s.input.write();
+		memcpy(w.ptr(), data, len);
+	}
+	ci->received++;
+	if(!ci->has_newest || (int32_t)(tick - ci->newest) > 0) {
+		ci->newest = tick;
+		ci->has_newest = true;
+	}
+}
+
+/*
+ * Input datagram body: [tick][count] then [len][input] for tick,
+ * tick - 1, ...
+ */
+void NetGameInputBuffer::receive(CID id, const DVector<uint8_t> &pkt) {
+	int i, ofs;
+
+	if(pkt.size() < INPUT_HEADER) {
+		return;
+	}
+	DVector<uint8_t>::Read r = pkt.read();
+	uint32_t tick = decode_uint32(r.ptr());
+	int count = r[4];
+	ClientInputs *ci = _get_or_add(id);
+
+	ofs = INPUT_HEADER;
+	for(i = 0; i < count; i++) {
+		if(ofs >= pkt.size() || ofs + 1 + r[ofs] > pkt.size()) {
+			return;
+		}
+		_store(ci, tick - i, r.ptr() + ofs + 1, r[ofs]);
+		ofs += 1 + r[ofs];
+	}
+}
+
+/*
+ * Inputs of every client for tick, as [id, input, id, input, ...].
+ * Their slots are freed, and older ticks can not be queued anymore.
+ */
+Array NetGameInputBuffer::get_inputs(uint32_t tick) {
+	Array out;
+	int i;
+
+	for(i = 0; i < clients.size(); i++) {
+		ClientInputs *ci = clients.getv(i);
+		Slot &s = ci->slots[tick % INPUT_BUFFER];
+		if(s.has && s.tick == tick) {
+			out.push_back(clients.getk(i));
+			out.push_back(s.input);
+			s.has = false;
+			s.input = DVector<uint8_t>();
+		}
+		else if(ci->has_newest) {
+			// Only clients that already sent inputs can miss one
+			s.tick = tick;
+			s.has = false;
+			s.missed = true;
+			ci->missing++;
+		}
+	}
+	consumed = tick;
+	has_consumed = true;
+	return out;
+}
+
+/*
+ * "lead" is how many ticks ahead of the simulation the newest input of
+ * the client is, clients should adjust their tick to keep it small and
+ * positive
+ */
+Dictionary NetGameInputBuffer::get_stats(CID id) const {
+	Dictionary out;
+	int index = clients.find(id);
+
+	if(index == -1) {
+		return out;
+	}
+	const ClientInputs *ci = clients.getv(index);
+	out["received"] = ci->received;
+	out["late"] = ci->late;
+	out["missing"] = ci->missing;
+	out["dropped"] = ci->dropped;
+	out["lead"] = ci->has_newest && has_consumed ?
+			(int32_t)(ci->newest - consumed) : 0;
+	return out;
+}
+
+/*
+ * Clients that sent inputs, the ones to ack
+ */
+void NetGameInputBuffer::get_clients(Vector<CID> &r_ids) const {
+	int i;
+
+	for(i = 0; i < clients.size(); i++) {
+		r_ids.push_back(clients.getk(i));
+	}
+}
+
+void NetGameInputBuffer::remove_client(CID id) {
+	int index = clients.find(id);
+
+	if(index != -1) {
+		memdelete(clients.getv(index));
+		clients.erase(id);
+	}
+}
+
+void NetGameInputBuffer::clear() {
+	int i;
+
+	for(i = 0; i < clients.size(); i++) {
+		memdelete(clients.getv(i));
+	}
+	clients.clear();
+	has_consumed = false;
+}
+
+/*
+ * Append an input datagram body with up to count inputs (newest first),
+ * as many as fit in INPUT_PACKET_MAX. Returns how many were written.
+ */
+int NetGameInputBuffer::build_packet(uint32_t tick,
+				const DVector<uint8_t> *inputs, int count,
+				DVector<uint8_t> &r_pkt) {
+	int i;
+	int start = r_pkt.size();
+	int size = start + INPUT_HEADER;
+
+	for(i = 0; i < count; i++) {
+		if(size + 1 + inputs[i].size() > INPUT_PACKET_MAX) {
+			break;
+		}
+		size += 1 + inputs[i].size();
+	}
+	count = i;
+
+	r_pkt.resize(size);
+	DVector<uint8_t>::Write w = r_pkt.write();
+	encode_uint32(tick, w.ptr() + start);
+	w[start + 4] = count;
+	size = start + INPUT_HEADER;
+	for(i = 0; i < count; i++) {
+		DVector<uint8_t>::Read r = inputs[i].read();
+		w[size] = inputs[i].size();
+		memcpy(w.ptr() + size + 1, r.ptr(), inputs[i].size());
+		size += 1 + inputs[i].size();
+	}
+	return count;
+}
+
+NetGameInputBuffer::NetGameInputBuffer() {
+	consumed = 0;
+	has_consumed = false;
+}
+
+NetGameInputBuffer::~NetGameInputBuffer() {
+	clear();
+}
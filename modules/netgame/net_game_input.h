@@ -0,0 +1,68 @@
+#ifndef NET_GAME_INPUT_H
+#define NET_GAME_INPUT_H
+
+#include "vmap.h"
+#include "variant.h"
+#include "dvector.h"
+#include "modules/netgame/net_game_server_data.h"
+
+// Ticks buffered per client, inputs further ahead are dropped
+#define INPUT_BUFFER 64
+#define INPUT_REDUNDANCY 3
+#define INPUT_REDUNDANCY_MAX 8
+#define INPUT_MAX_SIZE 255
+#define INPUT_PACKET_MAX 1200
+// [tick 4][count], then count times [len][input], newest first
+#define INPUT_HEADER 5
+
+/**
+ * Server side input queue, keyed by the tick the client stamped on each
+ * input. Every datagram repeats the last inputs of the client, copies
+ * of an input already buffered or consumed are dropped here.
+ * get_inputs() hands out the inputs of every client for one tick,
+ * a client that sent inputs before but none for that tick counts as
+ * missing, and as late too if its input shows up afterwards.
+ * Not thread safe: the server guards it with its connection mutex.
+ */
+class NetGameInputBuffer {
+
+	struct Slot {
+		uint32_t tick;
+		bool has;
+		bool missed;
+		DVector<uint8_t> input;
+	};
+
+	struct ClientInputs {
+		Slot slots[INPUT_BUFFER];
+		uint32_t newest;
+		bool has_newest;
+		int received;
+		int late;
+		int missing;
+		int dropped;
+	};
+
+	VMap<CID, ClientInputs*> clients;
+	uint32_t consumed;
+	bool has_consumed;
+
+	ClientInputs *_get_or_add(CID id);
+	void _store(ClientInputs *ci, uint32_t tick, const uint8_t *data, int len);
+
+public:
+	void receive(CID id, const DVector<uint8_t> &pkt);
+	Array get_inputs(uint32_t tick);
+	Dictionary get_stats(CID id) const;
+	void get_clients(Vector<CID> &r_ids) const;
+	void remove_client(CID id);
+	void clear();
+
+	static int build_packet(uint32_t tick, const DVector<uint8_t> *inputs,
+				int count, DVector<uint8_t> &r_pkt);
+
+	NetGameInputBuffer();
+	~NetGameInputBuffer();
+};
+
+#endif
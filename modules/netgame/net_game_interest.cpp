@@ -0,0 +1,227 @@
+
+#include "modules/netgame/net_game_interest.h"
+
+uint64_t NetGameInterest::_cell_key(int x, int y, int z) const {
+	// 21 bits per axis, enough for +-1M cells
+	return (((uint64_t)(x & 0x1FFFFF)) << 42) |
+		(((uint64_t)(y & 0x1FFFFF)) << 21) |
+		((uint64_t)(z & 0x1FFFFF));
+}
+
+/*
+ * Far positions (or NaN) share the border cells, the cast stays in range
+ */
+int NetGameInterest::_cell_coord(real_t v) const {
+	real_t c = Math::floor(v / cell_size);
+
+	if(!(c > -INTEREST_CELL_MAX)) {
+		return -INTEREST_CELL_MAX;
+	}
+	if(c > INTEREST_CELL_MAX) {
+		return INTEREST_CELL_MAX;
+	}
+	return (int)c;
+}
+
+uint64_t NetGameInterest::_get_cell(const Vector3 &pos) const {
+	return _cell_key(_cell_coord(pos.x), _cell_coord(pos.y),
+				_cell_coord(pos.z));
+}
+
+void NetGameInterest::_cell_remove(uint64_t cell, CID id) {
+	Vector<CID> *c = cells.getptr(cell);
+	if(c == NULL) {
+		return;
+	}
+	c->erase(id);
+	if(c->size() == 0) {
+		cells.erase(cell);
+	}
+}
+
+NetGameInterest::ClientInterest *NetGameInterest::_get_or_add(CID id) {
+	int index = clients.find(id);
+	if(index == -1) {
+		ClientInterest ci;
+		ci.cell = 0;
+		ci.has_pos = false;
+		index = clients.insert(id, ci);
+	}
+	return &clients.getv(index);
+}
+
+void NetGameInterest::set_cell_size(real_t p_size) {
+	ERR_FAIL_COND(p_size <= 0);
+	int i;
+
+	cell_size = p_size;
+
+	// Rebucket everyone
+	cells.clear();
+	for(i = 0; i < clients.size(); i++) {
+		ClientInterest &ci = clients.getv(i);
+		if(!ci.has_pos) {
+			continue;
+		}
+		ci.cell = _get_cell(ci.pos);
+		if(!cells.has(ci.cell)) {
+			cells.set(ci.cell, Vector<CID>());
+		}
+		cells.get(ci.cell).push_back(clients.getk(i));
+	}
+}
+
+real_t NetGameInterest::get_cell_size() const {
+	return cell_size;
+}
+
+void NetGameInterest::set_position(CID id, const Vector3 &pos) {
+	ClientInterest *ci = _get_or_add(id);
+	uint64_t cell = _get_cell(pos);
+
+	ci->pos = pos;
+	if(ci->has_pos && ci->cell == cell) {
+		return;
+	}
+	if(ci->has_pos) {
+		_cell_remove(ci->cell, id);
+	}
+	else {
+		positioned++;
+	}
+	ci->cell = cell;
+	ci->has_pos = true;
+	if(!cells.has(cell)) {
+		cells.set(cell, Vector<CID>());
+	}
+	cells.get(cell).push_back(id);
+}
+
+void NetGameInterest::clear_position(CID id) {
+	int index = clients.find(id);
+	if(index == -1) {
+		return;
+	}
+	ClientInterest &ci = clients.getv(index);
+	if(ci.has_pos) {
+		_cell_remove(ci.cell, id);
+		ci.has_pos = false;
+		positioned--;
+	}
+}
+
+void NetGameInterest::join_group(CID id, const String &group) {
+	ClientInterest *ci = _get_or_add(id);
+	ci->groups.insert(group);
+	if(!groups.has(group)) {
+		groups.insert(group, Set<CID>());
+	}
+	groups[group].insert(id);
+}
+
+void NetGameInterest::leave_group(CID id, const String &group) {
+	int index = clients.find(id);
+	if(index == -1) {
+		return;
+	}
+	clients.getv(index).groups.erase(group);
+
+	Map<String, Set<CID> >::Element *E = groups.find(group);
+	if(E == NULL) {
+		return;
+	}
+	E->get().erase(id);
+	if(E->get().empty()) {
+		groups.erase(E);
+	}
+}
+
+void NetGameInterest::remove_client(CID id) {
+	int index = clients.find(id);
+	if(index == -1) {
+		return;
+	}
+
+	clear_position(id);
+	ClientInterest &ci = clients.getv(index);
+	while(!ci.groups.empty()) {
+		String group = ci.groups.front()->get();
+		leave_group(id, group);
+	}
+	clients.erase(id);
+}
+
+void NetGameInterest::clear() {
+	cells.clear();
+	groups.clear();
+	clients.clear();
+	positioned = 0;
+}
+
+void NetGameInterest::query_radius(const Vector3 &origin, real_t radius,
+					Vector<CID> &out) const {
+	int x, y, z, i;
+	real_t r2 = radius * radius;
+
+	if(positioned == 0 || radius < 0) {
+		return;
+	}
+
+	int x0 = _cell_coord(origin.x - radius);
+	int y0 = _cell_coord(origin.y - radius);
+	int z0 = _cell_coord(origin.z - radius);
+	int x1 = _cell_coord(origin.x + radius);
+	int y1 = _cell_coord(origin.y + radius);
+	int z1 = _cell_coord(origin.z + radius);
+	int64_t span = (int64_t)(x1 - x0 + 1) * (y1 - y0 + 1);
+
+	// Radius covers more cells than there are clients, a plain scan
+	// is cheaper than visiting empty cells (and bounds the loop)
+	if(span > positioned || span * (z1 - z0 + 1) > positioned) {
+		for(i = 0; i < clients.size(); i++) {
+			const ClientInterest &ci = clients.getv(i);
+			if(ci.has_pos &&
+				ci.pos.distance_squared_to(origin) <= r2) {
+				out.push_back(clients.getk(i));
+			}
+		}
+		return;
+	}
+
+	for(x = x0; x <= x1; x++) {
+		for(y = y0; y <= y1; y++) {
+			for(z = z0; z <= z1; z++) {
+				const Vector<CID> *c = cells.getptr(
+							_cell_key(x, y, z));
+				if(c == NULL) {
+					continue;
+				}
+				for(i = 0; i < c->size(); i++) {
+					CID id = (*c)[i];
+					const ClientInterest &ci = clients.getv(
+							clients.find(id));
+					if(ci.pos.distance_squared_to(origin)
+								<= r2) {
+						out.push_back(id);
+					}
+				}
+			}
+		}
+	}
+}
+
+void NetGameInterest::query_group(const String &group,
+					Vector<CID> &out) const {
+	const Map<String, Set<CID> >::Element *E = groups.find(group);
+	if(E == NULL) {
+		return;
+	}
+	for(Set<CID>::Element *S = E->get().front(); S; S = S->next()) {
+		out.push_back(S->get());
+	}
+}
+
+NetGameInterest::NetGameInterest() {
+	cell_size = INTEREST_CELL_SIZE;
+	positioned = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef NET_GAME_INTEREST_H
+#define NET_GAME_INTEREST_H
+
+#include "hash_map.h"
+#include "vmap.h"
+#include "map.h"
+#include "set.h"
+#include "math/vector3.h"
+#include "modules/netgame/net_game_server_data.h"
+
+#define INTEREST_CELL_SIZE 64.0
+// Cell coordinates are clamped to what the 21 bit keys hold
+#define INTEREST_CELL_MAX 0xFFFFF
+
+/**
+ * Area of interest index.
+ * Clients are bucketed in a uniform spatial grid (by position) and in
+ * named groups so that filtered broadcasts only visit nearby clients.
+ * Not thread safe: the server guards it with its connection mutex.
+ */
+class NetGameInterest {
+
+	struct ClientInterest {
+		Vector3 pos;
+		uint64_t cell;
+		bool has_pos;
+		Set<String> groups;
+	};
+
+	real_t cell_size;
+	HashMap<uint64_t, Vector<CID> > cells;
+	Map<String, Set<CID> > groups;
+	VMap<CID, ClientInterest> clients;
+	int positioned;
+
+	uint64_t _cell_key(int x, int y, int z) const;
+	int _cell_coord(real_t v) const;
+	uint64_t _get_cell(const Vector3 &pos) const;
+	void _cell_remove(uint64_t cell, CID id);
+	ClientInterest *_get_or_add(CID id);
+
+public:
+	void set_cell_size(real_t p_size);
+	real_t get_cell_size() const;
+
+	void set_position(CID id, const Vector3 &pos);
+	void clear_position(CID id);
+	void join_group(CID id, const String &group);
+	void leave_group(CID id, const String &group);
+	void remove_client(CID id);
+	void clear();
+
+	void query_radius(const Vector3 &origin, real_t radius,
+				Vector<CID> &out) const;
+	void query_group(const String &group, Vector<CID> &out) const;
+
+	NetGameInterest();
+};
+
+#endif
@@ -0,0 +1,97 @@
+#include "modules/netgame/net_game_keepalive.h"
+
+void NetGameKeepalive::configure(int p_interval, int p_tcp_interval,
+				int p_timeout, int p_min_timeout) {
+	interval = p_interval;
+	tcp_interval = p_tcp_interval;
+	timeout = p_timeout;
+	min_timeout = MIN(p_min_timeout, p_timeout);
+}
+
+void NetGameKeepalive::reset(uint64_t time) {
+	srtt = 0;
+	rttvar = 0;
+	has_rtt = false;
+	udp_tx = time;
+	tcp_tx = time;
+	// First ping measures the RTT
+	probe_time = time - KEEPALIVE_PROBE;
+}
+
+void NetGameKeepalive::sent_udp(uint64_t time) {
+	udp_tx = time;
+}
+
+void NetGameKeepalive::sent_tcp(uint64_t time) {
+	tcp_tx = time;
+}
+
+bool NetGameKeepalive::udp_ping_due(uint64_t time) const {
+	return udp_tx + interval <= time || probe_due(time);
+}
+
+bool NetGameKeepalive::tcp_ping_due(uint64_t time) const {
+	return tcp_tx + tcp_interval <= time;
+}
+
+bool NetGameKeepalive::probe_due(uint64_t time) const {
+	return probe_time + KEEPALIVE_PROBE <= time;
+}
+
+void NetGameKeepalive::probe_sent(uint64_t time) {
+	probe_time = time;
+}
+
+/*
+ * When the next ping is due if nothing else is sent meanwhile
+ */
+uint64_t NetGameKeepalive::get_next_udp_ping() const {
+	return MIN(udp_tx + interval, probe_time + KEEPALIVE_PROBE);
+}
+
+uint64_t NetGameKeepalive::get_next_tcp_ping() const {
+	return tcp_tx + tcp_interval;
+}
+
+/*
+ * RTT sample from an echoed 16 bit timestamp (RFC 6298 smoothing)
+ */
+void NetGameKeepalive::pong(uint16_t stamp, uint64_t time) {
+	int rtt = (uint16_t)(time - stamp);
+	if(rtt > timeout) {
+		return;
+	}
+	if(!has_rtt) {
+		srtt = rtt;
+		rttvar = rtt / 2;
+		has_rtt = true;
+		return;
+	}
+	rttvar = (3 * rttvar + ABS(srtt - rtt)) / 4;
+	srtt = (7 * srtt + rtt) / 8;
+}
+
+int NetGameKeepalive::get_rtt() const {
+	return has_rtt ? srtt : -1;
+}
+
+int NetGameKeepalive::_timeout(int p_interval) const {
+	if(!has_rtt) {
+		return timeout;
+	}
+	int out = KEEPALIVE_MISSED * p_interval + srtt + 4 * rttvar;
+	return CLAMP(out, min_timeout, timeout);
+}
+
+int NetGameKeepalive::get_udp_timeout() const {
+	return _timeout(interval);
+}
+
+int NetGameKeepalive::get_tcp_timeout() const {
+	return _timeout(tcp_interval);
+}
+
+NetGameKeepalive::NetGameKeepalive() {
+	configure(UDP_PING, TCP_PING, TIMEOUT, KEEPALIVE_MIN_TIMEOUT);
+	reset(0);
+}
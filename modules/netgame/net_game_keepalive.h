@@ -0,0 +1,56 @@
+#ifndef NET_GAME_KEEPALIVE_H
+#define NET_GAME_KEEPALIVE_H
+
+#include "typedefs.h"
+#include "modules/netgame/net_game_server_data.h"
+
+#define KEEPALIVE_MIN_TIMEOUT 3000
+#define KEEPALIVE_PROBE 5000
+#define KEEPALIVE_MISSED 3
+
+/**
+ * Keepalive and timeout policy of one peer.
+ * A ping is only sent when nothing else was sent for an interval, so
+ * pings stop while real traffic flows. Every KEEPALIVE_PROBE a ping
+ * carries a timestamp the peer echoes back (PCMD_PONG) to measure the
+ * RTT. Once it is known the timeout is KEEPALIVE_MISSED intervals plus
+ * the RTT and its variance, kept between min_timeout and timeout.
+ */
+class NetGameKeepalive {
+
+	int interval;
+	int tcp_interval;
+	int timeout;
+	int min_timeout;
+	int srtt;
+	int rttvar;
+	bool has_rtt;
+	uint64_t udp_tx;
+	uint64_t tcp_tx;
+	uint64_t probe_time;
+
+	int _timeout(int p_interval) const;
+
+public:
+	void configure(int p_interval, int p_tcp_interval, int p_timeout,
+			int p_min_timeout);
+	void reset(uint64_t time);
+
+	void sent_udp(uint64_t time);
+	void sent_tcp(uint64_t time);
+	bool udp_ping_due(uint64_t time) const;
+	bool tcp_ping_due(uint64_t time) const;
+	bool probe_due(uint64_t time) const;
+	void probe_sent(uint64_t time);
+	uint64_t get_next_udp_ping() const;
+	uint64_t get_next_tcp_ping() const;
+	void pong(uint16_t stamp, uint64_t time);
+
+	int get_rtt() const;
+	int get_udp_timeout() const;
+	int get_tcp_timeout() const;
+
+	NetGameKeepalive();
+};
+
+#endif
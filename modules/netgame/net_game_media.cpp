@@ -0,0 +1,391 @@
+#include "modules/netgame/net_game_media.h"
+#include "io/marshalls.h"
+
+void NetGameMedia::set_bundle(int p_bundle) {
+	ERR_FAIL_COND(p_bundle < 1 || p_bundle > MEDIA_BUNDLE_MAX);
+	bundle = p_bundle;
+}
+
+int NetGameMedia::get_bundle() const {
+	return bundle;
+}
+
+void NetGameMedia::set_jitter(int p_jitter) {
+	ERR_FAIL_COND(p_jitter < 0 || p_jitter > MEDIA_JITTER_MAX);
+	jitter = p_jitter;
+}
+
+int NetGameMedia::get_jitter() const {
+	return jitter;
+}
+
+/***
+ * Sending side, bundles are closed into r_out (one packet each)
+ */
+NetGameMedia::TxStream &NetGameMedia::_get_tx(uint8_t stream) {
+	int index = tx.find(stream);
+	if(index == -1) {
+		TxStream s;
+		s.target.push_back(MEDIA_TO_SERVER);
+		s.seq = 0;
+		s.timestamp = 0;
+		s.count = 0;
+		s.start = 0;
+		index = tx.insert(stream, s);
+	}
+	return tx.getv(index);
+}
+
+void NetGameMedia::_close(uint8_t stream, TxStream &s,
+				Vector<DVector<uint8_t> > &r_out) {
+	DVector<uint8_t> out;
+	int tlen = s.target.size();
+
+	if(s.count == 0) {
+		return;
+	}
+	out.resize(tlen + MEDIA_HEADER + s.frames.size());
+	{
+		DVector<uint8_t>::Write w = out.write();
+		DVector<uint8_t>::Read t = s.target.read();
+		DVector<uint8_t>::Read f = s.frames.read();
+		memcpy(w.ptr(), t.ptr(), tlen);
+		w[tlen] = stream;
+		w[tlen + 1] = s.seq & 0xFF;
+		w[tlen + 2] = s.seq >> 8;
+		encode_uint32(s.timestamp, w.ptr() + tlen + 3);
+		w[tlen + 7] = s.count;
+		memcpy(w.ptr() + tlen + MEDIA_HEADER, f.ptr(), s.frames.size());
+	}
+	r_out.push_back(out);
+	s.seq += s.count;
+	s.count = 0;
+	s.frames.resize(0);
+}
+
+/*
+ * [RELAY_TO_CLIENT][id], [RELAY_TO_GROUP][len][group] or
+ * [MEDIA_TO_SERVER], the frames already bundled go first
+ */
+void NetGameMedia::set_target(int stream, const uint8_t *target, int len,
+				Vector<DVector<uint8_t> > &r_out) {
+	ERR_FAIL_INDEX(stream, 256);
+	TxStream &s = _get_tx(stream);
+
+	_close(stream, s, r_out);
+	s.target.resize(len);
+	DVector<uint8_t>::Write w = s.target.write();
+	memcpy(w.ptr(), target, len);
+}
+
+Error NetGameMedia::push(int stream, const DVector<uint8_t> &frame,
+				uint32_t timestamp, uint64_t time,
+				Vector<DVector<uint8_t> > &r_out) {
+	ERR_FAIL_INDEX_V(stream, 256, ERR_INVALID_PARAMETER);
+	ERR_FAIL_COND_V(frame.size() == 0 || frame.size() > MEDIA_FRAME_MAX,
+			ERR_INVALID_PARAMETER);
+	TxStream &s = _get_tx(stream);
+
+	// The offset must fit and the packet stay under the MTU
+	if(s.count > 0 && (timestamp - s.timestamp > 0xFFFF ||
+			s.target.size() + MEDIA_HEADER + s.frames.size() +
+			MEDIA_FRAME_HEADER + frame.size() > MEDIA_PACKET_MAX)) {
+		_close(stream, s, r_out);
+	}
+	if(s.count == 0) {
+		s.timestamp = timestamp;
+		s.start = time;
+	}
+
+	int pos = s.frames.size();
+	uint32_t delta = timestamp - s.timestamp;
+	s.frames.resize(pos + MEDIA_FRAME_HEADER + frame.size());
+	{
+		DVector<uint8_t>::Write w = s.frames.write();
+		DVector<uint8_t>::Read r = frame.read();
+		w[pos] = delta & 0xFF;
+		w[pos + 1] = delta >> 8;
+		w[pos + 2] = frame.size() & 0xFF;
+		w[pos + 3] = frame.size() >> 8;
+		memcpy(w.ptr() + pos + MEDIA_FRAME_HEADER, r.ptr(), frame.size());
+	}
+	s.count++;
+	if(s.count >= bundle) {
+		_close(stream, s, r_out);
+	}
+	return OK;
+}
+
+/*
+ * End of a talk spurt, stream -1 flushes all of them
+ */
+void NetGameMedia::flush(int stream, Vector<DVector<uint8_t> > &r_out) {
+	int i;
+
+	for(i = 0; i < tx.size(); i++) {
+		if(stream == -1 || tx.getk(i) == stream) {
+			_close(tx.getk(i), tx.getv(i), r_out);
+		}
+	}
+}
+
+void NetGameMedia::flush_due(uint64_t time, Vector<DVector<uint8_t> > &r_out) {
+	int i;
+
+	for(i = 0; i < tx.size(); i++) {
+		TxStream &s = tx.getv(i);
+		if(s.count > 0 && s.start + MEDIA_BUNDLE_WAIT <= time) {
+			_close(tx.getk(i), s, r_out);
+		}
+	}
+}
+
+/***
+ * Receiving side, buf is the stream packet (no target)
+ */
+bool NetGameMedia::_check(const uint8_t *buf, int len) {
+	int pos = MEDIA_HEADER;
+	int i, count;
+
+	if(len < MEDIA_HEADER) {
+		return false;
+	}
+	count = buf[7];
+	if(count < 1 || count > MEDIA_BUNDLE_MAX) {
+		return false;
+	}
+	for(i = 0; i < count; i++) {
+		if(pos + MEDIA_FRAME_HEADER > len) {
+			return false;
+		}
+		int flen = buf[pos + 2] | (buf[pos + 3] << 8);
+		if(flen == 0) {
+			return false;
+		}
+		pos += MEDIA_FRAME_HEADER + flen;
+	}
+	return pos == len;
+}
+
+/*
+ * Frames from next to seq are lost: reported as empty frames (at most
+ * MEDIA_GAP_MAX), their timestamps follow the last frame interval
+ */
+void NetGameMedia::_skip(CID id, uint8_t stream, RxStream &s, uint16_t seq,
+				Vector<MediaFrame> &r_frames) {
+	int16_t count = seq - s.next;
+	int i;
+
+	if(count <= 0) {
+		return;
+	}
+	for(i = 0; i < MIN(count, MEDIA_GAP_MAX); i++) {
+		MediaFrame f;
+		s.last_ts += s.step;
+		f.id = id;
+		f.stream = stream;
+		f.timestamp = s.last_ts;
+		r_frames.push_back(f);
+	}
+	s.lost += count;
+	s.next = seq;
+}
+
+/*
+ * Frames before next (already delivered or reported lost) are skipped
+ */
+void NetGameMedia::_deliver(CID id, RxStream &s, const uint8_t *buf,
+				Vector<MediaFrame> &r_frames) {
+	uint16_t seq = buf[1] | (buf[2] << 8);
+	uint32_t timestamp = decode_uint32(buf + 3);
+	int count = buf[7];
+	int pos = MEDIA_HEADER;
+	int i;
+
+	for(i = 0; i < count; i++) {
+		uint16_t fseq = seq + i;
+		uint32_t ts = timestamp + (buf[pos] | (buf[pos + 1] << 8));
+		int flen = buf[pos + 2] | (buf[pos + 3] << 8);
+
+		if((int16_t)(fseq - s.next) >= 0) {
+			MediaFrame f;
+			f.id = id;
+			f.stream = buf[0];
+			f.timestamp = ts;
+			f.data.resize(flen);
+			{
+				DVector<uint8_t>::Write w = f.data.write();
+				memcpy(w.ptr(), buf + pos + MEDIA_FRAME_HEADER, flen);
+			}
+			r_frames.push_back(f);
+			// Frame interval, guessed for the lost ones
+			if(s.received > 0 && ts - s.last_ts <= 0xFFFF) {
+				s.step = ts - s.last_ts;
+			}
+			s.last_ts = ts;
+			s.next = fseq + 1;
+			s.received++;
+		}
+		pos += MEDIA_FRAME_HEADER + flen;
+	}
+}
+
+/*
+ * Held packets that now follow the delivered frames
+ */
+void NetGameMedia::_drain(CID id, uint8_t stream, RxStream &s,
+				Vector<MediaFrame> &r_frames) {
+	while(s.held.size() > 0) {
+		int16_t d = s.held[0].seq - s.next;
+
+		if(d > 0) {
+			break;
+		}
+		{
+			DVector<uint8_t>::Read r = s.held[0].pkt.read();
+			if(d + r[7] <= 0) {
+				s.late++;
+			}
+			else {
+				_deliver(id, s, r.ptr(), r_frames);
+			}
+		}
+		s.held.remove(0);
+	}
+}
+
+bool NetGameMedia::receive(CID id, const uint8_t *buf, int len,
+				uint64_t time, Vector<MediaFrame> &r_frames) {
+	int i;
+
+	if(!_check(buf, len)) {
+		return false;
+	}
+	uint8_t stream = buf[0];
+	uint16_t seq = buf[1] | (buf[2] << 8);
+	int count = buf[7];
+	uint16_t key = (id << 8) | stream;
+	int index = rx.find(key);
+	if(index == -1) {
+		RxStream s;
+		s.started = false;
+		s.received = 0;
+		s.lost = 0;
+		s.late = 0;
+		index = rx.insert(key, s);
+	}
+
+	RxStream &s = rx.getv(index);
+	if(!s.started) {
+		s.started = true;
+		s.next = seq;
+		s.last_ts = decode_uint32(buf + 3);
+		s.step = 0;
+	}
+
+	int16_t d = seq - s.next;
+	if(d + count <= 0) {
+		s.late++;
+		return true;
+	}
+
+	// After a small gap, wait a bit for the missing packets
+	if(d > 0 && d <= MEDIA_GAP_MAX && jitter > 0 &&
+			s.held.size() < MEDIA_HOLD_MAX) {
+		Held h;
+		h.seq = seq;
+		h.arrival = time;
+		h.pkt.resize(len);
+		{
+			DVector<uint8_t>::Write w = h.pkt.write();
+			memcpy(w.ptr(), buf, len);
+		}
+		for(i = 0; i < s.held.size(); i++) {
+			int16_t o = seq - s.held[i].seq;
+			if(o == 0) {
+				s.late++;
+				return true;
+			}
+			if(o < 0) {
+				break;
+			}
+		}
+		s.held.insert(i, h);
+		return true;
+	}
+
+	// Too far ahead or nowhere to keep it, older held packets go first
+	while(s.held.size() > 0 && (int16_t)(s.held[0].seq - seq) < 0) {
+		{
+			DVector<uint8_t>::Read r = s.held[0].pkt.read();
+			_skip(id, stream, s, s.held[0].seq, r_frames);
+			_deliver(id, s, r.ptr(), r_frames);
+		}
+		s.held.remove(0);
+	}
+	_skip(id, stream, s, seq, r_frames);
+	_deliver(id, s, buf, r_frames);
+	_drain(id, stream, s, r_frames);
+	return true;
+}
+
+/*
+ * The missing packets did not come in time, they are reported lost
+ */
+void NetGameMedia::release(uint64_t time, Vector<MediaFrame> &r_frames) {
+	int i;
+
+	for(i = 0; i < rx.size(); i++) {
+		RxStream &s = rx.getv(i);
+		CID id = rx.getk(i) >> 8;
+		uint8_t stream = rx.getk(i) & 0xFF;
+
+		while(s.held.size() > 0 && s.held[0].arrival + jitter <= time) {
+			{
+				DVector<uint8_t>::Read r = s.held[0].pkt.read();
+				_skip(id, stream, s, s.held[0].seq, r_frames);
+				_deliver(id, s, r.ptr(), r_frames);
+			}
+			s.held.remove(0);
+			_drain(id, stream, s, r_frames);
+		}
+	}
+}
+
+/*
+ * "received" and "lost" count frames, "late" packets that came after
+ * their frames were delivered or reported lost
+ */
+Dictionary NetGameMedia::get_stats(CID id, int stream) const {
+	Dictionary out;
+	int index = rx.find((id << 8) | (stream & 0xFF));
+
+	if(stream < 0 || stream > 255 || index == -1) {
+		return out;
+	}
+	const RxStream &s = rx.getv(index);
+	out["received"] = s.received;
+	out["lost"] = s.lost;
+	out["late"] = s.late;
+	return out;
+}
+
+void NetGameMedia::remove(CID id) {
+	int i;
+
+	for(i = rx.size() - 1; i >= 0; i--) {
+		if((rx.getk(i) >> 8) == id) {
+			rx.erase(rx.getk(i));
+		}
+	}
+}
+
+void NetGameMedia::clear() {
+	tx.clear();
+	rx.clear();
+}
+
+NetGameMedia::NetGameMedia() {
+	bundle = MEDIA_BUNDLE;
+	jitter = MEDIA_JITTER;
+}
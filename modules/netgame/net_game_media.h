@@ -0,0 +1,111 @@
+#ifndef NET_GAME_MEDIA_H
+#define NET_GAME_MEDIA_H
+
+#include "vmap.h"
+#include "dvector.h"
+#include "variant.h"
+#include "modules/netgame/net_game_server_data.h"
+
+// Frames per packet, a partial bundle leaves after MEDIA_BUNDLE_WAIT msec
+#define MEDIA_BUNDLE 2
+#define MEDIA_BUNDLE_MAX 8
+#define MEDIA_BUNDLE_WAIT 50
+#define MEDIA_FRAME_MAX 1024
+#define MEDIA_PACKET_MAX 1200
+// Msec a packet after a gap waits for the missing ones, 0 never waits
+#define MEDIA_JITTER 60
+#define MEDIA_JITTER_MAX 1000
+// Packets held per stream, lost frames reported at most for one gap
+#define MEDIA_HOLD_MAX 8
+#define MEDIA_GAP_MAX 16
+// Client to server: [target] (RELAY_TO_CLIENT, RELAY_TO_GROUP or this)
+// then the stream packet
+#define MEDIA_TO_SERVER 2
+// [stream][seq 2][timestamp 4][count] then [delta 2][len 2][frame]
+#define MEDIA_HEADER 8
+#define MEDIA_FRAME_HEADER 4
+
+// Empty data for a lost frame
+struct MediaFrame {
+	CID id;
+	uint8_t stream;
+	uint32_t timestamp;
+	DVector<uint8_t> data;
+};
+
+/**
+ * Media streams (voice): unreliable, sequenced per stream and frame,
+ * several frames per packet. Timestamps are the sender's (samples or
+ * msec), a frame carries its offset from the first one of its packet.
+ * The receiver delivers frames in order and reports the missing ones
+ * as empty frames, so a decoder can conceal them. A packet arriving
+ * after a gap is held up to "jitter" msec for the late ones.
+ * Not thread safe, the owner guards it.
+ */
+class NetGameMedia {
+
+	struct TxStream {
+		DVector<uint8_t> target;
+		uint16_t seq;
+		uint32_t timestamp;
+		int count;
+		uint64_t start;
+		DVector<uint8_t> frames;
+	};
+
+	struct Held {
+		uint16_t seq;
+		uint64_t arrival;
+		DVector<uint8_t> pkt;
+	};
+
+	struct RxStream {
+		bool started;
+		uint16_t next;
+		uint32_t last_ts;
+		uint32_t step;
+		Vector<Held> held;
+		uint32_t received;
+		uint32_t lost;
+		uint32_t late;
+	};
+
+	VMap<uint8_t, TxStream> tx;
+	VMap<uint16_t, RxStream> rx;
+	int bundle;
+	int jitter;
+
+	TxStream &_get_tx(uint8_t stream);
+	void _close(uint8_t stream, TxStream &s, Vector<DVector<uint8_t> > &r_out);
+	static bool _check(const uint8_t *buf, int len);
+	void _skip(CID id, uint8_t stream, RxStream &s, uint16_t seq,
+			Vector<MediaFrame> &r_frames);
+	void _deliver(CID id, RxStream &s, const uint8_t *buf,
+			Vector<MediaFrame> &r_frames);
+	void _drain(CID id, uint8_t stream, RxStream &s,
+			Vector<MediaFrame> &r_frames);
+
+public:
+	void set_bundle(int p_bundle);
+	int get_bundle() const;
+	void set_jitter(int p_jitter);
+	int get_jitter() const;
+
+	void set_target(int stream, const uint8_t *target, int len,
+			Vector<DVector<uint8_t> > &r_out);
+	Error push(int stream, const DVector<uint8_t> &frame, uint32_t timestamp,
+			uint64_t time, Vector<DVector<uint8_t> > &r_out);
+	void flush(int stream, Vector<DVector<uint8_t> > &r_out);
+	void flush_due(uint64_t time, Vector<DVector<uint8_t> > &r_out);
+
+	bool receive(CID id, const uint8_t *buf, int len, uint64_t time,
+			Vector<MediaFrame> &r_frames);
+	void release(uint64_t time, Vector<MediaFrame> &r_frames);
+	Dictionary get_stats(CID id, int stream) const;
+	void remove(CID id);
+	void clear();
+
+	NetGameMedia();
+};
+
+#endif
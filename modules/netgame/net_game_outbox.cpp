@@ -0,0 +1,169 @@
+#include "modules/netgame/net_game_outbox.h"
+
+/*
+ * Owners never change once set, a stale read only misses a slot claimed
+ * meanwhile (and the caller then looks again under the claim lock)
+ */
+NetGameOutbox::Slot *NetGameOutbox::_find_slot(Thread::ID tid) {
+	int i;
+	int n = used;
+
+	for(i = 0; i < n; i++) {
+		if(slots[i].owner == tid) {
+			return &slots[i];
+		}
+	}
+	return NULL;
+}
+
+NetGameOutbox::Slot *NetGameOutbox::_get_slot() {
+	Thread::ID tid = Thread::get_caller_ID();
+	Slot *s = _find_slot(tid);
+
+	if(s != NULL) {
+		return s;
+	}
+
+	// First send of this thread
+	claim_mutex->lock();
+	s = _find_slot(tid);
+	if(s == NULL) {
+		if(used < OUTBOX_SLOTS) {
+			s = &slots[used];
+			s->owner = tid;
+			used++;
+		}
+		else {
+			s = &slots[OUTBOX_SLOTS - 1];
+		}
+	}
+	claim_mutex->unlock();
+	return s;
+}
+
+/*
+ * Called for every client each tick and before its lifecycle signals
+ */
+void NetGameOutbox::publish(CID id, bool ready) {
+	uint32_t word = table[id];
+
+	if(get_state(word) == OUTBOX_NONE) {
+		count++;
+	}
+	table[id] = (word & ~3) | (ready ? OUTBOX_READY : OUTBOX_CONNECTED);
+}
+
+void NetGameOutbox::unpublish(CID id) {
+	uint32_t word = table[id];
+
+	if(get_state(word) != OUTBOX_NONE) {
+		count--;
+	}
+	table[id] = ((get_generation(word) + 1) << 2) | OUTBOX_NONE;
+}
+
+/*
+ * Append the staged packets of every slot, in send order per thread
+ */
+void NetGameOutbox::take(Vector<QueuedPacket*> &r_packets) {
+	int i, j;
+	int n = used;
+
+	for(i = 0; i < n; i++) {
+		Slot &s = slots[i];
+		s.mutex->lock();
+		// Copy on write, the slot buffer is handed over as is
+		Vector<QueuedPacket*> staged = s.packets;
+		s.packets.clear();
+		s.mutex->unlock();
+		for(j = 0; j < staged.size(); j++) {
+			r_packets.push_back(staged[j]);
+		}
+	}
+}
+
+bool NetGameOutbox::is_empty() {
+	int i;
+	bool out = true;
+
+	for(i = 0; out && i < used; i++) {
+		slots[i].mutex->lock();
+		out = slots[i].packets.size() == 0;
+		slots[i].mutex->unlock();
+	}
+	return out;
+}
+
+void NetGameOutbox::clear() {
+	Vector<QueuedPacket*> staged;
+	int i;
+
+	take(staged);
+	for(i = 0; i < staged.size(); i++) {
+		memdelete(staged[i]);
+	}
+}
+
+uint32_t NetGameOutbox::lookup(int id) const {
+	if(id < 0 || id >= OUTBOX_CLIENTS) {
+		return OUTBOX_NONE;
+	}
+	return table[id];
+}
+
+int NetGameOutbox::get_count() const {
+	return count;
+}
+
+/*
+ * Each slot holds up to PKT_QUEUE_SIZE packets per client
+ */
+Error NetGameOutbox::push(CID id, uint32_t gen, const DVector<uint8_t> &pkt,
+			int cmd, bool timed, bool proto) {
+	Slot *s = _get_slot();
+	int limit = PKT_QUEUE_SIZE * (count + 1);
+
+	QueuedPacket *qp = (QueuedPacket *) memnew(QueuedPacket);
+	qp->id = id;
+	qp->gen = gen;
+	qp->cmd = cmd;
+	qp->packet = pkt;
+	qp->timed = timed;
+	qp->proto = proto;
+
+	s->mutex->lock();
+	if(s->packets.size() >= limit) {
+		s->mutex->unlock();
+		memdelete(qp);
+		WARN_PRINT("UDP QUEUE SIZE EXCEEDED");
+		return ERR_OUT_OF_MEMORY;
+	}
+	s->packets.push_back(qp);
+	s->mutex->unlock();
+	return OK;
+}
+
+NetGameOutbox::NetGameOutbox() {
+	int i;
+
+	for(i = 0; i < OUTBOX_SLOTS; i++) {
+		slots[i].owner = 0;
+		slots[i].mutex = Mutex::create();
+	}
+	for(i = 0; i < OUTBOX_CLIENTS; i++) {
+		table[i] = OUTBOX_NONE;
+	}
+	used = 0;
+	count = 0;
+	claim_mutex = Mutex::create();
+}
+
+NetGameOutbox::~NetGameOutbox() {
+	int i;
+
+	clear();
+	for(i = 0; i < OUTBOX_SLOTS; i++) {
+		memdelete(slots[i].mutex);
+	}
+	memdelete(claim_mutex);
+}
@@ -0,0 +1,69 @@
+#ifndef NET_GAME_OUTBOX_H
+#define NET_GAME_OUTBOX_H
+
+#include "os/thread.h"
+#include "os/mutex.h"
+#include "vector.h"
+#include "modules/netgame/net_game_server_data.h"
+
+#define OUTBOX_SLOTS 16
+#define OUTBOX_CLIENTS 256
+// Generation of the packets sent to every ready client
+#define OUTBOX_ALL 0xFFFFFFFF
+
+enum OutboxState {
+	OUTBOX_NONE,
+	OUTBOX_CONNECTED,
+	OUTBOX_READY
+};
+
+/**
+ * UDP send path of the game threads, producers share no lock.
+ * The network thread publishes its clients in a fixed table, one word per
+ * id: [generation 30][state 2], read in a single load. The generation
+ * changes when an id is freed, so a packet staged for a client that left
+ * is dropped instead of reaching the next client with the same id.
+ * Packets are staged in a slot owned by the calling thread (claimed on
+ * its first send) and the network thread takes every slot once per tick,
+ * so a slot lock is only ever shared with the network thread.
+ * Threads beyond OUTBOX_SLOTS share the last slot.
+ */
+class NetGameOutbox {
+
+	struct Slot {
+		Thread::ID owner;
+		Mutex *mutex;
+		Vector<QueuedPacket*> packets;
+	};
+
+	Slot slots[OUTBOX_SLOTS];
+	int used;
+	Mutex *claim_mutex;
+	volatile uint32_t table[OUTBOX_CLIENTS];
+	volatile int count;
+
+	Slot *_find_slot(Thread::ID tid);
+	Slot *_get_slot();
+
+public:
+	static OutboxState get_state(uint32_t word) { return (OutboxState)(word & 3); }
+	static uint32_t get_generation(uint32_t word) { return word >> 2; }
+
+	// Network thread
+	void publish(CID id, bool ready);
+	void unpublish(CID id);
+	void take(Vector<QueuedPacket*> &r_packets);
+	bool is_empty();
+	void clear();
+
+	// Any thread
+	uint32_t lookup(int id) const;
+	int get_count() const;
+	Error push(CID id, uint32_t gen, const DVector<uint8_t> &pkt, int cmd,
+			bool timed, bool proto=false);
+
+	NetGameOutbox();
+	~NetGameOutbox();
+};
+
+#endif
@@ -0,0 +1,183 @@
+#include "modules/netgame/net_game_reactor.h"
+#include "modules/netgame/net_game_server_core.h"
+#include "os/os.h"
+
+int NetGameReactor::_find(NetGameServerCore *p_server) const {
+	for(int i = 0; i < servers.size(); i++) {
+		if(servers[i].server == p_server) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Pick the next idle server that is due, starting after the last one
+ * picked so every server gets its turn
+ */
+NetGameServerCore *NetGameReactor::_acquire() {
+	NetGameServerCore *out = NULL;
+	uint64_t now = OS::get_singleton()->get_ticks_usec();
+
+	mutex->lock();
+	int size = servers.size();
+	for(int i = 0; i < size; i++) {
+		int idx = (cursor + i) % size;
+		Entry &e = servers[idx];
+		if(e.busy || e.removed || e.next > now) {
+			continue;
+		}
+		e.busy = true;
+		cursor = (idx + 1) % size;
+		out = e.server;
+		break;
+	}
+	mutex->unlock();
+	return out;
+}
+
+void NetGameReactor::_release(NetGameServerCore *p_server) {
+	mutex->lock();
+	int idx = _find(p_server);
+	if(idx != -1) {
+		servers[idx].busy = false;
+		servers[idx].next = OS::get_singleton()->get_ticks_usec() +
+			SERVER_SLEEP_USEC;
+	}
+	mutex->unlock();
+}
+
+/*
+ * With no server attached, block until one is added (or the reactor
+ * quits) instead of polling
+ */
+bool NetGameReactor::_wait_idle() {
+	mutex->lock();
+	if(servers.size() > 0 || quit) {
+		mutex->unlock();
+		return false;
+	}
+	idle++;
+	mutex->unlock();
+	wake->wait();
+	return true;
+}
+
+// With the mutex held, one post per waiting thread
+void NetGameReactor::_wake_idle() {
+	while(idle > 0) {
+		wake->post();
+		idle--;
+	}
+}
+
+/**
+ * Pool thread loop
+ */
+void NetGameReactor::_thread_start(void *s) {
+	NetGameReactor *self = (NetGameReactor*) s;
+
+	while(!self->quit) {
+		NetGameServerCore *server = self->_acquire();
+		if(server == NULL) {
+			if(!self->_wait_idle()) {
+				OS::get_singleton()->delay_usec(SERVER_SLEEP_USEC);
+			}
+			continue;
+		}
+		server->_server_tick();
+		self->_release(server);
+	}
+}
+
+void NetGameReactor::set_thread_count(int p_count) {
+	ERR_FAIL_COND(p_count < 1 || p_count > REACTOR_THREADS_MAX);
+	ERR_FAIL_COND(threads.size() > 0);
+	thread_count = p_count;
+}
+
+int NetGameReactor::get_thread_count() const {
+	return thread_count;
+}
+
+int NetGameReactor::get_server_count() {
+	mutex->lock();
+	int count = servers.size();
+	mutex->unlock();
+	return count;
+}
+
+void NetGameReactor::_add_server(NetGameServerCore *p_server) {
+	mutex->lock();
+	if(_find(p_server) == -1) {
+		Entry e;
+		e.server = p_server;
+		e.next = 0;
+		e.busy = false;
+		e.removed = false;
+		servers.push_back(e);
+	}
+	_wake_idle();
+	if(threads.size() == 0) {
+		quit = false;
+		for(int i = 0; i < thread_count; i++) {
+			threads.push_back(Thread::create(_thread_start, this));
+		}
+	}
+	mutex->unlock();
+}
+
+/*
+ * Returns once no pool thread is ticking the server anymore
+ */
+void NetGameReactor::_remove_server(NetGameServerCore *p_server) {
+	mutex->lock();
+	int idx = _find(p_server);
+	if(idx == -1) {
+		mutex->unlock();
+		return;
+	}
+	servers[idx].removed = true;
+	while(servers[idx].busy) {
+		mutex->unlock();
+		OS::get_singleton()->delay_usec(SERVER_SLEEP_USEC);
+		mutex->lock();
+		idx = _find(p_server);
+	}
+	servers.remove(idx);
+	if(cursor >= servers.size()) {
+		cursor = 0;
+	}
+	mutex->unlock();
+}
+
+void NetGameReactor::_bind_methods() {
+	ObjectTypeDB::bind_method(_MD("set_thread_count","count"),&NetGameReactor::set_thread_count);
+	ObjectTypeDB::bind_method(_MD("get_thread_count"),&NetGameReactor::get_thread_count);
+	ObjectTypeDB::bind_method(_MD("get_server_count"),&NetGameReactor::get_server_count);
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"thread_count",PROPERTY_HINT_RANGE,"1,64,1"),_SCS("set_thread_count"),_SCS("get_thread_count"));
+}
+
+NetGameReactor::NetGameReactor() {
+	mutex = Mutex::create();
+	wake = Semaphore::create();
+	cursor = 0;
+	thread_count = REACTOR_THREADS;
+	idle = 0;
+	quit = true;
+}
+
+NetGameReactor::~NetGameReactor() {
+	// Servers keep a reference, none can be registered here
+	mutex->lock();
+	quit = true;
+	_wake_idle();
+	mutex->unlock();
+	for(int i = 0; i < threads.size(); i++) {
+		Thread::wait_to_finish(threads[i]);
+		memdelete(threads[i]);
+	}
+	threads.clear();
+	memdelete(wake);
+	memdelete(mutex);
+}
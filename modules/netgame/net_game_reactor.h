@@ -0,0 +1,66 @@
+#ifndef NET_GAME_REACTOR_H
+#define NET_GAME_REACTOR_H
+
+#include "reference.h"
+#include "os/thread.h"
+#include "os/mutex.h"
+#include "os/semaphore.h"
+#include "modules/netgame/net_game_server_data.h"
+
+#define REACTOR_THREADS 2
+#define REACTOR_THREADS_MAX 64
+
+class NetGameServerCore;
+
+/**
+ * Shared network threads for many servers in one process.
+ * Servers given the same reactor (set_reactor) do not start a thread of
+ * their own: a fixed pool of threads ticks them round robin instead.
+ * A server is only ticked by one thread at a time, and at most once
+ * every SERVER_SLEEP_USEC, like with its own thread.
+ * The pool starts with the first server and stops with the reactor,
+ * while no server is attached its threads wait on a semaphore.
+ */
+class NetGameReactor: public Reference {
+	OBJ_TYPE( NetGameReactor, Reference );
+
+	struct Entry {
+		NetGameServerCore *server;
+		uint64_t next;
+		bool busy;
+		bool removed;
+	};
+
+	Mutex *mutex;
+	Semaphore *wake;
+	Vector<Thread*> threads;
+	Vector<Entry> servers;
+	int cursor;
+	int thread_count;
+	int idle;
+	bool quit;
+
+	int _find(NetGameServerCore *p_server) const;
+	NetGameServerCore *_acquire();
+	void _release(NetGameServerCore *p_server);
+	bool _wait_idle();
+	void _wake_idle();
+
+	static void _thread_start(void *s);
+
+protected:
+	static void _bind_methods();
+
+public:
+	void set_thread_count(int p_count);
+	int get_thread_count() const;
+	int get_server_count();
+
+	void _add_server(NetGameServerCore *p_server);
+	void _remove_server(NetGameServerCore *p_server);
+
+	NetGameReactor();
+	~NetGameReactor();
+};
+
+#endif
@@ -0,0 +1,335 @@
+#include "modules/netgame/net_game_record.h"
+#include "modules/netgame/net_game_server_core.h"
+#include "modules/netgame/net_game_client_core.h"
+#include "io/marshalls.h"
+#include "os/os.h"
+
+static const char *record_signals[] = {
+	SIGNAL_CLIENT_CONNECT,
+	SIGNAL_CLIENT_READY,
+	SIGNAL_CLIENT_DISCONNECT,
+	SIGNAL_CLIENT_RESUME,
+	SIGNAL_AUTH_PACKET,
+	SIGNAL_TCP_PACKET,
+	SIGNAL_UDP_PACKET,
+	NULL
+};
+
+// Message signal of each packet signal above, NULL when never decoded
+static const char *record_messages[] = {
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	SIGNAL_TCP_MESSAGE,
+	SIGNAL_UDP_MESSAGE,
+	NULL
+};
+
+int NetGameRecorder::signal_index(const char *sig) {
+	for(int i = 0; record_signals[i] != NULL; i++) {
+		if(strcmp(record_signals[i], sig) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+const char *NetGameRecorder::signal_name(int idx) {
+	if(idx < 0 || idx >= (int)(sizeof(record_signals) / sizeof(char*)) - 1) {
+		return NULL;
+	}
+	return record_signals[idx];
+}
+
+const char *NetGameRecorder::message_name(int idx) {
+	if(idx < 0 || idx >= (int)(sizeof(record_messages) / sizeof(char*)) - 1) {
+		return NULL;
+	}
+	return record_messages[idx];
+}
+
+void NetGameRecorder::_flush() {
+	if(buffer_len > 0) {
+		file->store_buffer(buffer, buffer_len);
+		buffer_len = 0;
+	}
+}
+
+Error NetGameRecorder::start(const String &path) {
+	stop();
+
+	Error err;
+	FileAccess *f = FileAccess::open(path, FileAccess::WRITE, &err);
+	if(f == NULL) {
+		return err;
+	}
+
+	mutex->lock();
+	file = f;
+	file->store_buffer((const uint8_t *)RECORD_MAGIC, 4);
+	file->store_8(RECORD_VERSION);
+	file->store_8(0);
+	file->store_16(0);
+	size = RECORD_HEADER;
+	buffer_len = 0;
+	last_time = OS::get_singleton()->get_ticks_usec();
+	mutex->unlock();
+	return OK;
+}
+
+void NetGameRecorder::stop() {
+	mutex->lock();
+	if(file != NULL) {
+		_flush();
+		file->close();
+		memdelete(file);
+		file = NULL;
+	}
+	mutex->unlock();
+}
+
+bool NetGameRecorder::is_recording() const {
+	return file != NULL;
+}
+
+int NetGameRecorder::get_size() const {
+	return size;
+}
+
+/*
+ * Called from the network thread and from put_*, the lock also keeps
+ * the time deltas in order
+ */
+void NetGameRecorder::record(RecordType type, int sig, CID id, int cmd,
+				const uint8_t *data, int len) {
+	if(file == NULL) {
+		return;
+	}
+	mutex->lock();
+	if(file == NULL) {
+		mutex->unlock();
+		return;
+	}
+
+	uint64_t now = OS::get_singleton()->get_ticks_usec();
+	uint64_t delta = now - last_time;
+	last_time = now;
+	if(delta > 0xFFFFFFFF) {
+		delta = 0xFFFFFFFF;
+	}
+
+	if(buffer_len + RECORD_EVENT_HEADER + len > RECORD_BUFFER) {
+		_flush();
+	}
+
+	uint8_t *w = buffer + buffer_len;
+	w[0] = type;
+	w[1] = sig;
+	w[2] = id;
+	w[3] = cmd & 0xFF;
+	w[4] = cmd >> 8;
+	encode_uint32(delta, w + 5);
+	encode_uint32(len, w + 9);
+	buffer_len += RECORD_EVENT_HEADER;
+
+	if(RECORD_EVENT_HEADER + len > RECORD_BUFFER) {
+		// Too big to buffer, goes straight to the file
+		_flush();
+		file->store_buffer(data, len);
+	}
+	else if(len > 0) {
+		memcpy(buffer + buffer_len, data, len);
+		buffer_len += len;
+	}
+	size += RECORD_EVENT_HEADER + len;
+	mutex->unlock();
+}
+
+void NetGameRecorder::record(RecordType type, int sig, CID id, int cmd,
+				const DVector<uint8_t> &pkt) {
+	DVector<uint8_t>::Read r = pkt.read();
+	record(type, sig, id, cmd, r.ptr(), pkt.size());
+}
+
+void NetGameRecorder::_bind_methods() {
+	ObjectTypeDB::bind_method(_MD("start:Error","path"),&NetGameRecorder::start);
+	ObjectTypeDB::bind_method(_MD("stop"),&NetGameRecorder::stop);
+	ObjectTypeDB::bind_method(_MD("is_recording"),&NetGameRecorder::is_recording);
+	ObjectTypeDB::bind_method(_MD("get_size"),&NetGameRecorder::get_size);
+}
+
+NetGameRecorder::NetGameRecorder() {
+	mutex = Mutex::create();
+	file = NULL;
+	buffer = (uint8_t *) memalloc(RECORD_BUFFER);
+	buffer_len = 0;
+	size = 0;
+	last_time = 0;
+}
+
+NetGameRecorder::~NetGameRecorder() {
+	stop();
+	memfree(buffer);
+	memdelete(mutex);
+}
+
+/***
+ * Replay
+ */
+Error NetGameReplay::open(const String &path) {
+	close();
+
+	Error err;
+	FileAccess *f = FileAccess::open(path, FileAccess::READ, &err);
+	if(f == NULL) {
+		return err;
+	}
+
+	int flen = f->get_len();
+	uint8_t header[RECORD_HEADER];
+	if(flen < RECORD_HEADER ||
+			f->get_buffer(header, RECORD_HEADER) != RECORD_HEADER ||
+			memcmp(header, RECORD_MAGIC, 4) != 0 ||
+			header[4] != RECORD_VERSION) {
+		f->close();
+		memdelete(f);
+		return ERR_FILE_UNRECOGNIZED;
+	}
+
+	len = flen - RECORD_HEADER;
+	data = (uint8_t *) memalloc(len > 0 ? len : 1);
+	len = f->get_buffer(data, len);
+	f->close();
+	memdelete(f);
+
+	rewind();
+	return OK;
+}
+
+void NetGameReplay::close() {
+	if(data != NULL) {
+		memfree(data);
+	}
+	data = NULL;
+	len = 0;
+	rewind();
+}
+
+void NetGameReplay::rewind() {
+	pos = 0;
+	events = 0;
+	rec_time = 0;
+	start_time = 0;
+	started = false;
+}
+
+bool NetGameReplay::is_finished() const {
+	return pos + RECORD_EVENT_HEADER > len;
+}
+
+int NetGameReplay::get_event_count() const {
+	return events;
+}
+
+void NetGameReplay::set_speed(float p_speed) {
+	ERR_FAIL_COND(p_speed < 0);
+	speed = p_speed;
+}
+
+float NetGameReplay::get_speed() const {
+	return speed;
+}
+
+/*
+ * Whether the event at pos is complete and due at the current speed
+ */
+bool NetGameReplay::_next_due() {
+	if(is_finished()) {
+		return false;
+	}
+	const uint8_t *r = data + pos;
+	int plen = decode_uint32(r + 9);
+	if(plen < 0 || pos + RECORD_EVENT_HEADER + plen > len) {
+		// Truncated log (recorder not stopped)
+		pos = len;
+		return false;
+	}
+	if(speed <= 0) {
+		return true;
+	}
+
+	uint64_t now = OS::get_singleton()->get_ticks_usec();
+	if(!started) {
+		started = true;
+		start_time = now;
+	}
+	uint64_t at = rec_time + decode_uint32(r + 5);
+	return (now - start_time) * speed >= at;
+}
+
+template<class T>
+int NetGameReplay::_play(T *core, int max_events) {
+	int count = 0;
+
+	while((max_events <= 0 || count < max_events) && _next_due()) {
+		const uint8_t *r = data + pos;
+		int plen = decode_uint32(r + 9);
+		rec_time += decode_uint32(r + 5);
+		pos += RECORD_EVENT_HEADER + plen;
+		events++;
+		count++;
+
+		const char *sig = NetGameRecorder::signal_name(r[1]);
+		if(r[0] == RECORD_SIGNAL && sig != NULL) {
+			core->_queue_signal(sig, r[2]);
+		}
+		else if(r[0] == RECORD_PACKET && sig != NULL) {
+			DVector<uint8_t> pkt;
+			pkt.resize(plen);
+			if(plen > 0) {
+				DVector<uint8_t>::Write w = pkt.write();
+				memcpy(w.ptr(), r + RECORD_EVENT_HEADER, plen);
+			}
+			core->_queue_packet(sig, NetGameRecorder::message_name(r[1]),
+						r[2], pkt, r[3] | (r[4] << 8));
+		}
+		// Sent packets are only counted
+	}
+	return count;
+}
+
+int NetGameReplay::play_server(const Ref<NetGameServerCore> &core, int max_events) {
+	ERR_FAIL_COND_V(core.is_null(), 0);
+	return _play(core.ptr(), max_events);
+}
+
+int NetGameReplay::play_client(const Ref<NetGameClientCore> &core, int max_events) {
+	ERR_FAIL_COND_V(core.is_null(), 0);
+	return _play(core.ptr(), max_events);
+}
+
+void NetGameReplay::_bind_methods() {
+	ObjectTypeDB::bind_method(_MD("open:Error","path"),&NetGameReplay::open);
+	ObjectTypeDB::bind_method(_MD("close"),&NetGameReplay::close);
+	ObjectTypeDB::bind_method(_MD("rewind"),&NetGameReplay::rewind);
+	ObjectTypeDB::bind_method(_MD("is_finished"),&NetGameReplay::is_finished);
+	ObjectTypeDB::bind_method(_MD("get_event_count"),&NetGameReplay::get_event_count);
+	ObjectTypeDB::bind_method(_MD("set_speed","speed"),&NetGameReplay::set_speed);
+	ObjectTypeDB::bind_method(_MD("get_speed"),&NetGameReplay::get_speed);
+	ObjectTypeDB::bind_method(_MD("play_server","server:NetGameServerCore","max_events"),&NetGameReplay::play_server,DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("play_client","client:NetGameClientCore","max_events"),&NetGameReplay::play_client,DEFVAL(0));
+	ADD_PROPERTY( PropertyInfo(Variant::REAL,"speed",PROPERTY_HINT_RANGE,"0,100,0.1"),_SCS("set_speed"),_SCS("get_speed"));
+}
+
+NetGameReplay::NetGameReplay() {
+	data = NULL;
+	len = 0;
+	speed = 1;
+	rewind();
+}
+
+NetGameReplay::~NetGameReplay() {
+	close();
+}
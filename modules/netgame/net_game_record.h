@@ -0,0 +1,109 @@
+#ifndef NET_GAME_RECORD_H
+#define NET_GAME_RECORD_H
+
+#include "reference.h"
+#include "os/mutex.h"
+#include "os/file_access.h"
+#include "modules/netgame/net_game_server_data.h"
+
+#define RECORD_MAGIC "NGRC"
+#define RECORD_VERSION 2
+#define RECORD_HEADER 8
+#define RECORD_EVENT_HEADER 13
+#define RECORD_BUFFER 65536
+
+enum RecordType {
+	RECORD_SIGNAL,
+	RECORD_PACKET,
+	RECORD_SEND_TCP,
+	RECORD_SEND_UDP
+};
+
+/**
+ * Append only session log.
+ * File: [magic 4][version][3 reserved] then events:
+ * [type][signal][id][cmd 2][usec since previous event 4][len 4][payload]
+ * SIGNAL events are the lifecycle signals, PACKET events the inbound
+ * packets as they are handed to the signal queue (before message decoding)
+ * and SEND events the packets given to put_* (signal is 1 for rt UDP).
+ * Events are buffered and written RECORD_BUFFER bytes at a time.
+ */
+class NetGameRecorder: public Reference {
+	OBJ_TYPE( NetGameRecorder, Reference );
+
+	Mutex *mutex;
+	FileAccess *file;
+	uint8_t *buffer;
+	int buffer_len;
+	int size;
+	uint64_t last_time;
+
+	void _flush();
+
+protected:
+	static void _bind_methods();
+
+public:
+	static int signal_index(const char *sig);
+	static const char *signal_name(int idx);
+	static const char *message_name(int idx);
+
+	Error start(const String &path);
+	void stop();
+	bool is_recording() const;
+	int get_size() const;
+
+	void record(RecordType type, int sig, CID id, int cmd,
+			const uint8_t *data=NULL, int len=0);
+	void record(RecordType type, int sig, CID id, int cmd,
+			const DVector<uint8_t> &pkt);
+
+	NetGameRecorder();
+	~NetGameRecorder();
+};
+
+class NetGameServerCore;
+class NetGameClientCore;
+
+/**
+ * Feeds a session log back through the signal queue of a server or
+ * client core, without sockets.
+ * Inbound packets go through message decoding again, so the handlers
+ * see the same signals as in the recorded session.
+ * A speed of 0 feeds events as fast as possible (for benchmarks).
+ */
+class NetGameReplay: public Reference {
+	OBJ_TYPE( NetGameReplay, Reference );
+
+	uint8_t *data;
+	int len;
+	int pos;
+	int events;
+	uint64_t rec_time;
+	uint64_t start_time;
+	bool started;
+	float speed;
+
+	bool _next_due();
+	template<class T> int _play(T *core, int max_events);
+
+protected:
+	static void _bind_methods();
+
+public:
+	Error open(const String &path);
+	void close();
+	void rewind();
+	bool is_finished() const;
+	int get_event_count() const;
+	void set_speed(float p_speed);
+	float get_speed() const;
+
+	int play_server(const Ref<NetGameServerCore> &core, int max_events=0);
+	int play_client(const Ref<NetGameClientCore> &core, int max_events=0);
+
+	NetGameReplay();
+	~NetGameReplay();
+};
+
+#endif
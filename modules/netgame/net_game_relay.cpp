@@ -0,0 +1,148 @@
+#include "modules/netgame/net_game_relay.h"
+
+NetGameRelay::ClientRelay *NetGameRelay::_get_or_add(CID id) {
+	int index = clients.find(id);
+	if(index == -1) {
+		ClientRelay cr;
+		cr.rate = -1;
+		cr.tokens = 0;
+		cr.time = 0;
+		cr.relayed = 0;
+		cr.limited = 0;
+		cr.filtered = 0;
+		index = clients.insert(id, cr);
+	}
+	return &clients.getv(index);
+}
+
+void NetGameRelay::set_rate(int p_rate) {
+	ERR_FAIL_COND(p_rate < 0 || p_rate > RELAY_RATE_MAX);
+	rate = p_rate;
+}
+
+int NetGameRelay::get_rate() const {
+	return rate;
+}
+
+/*
+ * -1 goes back to the server rate
+ */
+void NetGameRelay::set_client_rate(CID id, int p_rate) {
+	ERR_FAIL_COND(p_rate < -1 || p_rate > RELAY_RATE_MAX);
+	_get_or_add(id)->rate = p_rate;
+}
+
+void NetGameRelay::set_cmd_allowed(int cmd, bool allowed) {
+	ERR_FAIL_INDEX(cmd, CMD_LIMIT);
+	if(allowed) {
+		denied[cmd >> 5] &= ~(1U << (cmd & 31));
+	}
+	else {
+		denied[cmd >> 5] |= 1U << (cmd & 31);
+	}
+}
+
+bool NetGameRelay::is_cmd_allowed(int cmd) const {
+	ERR_FAIL_INDEX_V(cmd, CMD_LIMIT, false);
+	return !(denied[cmd >> 5] & (1U << (cmd & 31)));
+}
+
+void NetGameRelay::set_blocked(CID from, CID to, bool p_blocked) {
+	if(p_blocked) {
+		blocked.insert((from << 8) | to);
+	}
+	else {
+		blocked.erase((from << 8) | to);
+	}
+}
+
+/*
+ * Token bucket: "rate" packets per second, bursts of rate packets.
+ * A group relay takes one token whatever the number of receivers.
+ * Media packets (cmd -1) only go through the bucket.
+ */
+bool NetGameRelay::allow(CID from, int cmd, uint64_t time) {
+	ClientRelay *cr = _get_or_add(from);
+	int r = cr->rate >= 0 ? cr->rate : rate;
+
+	if(cmd >= 0 && !is_cmd_allowed(cmd)) {
+		cr->filtered++;
+		return false;
+	}
+	if(r <= 0) {
+		cr->limited++;
+		return false;
+	}
+
+	// Thousandths of a packet, refill is exact in milliseconds
+	uint32_t burst = r * 1000;
+	uint64_t refill = (time - cr->time) * r;
+	cr->tokens = refill >= burst - MIN(cr->tokens, burst) ?
+		burst : cr->tokens + refill;
+	cr->time = time;
+	if(cr->tokens < 1000) {
+		cr->limited++;
+		return false;
+	}
+	cr->tokens -= 1000;
+	return true;
+}
+
+bool NetGameRelay::filter(CID from, CID to) {
+	if(from == to || blocked.has((from << 8) | to)) {
+		return false;
+	}
+	return true;
+}
+
+void NetGameRelay::count(CID from, int relayed) {
+	_get_or_add(from)->relayed += relayed;
+}
+
+/*
+ * Dropped before the rules (invalid command)
+ */
+void NetGameRelay::count_filtered(CID from) {
+	_get_or_add(from)->filtered++;
+}
+
+/*
+ * "relayed" counts delivered copies, "limited" and "filtered" packets
+ * dropped by the rate or the command rules
+ */
+Dictionary NetGameRelay::get_stats(CID id) const {
+	Dictionary out;
+	int index = clients.find(id);
+
+	if(index == -1) {
+		return out;
+	}
+	const ClientRelay &cr = clients.getv(index);
+	out["relayed"] = cr.relayed;
+	out["limited"] = cr.limited;
+	out["filtered"] = cr.filtered;
+	return out;
+}
+
+void NetGameRelay::remove_client(CID id) {
+	Set<uint16_t>::Element *E = blocked.front();
+
+	clients.erase(id);
+	while(E) {
+		Set<uint16_t>::Element *N = E->next();
+		if((E->get() >> 8) == id || (E->get() & 0xFF) == id) {
+			blocked.erase(E);
+		}
+		E = N;
+	}
+}
+
+void NetGameRelay::clear() {
+	clients.clear();
+	blocked.clear();
+}
+
+NetGameRelay::NetGameRelay() {
+	rate = RELAY_RATE;
+	memset(denied, 0, sizeof(denied));
+}
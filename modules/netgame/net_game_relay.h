@@ -0,0 +1,63 @@
+#ifndef NET_GAME_RELAY_H
+#define NET_GAME_RELAY_H
+
+#include "vmap.h"
+#include "set.h"
+#include "variant.h"
+#include "modules/netgame/net_game_server_data.h"
+#include "modules/netgame/net_game_command.h"
+
+// Relayed packets per second and client, 0 disables relaying
+#define RELAY_RATE 0
+#define RELAY_RATE_MAX 1000
+// Client to server: [kind][id] or [kind][len][group], then [cmd 2]
+#define RELAY_TO_CLIENT 0
+#define RELAY_TO_GROUP 1
+// Server to client: [from][cmd 2]
+#define RELAY_HEADER 3
+
+/**
+ * Client to client relay rules, checked on the network thread for every
+ * relayed packet: a token bucket per sender (the server relay_rate or a
+ * per client override), the commands that may be relayed and the sender
+ * / receiver pairs that are blocked (mutes, teams).
+ * Not thread safe: the server guards it with its connection mutex.
+ */
+class NetGameRelay {
+
+	struct ClientRelay {
+		int rate;
+		uint32_t tokens;
+		uint64_t time;
+		int relayed;
+		int limited;
+		int filtered;
+	};
+
+	VMap<CID, ClientRelay> clients;
+	Set<uint16_t> blocked;
+	uint32_t denied[CMD_LIMIT / 32 + 1];
+	int rate;
+
+	ClientRelay *_get_or_add(CID id);
+
+public:
+	void set_rate(int p_rate);
+	int get_rate() const;
+	void set_client_rate(CID id, int p_rate);
+	void set_cmd_allowed(int cmd, bool allowed);
+	bool is_cmd_allowed(int cmd) const;
+	void set_blocked(CID from, CID to, bool p_blocked);
+
+	bool allow(CID from, int cmd, uint64_t time);
+	bool filter(CID from, CID to);
+	void count(CID from, int relayed);
+	void count_filtered(CID from);
+	Dictionary get_stats(CID id) const;
+	void remove_client(CID id);
+	void clear();
+
+	NetGameRelay();
+};
+
+#endif
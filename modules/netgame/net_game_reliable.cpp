@@ -0,0 +1,131 @@
+#include "modules/netgame/net_game_reliable.h"
+
+bool NetGameReliable::can_send() const {
+	return sent.size() < RELIABLE_WINDOW;
+}
+
+int NetGameReliable::get_unacked() const {
+	return sent.size();
+}
+
+Error NetGameReliable::send(const uint8_t *p_buf, int p_len, uint64_t time,
+				DVector<uint8_t> &r_pkt) {
+	ERR_FAIL_COND_V(p_len > RELIABLE_MAX_SIZE, ERR_INVALID_PARAMETER);
+	if(!can_send()) {
+		return ERR_BUSY;
+	}
+
+	r_pkt.resize(4 + p_len);
+	{
+		DVector<uint8_t>::Write w = r_pkt.write();
+		w[0] = CMD_MAX;
+		w[1] = PCMD_RELIABLE;
+		w[2] = next_seq & 0xFF;
+		w[3] = next_seq >> 8;
+		memcpy(&w[4], p_buf, p_len);
+	}
+
+	Outgoing o;
+	o.seq = next_seq++;
+	o.time = time;
+	o.pkt = r_pkt;
+	sent.push_back(o);
+	return OK;
+}
+
+void NetGameReliable::get_resends(uint64_t time,
+				Vector<DVector<uint8_t> > &r_pkts) {
+	int i;
+	for(i = 0; i < sent.size(); i++) {
+		if(sent[i].time + RELIABLE_RTO > time) {
+			continue;
+		}
+		sent[i].time = time;
+		r_pkts.push_back(sent[i].pkt);
+	}
+}
+
+/*
+ * Earliest resend, only meaningful with unacked packets
+ */
+uint64_t NetGameReliable::get_next_resend() const {
+	int i;
+	uint64_t next = sent.size() > 0 ? sent[0].time : 0;
+	for(i = 1; i < sent.size(); i++) {
+		next = MIN(next, sent[i].time);
+	}
+	return next + RELIABLE_RTO;
+}
+
+/*
+ * Cumulative ack, everything before "next" was received
+ */
+void NetGameReliable::ack(uint16_t next) {
+	// Past what was sent: bogus or wrapped, nothing is acked
+	if((int16_t)(next - next_seq) > 0) {
+		return;
+	}
+	while(sent.size() > 0 && (int16_t)(next - sent[0].seq) > 0) {
+		sent.remove(0);
+	}
+}
+
+/*
+ * Store a received packet, returns false if it is outside the window.
+ * Duplicates are accepted (and ignored) so they get acked again.
+ */
+bool NetGameReliable::receive(uint16_t seq, const uint8_t *p_buf, int p_len) {
+	int16_t d = seq - expected;
+	if(d < 0) {
+		return true;
+	}
+	if(d >= RELIABLE_WINDOW) {
+		return false;
+	}
+
+	int slot = seq % RELIABLE_WINDOW;
+	if(recv_has[slot]) {
+		return true;
+	}
+	recv_buf[slot].resize(p_len);
+	if(p_len > 0) {
+		DVector<uint8_t>::Write w = recv_buf[slot].write();
+		memcpy(w.ptr(), p_buf, p_len);
+	}
+	recv_has[slot] = true;
+	return true;
+}
+
+/*
+ * Next in order packet, if any
+ */
+bool NetGameReliable::pop(DVector<uint8_t> &r_pkt) {
+	int slot = expected % RELIABLE_WINDOW;
+	if(!recv_has[slot]) {
+		return false;
+	}
+	r_pkt = recv_buf[slot];
+	recv_buf[slot] = DVector<uint8_t>();
+	recv_has[slot] = false;
+	expected++;
+	return true;
+}
+
+uint16_t NetGameReliable::get_ack() const {
+	return expected;
+}
+
+void NetGameReliable::reset() {
+	int i;
+	sent.clear();
+	for(i = 0; i < RELIABLE_WINDOW; i++) {
+		recv_buf[i] = DVector<uint8_t>();
+		recv_has[i] = false;
+	}
+	next_seq = 0;
+	expected = 0;
+}
+
+NetGameReliable::NetGameReliable() {
+	reset();
+}
@@ -0,0 +1,50 @@
+#ifndef NET_GAME_RELIABLE_H
+#define NET_GAME_RELIABLE_H
+
+#include "dvector.h"
+#include "vector.h"
+#include "modules/netgame/net_game_server_data.h"
+
+#define RELIABLE_WINDOW 64
+#define RELIABLE_RTO 200
+#define RELIABLE_MAX_SIZE 1200
+
+/**
+ * Ordered reliable channel over UDP (used in UDP only mode in place of
+ * TCP). Packets are [CMD_MAX][PCMD_RELIABLE][seq (2)][data], the receiver
+ * acks with the next sequence it expects and buffers up to a window of
+ * out of order packets. Unacked packets are resent every RELIABLE_RTO.
+ */
+class NetGameReliable {
+
+	struct Outgoing {
+		uint16_t seq;
+		uint64_t time;
+		DVector<uint8_t> pkt;
+	};
+
+	Vector<Outgoing> sent;
+	DVector<uint8_t> recv_buf[RELIABLE_WINDOW];
+	bool recv_has[RELIABLE_WINDOW];
+	uint16_t next_seq;
+	uint16_t expected;
+
+public:
+	bool can_send() const;
+	int get_unacked() const;
+	Error send(const uint8_t *p_buf, int p_len, uint64_t time,
+			DVector<uint8_t> &r_pkt);
+	void get_resends(uint64_t time, Vector<DVector<uint8_t> > &r_pkts);
+	uint64_t get_next_resend() const;
+	void ack(uint16_t next);
+
+	bool receive(uint16_t seq, const uint8_t *p_buf, int p_len);
+	bool pop(DVector<uint8_t> &r_pkt);
+	uint16_t get_ack() const;
+
+	void reset();
+
+	NetGameReliable();
+};
+
+#endif
@@ -0,0 +1,640 @@
+
+#include "modules/netgame/net_game_replica.h"
+
+#define ENTRY_UPDATE 0
+#define ENTRY_CREATE 1
+#define ENTRY_REMOVE 2
+
+static int _find_field(const Vector<ReplicaField> &fields, const String &name) {
+	int i;
+	for(i = 0; i < fields.size(); i++) {
+		if(fields[i].name == name) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static bool _is_quantized(const ReplicaField &f) {
+	return f.bits > 0 && (f.type == REPLICA_FLOAT || f.type == REPLICA_VECTOR3);
+}
+
+static float _quantize_float(const ReplicaField &f, float v) {
+	if(f.bits == 0) {
+		return v;
+	}
+	uint32_t steps = (1u << f.bits) - 1;
+	float r = (CLAMP(v, f.min, f.max) - f.min) / (f.max - f.min);
+	uint32_t q = (uint32_t)Math::floor(r * steps + 0.5);
+	return f.min + (f.max - f.min) * ((float)q / steps);
+}
+
+/*
+ * Return the value as the client will see it, so that changes below the
+ * field precision are not sent at all.
+ */
+static Variant _quantize(const ReplicaField &f, const Variant &v) {
+	switch(f.type) {
+		case REPLICA_BOOL:
+			return (bool)v;
+		case REPLICA_INT: {
+			uint32_t i = (uint32_t)(int)v;
+			if(f.bits < 32) {
+				i &= (1u << f.bits) - 1;
+				if(i & (1u << (f.bits - 1))) {
+					i |= ~((1u << f.bits) - 1);
+				}
+			}
+			return (int)i;
+		}
+		case REPLICA_FLOAT:
+			return _quantize_float(f, v);
+		case REPLICA_VECTOR3: {
+			Vector3 vec = v;
+			return Vector3(_quantize_float(f, vec.x),
+					_quantize_float(f, vec.y),
+					_quantize_float(f, vec.z));
+		}
+	}
+	return Variant();
+}
+
+static void _write_float(NetGameBitWriter &w, const ReplicaField &f, float v) {
+	if(f.bits == 0) {
+		w.write_float(v);
+	}
+	else {
+		w.write_quantized(v, f.min, f.max, f.bits);
+	}
+}
+
+static float _read_float(NetGameBitReader &r, const ReplicaField &f) {
+	if(f.bits == 0) {
+		return r.read_float();
+	}
+	return r.read_quantized(f.min, f.max, f.bits);
+}
+
+static void _write_value(NetGameBitWriter &w, const ReplicaField &f,
+				const Variant &v) {
+	switch(f.type) {
+		case REPLICA_BOOL:
+			w.write_bool(v);
+			break;
+		case REPLICA_INT:
+			w.write_int((int)v, f.bits);
+			break;
+		case REPLICA_FLOAT:
+			_write_float(w, f, v);
+			break;
+		case REPLICA_VECTOR3: {
+			Vector3 vec = v;
+			_write_float(w, f, vec.x);
+			_write_float(w, f, vec.y);
+			_write_float(w, f, vec.z);
+			break;
+		}
+	}
+}
+
+static Variant _read_value(NetGameBitReader &r, const ReplicaField &f) {
+	switch(f.type) {
+		case REPLICA_BOOL:
+			return r.read_bool();
+		case REPLICA_INT:
+			return r.read_int(f.bits);
+		case REPLICA_FLOAT:
+			return _read_float(r, f);
+		case REPLICA_VECTOR3: {
+			float x = _read_float(r, f);
+			float y = _read_float(r, f);
+			float z = _read_float(r, f);
+			return Vector3(x, y, z);
+		}
+	}
+	return Variant();
+}
+
+static void _write_field_info(NetGameBitWriter &w, const ReplicaField &f) {
+	CharString name = f.name.utf8();
+
+	w.write_bits(f.type, 2);
+	w.write_bits(f.bits, 6);
+	if(_is_quantized(f)) {
+		w.write_float(f.min);
+		w.write_float(f.max);
+	}
+	w.write_bits(name.length(), 5);
+	w.write_bytes((const uint8_t *)name.get_data(), name.length());
+}
+
+static bool _read_field_info(NetGameBitReader &r, ReplicaField &f) {
+	char name[REPLICA_MAX_NAME + 1];
+	int len;
+
+	f.type = r.read_bits(2);
+	f.bits = r.read_bits(6);
+	f.min = 0;
+	f.max = 0;
+	if(_is_quantized(f)) {
+		f.min = r.read_float();
+		f.max = r.read_float();
+	}
+	len = r.read_bits(5);
+	if(len > REPLICA_MAX_NAME || r.get_remaining() < len * 8) {
+		return false;
+	}
+	r.read_bytes((uint8_t *)name, len);
+	name[len] = 0;
+	f.name.parse_utf8(name, len);
+
+	if(f.type == REPLICA_INT && (f.bits < 1 || f.bits > 32)) {
+		return false;
+	}
+	if(_is_quantized(f) && (f.bits > 24 || !(f.max > f.min))) {
+		return false;
+	}
+	return !r.has_error();
+}
+
+static Error _parse_fields(const Array &p_fields, Vector<ReplicaField> &out) {
+	int i;
+
+	if(p_fields.size() < 1 || p_fields.size() > REPLICA_MAX_FIELDS) {
+		ERR_EXPLAIN("Invalid replica field count");
+		ERR_FAIL_V(ERR_INVALID_PARAMETER);
+	}
+
+	for(i = 0; i < p_fields.size(); i++) {
+		Dictionary d = p_fields[i];
+		ReplicaField f;
+		f.name = d.has("name") ? String(d["name"]) : String();
+		f.type = d.has("type") ? (int)d["type"] : REPLICA_FLOAT;
+		f.bits = d.has("bits") ? (int)d["bits"] :
+				(f.type == REPLICA_INT ? 32 : 0);
+		f.min = d.has("min") ? (float)d["min"] : 0;
+		f.max = d.has("max") ? (float)d["max"] : 0;
+
+		if(f.name.empty() || f.name.utf8().length() > REPLICA_MAX_NAME ||
+				_find_field(out, f.name) != -1) {
+			ERR_EXPLAIN("Invalid replica field name: " + f.name);
+			ERR_FAIL_V(ERR_INVALID_PARAMETER);
+		}
+		if(f.type < REPLICA_BOOL || f.type > REPLICA_VECTOR3) {
+			ERR_EXPLAIN("Invalid replica field type: " + f.name);
+			ERR_FAIL_V(ERR_INVALID_PARAMETER);
+		}
+		if(f.type == REPLICA_INT && (f.bits < 1 || f.bits > 32)) {
+			ERR_EXPLAIN("Invalid replica int bits: " + f.name);
+			ERR_FAIL_V(ERR_INVALID_PARAMETER);
+		}
+		// Floats are raw (0) or quantized (1 to 24 bits)
+		if((f.type == REPLICA_FLOAT || f.type == REPLICA_VECTOR3) &&
+				(f.bits < 0 || f.bits > 24)) {
+			ERR_EXPLAIN("Invalid replica float bits: " + f.name);
+			ERR_FAIL_V(ERR_INVALID_PARAMETER);
+		}
+		if(_is_quantized(f) && !(f.max > f.min)) {
+			ERR_EXPLAIN("Invalid replica quantization: " + f.name);
+			ERR_FAIL_V(ERR_INVALID_PARAMETER);
+		}
+		if(f.type == REPLICA_BOOL) {
+			f.bits = 0;
+		}
+		out.push_back(f);
+	}
+	return OK;
+}
+
+NetGameReplicaPeer::NetGameReplicaPeer() {
+	int i;
+	acked = 0;
+	seq = 0;
+	for(i = 0; i < REPLICA_ACK_WINDOW; i++) {
+		sent_seq[i] = 0;
+		sent_version[i] = 0;
+	}
+}
+
+/***
+ * Server
+ */
+Error NetGameReplicaServer::create(int oid, const Array &p_fields) {
+	int i;
+	ReplicaObject obj;
+
+	ERR_FAIL_INDEX_V(oid, 65536, ERR_INVALID_PARAMETER);
+	Error err = _parse_fields(p_fields, obj.fields);
+	if(err != OK) {
+		return err;
+	}
+
+	mutex->lock();
+	if(objects.has(oid)) {
+		mutex->unlock();
+		return ERR_ALREADY_EXISTS;
+	}
+
+	// A new object replaces any pending removal
+	for(i = 0; i < tombstones.size(); i++) {
+		if(tombstones[i].oid == oid) {
+			tombstones.remove(i);
+			break;
+		}
+	}
+
+	obj.created = ++version;
+	for(i = 0; i < obj.fields.size(); i++) {
+		obj.values.push_back(_quantize(obj.fields[i], Variant()));
+		obj.versions.push_back(obj.created);
+	}
+	objects.insert(oid, obj);
+	mutex->unlock();
+	return OK;
+}
+
+Error NetGameReplicaServer::remove(int oid) {
+	mutex->lock();
+	if(!objects.erase(oid)) {
+		mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	Tombstone t;
+	t.oid = oid;
+	t.version = ++version;
+	tombstones.push_back(t);
+	mutex->unlock();
+	return OK;
+}
+
+Error NetGameReplicaServer::set(int oid, const String &field,
+					const Variant &value) {
+	mutex->lock();
+	Map<uint16_t, ReplicaObject>::Element *E = objects.find(oid);
+	if(E == NULL) {
+		mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	ReplicaObject &obj = E->get();
+	int idx = _find_field(obj.fields, field);
+	if(idx == -1) {
+		mutex->unlock();
+		return ERR_INVALID_PARAMETER;
+	}
+	Variant q = _quantize(obj.fields[idx], value);
+	if(q != obj.values[idx]) {
+		obj.values[idx] = q;
+		obj.versions[idx] = ++version;
+	}
+	mutex->unlock();
+	return OK;
+}
+
+Variant NetGameReplicaServer::get(int oid, const String &field) {
+	Variant out;
+
+	mutex->lock();
+	Map<uint16_t, ReplicaObject>::Element *E = objects.find(oid);
+	if(E != NULL) {
+		int idx = _find_field(E->get().fields, field);
+		if(idx != -1) {
+			out = E->get().values[idx];
+		}
+	}
+	mutex->unlock();
+	return out;
+}
+
+void NetGameReplicaServer::clear() {
+	mutex->lock();
+	objects.clear();
+	tombstones.clear();
+	mutex->unlock();
+}
+
+/*
+ * Build the update datagram for a peer.
+ * When not everything fits, the packet is stamped with the version right
+ * below the oldest skipped change so the ack never covers it.
+ */
+bool NetGameReplicaServer::build_update(NetGameReplicaPeer &peer,
+					DVector<uint8_t> &out) {
+	int i, mark;
+	// Room left for the end marker
+	int limit = REPLICA_MAX_PACKET * 8 - 1;
+	uint8_t buf[REPLICA_MAX_PACKET];
+	uint32_t skipped = 0xFFFFFFFF;
+	bool any = false;
+
+	memset(buf, 0, REPLICA_MAX_PACKET);
+	NetGameBitWriter w(buf, REPLICA_MAX_PACKET);
+
+	mutex->lock();
+	if(version == peer.acked) {
+		mutex->unlock();
+		return false;
+	}
+
+	w.write_bits(CMD_MAX, 8);
+	w.write_bits(PCMD_REPLICA, 8);
+	w.write_bits(peer.seq, 16);
+
+	for(i = 0; i < tombstones.size(); i++) {
+		const Tombstone &t = tombstones[i];
+		if(t.version <= peer.acked) {
+			continue;
+		}
+		mark = w.get_pos();
+		w.write_bool(true);
+		w.write_bits(t.oid, 16);
+		w.write_bits(ENTRY_REMOVE, 2);
+		if(w.has_overflow() || w.get_pos() > limit) {
+			w.set_pos(mark);
+			skipped = MIN(skipped, t.version);
+			continue;
+		}
+		any = true;
+	}
+
+	for(Map<uint16_t, ReplicaObject>::Element *E = objects.front(); E;
+							E = E->next()) {
+		const ReplicaObject &obj = E->get();
+		uint32_t oldest = 0xFFFFFFFF;
+
+		mark = w.get_pos();
+		if(obj.created > peer.acked) {
+			oldest = obj.created;
+			w.write_bool(true);
+			w.write_bits(E->key(), 16);
+			w.write_bits(ENTRY_CREATE, 2);
+			w.write_bits(obj.fields.size() - 1, 5);
+			for(i = 0; i < obj.fields.size(); i++) {
+				_write_field_info(w, obj.fields[i]);
+			}
+			for(i = 0; i < obj.fields.size(); i++) {
+				_write_value(w, obj.fields[i], obj.values[i]);
+			}
+		}
+		else {
+			for(i = 0; i < obj.versions.size(); i++) {
+				if(obj.versions[i] > peer.acked) {
+					oldest = MIN(oldest, obj.versions[i]);
+				}
+			}
+			if(oldest == 0xFFFFFFFF) {
+				// Nothing changed
+				continue;
+			}
+			w.write_bool(true);
+			w.write_bits(E->key(), 16);
+			w.write_bits(ENTRY_UPDATE, 2);
+			for(i = 0; i < obj.fields.size(); i++) {
+				bool dirty = obj.versions[i] > peer.acked;
+				w.write_bool(dirty);
+				if(dirty) {
+					_write_value(w, obj.fields[i],
+							obj.values[i]);
+				}
+			}
+		}
+		if(w.has_overflow() || w.get_pos() > limit) {
+			w.set_pos(mark);
+			skipped = MIN(skipped, oldest);
+			continue;
+		}
+		any = true;
+	}
+
+	// End marker, always fits
+	w.write_bool(false);
+
+	if(!any) {
+		mutex->unlock();
+		return false;
+	}
+
+	int slot = peer.seq % REPLICA_ACK_WINDOW;
+	peer.sent_seq[slot] = peer.seq;
+	peer.sent_version[slot] = skipped == 0xFFFFFFFF ? version : skipped - 1;
+	peer.seq++;
+	mutex->unlock();
+
+	out.resize(w.get_byte_size());
+	DVector<uint8_t>::Write wr = out.write();
+	memcpy(wr.ptr(), buf, w.get_byte_size());
+	return true;
+}
+
+void NetGameReplicaServer::ack(NetGameReplicaPeer &peer, uint16_t seq) {
+	int slot = seq % REPLICA_ACK_WINDOW;
+	if(peer.sent_seq[slot] == seq && peer.sent_version[slot] > peer.acked) {
+		peer.acked = peer.sent_version[slot];
+	}
+}
+
+/*
+ * Drop removals every client already knows about
+ */
+void NetGameReplicaServer::collect(uint32_t min_acked) {
+	int i;
+
+	mutex->lock();
+	for(i = 0; i < tombstones.size(); i++) {
+		if(tombstones[i].version <= min_acked) {
+			tombstones.remove(i);
+			i--;
+		}
+	}
+	mutex->unlock();
+}
+
+uint32_t NetGameReplicaServer::get_version() const {
+	return version;
+}
+
+NetGameReplicaServer::NetGameReplicaServer() {
+	version = 0;
+	mutex = Mutex::create();
+}
+
+NetGameReplicaServer::~NetGameReplicaServer() {
+	memdelete(mutex);
+}
+
+/***
+ * Client
+ */
+Error NetGameReplicaClient::apply(const DVector<uint8_t> &pkt,
+					uint16_t &r_seq) {
+	Vector<Entry> entries;
+	int i;
+
+	DVector<uint8_t>::Read rd = pkt.read();
+	NetGameBitReader r(rd.ptr(), pkt.size());
+
+	r_seq = r.read_bits(16);
+	if(r.has_error()) {
+		return ERR_INVALID_DATA;
+	}
+
+	mutex->lock();
+
+	// Older than what we have, every change it carries was resent since
+	if(has_seq && (int16_t)(r_seq - last_seq) <= 0) {
+		mutex->unlock();
+		return ERR_SKIP;
+	}
+
+	// Parse everything before touching the store
+	while(r.read_bool() && !r.has_error()) {
+		Entry e;
+		e.oid = r.read_bits(16);
+		e.kind = r.read_bits(2);
+
+		if(e.kind == ENTRY_CREATE) {
+			int count = r.read_bits(5) + 1;
+			for(i = 0; i < count; i++) {
+				ReplicaField f;
+				if(!_read_field_info(r, f)) {
+					mutex->unlock();
+					return ERR_INVALID_DATA;
+				}
+				e.fields.push_back(f);
+			}
+			for(i = 0; i < count; i++) {
+				e.values.push_back(_read_value(r, e.fields[i]));
+				e.dirty.push_back(true);
+			}
+		}
+		else if(e.kind == ENTRY_UPDATE) {
+			Map<uint16_t, ReplicaObject>::Element *E = objects.find(e.oid);
+			const Vector<ReplicaField> *fields = NULL;
+			// The object may be created earlier in this same packet
+			for(i = entries.size() - 1; i >= 0; i--) {
+				if(entries[i].oid == e.oid) {
+					if(entries[i].kind == ENTRY_CREATE) {
+						fields = &entries[i].fields;
+					}
+					break;
+				}
+			}
+			if(fields == NULL && i < 0 && E != NULL) {
+				fields = &E->get().fields;
+			}
+			if(fields == NULL) {
+				mutex->unlock();
+				return ERR_INVALID_DATA;
+			}
+			for(i = 0; i < fields->size(); i++) {
+				bool dirty = r.read_bool();
+				e.dirty.push_back(dirty);
+				e.values.push_back(dirty ?
+					_read_value(r, (*fields)[i]) : Variant());
+			}
+		}
+		else if(e.kind != ENTRY_REMOVE) {
+			mutex->unlock();
+			return ERR_INVALID_DATA;
+		}
+		entries.push_back(e);
+	}
+
+	if(r.has_error()) {
+		mutex->unlock();
+		return ERR_INVALID_DATA;
+	}
+
+	for(i = 0; i < entries.size(); i++) {
+		Entry &e = entries[i];
+		if(e.kind == ENTRY_REMOVE) {
+			objects.erase(e.oid);
+		}
+		else if(e.kind == ENTRY_CREATE) {
+			ReplicaObject obj;
+			obj.fields = e.fields;
+			obj.values = e.values;
+			objects[e.oid] = obj;
+		}
+		else {
+			ReplicaObject &obj = objects[e.oid];
+			int j;
+			for(j = 0; j < e.values.size(); j++) {
+				if(e.dirty[j]) {
+					obj.values[j] = e.values[j];
+				}
+			}
+		}
+	}
+
+	last_seq = r_seq;
+	has_seq = true;
+	mutex->unlock();
+	return OK;
+}
+
+bool NetGameReplicaClient::has(int oid) {
+	mutex->lock();
+	bool out = objects.has(oid);
+	mutex->unlock();
+	return out;
+}
+
+Variant NetGameReplicaClient::get(int oid, const String &field) {
+	Variant out;
+
+	mutex->lock();
+	Map<uint16_t, ReplicaObject>::Element *E = objects.find(oid);
+	if(E != NULL) {
+		int idx = _find_field(E->get().fields, field);
+		if(idx != -1) {
+			out = E->get().values[idx];
+		}
+	}
+	mutex->unlock();
+	return out;
+}
+
+Dictionary NetGameReplicaClient::get_fields(int oid) {
+	Dictionary out;
+	int i;
+
+	mutex->lock();
+	Map<uint16_t, ReplicaObject>::Element *E = objects.find(oid);
+	if(E != NULL) {
+		for(i = 0; i < E->get().fields.size(); i++) {
+			out[E->get().fields[i].name] = E->get().values[i];
+		}
+	}
+	mutex->unlock();
+	return out;
+}
+
+Array NetGameReplicaClient::get_ids() {
+	Array out;
+
+	mutex->lock();
+	for(Map<uint16_t, ReplicaObject>::Element *E = objects.front(); E;
+							E = E->next()) {
+		out.push_back(E->key());
+	}
+	mutex->unlock();
+	return out;
+}
+
+void NetGameReplicaClient::clear() {
+	mutex->lock();
+	objects.clear();
+	has_seq = false;
+	last_seq = 0;
+	mutex->unlock();
+}
+
+NetGameReplicaClient::NetGameReplicaClient() {
+	has_seq = false;
+	last_seq = 0;
+	mutex = Mutex::create();
+}
+
+NetGameReplicaClient::~NetGameReplicaClient() {
+	memdelete(mutex);
+}
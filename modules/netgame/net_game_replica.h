@@ -0,0 +1,119 @@
+#ifndef NET_GAME_REPLICA_H
+#define NET_GAME_REPLICA_H
+
+#include "map.h"
+#include "variant.h"
+#include "os/mutex.h"
+#include "modules/netgame/net_game_server_data.h"
+#include "modules/netgame/net_game_bits.h"
+
+#define REPLICA_RATE 20
+#define REPLICA_MAX_PACKET 1400
+#define REPLICA_MAX_FIELDS 32
+#define REPLICA_MAX_NAME 16
+#define REPLICA_ACK_WINDOW 64
+
+enum ReplicaFieldType {
+	REPLICA_BOOL, REPLICA_INT, REPLICA_FLOAT, REPLICA_VECTOR3
+};
+
+struct ReplicaField {
+	String name;
+	int type;
+	int bits; // 0 means full precision for floats
+	float min;
+	float max;
+};
+
+/**
+ * Per connection replication state (owned by the network thread).
+ * Remembers which state version every update packet carried, so an ack
+ * tells which changes the client is guaranteed to have.
+ */
+struct NetGameReplicaPeer {
+	uint32_t acked;
+	uint16_t seq;
+	uint16_t sent_seq[REPLICA_ACK_WINDOW];
+	uint32_t sent_version[REPLICA_ACK_WINDOW];
+
+	NetGameReplicaPeer();
+};
+
+/**
+ * Server side replicated objects registry.
+ * Every field change is stamped with a version, update packets carry
+ * the fields newer than what the client acked, so lost packets are
+ * simply covered by the next update.
+ */
+class NetGameReplicaServer {
+
+	struct ReplicaObject {
+		Vector<ReplicaField> fields;
+		Vector<Variant> values;
+		Vector<uint32_t> versions;
+		uint32_t created;
+	};
+
+	struct Tombstone {
+		uint16_t oid;
+		uint32_t version;
+	};
+
+	Mutex *mutex;
+	Map<uint16_t, ReplicaObject> objects;
+	Vector<Tombstone> tombstones;
+	uint32_t version;
+
+public:
+	Error create(int oid, const Array &fields);
+	Error remove(int oid);
+	Error set(int oid, const String &field, const Variant &value);
+	Variant get(int oid, const String &field);
+	void clear();
+
+	bool build_update(NetGameReplicaPeer &peer, DVector<uint8_t> &out);
+	void ack(NetGameReplicaPeer &peer, uint16_t seq);
+	void collect(uint32_t min_acked);
+	uint32_t get_version() const;
+
+	NetGameReplicaServer();
+	~NetGameReplicaServer();
+};
+
+/**
+ * Client side replicated objects store, filled by the network thread
+ * and read by scripts.
+ */
+class NetGameReplicaClient {
+
+	struct ReplicaObject {
+		Vector<ReplicaField> fields;
+		Vector<Variant> values;
+	};
+
+	struct Entry {
+		uint16_t oid;
+		int kind;
+		Vector<ReplicaField> fields;
+		Vector<Variant> values;
+		Vector<bool> dirty;
+	};
+
+	Mutex *mutex;
+	Map<uint16_t, ReplicaObject> objects;
+	uint16_t last_seq;
+	bool has_seq;
+
+public:
+	Error apply(const DVector<uint8_t> &pkt, uint16_t &r_seq);
+	bool has(int oid);
+	Variant get(int oid, const String &field);
+	Dictionary get_fields(int oid);
+	Array get_ids();
+	void clear();
+
+	NetGameReplicaClient();
+	~NetGameReplicaClient();
+};
+
+#endif
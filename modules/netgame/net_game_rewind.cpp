@@ -0,0 +1,268 @@
+#include "modules/netgame/net_game_rewind.h"
+
+/*
+ * Double the slots, every frame keeps its positions
+ */
+void NetGameRewind::_grow() {
+	int cap = capacity * 2;
+	int f, i;
+	Vector<real_t> nx, ny, nz;
+	Vector<uint8_t> np;
+
+	nx.resize(REWIND_FRAMES * cap);
+	ny.resize(REWIND_FRAMES * cap);
+	nz.resize(REWIND_FRAMES * cap);
+	np.resize(REWIND_FRAMES * cap);
+	memset(np.ptr(), 0, REWIND_FRAMES * cap);
+	for(f = 0; f < REWIND_FRAMES; f++) {
+		memcpy(nx.ptr() + f * cap, px.ptr() + f * capacity,
+				capacity * sizeof(real_t));
+		memcpy(ny.ptr() + f * cap, py.ptr() + f * capacity,
+				capacity * sizeof(real_t));
+		memcpy(nz.ptr() + f * cap, pz.ptr() + f * capacity,
+				capacity * sizeof(real_t));
+		memcpy(np.ptr() + f * cap, present.ptr() + f * capacity, capacity);
+	}
+	px = nx;
+	py = ny;
+	pz = nz;
+	present = np;
+
+	current.resize(cap);
+	radius.resize(cap);
+	ids.resize(cap);
+	// Lowest slots first
+	for(i = cap - 1; i >= capacity; i--) {
+		ids[i] = -1;
+		free_slots.push_back(i);
+	}
+	capacity = cap;
+}
+
+/*
+ * Frames around time: returns the older one (-1 when empty), r_b the
+ * newer one and r_w the weight of r_b. Clamped to the captured range.
+ */
+int NetGameRewind::_frames_at(uint64_t time, int &r_b, real_t &r_w) const {
+	int k;
+
+	if(frames == 0) {
+		return -1;
+	}
+	for(k = 0; k < frames; k++) {
+		int a = (head - 1 - k + REWIND_FRAMES) % REWIND_FRAMES;
+		if(times[a] > time) {
+			continue;
+		}
+		r_b = k == 0 ? a : (a + 1) % REWIND_FRAMES;
+		r_w = r_b == a ? 0 :
+			(real_t)(time - times[a]) / (real_t)(times[r_b] - times[a]);
+		return a;
+	}
+	// Older than the history, use the oldest frame
+	r_b = (head - frames + REWIND_FRAMES) % REWIND_FRAMES;
+	r_w = 0;
+	return r_b;
+}
+
+bool NetGameRewind::_position(int slot, int a, int b, real_t w,
+				Vector3 &r_pos) const {
+	int ia = a * capacity + slot;
+	int ib = b * capacity + slot;
+	bool has_a = present[ia] != 0;
+	bool has_b = present[ib] != 0;
+
+	if(has_a && has_b) {
+		r_pos.x = px[ia] + (px[ib] - px[ia]) * w;
+		r_pos.y = py[ia] + (py[ib] - py[ia]) * w;
+		r_pos.z = pz[ia] + (pz[ib] - pz[ia]) * w;
+	}
+	else if(has_a || has_b) {
+		// Spawned or removed between the two frames
+		int i = has_a ? ia : ib;
+		r_pos = Vector3(px[i], py[i], pz[i]);
+	}
+	return has_a || has_b;
+}
+
+Error NetGameRewind::add(int eid, real_t p_radius) {
+	ERR_FAIL_COND_V(p_radius <= 0, ERR_INVALID_PARAMETER);
+	if(slots.has(eid)) {
+		return ERR_ALREADY_EXISTS;
+	}
+	if(free_slots.size() == 0) {
+		_grow();
+	}
+
+	int slot = free_slots[free_slots.size() - 1];
+	free_slots.resize(free_slots.size() - 1);
+	slots.set(eid, slot);
+	ids[slot] = eid;
+	radius[slot] = p_radius;
+	current[slot] = Vector3();
+	return OK;
+}
+
+/*
+ * The slot is forgotten in every frame, a new entity may take it
+ */
+void NetGameRewind::remove(int eid) {
+	const int *slot = slots.getptr(eid);
+	int f;
+
+	if(slot == NULL) {
+		return;
+	}
+	int s = *slot;
+	uint8_t *p = present.ptr();
+	for(f = 0; f < REWIND_FRAMES; f++) {
+		p[f * capacity + s] = 0;
+	}
+	ids[s] = -1;
+	free_slots.push_back(s);
+	slots.erase(eid);
+}
+
+Error NetGameRewind::set_position(int eid, const Vector3 &pos) {
+	const int *slot = slots.getptr(eid);
+
+	if(slot == NULL) {
+		return ERR_DOES_NOT_EXIST;
+	}
+	current[*slot] = pos;
+	return OK;
+}
+
+/*
+ * Store the current position of every entity, once per physics step
+ */
+void NetGameRewind::capture(uint64_t time) {
+	int base = head * capacity;
+	real_t *x = px.ptr() + base;
+	real_t *y = py.ptr() + base;
+	real_t *z = pz.ptr() + base;
+	uint8_t *p = present.ptr() + base;
+	const Vector3 *c = current.ptr();
+	const int *id = ids.ptr();
+	int i;
+
+	for(i = 0; i < capacity; i++) {
+		x[i] = c[i].x;
+		y[i] = c[i].y;
+		z[i] = c[i].z;
+		p[i] = id[i] >= 0;
+	}
+	times[head] = time;
+	head = (head + 1) % REWIND_FRAMES;
+	frames = MIN(frames + 1, REWIND_FRAMES);
+}
+
+bool NetGameRewind::get_position(int eid, uint64_t time, Vector3 &r_pos) const {
+	const int *slot = slots.getptr(eid);
+	int b;
+	real_t w;
+
+	if(slot == NULL) {
+		return false;
+	}
+	int a = _frames_at(time, b, w);
+	if(a < 0) {
+		return false;
+	}
+	return _position(*slot, a, b, w, r_pos);
+}
+
+/*
+ * First entity hit by the segment from-to at time, -1 if none
+ */
+int NetGameRewind::raycast(uint64_t time, const Vector3 &from,
+				const Vector3 &to, Vector3 &r_point) const {
+	Vector3 d = to - from;
+	real_t dd = d.dot(d);
+	real_t best = 2;
+	int hit = -1;
+	int b, i;
+	real_t w;
+
+	int a = _frames_at(time, b, w);
+	if(a < 0 || dd <= 0) {
+		return -1;
+	}
+	for(i = 0; i < capacity; i++) {
+		Vector3 pos;
+		if(ids[i] < 0 || !_position(i, a, b, w, pos)) {
+			continue;
+		}
+		// |from + t * d - pos| = radius
+		Vector3 f = from - pos;
+		real_t bf = f.dot(d);
+		real_t c = f.dot(f) - radius[i] * radius[i];
+		real_t t;
+		if(c <= 0) {
+			// Starts inside
+			t = 0;
+		}
+		else {
+			real_t disc = bf * bf - dd * c;
+			if(disc < 0 || bf > 0) {
+				continue;
+			}
+			t = (-bf - Math::sqrt(disc)) / dd;
+		}
+		if(t <= 1 && t < best) {
+			best = t;
+			hit = ids[i];
+		}
+	}
+	if(hit >= 0) {
+		r_point = from + d * best;
+	}
+	return hit;
+}
+
+void NetGameRewind::query_sphere(uint64_t time, const Vector3 &center,
+				real_t p_radius, Vector<int> &r_ids) const {
+	int b, i;
+	real_t w;
+
+	int a = _frames_at(time, b, w);
+	if(a < 0) {
+		return;
+	}
+	for(i = 0; i < capacity; i++) {
+		Vector3 pos;
+		if(ids[i] < 0 || !_position(i, a, b, w, pos)) {
+			continue;
+		}
+		real_t r = p_radius + radius[i];
+		if(center.distance_squared_to(pos) <= r * r) {
+			r_ids.push_back(ids[i]);
+		}
+	}
+}
+
+void NetGameRewind::clear() {
+	int i;
+
+	px.resize(REWIND_FRAMES * REWIND_SLOTS);
+	py.resize(REWIND_FRAMES * REWIND_SLOTS);
+	pz.resize(REWIND_FRAMES * REWIND_SLOTS);
+	present.resize(REWIND_FRAMES * REWIND_SLOTS);
+	memset(present.ptr(), 0, REWIND_FRAMES * REWIND_SLOTS);
+	current.resize(REWIND_SLOTS);
+	radius.resize(REWIND_SLOTS);
+	ids.resize(REWIND_SLOTS);
+	free_slots.clear();
+	for(i = REWIND_SLOTS - 1; i >= 0; i--) {
+		ids[i] = -1;
+		free_slots.push_back(i);
+	}
+	capacity = REWIND_SLOTS;
+	slots.clear();
+	head = 0;
+	frames = 0;
+}
+
+NetGameRewind::NetGameRewind() {
+	clear();
+}
@@ -0,0 +1,61 @@
+#ifndef NET_GAME_REWIND_H
+#define NET_GAME_REWIND_H
+
+#include "vector.h"
+#include "hash_map.h"
+#include "math/vector3.h"
+#include "modules/netgame/net_game_server_data.h"
+
+// Captured frames, about one second at 60 Hz
+#define REWIND_FRAMES 64
+#define REWIND_SLOTS 64
+#define REWIND_INTERP_DELAY 100
+
+/**
+ * Lag compensation history. Tracked entities are spheres, each capture
+ * stores the position of every entity in the frame ring.
+ * Positions are kept as structure of arrays, frame after frame, so a
+ * query reads two contiguous runs of floats whatever the entity count.
+ * Queries interpolate between the two frames around the requested time.
+ * Not thread safe, capture and query from the same thread.
+ */
+class NetGameRewind {
+
+	// [frame][slot]
+	Vector<real_t> px;
+	Vector<real_t> py;
+	Vector<real_t> pz;
+	Vector<uint8_t> present;
+	uint64_t times[REWIND_FRAMES];
+	int head;
+	int frames;
+
+	// By slot
+	Vector<Vector3> current;
+	Vector<real_t> radius;
+	Vector<int> ids;
+	Vector<int> free_slots;
+	int capacity;
+	HashMap<int, int> slots;
+
+	void _grow();
+	int _frames_at(uint64_t time, int &r_b, real_t &r_w) const;
+	bool _position(int slot, int a, int b, real_t w, Vector3 &r_pos) const;
+
+public:
+	Error add(int eid, real_t p_radius);
+	void remove(int eid);
+	Error set_position(int eid, const Vector3 &pos);
+	void capture(uint64_t time);
+
+	bool get_position(int eid, uint64_t time, Vector3 &r_pos) const;
+	int raycast(uint64_t time, const Vector3 &from, const Vector3 &to,
+			Vector3 &r_point) const;
+	void query_sphere(uint64_t time, const Vector3 &center, real_t p_radius,
+			Vector<int> &r_ids) const;
+	void clear();
+
+	NetGameRewind();
+};
+
+#endif
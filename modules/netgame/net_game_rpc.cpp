@@ -0,0 +1,234 @@
+#include "modules/netgame/net_game_rpc.h"
+#include "io/marshalls.h"
+
+int NetGameCall::get_peer() const {
+	return peer;
+}
+
+int NetGameCall::get_method() const {
+	return method;
+}
+
+bool NetGameCall::is_done() const {
+	return done;
+}
+
+Variant NetGameCall::get_result() const {
+	return result;
+}
+
+Error NetGameCall::get_error() const {
+	return error;
+}
+
+void NetGameCall::_bind_methods() {
+	ObjectTypeDB::bind_method(_MD("get_peer"),&NetGameCall::get_peer);
+	ObjectTypeDB::bind_method(_MD("get_method"),&NetGameCall::get_method);
+	ObjectTypeDB::bind_method(_MD("is_done"),&NetGameCall::is_done);
+	ObjectTypeDB::bind_method(_MD("get_result"),&NetGameCall::get_result);
+	ObjectTypeDB::bind_method(_MD("get_error:Error"),&NetGameCall::get_error);
+	ADD_SIGNAL(MethodInfo("completed", PropertyInfo(Variant::NIL, "result")));
+}
+
+NetGameCall::NetGameCall() {
+	key = 0;
+	deadline = 0;
+	peer = 0;
+	method = 0;
+	error = OK;
+	done = false;
+}
+
+/*
+ * Called with the lock held, the call is emitted on the next dispatch
+ */
+void NetGameRPC::_finish(const Ref<NetGameCall> &call, Error err) {
+	call->error = err;
+	call->done = true;
+	ready.push_back(call);
+}
+
+/*
+ * New call to a peer, r_pkt gets its [rid][method][args] body.
+ * When the call can not be sent it is already failed (and r_pkt empty),
+ * the caller still gets "completed".
+ */
+Ref<NetGameCall> NetGameRPC::begin(int peer, int method, const Variant &args,
+				uint64_t time, DVector<uint8_t> &r_pkt) {
+	Ref<NetGameCall> call = memnew(NetGameCall);
+	int len;
+
+	call->peer = peer;
+	call->method = method;
+	r_pkt.resize(0);
+
+	mutex->lock();
+	if(method < 0 || method > 0xFFFF ||
+			encode_variant(args, NULL, len) != OK) {
+		_finish(call, ERR_INVALID_PARAMETER);
+		mutex->unlock();
+		return call;
+	}
+	if(pending.size() >= RPC_MAX_PENDING) {
+		_finish(call, ERR_OUT_OF_MEMORY);
+		mutex->unlock();
+		return call;
+	}
+
+	uint32_t rid = next_id++;
+	call->key = ((uint64_t)peer << 32) | rid;
+	call->deadline = time + timeout;
+	pending.insert(call->key, call);
+	order.push_back(call);
+	mutex->unlock();
+
+	r_pkt.resize(RPC_CALL_HEADER + len);
+	{
+		DVector<uint8_t>::Write w = r_pkt.write();
+		encode_uint32(rid, w.ptr());
+		w[4] = method & 0xFF;
+		w[5] = method >> 8;
+		encode_variant(args, w.ptr() + RPC_CALL_HEADER, len);
+	}
+	return call;
+}
+
+/*
+ * The body could not be queued
+ */
+void NetGameRPC::fail(const Ref<NetGameCall> &call, Error err) {
+	mutex->lock();
+	if(!call->done) {
+		pending.erase(call->key);
+		_finish(call, err);
+	}
+	mutex->unlock();
+}
+
+/*
+ * Result body from a peer: [rid][result]
+ */
+void NetGameRPC::complete(int peer, const DVector<uint8_t> &pkt) {
+	Variant result;
+
+	if(pkt.size() < RPC_RESULT_HEADER) {
+		return;
+	}
+	DVector<uint8_t>::Read r = pkt.read();
+	uint64_t key = ((uint64_t)peer << 32) | decode_uint32(r.ptr());
+	if(decode_variant(result, r.ptr() + RPC_RESULT_HEADER,
+				pkt.size() - RPC_RESULT_HEADER) != OK) {
+		return;
+	}
+
+	mutex->lock();
+	Map<uint64_t, Ref<NetGameCall> >::Element *E = pending.find(key);
+	if(E != NULL) {
+		Ref<NetGameCall> call = E->get();
+		pending.erase(E);
+		call->result = result;
+		_finish(call, OK);
+	}
+	mutex->unlock();
+}
+
+void NetGameRPC::cancel_peer(int peer) {
+	mutex->lock();
+	Map<uint64_t, Ref<NetGameCall> >::Element *E = pending.front();
+	while(E != NULL) {
+		Map<uint64_t, Ref<NetGameCall> >::Element *next = E->next();
+		if(E->get()->peer == peer) {
+			_finish(E->get(), ERR_CONNECTION_ERROR);
+			pending.erase(E);
+		}
+		E = next;
+	}
+	mutex->unlock();
+}
+
+/*
+ * Fail every pending call (the core stopped or closed)
+ */
+void NetGameRPC::clear() {
+	mutex->lock();
+	Map<uint64_t, Ref<NetGameCall> >::Element *E = pending.front();
+	for(; E != NULL; E = E->next()) {
+		_finish(E->get(), ERR_CONNECTION_ERROR);
+	}
+	pending.clear();
+	mutex->unlock();
+}
+
+/*
+ * Time out the expired calls and emit "completed" for every finished
+ * one, returns how many
+ */
+int NetGameRPC::dispatch(uint64_t time) {
+	Vector<Ref<NetGameCall> > out;
+	int i;
+
+	mutex->lock();
+	while(order.size() > 0) {
+		Ref<NetGameCall> call = order.front()->get();
+		if(!call->done && call->deadline > time) {
+			break;
+		}
+		order.pop_front();
+		if(!call->done) {
+			pending.erase(call->key);
+			_finish(call, ERR_TIMEOUT);
+		}
+	}
+	out = ready;
+	ready.clear();
+	mutex->unlock();
+
+	for(i = 0; i < out.size(); i++) {
+		out[i]->emit_signal("completed", out[i]->result);
+	}
+	return out.size();
+}
+
+Error NetGameRPC::parse_call(const DVector<uint8_t> &pkt, uint32_t &r_rid,
+				int &r_method, Variant &r_args) {
+	if(pkt.size() < RPC_CALL_HEADER) {
+		return ERR_INVALID_DATA;
+	}
+	DVector<uint8_t>::Read r = pkt.read();
+	r_rid = decode_uint32(r.ptr());
+	r_method = r[4] | (r[5] << 8);
+	return decode_variant(r_args, r.ptr() + RPC_CALL_HEADER,
+				pkt.size() - RPC_CALL_HEADER);
+}
+
+Error NetGameRPC::build_result(uint32_t rid, const Variant &result,
+				DVector<uint8_t> &r_pkt) {
+	int len;
+	Error err = encode_variant(result, NULL, len);
+	if(err != OK) {
+		return err;
+	}
+
+	r_pkt.resize(RPC_RESULT_HEADER + len);
+	DVector<uint8_t>::Write w = r_pkt.write();
+	encode_uint32(rid, w.ptr());
+	return encode_variant(result, w.ptr() + RPC_RESULT_HEADER, len);
+}
+
+void NetGameRPC::set_timeout(int p_timeout) {
+	timeout = p_timeout;
+}
+
+int NetGameRPC::get_timeout() const {
+	return timeout;
+}
+
+NetGameRPC::NetGameRPC() {
+	mutex = Mutex::create();
+	next_id = 1;
+	timeout = RPC_TIMEOUT;
+}
+
+NetGameRPC::~NetGameRPC() {
+	memdelete(mutex);
+}
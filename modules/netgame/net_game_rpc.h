@@ -0,0 +1,89 @@
+#ifndef NET_GAME_RPC_H
+#define NET_GAME_RPC_H
+
+#include "reference.h"
+#include "os/mutex.h"
+#include "map.h"
+#include "list.h"
+#include "modules/netgame/net_game_server_data.h"
+
+#define RPC_TIMEOUT 10000
+#define RPC_MAX_PENDING 1024
+// [rid 4][method 2][args]
+#define RPC_CALL_HEADER 6
+// [rid 4][result]
+#define RPC_RESULT_HEADER 4
+
+/**
+ * Pending remote call, yield on "completed" to get the result:
+ *     var res = yield(client.rpc_call(CMD_INVENTORY, [slot]), "completed")
+ * get_error() is ERR_TIMEOUT, ERR_CONNECTION_ERROR (peer left) or
+ * ERR_OUT_OF_MEMORY (too many calls in flight) when the call failed.
+ */
+class NetGameCall: public Reference {
+	OBJ_TYPE( NetGameCall, Reference );
+
+	friend class NetGameRPC;
+
+	uint64_t key;
+	uint64_t deadline;
+	int peer;
+	int method;
+	Variant result;
+	Error error;
+	bool done;
+
+protected:
+	static void _bind_methods();
+
+public:
+	int get_peer() const;
+	int get_method() const;
+	bool is_done() const;
+	Variant get_result() const;
+	Error get_error() const;
+
+	NetGameCall();
+};
+
+/**
+ * Request ids and result correlation for one core.
+ * Calls are made from any thread, results arrive on the network thread
+ * and "completed" is emitted by dispatch(), from poll() or from the
+ * network thread in THREADED mode. Results for unknown or timed out
+ * calls are dropped.
+ */
+class NetGameRPC {
+
+	Mutex *mutex;
+	uint32_t next_id;
+	int timeout;
+	Map<uint64_t, Ref<NetGameCall> > pending;
+	// Creation order, the timeout is the same for every call
+	List<Ref<NetGameCall> > order;
+	Vector<Ref<NetGameCall> > ready;
+
+	void _finish(const Ref<NetGameCall> &call, Error err);
+
+public:
+	Ref<NetGameCall> begin(int peer, int method, const Variant &args,
+				uint64_t time, DVector<uint8_t> &r_pkt);
+	void fail(const Ref<NetGameCall> &call, Error err);
+	void complete(int peer, const DVector<uint8_t> &pkt);
+	void cancel_peer(int peer);
+	void clear();
+	int dispatch(uint64_t time);
+
+	static Error parse_call(const DVector<uint8_t> &pkt, uint32_t &r_rid,
+				int &r_method, Variant &r_args);
+	static Error build_result(uint32_t rid, const Variant &result,
+				DVector<uint8_t> &r_pkt);
+
+	void set_timeout(int p_timeout);
+	int get_timeout() const;
+
+	NetGameRPC();
+	~NetGameRPC();
+};
+
+#endif
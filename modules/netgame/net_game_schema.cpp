@@ -0,0 +1,329 @@
+
+#include "modules/netgame/net_game_schema.h"
+
+static bool _is_quantized(const MessageField &f) {
+	return f.bits > 0 && (f.type == MSG_FLOAT || f.type == MSG_VECTOR2 ||
+				f.type == MSG_VECTOR3);
+}
+
+static int _float_bits(const MessageField &f) {
+	return f.bits > 0 ? f.bits : 32;
+}
+
+static int _field_bits(const MessageField &f) {
+	switch(f.type) {
+		case MSG_BOOL: return 1;
+		case MSG_INT:
+		case MSG_UINT: return f.bits;
+		case MSG_FLOAT: return _float_bits(f);
+		case MSG_VECTOR2: return _float_bits(f) * 2;
+		case MSG_VECTOR3: return _float_bits(f) * 3;
+	}
+	return -1;
+}
+
+static void _write_float(NetGameBitWriter &w, const MessageField &f, float v) {
+	if(f.bits > 0) {
+		w.write_quantized(v, f.min, f.max, f.bits);
+	}
+	else {
+		w.write_float(v);
+	}
+}
+
+static float _read_float(NetGameBitReader &r, const MessageField &f) {
+	if(f.bits > 0) {
+		return r.read_quantized(f.min, f.max, f.bits);
+	}
+	return r.read_float();
+}
+
+Error NetGameSchema::register_message(int cmd, const Array &p_layout) {
+	int i;
+	NetGameMessageLayout layout;
+
+	// An empty body could not be told apart from a missing one
+	if(p_layout.size() == 0) {
+		ERR_EXPLAIN("Message layout without fields");
+		ERR_FAIL_V(ERR_INVALID_PARAMETER);
+	}
+	layout.fixed_bits = 0;
+	for(i = 0; i < p_layout.size(); i++) {
+		Dictionary d = p_layout[i];
+		MessageField f;
+		f.name = d.has("name") ? String(d["name"]) : String();
+		f.type = d.has("type") ? (int)d["type"] : MSG_INT;
+		f.min = d.has("min") ? (float)d["min"] : 0;
+		f.max = d.has("max") ? (float)d["max"] : 0;
+		switch(f.type) {
+			case MSG_INT:
+				f.bits = d.has("bits") ? (int)d["bits"] : 32;
+				break;
+			case MSG_UINT:
+				f.bits = d.has("bits") ? (int)d["bits"] : 31;
+				break;
+			case MSG_STRING:
+				f.bits = d.has("bits") ? (int)d["bits"] : 8;
+				break;
+			default:
+				f.bits = d.has("bits") ? (int)d["bits"] : 0;
+		}
+
+		if(f.name.empty()) {
+			ERR_EXPLAIN("Message field without name");
+			ERR_FAIL_V(ERR_INVALID_PARAMETER);
+		}
+		if(f.type < MSG_BOOL || f.type > MSG_STRING) {
+			ERR_EXPLAIN("Invalid message field type: " + f.name);
+			ERR_FAIL_V(ERR_INVALID_PARAMETER);
+		}
+		// Decoded into a signed int, a 32 bit uint would wrap
+		if((f.type == MSG_INT && (f.bits < 1 || f.bits > 32)) ||
+					(f.type == MSG_UINT && (f.bits < 1 || f.bits > 31))) {
+			ERR_EXPLAIN("Invalid message int bits: " + f.name);
+			ERR_FAIL_V(ERR_INVALID_PARAMETER);
+		}
+		if(f.type == MSG_STRING && (f.bits < 1 || f.bits > 16)) {
+			ERR_EXPLAIN("Invalid message string length bits: " + f.name);
+			ERR_FAIL_V(ERR_INVALID_PARAMETER);
+		}
+		if(_is_quantized(f) && (f.bits > 24 || !(f.max > f.min))) {
+			ERR_EXPLAIN("Invalid message quantization: " + f.name);
+			ERR_FAIL_V(ERR_INVALID_PARAMETER);
+		}
+		if(f.type == MSG_BOOL) {
+			f.bits = 0;
+		}
+
+		if(f.type == MSG_STRING) {
+			layout.fixed_bits = -1;
+		}
+		else if(layout.fixed_bits >= 0) {
+			layout.fixed_bits += _field_bits(f);
+		}
+		layout.fields.push_back(f);
+	}
+
+	mutex->lock();
+	layouts[cmd] = layout;
+	mutex->unlock();
+	return OK;
+}
+
+void NetGameSchema::unregister_message(int cmd) {
+	mutex->lock();
+	layouts.erase(cmd);
+	mutex->unlock();
+}
+
+bool NetGameSchema::has_message(int cmd) {
+	mutex->lock();
+	bool out = layouts.has(cmd);
+	mutex->unlock();
+	return out;
+}
+
+void NetGameSchema::clear() {
+	mutex->lock();
+	layouts.clear();
+	mutex->unlock();
+}
+
+/*
+ * Args can be a Dictionary (by field name) or an Array (by position)
+ */
+Error NetGameSchema::encode(int cmd, const Variant &args,
+				DVector<uint8_t> &out) {
+	int i, bits;
+	Vector<Variant> values;
+	Vector<CharString> strings;
+
+	mutex->lock();
+	Map<int, NetGameMessageLayout>::Element *E = layouts.find(cmd);
+	if(E == NULL) {
+		mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	const NetGameMessageLayout &layout = E->get();
+
+	// Gather values and compute the exact size
+	bits = 0;
+	for(i = 0; i < layout.fields.size(); i++) {
+		const MessageField &f = layout.fields[i];
+		Variant v;
+		if(args.get_type() == Variant::DICTIONARY) {
+			Dictionary d = args;
+			if(!d.has(f.name)) {
+				mutex->unlock();
+				ERR_EXPLAIN("Missing message field: " + f.name);
+				ERR_FAIL_V(ERR_INVALID_PARAMETER);
+			}
+			v = d[f.name];
+		}
+		else if(args.get_type() == Variant::ARRAY) {
+			Array a = args;
+			if(i >= a.size()) {
+				mutex->unlock();
+				ERR_EXPLAIN("Missing message field: " + f.name);
+				ERR_FAIL_V(ERR_INVALID_PARAMETER);
+			}
+			v = a[i];
+		}
+		else {
+			mutex->unlock();
+			ERR_FAIL_V(ERR_INVALID_PARAMETER);
+		}
+
+		if(f.type == MSG_STRING) {
+			CharString cs = String(v).utf8();
+			if(cs.length() >= (1 << f.bits)) {
+				mutex->unlock();
+				ERR_EXPLAIN("Message string too long: " + f.name);
+				ERR_FAIL_V(ERR_INVALID_PARAMETER);
+			}
+			strings.push_back(cs);
+			bits += f.bits + cs.length() * 8;
+		}
+		else {
+			bits += _field_bits(f);
+		}
+		values.push_back(v);
+	}
+
+	int size = (bits + 7) / 8;
+	out.resize(size);
+	DVector<uint8_t>::Write wr = out.write();
+	NetGameBitWriter w(wr.ptr(), size);
+	int s = 0;
+
+	for(i = 0; i < layout.fields.size(); i++) {
+		const MessageField &f = layout.fields[i];
+		const Variant &v = values[i];
+		switch(f.type) {
+			case MSG_BOOL:
+				w.write_bool(v);
+				break;
+			case MSG_INT:
+				w.write_int((int)v, f.bits);
+				break;
+			case MSG_UINT:
+				w.write_bits((uint32_t)(int64_t)v, f.bits);
+				break;
+			case MSG_FLOAT:
+				_write_float(w, f, v);
+				break;
+			case MSG_VECTOR2: {
+				Vector2 vec = v;
+				_write_float(w, f, vec.x);
+				_write_float(w, f, vec.y);
+				break;
+			}
+			case MSG_VECTOR3: {
+				Vector3 vec = v;
+				_write_float(w, f, vec.x);
+				_write_float(w, f, vec.y);
+				_write_float(w, f, vec.z);
+				break;
+			}
+			case MSG_STRING: {
+				const CharString &cs = strings[s++];
+				w.write_bits(cs.length(), f.bits);
+				w.write_bytes((const uint8_t *)cs.get_data(),
+						cs.length());
+				break;
+			}
+		}
+	}
+	// Clear padding bits
+	w.write_bits(0, size * 8 - w.get_pos());
+	mutex->unlock();
+	return OK;
+}
+
+/*
+ * Decode and validate a payload, the whole packet must be consumed
+ */
+Error NetGameSchema::decode(int cmd, const DVector<uint8_t> &pkt,
+				Dictionary &out) {
+	int i;
+
+	mutex->lock();
+	Map<int, NetGameMessageLayout>::Element *E = layouts.find(cmd);
+	if(E == NULL) {
+		mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	const NetGameMessageLayout &layout = E->get();
+
+	if(layout.fixed_bits >= 0 && pkt.size() != (layout.fixed_bits + 7) / 8) {
+		mutex->unlock();
+		return ERR_INVALID_DATA;
+	}
+
+	DVector<uint8_t>::Read rd = pkt.read();
+	NetGameBitReader r(rd.ptr(), pkt.size());
+
+	for(i = 0; i < layout.fields.size() && !r.has_error(); i++) {
+		const MessageField &f = layout.fields[i];
+		switch(f.type) {
+			case MSG_BOOL:
+				out[f.name] = r.read_bool();
+				break;
+			case MSG_INT:
+				out[f.name] = r.read_int(f.bits);
+				break;
+			case MSG_UINT:
+				out[f.name] = (int64_t)r.read_bits(f.bits);
+				break;
+			case MSG_FLOAT:
+				out[f.name] = _read_float(r, f);
+				break;
+			case MSG_VECTOR2: {
+				float x = _read_float(r, f);
+				float y = _read_float(r, f);
+				out[f.name] = Vector2(x, y);
+				break;
+			}
+			case MSG_VECTOR3: {
+				float x = _read_float(r, f);
+				float y = _read_float(r, f);
+				float z = _read_float(r, f);
+				out[f.name] = Vector3(x, y, z);
+				break;
+			}
+			case MSG_STRING: {
+				int len = r.read_bits(f.bits);
+				if(r.get_remaining() < len * 8) {
+					mutex->unlock();
+					return ERR_INVALID_DATA;
+				}
+				Vector<uint8_t> buf;
+				buf.resize(len + 1);
+				r.read_bytes(buf.ptr(), len);
+				buf[len] = 0;
+				String str;
+				if(str.parse_utf8((const char *)buf.ptr(), len)) {
+					mutex->unlock();
+					return ERR_INVALID_DATA;
+				}
+				out[f.name] = str;
+				break;
+			}
+		}
+	}
+	mutex->unlock();
+
+	// Truncated or trailing data
+	if(r.has_error() || r.get_remaining() >= 8) {
+		return ERR_INVALID_DATA;
+	}
+	return OK;
+}
+
+NetGameSchema::NetGameSchema() {
+	mutex = Mutex::create();
+}
+
+NetGameSchema::~NetGameSchema() {
+	memdelete(mutex);
+}
@@ -0,0 +1,161 @@
+#ifndef NET_GAME_SCHEMA_H
+#define NET_GAME_SCHEMA_H
+
+#include "map.h"
+#include "variant.h"
+#include "os/mutex.h"
+#include "math/vector3.h"
+#include "math/math_2d.h"
+#include "modules/netgame/net_game_bits.h"
+
+enum MessageFieldType {
+	MSG_BOOL, MSG_INT, MSG_UINT, MSG_FLOAT,
+	MSG_VECTOR2, MSG_VECTOR3, MSG_STRING
+};
+
+struct MessageField {
+	String name;
+	int type;
+	int bits; // int width, float quantization or string length width
+	float min;
+	float max;
+};
+
+/**
+ * Message layout for a command.
+ * Fixed layouts (no strings) have a known size so invalid packets are
+ * rejected by a single length comparison.
+ */
+struct NetGameMessageLayout {
+	Vector<MessageField> fields;
+	int fixed_bits; // -1 when the size depends on the content
+};
+
+/**
+ * Per command message layouts.
+ * Encodes Dictionary/Array arguments to bit packed payloads and decodes
+ * (validating) received payloads before they reach scripts.
+ */
+class NetGameSchema {
+
+	Mutex *mutex;
+	Map<int, NetGameMessageLayout> layouts;
+
+public:
+	Error register_message(int cmd, const Array &layout);
+	void unregister_message(int cmd);
+	bool has_message(int cmd);
+	void clear();
+
+	Error encode(int cmd, const Variant &args, DVector<uint8_t> &out);
+	Error decode(int cmd, const DVector<uint8_t> &pkt, Dictionary &out);
+
+	NetGameSchema();
+	~NetGameSchema();
+};
+
+/**
+ * Compile time message layouts for native code.
+ * e.g. NetGameFixedMessage<uint16_t, NetGameQVector3<16, 1024>, float>
+ * has a constant SIZE, and encode/decode are fully inlined.
+ */
+struct NetGameNone {};
+
+template<int BITS, int RANGE>
+struct NetGameQVector3 {
+	Vector3 v;
+};
+
+template<class T> struct NetGameCodec;
+
+#define NG_INT_CODEC(m_type, m_bits) \
+template<> struct NetGameCodec<m_type> { \
+	enum { BITS = m_bits }; \
+	static _FORCE_INLINE_ void write(NetGameBitWriter &w, m_type v) { w.write_bits((uint32_t)v, m_bits); } \
+	static _FORCE_INLINE_ void read(NetGameBitReader &r, m_type &v) { v = (m_type)r.read_bits(m_bits); } \
+};
+
+NG_INT_CODEC(uint8_t, 8)
+NG_INT_CODEC(int8_t, 8)
+NG_INT_CODEC(uint16_t, 16)
+NG_INT_CODEC(int16_t, 16)
+NG_INT_CODEC(uint32_t, 32)
+NG_INT_CODEC(int32_t, 32)
+
+#undef NG_INT_CODEC
+
+template<> struct NetGameCodec<bool> {
+	enum { BITS = 1 };
+	static _FORCE_INLINE_ void write(NetGameBitWriter &w, bool v) { w.write_bool(v); }
+	static _FORCE_INLINE_ void read(NetGameBitReader &r, bool &v) { v = r.read_bool(); }
+};
+
+template<> struct NetGameCodec<float> {
+	enum { BITS = 32 };
+	static _FORCE_INLINE_ void write(NetGameBitWriter &w, float v) { w.write_float(v); }
+	static _FORCE_INLINE_ void read(NetGameBitReader &r, float &v) { v = r.read_float(); }
+};
+
+template<> struct NetGameCodec<NetGameNone> {
+	enum { BITS = 0 };
+	static _FORCE_INLINE_ void write(NetGameBitWriter &w, const NetGameNone &v) {}
+	static _FORCE_INLINE_ void read(NetGameBitReader &r, NetGameNone &v) {}
+};
+
+template<int B, int R> struct NetGameCodec<NetGameQVector3<B, R> > {
+	enum { BITS = B * 3 };
+	static _FORCE_INLINE_ void write(NetGameBitWriter &w, const NetGameQVector3<B, R> &v) {
+		w.write_quantized(v.v.x, -R, R, B);
+		w.write_quantized(v.v.y, -R, R, B);
+		w.write_quantized(v.v.z, -R, R, B);
+	}
+	static _FORCE_INLINE_ void read(NetGameBitReader &r, NetGameQVector3<B, R> &v) {
+		v.v.x = r.read_quantized(-R, R, B);
+		v.v.y = r.read_quantized(-R, R, B);
+		v.v.z = r.read_quantized(-R, R, B);
+	}
+};
+
+template<class A, class B=NetGameNone, class C=NetGameNone,
+	class D=NetGameNone, class E=NetGameNone, class F=NetGameNone>
+struct NetGameFixedMessage {
+	enum {
+		BITS = NetGameCodec<A>::BITS + NetGameCodec<B>::BITS +
+			NetGameCodec<C>::BITS + NetGameCodec<D>::BITS +
+			NetGameCodec<E>::BITS + NetGameCodec<F>::BITS,
+		SIZE = (BITS + 7) / 8
+	};
+
+	A a; B b; C c; D d; E e; F f;
+
+	void encode(DVector<uint8_t> &out) const {
+		out.resize(SIZE);
+		DVector<uint8_t>::Write wr = out.write();
+		NetGameBitWriter w(wr.ptr(), SIZE);
+		NetGameCodec<A>::write(w, a);
+		NetGameCodec<B>::write(w, b);
+		NetGameCodec<C>::write(w, c);
+		NetGameCodec<D>::write(w, d);
+		NetGameCodec<E>::write(w, e);
+		NetGameCodec<F>::write(w, f);
+		// Clear padding bits
+		w.write_bits(0, SIZE * 8 - BITS);
+	}
+
+	bool decode(const DVector<uint8_t> &pkt) {
+		if(pkt.size() != SIZE) {
+			return false;
+		}
+		DVector<uint8_t>::Read rd = pkt.read();
+		NetGameBitReader r(rd.ptr(), SIZE);
+		NetGameCodec<A>::read(r, a);
+		NetGameCodec<B>::read(r, b);
+		NetGameCodec<C>::read(r, c);
+		NetGameCodec<D>::read(r, d);
+		NetGameCodec<E>::read(r, e);
+		NetGameCodec<F>::read(r, f);
+		return true;
+	}
+};
+
+#endif
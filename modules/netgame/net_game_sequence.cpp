@@ -0,0 +1,192 @@
+#include "modules/netgame/net_game_sequence.h"
+#include "io/marshalls.h"
+
+uint16_t NetGameSequence::next(uint16_t cmd) {
+	int index = tx.find(cmd);
+	if(index == -1) {
+		index = tx.insert(cmd, 0);
+	}
+	return tx.getv(index)++;
+}
+
+/*
+ * Half window ordering (int16 difference), newer sequences are accepted
+ * and the ones skipped are counted lost until they show up late
+ */
+SeqResult NetGameSequence::receive(uint16_t cmd, uint16_t seq) {
+	int index = rx.find(cmd);
+	if(index == -1) {
+		RxState s;
+		s.started = false;
+		s.received = 0;
+		s.lost = 0;
+		s.late = 0;
+		s.duplicate = 0;
+		index = rx.insert(cmd, s);
+	}
+
+	RxState &s = rx.getv(index);
+	if(!s.started) {
+		s.started = true;
+		s.last = seq;
+		s.mask = 0;
+		s.span = 0;
+		s.received++;
+		return SEQ_NEW;
+	}
+
+	int16_t d = seq - s.last;
+
+	if(d > 0) {
+		// Bit i of the mask is last - 1 - i
+		s.mask = d < SEQ_WINDOW ? (s.mask << d) | (1U << (d - 1)) :
+			(d == SEQ_WINDOW ? 1U << (d - 1) : 0);
+		s.span = MIN(s.span + d, SEQ_WINDOW);
+		s.lost += d - 1;
+		s.last = seq;
+		s.received++;
+		return SEQ_NEW;
+	}
+	if(d == 0) {
+		s.duplicate++;
+		return SEQ_DUPLICATE;
+	}
+
+	int back = -d - 1;
+	if(back < s.span) {
+		if(s.mask & (1U << back)) {
+			s.duplicate++;
+			return SEQ_DUPLICATE;
+		}
+		// Counted lost when it was skipped
+		s.mask |= 1U << back;
+		s.lost--;
+	}
+	s.late++;
+	return SEQ_LATE;
+}
+
+/*
+ * Counters of one command, or of all of them with cmd -1
+ */
+Dictionary NetGameSequence::get_stats(int cmd) const {
+	Dictionary d;
+	uint32_t received = 0, lost = 0, late = 0, duplicate = 0;
+	int i;
+
+	for(i = 0; i < rx.size(); i++) {
+		if(cmd != -1 && rx.getk(i) != cmd) {
+			continue;
+		}
+		const RxState &s = rx.getv(i);
+		received += s.received;
+		lost += s.lost;
+		late += s.late;
+		duplicate += s.duplicate;
+	}
+	d["received"] = received;
+	d["lost"] = lost;
+	d["late"] = late;
+	d["duplicate"] = duplicate;
+	return d;
+}
+
+/*
+ * The peer may restart its sequences (session moved to a new server),
+ * counters are kept
+ */
+void NetGameSequence::reset_rx() {
+	int i;
+	for(i = 0; i < rx.size(); i++) {
+		rx.getv(i).started = false;
+	}
+}
+
+void NetGameSequence::reset() {
+	tx.clear();
+	rx.clear();
+}
+
+/*
+ * Sequences of a session moving to another process (appended to out):
+ * [tx count 2] then [cmd 2][next 2], [rx count 2] then
+ * [cmd 2][last 2][mask 4][span], only for started commands
+ */
+void NetGameSequence::save_state(DVector<uint8_t> &out) const {
+	int i, count = 0;
+
+	for(i = 0; i < rx.size(); i++) {
+		count += rx.getv(i).started;
+	}
+	int pos = out.size();
+	out.resize(pos + 4 + tx.size() * 4 + count * 9);
+	DVector<uint8_t>::Write w = out.write();
+	uint8_t *p = w.ptr() + pos;
+
+	p[0] = tx.size() & 0xFF;
+	p[1] = tx.size() >> 8;
+	p += 2;
+	for(i = 0; i < tx.size(); i++) {
+		p[0] = tx.getk(i) & 0xFF;
+		p[1] = tx.getk(i) >> 8;
+		p[2] = tx.getv(i) & 0xFF;
+		p[3] = tx.getv(i) >> 8;
+		p += 4;
+	}
+	p[0] = count & 0xFF;
+	p[1] = count >> 8;
+	p += 2;
+	for(i = 0; i < rx.size(); i++) {
+		const RxState &s = rx.getv(i);
+		if(!s.started) {
+			continue;
+		}
+		p[0] = rx.getk(i) & 0xFF;
+		p[1] = rx.getk(i) >> 8;
+		p[2] = s.last & 0xFF;
+		p[3] = s.last >> 8;
+		encode_uint32(s.mask, p + 4);
+		p[8] = s.span;
+		p += 9;
+	}
+}
+
+/*
+ * Returns the bytes read, 0 if buf is invalid (nothing is loaded)
+ */
+int NetGameSequence::load_state(const uint8_t *buf, int len) {
+	int i, tx_count, rx_count;
+
+	if(len < 2) {
+		return 0;
+	}
+	tx_count = buf[0] | (buf[1] << 8);
+	if(len < 4 + tx_count * 4) {
+		return 0;
+	}
+	rx_count = buf[2 + tx_count * 4] | (buf[3 + tx_count * 4] << 8);
+	int size = 4 + tx_count * 4 + rx_count * 9;
+	if(len < size) {
+		return 0;
+	}
+
+	reset();
+	const uint8_t *p = buf + 2;
+	for(i = 0; i < tx_count; i++, p += 4) {
+		tx.insert(p[0] | (p[1] << 8), p[2] | (p[3] << 8));
+	}
+	p += 2;
+	for(i = 0; i < rx_count; i++, p += 9) {
+		RxState s;
+		s.started = true;
+		s.last = p[2] | (p[3] << 8);
+		s.mask = decode_uint32(p + 4);
+		s.span = MIN((int)p[8], SEQ_WINDOW);
+		s.received = 0;
+		s.lost = 0;
+		s.late = 0;
+		s.duplicate = 0;
+		rx.insert(p[0] | (p[1] << 8), s);
+	}
+	return size;
+}
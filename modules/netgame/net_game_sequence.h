@@ -0,0 +1,52 @@
+#ifndef NET_GAME_SEQUENCE_H
+#define NET_GAME_SEQUENCE_H
+
+#include "vmap.h"
+#include "variant.h"
+#include "dvector.h"
+#include "modules/netgame/net_game_server_data.h"
+
+#define SEQ_WINDOW 32
+
+enum SeqResult {
+	SEQ_NEW,
+	SEQ_LATE,
+	SEQ_DUPLICATE
+};
+
+/**
+ * 16 bit sequences of the timed UDP packets, one per command.
+ * Only a packet newer than the last one of its command is accepted.
+ * The last SEQ_WINDOW sequences are remembered to tell gaps (lost),
+ * packets arriving after a newer one (late) and duplicates apart.
+ * State only exists for the commands actually used.
+ */
+class NetGameSequence {
+
+	struct RxState {
+		bool started;
+		uint16_t last;
+		uint32_t mask;
+		int span;
+		uint32_t received;
+		uint32_t lost;
+		uint32_t late;
+		uint32_t duplicate;
+	};
+
+	VMap<uint16_t, uint16_t> tx;
+	VMap<uint16_t, RxState> rx;
+
+public:
+	uint16_t next(uint16_t cmd);
+	SeqResult receive(uint16_t cmd, uint16_t seq);
+	Dictionary get_stats(int cmd=-1) const;
+
+	void reset_rx();
+	void reset();
+
+	void save_state(DVector<uint8_t> &out) const;
+	int load_state(const uint8_t *buf, int len);
+};
+
+#endif
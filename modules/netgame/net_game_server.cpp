@@ -1,479 +1,582 @@
 
-#include <modules/netgame/net_game_server.h>
+#include "modules/netgame/net_game_server.h"
 
-void NetGameServer::set_signal_mode(SignalsMode p_mode) {
-	if(!quit)
-	{
-		_update_signal_mode();
-	}
-	signal_mode = p_mode;
-}
-
-void NetGameServer::_update_signal_mode()
-{
-	set_process(false);
-	set_fixed_process(false);
-	switch(signal_mode)
-	{
-		case PROCESS:
-			set_process(true);
-			break;
-		case FIXED:
-			set_fixed_process(true);
-			break;
-		case THREADED:
-			// noop
-			break;
-	}
-}
-
-SignalsMode NetGameServer::get_signal_mode() const{
-	return signal_mode;
+void NetGameServer::_update_signal_mode() {
+	set_process(core->get_signal_mode() == PROCESS);
+	set_fixed_process(core->get_signal_mode() == FIXED);
 }
 
 void NetGameServer::_notification(int p_what) {
 	if (
-		(p_what==NOTIFICATION_PROCESS && signal_mode == PROCESS) ||
-		(p_what==NOTIFICATION_FIXED_PROCESS && signal_mode == FIXED)) {
-		// Flush signals
-		while(signal_queue.size() > 0) {
-			// Only this thread removes from the queue
-			// it is safe to lock here
-			signal_mutex->lock();
-			QueuedSignal *qs = signal_queue.get(0);
-			signal_queue.remove(0);
-			signal_mutex->unlock();
-			if(qs->has_pkt) {
-				emit_signal(qs->signal, qs->id, qs->cmd, qs->packet);
-			}
-			else {
-				emit_signal(qs->signal, qs->id);
-			}
-			memdelete(qs);
-		}
+		(p_what==NOTIFICATION_PROCESS && core->get_signal_mode() == PROCESS) ||
+		(p_what==NOTIFICATION_FIXED_PROCESS && core->get_signal_mode() == FIXED)) {
+		core->poll();
 	}
 }
 
-void NetGameServer::_server_tick() {
-	if(quit) {
-		return;
-	}
-	// Accept new connections
-	_check_connections();
+Ref<NetGameServerCore> NetGameServer::get_core() const {
+	return core;
+}
 
-	// Handle incoming packets
-	_handle_udp();
+void NetGameServer::start(int tcp_port, int udp_port) {
+	core->start(tcp_port, udp_port);
+	_update_signal_mode();
+}
 
-	// Update clients (handle tcp packets)
-	_handle_tcp();
+void NetGameServer::start_udp_only(int udp_port) {
+	core->start_udp_only(udp_port);
+	_update_signal_mode();
+}
 
-	// Cleanup disconnected clients
-	_remove_stale_clients();
+bool NetGameServer::is_udp_only() const {
+	return core->is_udp_only();
+}
 
+void NetGameServer::stop(int reason) {
+	core->stop(reason);
 }
 
-/**
- * Main UDP/TCP server loop
- */
-void NetGameServer::_thread_start(void*s) {
-	NetGameServer *self = (NetGameServer*) s;
+Error NetGameServer::drain(int timeout_msec) {
+	return core->drain(timeout_msec);
+}
 
-	while (!self->quit) {
-		self->_server_tick();
-		OS::get_singleton()->delay_usec(SERVER_SLEEP_USEC);
-	}
+DVector<uint8_t> NetGameServer::export_sessions() {
+	return core->export_sessions();
+}
 
-	// Close all connections
-	self->_clear_clients();
+Error NetGameServer::import_sessions(const DVector<uint8_t> &data) {
+	return core->import_sessions(data);
 }
 
-void NetGameServer::_clear_queues() {
-	// Clear UDP queue
-	udp_mutex->lock();
-	while(udp_queue.size() > 0) {
-		QueuedPacket *qp = udp_queue.get(0);
-		udp_queue.remove(0);
-		memdelete(qp);
-	}
-	udp_mutex->unlock();
-
-	// Clear Signal queue
-	signal_mutex->lock();
-	while(signal_queue.size() > 0) {
-		QueuedSignal *qs = signal_queue.get(0);
-		signal_queue.remove(0);
-		memdelete(qs);
-	}
-	signal_mutex->unlock();
+void NetGameServer::set_signal_mode(SignalsMode p_mode) {
+	core->set_signal_mode(p_mode);
+	_update_signal_mode();
 }
 
-/***
- * Manage UDP packets
- */
-void NetGameServer::_handle_tcp() {
-	int i;
+SignalsMode NetGameServer::get_signal_mode() const {
+	return core->get_signal_mode();
+}
 
-	conn_mutex->lock();
-	for (i = 0; i < connections.size(); i++) {
-		NetGameServerConnection *cd = connections.getv(i);
-		cd->on_update();
-	}
-	conn_mutex->unlock();
-}
-
-/***
- * Manage UDP packets
- */
-void NetGameServer::_handle_udp() {
-	DVector<uint8_t> raw;
-	NetGameServerConnection *cd;
-
-	// Flush packets queue
-	while(udp_queue.size() > 0) {
-		// Only this thread removes from the queue
-		// it is safe to lock here
-		udp_mutex->lock();
-		QueuedPacket *qp = udp_queue.get(0);
-		udp_queue.remove(0);
-		udp_mutex->unlock();
-
-		NetGameServerConnection *cd = _get_client(qp->id);
-		if(cd != NULL) {
-			udp_server->set_send_address(cd->udp_host,
-							cd->udp_port);
-			udp_server->put_packet_buffer(cd->build_pkt(qp));
-		}
-		memdelete(qp);
-	}
+void NetGameServer::set_recorder(const Ref<NetGameRecorder> &p_recorder) {
+	core->set_recorder(p_recorder);
+}
 
-	// Handle incoming packets
-	if(udp_server->get_available_packet_count() > 0) {
-		udp_server->get_packet_buffer(raw);
+Ref<NetGameRecorder> NetGameServer::get_recorder() const {
+	return core->get_recorder();
+}
 
-		if(raw.size() < 1) {
-			WARN_PRINT("Invalid UDP Packet!");
-			return;
-		}
+void NetGameServer::set_reactor(const Ref<NetGameReactor> &p_reactor) {
+	core->set_reactor(p_reactor);
+}
 
-		cd = _get_client(raw.get(0));
-		if(cd == NULL) {
-			WARN_PRINT("Invalid UDP Auth!");
-			return;
-		}
+Ref<NetGameReactor> NetGameServer::get_reactor() const {
+	return core->get_reactor();
+}
 
-		cd->handle_udp(raw,
-				udp_server->get_packet_address(),
-				udp_server->get_packet_port());
-	}
+void NetGameServer::set_secure(bool p_secure) {
+	core->set_secure(p_secure);
 }
 
-/***
- * Free client and send disconnect signal
- */
-void NetGameServer::_delete_client(NetGameServerConnection *cd) {
-	if(!quit) {
-		_queue_signal(SIGNAL_CLIENT_DISCONNECT, cd->id);
-	}
-	memdelete(cd);
-}
-
-/**
- * Disconnect and remove dead clients
- */
-void NetGameServer::_remove_stale_clients() {
-	int i = 0;
-	int id = 0;
-
-	conn_mutex->lock();
-	for (i = 0; i < connections.size(); ++i) {
-		id = connections.get_array()[i].key;
-		NetGameServerConnection *cd = connections.getv(i);
-		if(!cd->is_connected()) {
-			connections.erase(id);
-			_delete_client(cd);
-			i--;
-		}
-	}
-	conn_mutex->unlock();
+bool NetGameServer::is_secure() const {
+	return core->is_secure();
 }
 
-/***
- * Remove all clients
- */
-void NetGameServer::_clear_clients() {
-	int i = 0;
+void NetGameServer::set_secure_key(const String &p_key) {
+	core->set_secure_key(p_key);
+}
 
-	conn_mutex->lock();
-	for (i = 0; i < connections.size(); ++i) {
-		_delete_client(connections.getv(i));
-	}
-	connections.empty();
-	conn_mutex->unlock();
+void NetGameServer::set_handshake_rate(int p_rate) {
+	core->set_handshake_rate(p_rate);
 }
 
-void NetGameServer::_check_connections() {
-	// Accept new connections
-	if (tcp_server->is_connection_available()) {
+int NetGameServer::get_handshake_rate() const {
+	return core->get_handshake_rate();
+}
 
-		conn_mutex->lock();
-		NetGameServerConnection *cd = memnew(
-			NetGameServerConnection(_get_id(), _get_secret(),
-				tcp_server->take_connection(), this));
-		connections.insert(cd->id, cd);
-		conn_mutex->unlock();
+void NetGameServer::set_resume_grace(int p_msec) {
+	core->set_resume_grace(p_msec);
+}
 
-		_queue_signal(SIGNAL_CLIENT_CONNECT, cd->id);
-	}
+int NetGameServer::get_resume_grace() const {
+	return core->get_resume_grace();
 }
 
-void NetGameServer::_queue_signal(const char *sig, CID id)
-{
-	if(signal_mode == THREADED) {
-		emit_signal(sig, id);
-	}
-	else {
-		if(signal_queue.size() >= SIG_QUEUE_SIZE * (connections.size()+1)) {
-			WARN_PRINT("SIGNAL QUEUE SIZE EXCEEDED");
-			return;
-		}
-		QueuedSignal *qs = (QueuedSignal *) memnew(QueuedSignal);
-		qs->id = id;
-		qs->signal = sig;
-		qs->cmd = -1;
-		qs->has_pkt = false;
-		signal_mutex->lock();
-		signal_queue.insert(signal_queue.size(), qs);
-		signal_mutex->unlock();
-	}
+Error NetGameServer::put_tcp_packet(int id, const DVector<uint8_t> &pkt, int cmd) {
+	return core->put_tcp_packet(id, pkt, cmd);
 }
 
-void NetGameServer::_queue_signal(const char *sig, CID id,
-				const DVector<uint8_t> &pkt, int cmd)
-{
-	if(signal_mode == THREADED) {
-		emit_signal(sig, id, cmd, pkt);
-	}
-	else {
-		QueuedSignal *qs = (QueuedSignal *) memnew(QueuedSignal);
-		qs->id = id;
-		qs->signal = sig;
-		qs->cmd = cmd;
-		qs->packet = pkt;
-		qs->has_pkt = true;
-		signal_mutex->lock();
-		signal_queue.insert(signal_queue.size(), qs);
-		signal_mutex->unlock();
-	}
+Error NetGameServer::broadcast_tcp(const DVector<uint8_t> &pkt, int cmd) {
+	return core->broadcast_tcp(pkt, cmd);
 }
 
-CID NetGameServer::_get_id() {
-	int i = 0;
-	CID last = 0;
-	CID curr = 0;
-	for (i = 0; i < connections.size(); ++i) {
-		curr = connections.get_array()[i].key;
-		if(curr > last+1) {
-			return last+1;
-		}
-		last = curr;
-	}
-	if(last == 255) return 0;
-	return last+1;
+Error NetGameServer::put_udp_packet(int id, const DVector<uint8_t> &pkt,
+			int cmd, bool timed) {
+	return core->put_udp_packet(id, pkt, cmd, timed);
 }
 
-CSE NetGameServer::_get_secret() {
-	return rand() % 256;
+Error NetGameServer::broadcast_udp(const DVector<uint8_t> &pkt,
+			int cmd, bool timed) {
+	return core->broadcast_udp(pkt, cmd, timed);
 }
 
-void NetGameServer::start(int tcp_port, int udp_port) {
-	stop();
-	_update_signal_mode();
-	tcp_server->listen(tcp_port);
-	udp_server->listen(udp_port);
-	quit = false;
-	thread = Thread::create(_thread_start, this);
-}
-
-void NetGameServer::stop() {
-	if (thread != NULL) {
-		quit = true;
-		Thread::wait_to_finish(thread);
-		memdelete(thread);
-		tcp_server->stop();
-		udp_server->close();
-		_clear_queues();
-	}
+Error NetGameServer::register_message(int cmd, const Array &layout) {
+	return core->register_message(cmd, layout);
+}
 
-	thread = NULL;
+void NetGameServer::unregister_message(int cmd) {
+	core->unregister_message(cmd);
 }
 
-NetGameServerConnection *NetGameServer::_get_client(int id) {
-	int index = connections.find(id);
-	if(index == -1) {
-		return NULL;
-	}
-	return connections.getv(index);
+Error NetGameServer::put_tcp_message(int id, int cmd, const Variant &args) {
+	return core->put_tcp_message(id, cmd, args);
 }
 
-Error NetGameServer::put_tcp_packet(int id, const DVector<uint8_t> &pkt, int cmd) {
-	Error out;
+Error NetGameServer::put_udp_message(int id, int cmd, const Variant &args,
+			bool timed) {
+	return core->put_udp_message(id, cmd, args, timed);
+}
 
-	conn_mutex->lock();
-	NetGameServerConnection *cd = _get_client(id);
-	if(cd == NULL) {
-		conn_mutex->unlock();
-		return ERR_DOES_NOT_EXIST;
-	}
-	out = cd->enqueue_tcp(pkt, cmd);
-	conn_mutex->unlock();
-	return out;
+Error NetGameServer::broadcast_udp_message(int cmd, const Variant &args,
+			bool timed) {
+	return core->broadcast_udp_message(cmd, args, timed);
 }
 
-Error NetGameServer::put_udp_packet(int id, const DVector<uint8_t> &pkt,
-					int cmd, bool timed) {
-	conn_mutex->lock();
-	NetGameServerConnection *cd = _get_client(id);
-	if(cd == NULL) {
-		conn_mutex->unlock();
-		return ERR_DOES_NOT_EXIST;
-	}
-	if(cd->state != READY) {
-		conn_mutex->unlock();
-		return ERR_CONNECTION_ERROR;
-	}
-	conn_mutex->unlock();
-	return _enqueue_udp(id, pkt, cmd, timed);
+Error NetGameServer::broadcast_udp_interest(const DVector<uint8_t> &pkt, int cmd,
+			const Vector3 &origin, real_t radius, bool timed) {
+	return core->broadcast_udp_interest(pkt, cmd, origin, radius, timed);
 }
 
-Error NetGameServer::broadcast_udp(const DVector<uint8_t> &pkt, int cmd,
-					bool timed) {
-	int i;
-	conn_mutex->lock();
-	for(i=0; i<connections.size(); i++) {
-		NetGameServerConnection *cd = connections.getv(i);
-		_enqueue_udp(cd->id, pkt, cmd, timed);
-	}
-	conn_mutex->unlock();
-	return OK;
+Error NetGameServer::multicast_to_group(const String &group,
+			const DVector<uint8_t> &pkt, int cmd, bool timed) {
+	return core->multicast_to_group(group, pkt, cmd, timed);
 }
 
-Error NetGameServer::broadcast_tcp(const DVector<uint8_t> &pkt, int cmd) {
-	int i;
-	conn_mutex->lock();
-	for(i=0; i<connections.size(); i++) {
-		NetGameServerConnection *cd = connections.getv(i);
-		cd->enqueue_tcp(pkt, cmd);
-	}
-	conn_mutex->unlock();
-	return OK;
-}
-
-/*
- * Enqueue packet (the thread will send it)
- */
-Error NetGameServer::_enqueue_udp(CID id, const DVector<uint8_t> &pkt,
-				int cmd, bool timed) {
-	if(udp_queue.size() >= PKT_QUEUE_SIZE * (connections.size()+1)) {
-		WARN_PRINT("UDP QUEUE SIZE EXCEEDED");
-		return ERR_OUT_OF_MEMORY;
-	}
+Error NetGameServer::set_client_position(int id, const Vector3 &pos) {
+	return core->set_client_position(id, pos);
+}
 
-	QueuedPacket *qp = (QueuedPacket *) memnew(QueuedPacket);
-	qp->id = id;
-	qp->cmd = cmd;
-	qp->packet = pkt;
-	qp->timed = timed;
-	udp_mutex->lock();
-	udp_queue.insert(udp_queue.size(), qp);
-	udp_mutex->unlock();
-	return OK;
-}
-
-Error NetGameServer::auth_client(CID id) {
-	conn_mutex->lock();
-	NetGameServerConnection *conn = _get_client(id);
-	if(conn == NULL) {
-		conn_mutex->unlock();
-		return ERR_DOES_NOT_EXIST;
-	}
-	if(conn->authed) {
-		conn_mutex->unlock();
-		return ERR_ALREADY_EXISTS;
-	}
-	conn->authed = true;
-
-	// Assign id to client
-	unsigned char raw[4];
-	raw[0] = CMD_MAX;
-	raw[1] = PCMD_AUTH;
-	raw[2] = conn->id;
-	raw[3] = conn->secret;
-	conn->tcp->put_packet(raw, 4);
-
-	conn_mutex->unlock();
-	return OK;
-}
-
-Error NetGameServer::kick_client(CID id) {
-	conn_mutex->lock();
-	NetGameServerConnection *conn = _get_client(id);
-	if(conn == NULL) {
-		conn_mutex->unlock();
-		return ERR_DOES_NOT_EXIST;
-	}
+Error NetGameServer::clear_client_position(int id) {
+	return core->clear_client_position(id);
+}
+
+Error NetGameServer::join_group(int id, const String &group) {
+	return core->join_group(id, group);
+}
+
+Error NetGameServer::leave_group(int id, const String &group) {
+	return core->leave_group(id, group);
+}
+
+void NetGameServer::set_interest_cell_size(real_t p_size) {
+	core->set_interest_cell_size(p_size);
+}
+
+real_t NetGameServer::get_interest_cell_size() const {
+	return core->get_interest_cell_size();
+}
+
+Error NetGameServer::replica_create(int oid, const Array &fields) {
+	return core->replica_create(oid, fields);
+}
+
+Error NetGameServer::replica_remove(int oid) {
+	return core->replica_remove(oid);
+}
+
+Error NetGameServer::replica_set(int oid, const String &field, const Variant &value) {
+	return core->replica_set(oid, field, value);
+}
+
+Variant NetGameServer::replica_get(int oid, const String &field) {
+	return core->replica_get(oid, field);
+}
+
+void NetGameServer::set_replication_rate(int p_rate) {
+	core->set_replication_rate(p_rate);
+}
+
+int NetGameServer::get_replication_rate() const {
+	return core->get_replication_rate();
+}
+
+Error NetGameServer::auth_client(int id) {
+	return core->auth_client(id);
+}
+
+Error NetGameServer::kick_client(int id, int reason) {
+	return core->kick_client(id, reason);
+}
+
+void NetGameServer::set_keepalive_interval(int p_msec) {
+	core->set_keepalive_interval(p_msec);
+}
+
+int NetGameServer::get_keepalive_interval() const {
+	return core->get_keepalive_interval();
+}
+
+void NetGameServer::set_tcp_keepalive_interval(int p_msec) {
+	core->set_tcp_keepalive_interval(p_msec);
+}
+
+int NetGameServer::get_tcp_keepalive_interval() const {
+	return core->get_tcp_keepalive_interval();
+}
+
+void NetGameServer::set_keepalive_timeout(int p_msec) {
+	core->set_keepalive_timeout(p_msec);
+}
+
+int NetGameServer::get_keepalive_timeout() const {
+	return core->get_keepalive_timeout();
+}
+
+void NetGameServer::set_keepalive_min_timeout(int p_msec) {
+	core->set_keepalive_min_timeout(p_msec);
+}
+
+int NetGameServer::get_keepalive_min_timeout() const {
+	return core->get_keepalive_min_timeout();
+}
+
+Error NetGameServer::set_client_keepalive(int id, int interval, int timeout) {
+	return core->set_client_keepalive(id, interval, timeout);
+}
+
+int NetGameServer::get_client_rtt(int id) {
+	return core->get_client_rtt(id);
+}
+
+Dictionary NetGameServer::get_udp_stats(int id, int cmd) {
+	return core->get_udp_stats(id, cmd);
+}
+
+Ref<NetGameCall> NetGameServer::rpc_call(int id, int method, const Variant &args) {
+	return core->rpc_call(id, method, args);
+}
+
+Error NetGameServer::rpc_reply(int id, int rid, const Variant &result) {
+	return core->rpc_reply(id, rid, result);
+}
+
+void NetGameServer::set_rpc_timeout(int p_msec) {
+	core->set_rpc_timeout(p_msec);
+}
+
+int NetGameServer::get_rpc_timeout() const {
+	return core->get_rpc_timeout();
+}
+
+int NetGameServer::stream_file(int id, const String &path, const String &name) {
+	return core->stream_file(id, path, name);
+}
+
+int NetGameServer::stream_buffer(int id, const DVector<uint8_t> &buf, const String &name) {
+	return core->stream_buffer(id, buf, name);
+}
+
+Error NetGameServer::accept_stream(int id, int sid, const String &path, int offset) {
+	return core->accept_stream(id, sid, path, offset);
+}
+
+Error NetGameServer::cancel_stream(int id, int sid) {
+	return core->cancel_stream(id, sid);
+}
+
+Error NetGameServer::reject_stream(int id, int sid) {
+	return core->reject_stream(id, sid);
+}
+
+Array NetGameServer::get_inputs_for_tick(int tick) {
+	return core->get_inputs_for_tick(tick);
+}
+
+Dictionary NetGameServer::get_input_stats(int id) {
+	return core->get_input_stats(id);
+}
+
+Error NetGameServer::rewind_add(int eid, real_t radius) {
+	return core->rewind_add(eid, radius);
+}
+
+void NetGameServer::rewind_remove(int eid) {
+	core->rewind_remove(eid);
+}
+
+Error NetGameServer::rewind_set_position(int eid, const Vector3 &pos) {
+	return core->rewind_set_position(eid, pos);
+}
+
+void NetGameServer::rewind_capture() {
+	core->rewind_capture();
+}
+
+Variant NetGameServer::rewind_get_position(int id, int eid) {
+	return core->rewind_get_position(id, eid);
+}
 
-	this->connections.erase(conn->id);
-	conn_mutex->unlock();
+Dictionary NetGameServer::rewind_raycast(int id, const Vector3 &from, const Vector3 &to) {
+	return core->rewind_raycast(id, from, to);
+}
+
+Array NetGameServer::rewind_query_sphere(int id, const Vector3 &center, real_t radius) {
+	return core->rewind_query_sphere(id, center, radius);
+}
+
+void NetGameServer::set_rewind_interp_delay(int p_msec) {
+	core->set_rewind_interp_delay(p_msec);
+}
+
+int NetGameServer::get_rewind_interp_delay() const {
+	return core->get_rewind_interp_delay();
+}
+
+void NetGameServer::set_relay_rate(int p_rate) {
+	core->set_relay_rate(p_rate);
+}
+
+int NetGameServer::get_relay_rate() const {
+	return core->get_relay_rate();
+}
+
+Error NetGameServer::set_client_relay_rate(int id, int rate) {
+	return core->set_client_relay_rate(id, rate);
+}
+
+void NetGameServer::set_relay_cmd_allowed(int cmd, bool allowed) {
+	core->set_relay_cmd_allowed(cmd, allowed);
+}
+
+bool NetGameServer::is_relay_cmd_allowed(int cmd) {
+	return core->is_relay_cmd_allowed(cmd);
+}
+
+Error NetGameServer::set_relay_blocked(int from, int to, bool blocked) {
+	return core->set_relay_blocked(from, to, blocked);
+}
+
+Dictionary NetGameServer::get_relay_stats(int id) {
+	return core->get_relay_stats(id);
+}
 
-	_delete_client(conn);
-	return OK;
+void NetGameServer::set_bridge_key(const String &p_key) {
+	core->set_bridge_key(p_key);
+}
+
+Error NetGameServer::bridge_listen(int port, const String &bind) {
+	return core->bridge_listen(port, bind);
+}
+
+int NetGameServer::bridge_connect(const String &host, int port) {
+	return core->bridge_connect(host, port);
+}
+
+void NetGameServer::bridge_disconnect(int peer) {
+	core->bridge_disconnect(peer);
+}
+
+Array NetGameServer::get_bridge_peers() {
+	return core->get_bridge_peers();
+}
+
+Error NetGameServer::bridge_send(int peer, const DVector<uint8_t> &pkt, int cmd, int id) {
+	return core->bridge_send(peer, pkt, cmd, id);
+}
+
+Error NetGameServer::bridge_broadcast(const DVector<uint8_t> &pkt, int cmd, int id) {
+	return core->bridge_broadcast(pkt, cmd, id);
+}
+
+Error NetGameServer::bridge_send_to_client(int peer, int id, const DVector<uint8_t> &pkt, int cmd) {
+	return core->bridge_send_to_client(peer, id, pkt, cmd);
+}
+
+Error NetGameServer::set_client_forward(int id, int peer) {
+	return core->set_client_forward(id, peer);
+}
+
+Error NetGameServer::migrate_client(int id, int peer, const String &host, int tcp_port, int udp_port, const Dictionary &data) {
+	return core->migrate_client(id, peer, host, tcp_port, udp_port, data);
+}
+
+void NetGameServer::set_media_jitter(int p_msec) {
+	core->set_media_jitter(p_msec);
+}
+
+int NetGameServer::get_media_jitter() const {
+	return core->get_media_jitter();
+}
+
+Dictionary NetGameServer::get_media_stats(int id, int stream) {
+	return core->get_media_stats(id, stream);
 }
 
 void NetGameServer::_bind_methods() {
 	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_CONNECT,PropertyInfo( Variant::INT,"id")));
 	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_READY,PropertyInfo( Variant::INT,"id")));
 	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_DISCONNECT,PropertyInfo( Variant::INT,"id")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_RESUME,PropertyInfo( Variant::INT,"id")));
 
 	ADD_SIGNAL(MethodInfo(SIGNAL_UDP_PACKET,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"cmd"), PropertyInfo(Variant::RAW_ARRAY,"pkt")));
 	ADD_SIGNAL(MethodInfo(SIGNAL_TCP_PACKET,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"cmd"), PropertyInfo(Variant::RAW_ARRAY,"pkt")));
 	ADD_SIGNAL(MethodInfo(SIGNAL_AUTH_PACKET,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"cmd"), PropertyInfo(Variant::RAW_ARRAY,"pkt")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_UDP_MESSAGE,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"cmd"), PropertyInfo(Variant::DICTIONARY,"msg")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_TCP_MESSAGE,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"cmd"), PropertyInfo(Variant::DICTIONARY,"msg")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_RPC_REQUEST,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"rid"), PropertyInfo(Variant::INT,"method"), PropertyInfo(Variant::NIL,"args")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_STREAM_OFFER,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"sid"), PropertyInfo(Variant::INT,"size"), PropertyInfo(Variant::STRING,"name")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_STREAM_PROGRESS,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"sid"), PropertyInfo(Variant::INT,"offset"), PropertyInfo(Variant::INT,"size")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_STREAM_COMPLETED,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"sid"), PropertyInfo(Variant::INT,"error"), PropertyInfo(Variant::INT,"offset")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_MEDIA_FRAME,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"stream"), PropertyInfo(Variant::REAL,"timestamp"), PropertyInfo(Variant::RAW_ARRAY,"frame")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_BRIDGE_CONNECT,PropertyInfo(Variant::INT,"peer")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_BRIDGE_DISCONNECT,PropertyInfo(Variant::INT,"peer")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_BRIDGE_PACKET,PropertyInfo(Variant::INT,"peer"), PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"cmd"), PropertyInfo(Variant::RAW_ARRAY,"pkt")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_MIGRATED,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"peer"), PropertyInfo(Variant::DICTIONARY,"data")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_MIGRATE_FAILED,PropertyInfo(Variant::INT,"id")));
 
 	BIND_CONSTANT(PROCESS);
 	BIND_CONSTANT(FIXED);
 	BIND_CONSTANT(THREADED);
 
+	BIND_CONSTANT(DISCONNECT_NONE);
+	BIND_CONSTANT(DISCONNECT_CLOSE);
+	BIND_CONSTANT(DISCONNECT_KICK);
+	BIND_CONSTANT(DISCONNECT_SHUTDOWN);
+	BIND_CONSTANT(DISCONNECT_RESTART);
+	BIND_CONSTANT(DISCONNECT_MIGRATE);
+
+	BIND_CONSTANT(MSG_BOOL);
+	BIND_CONSTANT(MSG_INT);
+	BIND_CONSTANT(MSG_UINT);
+	BIND_CONSTANT(MSG_FLOAT);
+	BIND_CONSTANT(MSG_VECTOR2);
+	BIND_CONSTANT(MSG_VECTOR3);
+	BIND_CONSTANT(MSG_STRING);
+
+	BIND_CONSTANT(REPLICA_BOOL);
+	BIND_CONSTANT(REPLICA_INT);
+	BIND_CONSTANT(REPLICA_FLOAT);
+	BIND_CONSTANT(REPLICA_VECTOR3);
+
+	ObjectTypeDB::bind_method(_MD("get_core:NetGameServerCore"), &NetGameServer::get_core);
 	ObjectTypeDB::bind_method(_MD("start", "tcp_port", "udp_port"), &NetGameServer::start);
-	ObjectTypeDB::bind_method("stop", &NetGameServer::stop);
+	ObjectTypeDB::bind_method(_MD("start_udp_only", "udp_port"), &NetGameServer::start_udp_only);
+	ObjectTypeDB::bind_method(_MD("is_udp_only"), &NetGameServer::is_udp_only);
+	ObjectTypeDB::bind_method(_MD("stop", "reason"), &NetGameServer::stop, DEFVAL(DISCONNECT_SHUTDOWN));
+	ObjectTypeDB::bind_method(_MD("drain:Error", "timeout_msec"), &NetGameServer::drain);
+	ObjectTypeDB::bind_method(_MD("export_sessions"), &NetGameServer::export_sessions);
+	ObjectTypeDB::bind_method(_MD("import_sessions:Error", "data"), &NetGameServer::import_sessions);
 	ObjectTypeDB::bind_method(_MD("put_udp_packet:Error", "id", "pkt", "cmd", "rt"),&NetGameServer::put_udp_packet,DEFVAL(0), DEFVAL(false));
 	ObjectTypeDB::bind_method(_MD("put_tcp_packet:Error", "id", "pkt", "cmd"),&NetGameServer::put_tcp_packet, DEFVAL(0));
 	ObjectTypeDB::bind_method(_MD("broadcast_udp:Error", "pkt", "cmd", "rt"),&NetGameServer::broadcast_udp,DEFVAL(0), DEFVAL(false));
 	ObjectTypeDB::bind_method(_MD("broadcast_tcp:Error", "pkt", "cmd"),&NetGameServer::broadcast_tcp, DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("register_message:Error", "cmd", "layout"),&NetGameServer::register_message);
+	ObjectTypeDB::bind_method(_MD("unregister_message", "cmd"),&NetGameServer::unregister_message);
+	ObjectTypeDB::bind_method(_MD("put_tcp_message:Error", "id", "cmd", "args"),&NetGameServer::put_tcp_message);
+	ObjectTypeDB::bind_method(_MD("put_udp_message:Error", "id", "cmd", "args", "rt"),&NetGameServer::put_udp_message,DEFVAL(false));
+	ObjectTypeDB::bind_method(_MD("broadcast_udp_message:Error", "cmd", "args", "rt"),&NetGameServer::broadcast_udp_message,DEFVAL(false));
+	ObjectTypeDB::bind_method(_MD("broadcast_udp_interest:Error", "pkt", "cmd", "origin", "radius", "rt"),&NetGameServer::broadcast_udp_interest,DEFVAL(false));
+	ObjectTypeDB::bind_method(_MD("multicast_to_group:Error", "group", "pkt", "cmd", "rt"),&NetGameServer::multicast_to_group,DEFVAL(0), DEFVAL(false));
+	ObjectTypeDB::bind_method(_MD("set_client_position:Error", "id", "pos"),&NetGameServer::set_client_position);
+	ObjectTypeDB::bind_method(_MD("clear_client_position:Error", "id"),&NetGameServer::clear_client_position);
+	ObjectTypeDB::bind_method(_MD("join_group:Error", "id", "group"),&NetGameServer::join_group);
+	ObjectTypeDB::bind_method(_MD("leave_group:Error", "id", "group"),&NetGameServer::leave_group);
+	ObjectTypeDB::bind_method(_MD("set_interest_cell_size","size"),&NetGameServer::set_interest_cell_size);
+	ObjectTypeDB::bind_method(_MD("get_interest_cell_size"),&NetGameServer::get_interest_cell_size);
+	ObjectTypeDB::bind_method(_MD("replica_create:Error", "oid", "fields"),&NetGameServer::replica_create);
+	ObjectTypeDB::bind_method(_MD("replica_remove:Error", "oid"),&NetGameServer::replica_remove);
+	ObjectTypeDB::bind_method(_MD("replica_set:Error", "oid", "field", "value"),&NetGameServer::replica_set);
+	ObjectTypeDB::bind_method(_MD("replica_get", "oid", "field"),&NetGameServer::replica_get);
+	ObjectTypeDB::bind_method(_MD("set_replication_rate","rate"),&NetGameServer::set_replication_rate);
+	ObjectTypeDB::bind_method(_MD("get_replication_rate"),&NetGameServer::get_replication_rate);
 	ObjectTypeDB::bind_method(_MD("auth_client", "id"),&NetGameServer::auth_client);
-	ObjectTypeDB::bind_method(_MD("kick_client", "id"),&NetGameServer::kick_client);
+	ObjectTypeDB::bind_method(_MD("kick_client", "id", "reason"),&NetGameServer::kick_client,DEFVAL(DISCONNECT_KICK));
+	ObjectTypeDB::bind_method(_MD("set_secure","enabled"),&NetGameServer::set_secure);
+	ObjectTypeDB::bind_method(_MD("is_secure"),&NetGameServer::is_secure);
+	ObjectTypeDB::bind_method(_MD("set_secure_key","key"),&NetGameServer::set_secure_key);
+	ObjectTypeDB::bind_method(_MD("set_handshake_rate","rate"),&NetGameServer::set_handshake_rate);
+	ObjectTypeDB::bind_method(_MD("get_handshake_rate"),&NetGameServer::get_handshake_rate);
+	ObjectTypeDB::bind_method(_MD("set_resume_grace","msec"),&NetGameServer::set_resume_grace);
+	ObjectTypeDB::bind_method(_MD("get_resume_grace"),&NetGameServer::get_resume_grace);
 	ObjectTypeDB::bind_method(_MD("set_signal_mode","mode"),&NetGameServer::set_signal_mode);
 	ObjectTypeDB::bind_method(_MD("get_signal_mode"),&NetGameServer::get_signal_mode);
+	ObjectTypeDB::bind_method(_MD("set_recorder","recorder:NetGameRecorder"),&NetGameServer::set_recorder);
+	ObjectTypeDB::bind_method(_MD("get_recorder:NetGameRecorder"),&NetGameServer::get_recorder);
+	ObjectTypeDB::bind_method(_MD("set_reactor","reactor:NetGameReactor"),&NetGameServer::set_reactor);
+	ObjectTypeDB::bind_method(_MD("get_reactor:NetGameReactor"),&NetGameServer::get_reactor);
+	ObjectTypeDB::bind_method(_MD("set_keepalive_interval","msec"),&NetGameServer::set_keepalive_interval);
+	ObjectTypeDB::bind_method(_MD("get_keepalive_interval"),&NetGameServer::get_keepalive_interval);
+	ObjectTypeDB::bind_method(_MD("set_tcp_keepalive_interval","msec"),&NetGameServer::set_tcp_keepalive_interval);
+	ObjectTypeDB::bind_method(_MD("get_tcp_keepalive_interval"),&NetGameServer::get_tcp_keepalive_interval);
+	ObjectTypeDB::bind_method(_MD("set_keepalive_timeout","msec"),&NetGameServer::set_keepalive_timeout);
+	ObjectTypeDB::bind_method(_MD("get_keepalive_timeout"),&NetGameServer::get_keepalive_timeout);
+	ObjectTypeDB::bind_method(_MD("set_keepalive_min_timeout","msec"),&NetGameServer::set_keepalive_min_timeout);
+	ObjectTypeDB::bind_method(_MD("get_keepalive_min_timeout"),&NetGameServer::get_keepalive_min_timeout);
+	ObjectTypeDB::bind_method(_MD("set_client_keepalive:Error","id","interval","timeout"),&NetGameServer::set_client_keepalive);
+	ObjectTypeDB::bind_method(_MD("get_client_rtt","id"),&NetGameServer::get_client_rtt);
+	ObjectTypeDB::bind_method(_MD("get_udp_stats","id","cmd"),&NetGameServer::get_udp_stats,DEFVAL(-1));
+	ObjectTypeDB::bind_method(_MD("rpc_call:NetGameCall","id","method","args"),&NetGameServer::rpc_call,DEFVAL(Variant()));
+	ObjectTypeDB::bind_method(_MD("rpc_reply:Error","id","rid","result"),&NetGameServer::rpc_reply,DEFVAL(Variant()));
+	ObjectTypeDB::bind_method(_MD("set_rpc_timeout","msec"),&NetGameServer::set_rpc_timeout);
+	ObjectTypeDB::bind_method(_MD("get_rpc_timeout"),&NetGameServer::get_rpc_timeout);
+	ObjectTypeDB::bind_method(_MD("stream_file","id","path","name"),&NetGameServer::stream_file,DEFVAL(""));
+	ObjectTypeDB::bind_method(_MD("stream_buffer","id","buffer","name"),&NetGameServer::stream_buffer,DEFVAL(""));
+	ObjectTypeDB::bind_method(_MD("accept_stream:Error","id","sid","path","offset"),&NetGameServer::accept_stream,DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("cancel_stream:Error","id","sid"),&NetGameServer::cancel_stream);
+	ObjectTypeDB::bind_method(_MD("reject_stream:Error","id","sid"),&NetGameServer::reject_stream);
+	ObjectTypeDB::bind_method(_MD("get_inputs_for_tick","tick"),&NetGameServer::get_inputs_for_tick);
+	ObjectTypeDB::bind_method(_MD("get_input_stats","id"),&NetGameServer::get_input_stats);
+	ObjectTypeDB::bind_method(_MD("rewind_add:Error","eid","radius"),&NetGameServer::rewind_add,DEFVAL(0.5));
+	ObjectTypeDB::bind_method(_MD("rewind_remove","eid"),&NetGameServer::rewind_remove);
+	ObjectTypeDB::bind_method(_MD("rewind_set_position:Error","eid","pos"),&NetGameServer::rewind_set_position);
+	ObjectTypeDB::bind_method(_MD("rewind_capture"),&NetGameServer::rewind_capture);
+	ObjectTypeDB::bind_method(_MD("rewind_get_position","id","eid"),&NetGameServer::rewind_get_position);
+	ObjectTypeDB::bind_method(_MD("rewind_raycast","id","from","to"),&NetGameServer::rewind_raycast);
+	ObjectTypeDB::bind_method(_MD("rewind_query_sphere","id","center","radius"),&NetGameServer::rewind_query_sphere);
+	ObjectTypeDB::bind_method(_MD("set_rewind_interp_delay","msec"),&NetGameServer::set_rewind_interp_delay);
+	ObjectTypeDB::bind_method(_MD("get_rewind_interp_delay"),&NetGameServer::get_rewind_interp_delay);
+	ObjectTypeDB::bind_method(_MD("set_relay_rate","rate"),&NetGameServer::set_relay_rate);
+	ObjectTypeDB::bind_method(_MD("get_relay_rate"),&NetGameServer::get_relay_rate);
+	ObjectTypeDB::bind_method(_MD("set_client_relay_rate:Error","id","rate"),&NetGameServer::set_client_relay_rate);
+	ObjectTypeDB::bind_method(_MD("set_relay_cmd_allowed","cmd","allowed"),&NetGameServer::set_relay_cmd_allowed);
+	ObjectTypeDB::bind_method(_MD("is_relay_cmd_allowed","cmd"),&NetGameServer::is_relay_cmd_allowed);
+	ObjectTypeDB::bind_method(_MD("set_relay_blocked:Error","from","to","blocked"),&NetGameServer::set_relay_blocked);
+	ObjectTypeDB::bind_method(_MD("get_relay_stats","id"),&NetGameServer::get_relay_stats);
+	ObjectTypeDB::bind_method(_MD("set_bridge_key","key"),&NetGameServer::set_bridge_key);
+	ObjectTypeDB::bind_method(_MD("bridge_listen:Error","port","bind"),&NetGameServer::bridge_listen,DEFVAL("*"));
+	ObjectTypeDB::bind_method(_MD("bridge_connect","host","port"),&NetGameServer::bridge_connect);
+	ObjectTypeDB::bind_method(_MD("bridge_disconnect","peer"),&NetGameServer::bridge_disconnect);
+	ObjectTypeDB::bind_method(_MD("get_bridge_peers"),&NetGameServer::get_bridge_peers);
+	ObjectTypeDB::bind_method(_MD("bridge_send:Error","peer","pkt","cmd","id"),&NetGameServer::bridge_send,DEFVAL(0),DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("bridge_broadcast:Error","pkt","cmd","id"),&NetGameServer::bridge_broadcast,DEFVAL(0),DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("bridge_send_to_client:Error","peer","id","pkt","cmd"),&NetGameServer::bridge_send_to_client,DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("set_client_forward:Error","id","peer"),&NetGameServer::set_client_forward);
+	ObjectTypeDB::bind_method(_MD("migrate_client:Error","id","peer","host","tcp_port","udp_port","data"),&NetGameServer::migrate_client,DEFVAL(Dictionary()));
+	ObjectTypeDB::bind_method(_MD("set_media_jitter","msec"),&NetGameServer::set_media_jitter);
+	ObjectTypeDB::bind_method(_MD("get_media_jitter"),&NetGameServer::get_media_jitter);
+	ObjectTypeDB::bind_method(_MD("get_media_stats","id","stream"),&NetGameServer::get_media_stats);
 	ADD_PROPERTYNZ( PropertyInfo(Variant::INT,"signal_mode",PROPERTY_HINT_ENUM,"Process,Fixed,Threaded"),_SCS("set_signal_mode"),_SCS("get_signal_mode"));
+	ADD_PROPERTY( PropertyInfo(Variant::BOOL,"secure"),_SCS("set_secure"),_SCS("is_secure"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"handshake_rate",PROPERTY_HINT_RANGE,"0,1000,1"),_SCS("set_handshake_rate"),_SCS("get_handshake_rate"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"resume_grace",PROPERTY_HINT_RANGE,"0,60000,100"),_SCS("set_resume_grace"),_SCS("get_resume_grace"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"keepalive_interval",PROPERTY_HINT_RANGE,"50,10000,50"),_SCS("set_keepalive_interval"),_SCS("get_keepalive_interval"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"tcp_keepalive_interval",PROPERTY_HINT_RANGE,"100,30000,100"),_SCS("set_tcp_keepalive_interval"),_SCS("get_tcp_keepalive_interval"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"keepalive_timeout",PROPERTY_HINT_RANGE,"1000,120000,100"),_SCS("set_keepalive_timeout"),_SCS("get_keepalive_timeout"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"keepalive_min_timeout",PROPERTY_HINT_RANGE,"500,120000,100"),_SCS("set_keepalive_min_timeout"),_SCS("get_keepalive_min_timeout"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"replication_rate",PROPERTY_HINT_RANGE,"0,120,1"),_SCS("set_replication_rate"),_SCS("get_replication_rate"));
+	ADD_PROPERTY( PropertyInfo(Variant::REAL,"interest_cell_size",PROPERTY_HINT_RANGE,"1,4096,1"),_SCS("set_interest_cell_size"),_SCS("get_interest_cell_size"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"relay_rate",PROPERTY_HINT_RANGE,"0,1000,1"),_SCS("set_relay_rate"),_SCS("get_relay_rate"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"rpc_timeout",PROPERTY_HINT_RANGE,"100,120000,100"),_SCS("set_rpc_timeout"),_SCS("get_rpc_timeout"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"rewind_interp_delay",PROPERTY_HINT_RANGE,"0,1000,1"),_SCS("set_rewind_interp_delay"),_SCS("get_rewind_interp_delay"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"media_jitter",PROPERTY_HINT_RANGE,"0,1000,1"),_SCS("set_media_jitter"),_SCS("get_media_jitter"));
 }
 
 NetGameServer::NetGameServer() {
-	signal_mode = PROCESS;
-	quit = true;
-	udp_mutex = Mutex::create();
-	conn_mutex = Mutex::create();
-	signal_mutex = Mutex::create();
-	tcp_server = TCP_Server::create_ref();
-	udp_server = PacketPeerUDP::create_ref();
-	thread = NULL;
+	core = Ref<NetGameServerCore>(memnew(NetGameServerCore));
+	core->set_signal_target(this);
 }
 
 NetGameServer::~NetGameServer() {
-	if (thread != NULL) {
-		quit = true;
-		Thread::wait_to_finish(thread);
-		memdelete(thread);
-	}
-
-	memdelete(udp_mutex);
-	memdelete(conn_mutex);
-	memdelete(signal_mutex);
+	// The network thread may emit on us in THREADED mode
+	core->stop();
+	core->set_signal_target(NULL);
 }
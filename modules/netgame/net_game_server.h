@@ -1,63 +1,48 @@
 #ifndef UDPSERVER_H
 #define UDPSERVER_H
 
-#include <stdlib.h>
-#include "reference.h"
-#include "os/thread.h"
-#include "io/tcp_server.h"
-#include "io/packet_peer_udp.h"
 #include "scene/main/node.h"
-#include "modules/netgame/net_game_server_data.h"
-#include "modules/netgame/net_game_server_connection.h"
-
-class NetGameServerConnection;
+#include "modules/netgame/net_game_server_core.h"
 
+/**
+ * Scene node around NetGameServerCore: forwards the API, re-emits the
+ * signals from the node and polls them in process/fixed process.
+ * Headless hosts can use NetGameServerCore directly.
+ */
 class NetGameServer: public Node {
 	OBJ_TYPE( NetGameServer, Node );
 
-	Mutex *conn_mutex;
-	Mutex *udp_mutex;
-	Mutex *signal_mutex;
-	Ref<TCP_Server> tcp_server;
-	Vector<QueuedPacket*> udp_queue;
-	Vector<QueuedSignal*> signal_queue;
-	VMap<CID, NetGameServerConnection*> connections;
-	Thread *thread;
-	bool quit;
-
-	CID _get_id();
-	CSE _get_secret();
+	Ref<NetGameServerCore> core;
 
-	void _server_tick();
-	Error _enqueue_udp(CID id, const DVector<uint8_t> &pkt, int cmd, bool timed);
-	void _check_connections();
-	void _delete_client(NetGameServerConnection *cd);
-	void _clear_clients();
-	void _remove_stale_clients();
-	void _handle_udp();
-	void _handle_tcp();
 	void _update_signal_mode();
-	void _clear_queues();
-
-	NetGameServerConnection* _handle_udp_handshake(CID id, CSE secret);
-	NetGameServerConnection *_get_client(int id);
 
 protected:
 	void _notification(int p_what);
 	static void _bind_methods();
 
 public:
-	Ref<PacketPeerUDP> udp_server;
-	SignalsMode signal_mode;
+	Ref<NetGameServerCore> get_core() const;
 
 	void start(int tcp_port, int udp_port);
-	void stop();
+	void start_udp_only(int udp_port);
+	bool is_udp_only() const;
+	void stop(int reason=DISCONNECT_SHUTDOWN);
+	Error drain(int timeout_msec);
+	DVector<uint8_t> export_sessions();
+	Error import_sessions(const DVector<uint8_t> &data);
 	void set_signal_mode(SignalsMode p_mode);
 	SignalsMode get_signal_mode() const;
-
-	void _queue_signal(const char *sig, CID id);
-	void _queue_signal(const char *sig, CID id,
-				const DVector<uint8_t> &pkt, int cmd=0);
+	void set_recorder(const Ref<NetGameRecorder> &p_recorder);
+	Ref<NetGameRecorder> get_recorder() const;
+	void set_reactor(const Ref<NetGameReactor> &p_reactor);
+	Ref<NetGameReactor> get_reactor() const;
+	void set_secure(bool p_secure);
+	bool is_secure() const;
+	void set_secure_key(const String &p_key);
+	void set_handshake_rate(int p_rate);
+	int get_handshake_rate() const;
+	void set_resume_grace(int p_msec);
+	int get_resume_grace() const;
 
 	Error put_tcp_packet(int id, const DVector<uint8_t> &pkt, int cmd=0);
 	Error broadcast_tcp(const DVector<uint8_t> &pkt, int cmd=0);
@@ -65,11 +50,89 @@ public:
 				int cmd=0, bool timed=false);
 	Error broadcast_udp(const DVector<uint8_t> &pkt,
 				int cmd=0, bool timed=false);
-	Error auth_client(CID id);
-	Error kick_client(CID id);
-
-	static void _thread_start(void*s);
+	Error register_message(int cmd, const Array &layout);
+	void unregister_message(int cmd);
+	Error put_tcp_message(int id, int cmd, const Variant &args);
+	Error put_udp_message(int id, int cmd, const Variant &args,
+				bool timed=false);
+	Error broadcast_udp_message(int cmd, const Variant &args,
+				bool timed=false);
+
+	Error broadcast_udp_interest(const DVector<uint8_t> &pkt, int cmd,
+				const Vector3 &origin, real_t radius,
+				bool timed=false);
+	Error multicast_to_group(const String &group,
+				const DVector<uint8_t> &pkt,
+				int cmd=0, bool timed=false);
 
+	Error set_client_position(int id, const Vector3 &pos);
+	Error clear_client_position(int id);
+	Error join_group(int id, const String &group);
+	Error leave_group(int id, const String &group);
+	void set_interest_cell_size(real_t p_size);
+	real_t get_interest_cell_size() const;
+
+	Error replica_create(int oid, const Array &fields);
+	Error replica_remove(int oid);
+	Error replica_set(int oid, const String &field, const Variant &value);
+	Variant replica_get(int oid, const String &field);
+	void set_replication_rate(int p_rate);
+	int get_replication_rate() const;
+
+	Error auth_client(int id);
+	Error kick_client(int id, int reason=DISCONNECT_KICK);
+
+	void set_keepalive_interval(int p_msec);
+	int get_keepalive_interval() const;
+	void set_tcp_keepalive_interval(int p_msec);
+	int get_tcp_keepalive_interval() const;
+	void set_keepalive_timeout(int p_msec);
+	int get_keepalive_timeout() const;
+	void set_keepalive_min_timeout(int p_msec);
+	int get_keepalive_min_timeout() const;
+	Error set_client_keepalive(int id, int interval, int timeout);
+	int get_client_rtt(int id);
+	Dictionary get_udp_stats(int id, int cmd=-1);
+	Ref<NetGameCall> rpc_call(int id, int method, const Variant &args=Variant());
+	Error rpc_reply(int id, int rid, const Variant &result=Variant());
+	void set_rpc_timeout(int p_msec);
+	int get_rpc_timeout() const;
+	int stream_file(int id, const String &path, const String &name="");
+	int stream_buffer(int id, const DVector<uint8_t> &buf, const String &name="");
+	Error accept_stream(int id, int sid, const String &path, int offset=0);
+	Error cancel_stream(int id, int sid);
+	Error reject_stream(int id, int sid);
+	Array get_inputs_for_tick(int tick);
+	Dictionary get_input_stats(int id);
+	Error rewind_add(int eid, real_t radius=0.5);
+	void rewind_remove(int eid);
+	Error rewind_set_position(int eid, const Vector3 &pos);
+	void rewind_capture();
+	Variant rewind_get_position(int id, int eid);
+	Dictionary rewind_raycast(int id, const Vector3 &from, const Vector3 &to);
+	Array rewind_query_sphere(int id, const Vector3 &center, real_t radius);
+	void set_rewind_interp_delay(int p_msec);
+	int get_rewind_interp_delay() const;
+	void set_relay_rate(int p_rate);
+	int get_relay_rate() const;
+	Error set_client_relay_rate(int id, int rate);
+	void set_relay_cmd_allowed(int cmd, bool allowed);
+	bool is_relay_cmd_allowed(int cmd);
+	Error set_relay_blocked(int from, int to, bool blocked);
+	Dictionary get_relay_stats(int id);
+	void set_bridge_key(const String &p_key);
+	Error bridge_listen(int port, const String &bind="*");
+	int bridge_connect(const String &host, int port);
+	void bridge_disconnect(int peer);
+	Array get_bridge_peers();
+	Error bridge_send(int peer, const DVector<uint8_t> &pkt, int cmd=0, int id=0);
+	Error bridge_broadcast(const DVector<uint8_t> &pkt, int cmd=0, int id=0);
+	Error bridge_send_to_client(int peer, int id, const DVector<uint8_t> &pkt, int cmd=0);
+	Error set_client_forward(int id, int peer);
+	Error migrate_client(int id, int peer, const String &host, int tcp_port, int udp_port, const Dictionary &data=Dictionary());
+	void set_media_jitter(int p_msec);
+	int get_media_jitter() const;
+	Dictionary get_media_stats(int id, int stream);
 
 	NetGameServer();
 	~NetGameServer();
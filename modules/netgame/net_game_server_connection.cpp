@@ -1,36 +1,53 @@
 
 #include "modules/netgame/net_game_server_connection.h"
+#include "io/marshalls.h"
 
-void NetGameServerConnection::on_update() {
-	int time = OS::get_singleton()->get_ticks_msec();
+/*
+ * Socket work, every tick. Deadlines (timeouts, resends and pings) are
+ * handled by on_timer. Returns false once the client must be removed.
+ */
+bool NetGameServerConnection::on_update(uint64_t time) {
+	// TCP closed, suspend it or drop the client right away
+	if(state != DISCONNECTED && !udp_only && !suspended &&
+			!stream_peer->is_connected()) {
+		_check_alive(time);
+	}
 
-	if (!is_connected()) {
-		state = DISCONNECTED;
-		if(stream_peer->is_connected()) {
+	if(state != DISCONNECTED && !suspended) {
+		_update_io(time);
+	}
+
+	// Kicked, timed out, closed by the client or refused
+	if(state == DISCONNECTED) {
+		// Removed in this same tick, so this is sent once
+		if(disconnect_reason != DISCONNECT_CLOSE &&
+				disconnect_reason != DISCONNECT_MIGRATE) {
+			send_disconnect(disconnect_reason);
+		}
+		if(!udp_only && stream_peer->is_connected()) {
 			stream_peer->disconnect();
 		}
-		return;
+		return false;
 	}
+	return true;
+}
 
-	time = OS::get_singleton()->get_ticks_msec();
-
-	if(tcp->get_available_packet_count() > 0) {
+void NetGameServerConnection::_update_io(uint64_t time) {
+	if(!udp_only && tcp->get_available_packet_count() > 0) {
 		_handle_tcp();
 		tcp_time = time;
 	}
 
-	if(udp_ping + UDP_PING < time) {
-		_send_udp_ping();
-		udp_ping = time;
+	// Assign id to client (in secure mode wait for the session)
+	if(authed && !auth_sent && (!server->secure || session.is_ready())) {
+		_send_auth();
 	}
 
-	if(tcp_ping + TCP_PING < time) {
-		_send_tcp_ping();
-		tcp_ping = time;
-	}
-
-	// Flush tcp queue
-	while(tcp_queue.size() > 0) {
+	// Flush tcp queue (once the session is ready in secure mode, while
+	// the reliable window has room in UDP only mode)
+	while(tcp_queue.size() > 0 &&
+			(!server->secure || session.is_ready()) &&
+			(!udp_only || reliable.can_send())) {
 		// This thread is the only one removing from the queue
 		// locking only for remove is safe
 		QueuedPacket *qp = tcp_queue.get(0);
@@ -38,10 +55,198 @@ void NetGameServerConnection::on_update() {
 		tcp_queue.remove(0);
 		out_mutex->unlock();
 
-		tcp->put_packet_buffer(build_pkt(qp));
+		put_tcp(build_pkt(qp));
 		memdelete(qp);
 
 	}
+
+	if(state == READY && tcp_queue.size() == 0 &&
+			(!server->secure || session.is_ready())) {
+		if(migrate_state == MIGRATE_ACCEPTED) {
+			_migrate();
+		}
+		else {
+			_pump_streams();
+		}
+	}
+}
+
+/*
+ * Everything queued for the client is out: hand the session over
+ * ([state][sequences][data], under the id the peer gave), then tell the
+ * client its new id and where to resume.
+ * Nothing is sent on this session afterwards, the new server goes on
+ * with its keys (counters skipped on import).
+ */
+void NetGameServerConnection::_migrate() {
+	DVector<uint8_t> pkt;
+	DVector<uint8_t> out;
+	int len;
+
+	if(encode_variant(migrate_data, NULL, len) != OK) {
+		_migrate_failed();
+		return;
+	}
+	out.resize(get_state_size());
+	{
+		DVector<uint8_t>::Write w = out.write();
+		save_state(w.ptr());
+		w[0] = migrate_id;
+	}
+	sequence.save_state(out);
+	int pos = out.size();
+	out.resize(pos + len);
+	{
+		DVector<uint8_t>::Write w = out.write();
+		encode_variant(migrate_data, w.ptr() + pos, len);
+	}
+	// Queue full, message too large or peer gone: the client stays
+	if(server->bridge.send(migrate_peer, BRIDGE_MIGRATE, migrate_id, 0,
+				out) != OK) {
+		_migrate_failed();
+		return;
+	}
+
+	pkt.append(CMD_MAX);
+	pkt.append(PCMD_MIGRATE);
+	pkt.append(migrate_id);
+	pkt.append_array(migrate_target);
+	// The copy on the peer expires unresumed (resume_grace)
+	if(put_tcp(pkt) != OK) {
+		_migrate_failed();
+		return;
+	}
+	state = DISCONNECTED;
+	disconnect_reason = DISCONNECT_MIGRATE;
+}
+
+void NetGameServerConnection::_migrate_failed() {
+	migrate_state = MIGRATE_NONE;
+	migrate_data = Dictionary();
+	server->_queue_signal(SIGNAL_CLIENT_MIGRATE_FAILED, id);
+}
+
+/*
+ * Bulk streams only fill the gaps, a few chunks per tick once the
+ * queued packets are out
+ */
+void NetGameServerConnection::_pump_streams() {
+	Vector<TransferEvent> events;
+	DVector<uint8_t> pkt;
+	int chunk = udp_only ? TRANSFER_CHUNK_RELIABLE : TRANSFER_CHUNK;
+	int i;
+
+	for(i = 0; i < TRANSFER_BURST; i++) {
+		if((udp_only && !reliable.can_send()) ||
+				!transfer.pump(chunk, pkt, events)) {
+			break;
+		}
+		put_tcp(pkt);
+	}
+	_queue_events(events);
+}
+
+void NetGameServerConnection::_handle_stream(const DVector<uint8_t> &pkt) {
+	Vector<DVector<uint8_t> > replies;
+	Vector<TransferEvent> events;
+	int i;
+
+	transfer.handle(pkt, replies, events);
+	for(i = 0; i < replies.size(); i++) {
+		enqueue_pcmd(replies[i], PCMD_STREAM);
+	}
+	_queue_events(events);
+}
+
+void NetGameServerConnection::_queue_events(
+				const Vector<TransferEvent> &events) {
+	int i;
+
+	for(i = 0; i < events.size(); i++) {
+		server->_queue_signal(events[i].signal, id, events[i].sid,
+					events[i].value, events[i].arg);
+	}
+}
+
+/*
+ * Called by the server timer wheel when the earliest deadline is due,
+ * deadlines moved later by traffic are just checked again
+ */
+void NetGameServerConnection::on_timer(uint64_t time) {
+	_check_alive(time);
+	if(state == DISCONNECTED) {
+		// on_update closes it in this same tick
+		return;
+	}
+
+	if(!suspended) {
+		if(udp_only && reliable.get_unacked() > 0) {
+			// Resend unacked reliable packets
+			Vector<DVector<uint8_t> > resend;
+			int i;
+			reliable.get_resends(time, resend);
+			for(i = 0; i < resend.size(); i++) {
+				put_udp(resend[i]);
+			}
+		}
+
+		// Only when nothing else went out for an interval
+		if(keepalive.udp_ping_due(time)) {
+			_send_udp_ping(time);
+		}
+
+		if(!udp_only && keepalive.tcp_ping_due(time)) {
+			_send_tcp_ping();
+		}
+	}
+
+	server->timers.schedule(&timer, _next_deadline(time));
+}
+
+uint64_t NetGameServerConnection::_next_deadline(uint64_t time) {
+	uint64_t next;
+
+	if(suspended) {
+		return MAX(suspend_time + server->resume_grace, time + 1);
+	}
+
+	next = udp_time + keepalive.get_udp_timeout();
+	// No UDP ping before the address is known (always in UDP only mode)
+	if(udp_only || state == READY) {
+		next = MIN(next, keepalive.get_next_udp_ping());
+	}
+	if(udp_only) {
+		if(reliable.get_unacked() > 0) {
+			next = MIN(next, reliable.get_next_resend());
+		}
+	}
+	else {
+		next = MIN(next, tcp_time + keepalive.get_tcp_timeout());
+		next = MIN(next, keepalive.get_next_tcp_ping());
+	}
+	// A deadline that could not be served waits for the next msec
+	return MAX(next, time + 1);
+}
+
+/*
+ * TCP lost, keep the client (queues and sequences) so it can resume,
+ * or mark it disconnected once it timed out
+ */
+void NetGameServerConnection::_check_alive(uint64_t time) {
+	if(!udp_only && !suspended && state == READY &&
+			server->resume_grace > 0 && _is_tcp_lost(time)) {
+		suspended = true;
+		suspend_time = time;
+		if(stream_peer->is_connected()) {
+			stream_peer->disconnect();
+		}
+		server->timers.schedule_before(&timer,
+				suspend_time + server->resume_grace);
+	}
+
+	if(!is_connected(time)) {
+		state = DISCONNECTED;
+	}
 }
 
 void NetGameServerConnection::_send_tcp_ping() {
@@ -51,38 +256,202 @@ void NetGameServerConnection::_send_tcp_ping() {
 	raw[1] = PCMD_PING;
 
 	// TCP Ping
-	tcp->put_packet(raw, 2);
+	put_tcp(raw, 2);
 }
 
-void NetGameServerConnection::_send_udp_ping() {
-	if(state != READY) return;
+void NetGameServerConnection::_send_auth() {
+	uint8_t raw[6 + RESUME_TOKEN_SIZE];
+	int len = 4;
 
-	uint8_t raw[2];
+	raw[0] = CMD_MAX;
+	raw[1] = PCMD_AUTH;
+	raw[2] = id;
+	raw[3] = secret;
+	// Resume token and grace, only if resume is enabled (TCP mode)
+	if(!udp_only && server->resume_grace > 0 && _new_token()) {
+		memcpy(raw + 4, resume_token, RESUME_TOKEN_SIZE);
+		raw[4 + RESUME_TOKEN_SIZE] = server->resume_grace >> 8;
+		raw[5 + RESUME_TOKEN_SIZE] = server->resume_grace;
+		len += RESUME_TOKEN_SIZE + 2;
+	}
+	put_tcp(raw, len);
+	auth_sent = true;
+
+	// The address was bound by the handshake in UDP only mode
+	if(udp_only && state == WAIT_AUTH) {
+		state = READY;
+		server->_queue_signal(SIGNAL_CLIENT_READY, id);
+	}
+}
+
+/*
+ * UDP only mode: id, secret (and our key in secure mode), always in clear
+ */
+void NetGameServerConnection::send_welcome() {
+	uint8_t raw[4 + 32];
+	int len = 4;
+
+	raw[0] = CMD_MAX;
+	raw[1] = PCMD_WELCOME;
+	raw[2] = id;
+	raw[3] = secret;
+	if(server->secure) {
+		memcpy(raw + 4, kx_pub, 32);
+		len += 32;
+	}
+	server->_put_udp_raw(udp_host, udp_port, raw, len);
+}
+
+/*
+ * UDP only: [CMD_MAX][PCMD_DISCONNECT][secret][reason]
+ * TCP:      [CMD_MAX][PCMD_DISCONNECT][reason]
+ */
+void NetGameServerConnection::send_disconnect(DisconnectReason reason) {
+	uint8_t raw[4];
+
+	raw[0] = CMD_MAX;
+	raw[1] = PCMD_DISCONNECT;
+	if(udp_only) {
+		raw[2] = secret;
+		raw[3] = reason;
+		put_udp(raw, 4);
+	}
+	else if(!suspended && stream_peer->is_connected() &&
+			(!server->secure || session.is_ready())) {
+		raw[2] = reason;
+		put_tcp(raw, 3);
+	}
+}
+
+/*
+ * Nothing left to send (reliable packets acked in UDP only mode)
+ */
+bool NetGameServerConnection::is_flushed() const {
+	return tcp_queue.size() == 0 &&
+		(!udp_only || reliable.get_unacked() == 0);
+}
+
+/*
+ * Only ready TCP clients holding a resume token can move to another
+ * process, they come back with a resume
+ */
+bool NetGameServerConnection::can_export() const {
+	static const uint8_t zero[RESUME_TOKEN_SIZE] = { 0 };
+
+	return !udp_only && state == READY && authed &&
+		!NetGameCrypto::equals(resume_token, zero, RESUME_TOKEN_SIZE);
+}
+
+int NetGameServerConnection::get_state_size() const {
+	return CONNECTION_STATE_SIZE + (server->secure ? SESSION_STATE_SIZE : 0);
+}
+
+void NetGameServerConnection::save_state(uint8_t *out) const {
+	out[0] = id;
+	out[1] = secret;
+	memcpy(out + 2, resume_token, RESUME_TOKEN_SIZE);
+	out += 2 + RESUME_TOKEN_SIZE;
+	memcpy(out, udp_host.get_ipv6(), ADDRESS_SIZE);
+	out[ADDRESS_SIZE] = udp_port >> 8;
+	out[ADDRESS_SIZE + 1] = udp_port;
+	if(server->secure) {
+		session.save_state(out + ADDRESS_SIZE + 2);
+	}
+}
+
+/*
+ * Tokens are single use, a new one is sent with each resume (with this
+ * server's grace, it may be another process)
+ */
+void NetGameServerConnection::_send_resume() {
+	uint8_t raw[4 + RESUME_TOKEN_SIZE];
+
+	if(!_new_token()) {
+		return;
+	}
+	raw[0] = CMD_MAX;
+	raw[1] = PCMD_RESUME;
+	memcpy(raw + 2, resume_token, RESUME_TOKEN_SIZE);
+	raw[2 + RESUME_TOKEN_SIZE] = server->resume_grace >> 8;
+	raw[3 + RESUME_TOKEN_SIZE] = server->resume_grace;
+	put_tcp(raw, 4 + RESUME_TOKEN_SIZE);
+}
+
+bool NetGameServerConnection::_new_token() {
+	if(NetGameCrypto::random_bytes(resume_token, RESUME_TOKEN_SIZE) != OK) {
+		WARN_PRINT("Unable to generate resume token");
+		// An all zero token never matches (see resume)
+		memset(resume_token, 0, RESUME_TOKEN_SIZE);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Probes carry a timestamp for the client to echo back (RTT)
+ */
+void NetGameServerConnection::_send_udp_ping(uint64_t time) {
+	// The address is only known once READY (always in UDP only mode)
+	if(state != READY && !udp_only) return;
+
+	uint8_t raw[4];
+	int len = 2;
 
 	raw[0] = CMD_MAX;
 	raw[1] = PCMD_PING;
+	if(keepalive.probe_due(time)) {
+		raw[2] = time & 0xFF;
+		raw[3] = (time >> 8) & 0xFF;
+		len = 4;
+		keepalive.probe_sent(time);
+	}
 	// UDP Ping
-	server->udp_server->set_send_address(udp_host, udp_port);
-	server->udp_server->put_packet(raw, 2);
+	put_udp(raw, len);
 }
 
 void NetGameServerConnection::_handle_tcp() {
-	uint8_t cmd, pcmd;
 	DVector<uint8_t> pkt;
 
 	tcp->get_packet_buffer(pkt);
 
-	if(pkt.size() < 2) {
+	if(server->secure) {
+		// First packet must be the client key, then all encrypted
+		if(!session.is_ready()) {
+			_handle_key(pkt);
+			return;
+		}
+		DVector<uint8_t> raw = pkt;
+		DVector<uint8_t>::Read r = raw.read();
+		if(session.open(CHANNEL_TCP, r.ptr(), raw.size(), 0, pkt) != OK) {
+			WARN_PRINT("Invalid encrypted TCP packet");
+			state = DISCONNECTED;
+			return;
+		}
+	}
+
+	_handle_tcp_packet(pkt);
+}
+
+/*
+ * A TCP packet, or a reliable packet in UDP only mode
+ */
+void NetGameServerConnection::_handle_tcp_packet(DVector<uint8_t> &pkt) {
+	uint8_t pcmd;
+	int cmd, hdr;
+	bool proto;
+
+	{
+		DVector<uint8_t>::Read r = pkt.read();
+		hdr = NetGameCommand::read_header(r.ptr(), pkt.size(),
+						proto, cmd, pcmd);
+	}
+	if(hdr == 0) {
 		// Invalid packet
 		return;
 	}
+	NetGameCommand::strip(pkt, hdr);
 
-	cmd = pkt.get(0);
-	pcmd = pkt.get(1);
-	pkt.remove(0);
-	pkt.remove(0);
-
-	if(cmd == CMD_MAX) {
+	if(proto) {
 		_handle_tcp_pcmd(pkt, pcmd);
 		return;
 	}
@@ -93,144 +462,371 @@ void NetGameServerConnection::_handle_tcp() {
 	}
 
 	if(!authed) {
-		server->_queue_signal(SIGNAL_AUTH_PACKET, id, pkt, cmd);
+		server->_queue_packet(SIGNAL_AUTH_PACKET, NULL, id, pkt, cmd);
+	}
+	else if(forward_peer != 0) {
+		server->bridge.send(forward_peer, BRIDGE_PACKET, id, cmd, pkt);
 	}
 	else {
-		server->_queue_signal(SIGNAL_TCP_PACKET, id, pkt, cmd);
+		server->_queue_packet(SIGNAL_TCP_PACKET, SIGNAL_TCP_MESSAGE,
+					id, pkt, cmd);
+	}
+}
+
+void NetGameServerConnection::_handle_key(const DVector<uint8_t> &pkt) {
+	if(pkt.size() != 34 || pkt[0] != CMD_MAX || pkt[1] != PCMD_KEY) {
+		state = DISCONNECTED;
+		return;
 	}
+
+	uint8_t peer[32];
+	DVector<uint8_t>::Read r = pkt.read();
+	memcpy(peer, r.ptr() + 2, 32);
+
+	if(session.setup(kx_priv, kx_pub, peer, true,
+			server->has_psk ? server->psk : NULL) != OK) {
+		state = DISCONNECTED;
+	}
+	memset(kx_priv, 0, 32);
 }
 
 void NetGameServerConnection::_handle_tcp_pcmd(DVector<uint8_t> &pkt,
 						uint8_t pcmd) {
-	if(pcmd == PCMD_AUTH) {
-		if(!authed || state != WAIT_AUTH || pkt.size() < 6) {
+	if(pcmd == PCMD_DISCONNECT) {
+		// Closed by the client, do not wait for a resume
+		state = DISCONNECTED;
+		disconnect_reason = DISCONNECT_CLOSE;
+	}
+	else if(pcmd == PCMD_CALL && state == READY) {
+		uint32_t rid;
+		int method;
+		Variant args;
+		if(NetGameRPC::parse_call(pkt, rid, method, args) == OK) {
+			server->_queue_signal(SIGNAL_RPC_REQUEST, id, rid, method,
+						args);
+		}
+	}
+	else if(pcmd == PCMD_RESULT && state == READY) {
+		server->rpc.complete(id, pkt);
+	}
+	else if(pcmd == PCMD_STREAM && state == READY) {
+		_handle_stream(pkt);
+	}
+	else if(pcmd == PCMD_AUTH) {
+		// READY clients rebind their UDP address the same way
+		if(!authed || (state != WAIT_AUTH && state != READY)) {
 			return;
 		}
 		IP_Address host;
-		int port = 0;
-		host.field[0] = pkt[0];
-		host.field[1] = pkt[1];
-		host.field[2] = pkt[2];
-		host.field[3] = pkt[3];
-		port |= ((pkt[4]<<8) | pkt[5]);
-
-		// Invalid auth
-		if(host != udp_host || port != udp_port) {
+		int port;
+		DVector<uint8_t>::Read r = pkt.read();
+		int len = NetGameAddress::decode(r.ptr(), pkt.size(), host, port);
+
+		// Invalid auth, the cookie proves the client got our UDP reply
+		if(len == 0 || pkt.size() != len + COOKIE_SIZE ||
+				!server->handshake.check_cookie(COOKIE_UDP, host, port,
+				id, secret, server->tick_time, r.ptr() + len)) {
 			state = DISCONNECTED;
 			return;
 		}
 
+		udp_host = host;
+		udp_port = port;
+		if(state == READY) {
+			return;
+		}
 		state = READY;
+		// UDP pings can start
+		server->timers.schedule_before(&timer, server->tick_time);
 		server->_queue_signal(SIGNAL_CLIENT_READY, id);
 	}
 }
 
+void NetGameServerConnection::_handle_udp_pcmd(DVector<uint8_t> &pkt,
+						uint8_t pcmd) {
+	if(udp_only && pcmd == PCMD_RELIABLE) {
+		if(pkt.size() < 2) {
+			return;
+		}
+		DVector<uint8_t>::Read r = pkt.read();
+		if(!reliable.receive(r[0] | (r[1] << 8), r.ptr() + 2,
+					pkt.size() - 2)) {
+			return;
+		}
+
+		uint8_t raw[4];
+		uint16_t next = reliable.get_ack();
+		raw[0] = CMD_MAX;
+		raw[1] = PCMD_ACK;
+		raw[2] = next & 0xFF;
+		raw[3] = next >> 8;
+		put_udp(raw, 4);
+
+		DVector<uint8_t> inner;
+		while(state != DISCONNECTED && reliable.pop(inner)) {
+			_handle_tcp_packet(inner);
+		}
+	}
+	else if(udp_only && pcmd == PCMD_ACK) {
+		if(pkt.size() < 2) {
+			return;
+		}
+		reliable.ack(pkt[0] | (pkt[1] << 8));
+	}
+	else if(udp_only && pcmd == PCMD_DISCONNECT) {
+		state = DISCONNECTED;
+		disconnect_reason = DISCONNECT_CLOSE;
+	}
+	else if(pcmd == PCMD_INPUT) {
+		if(state != READY) {
+			return;
+		}
+		server->inputs.receive(id, pkt);
+	}
+	else if(pcmd == PCMD_RELAY) {
+		if(state != READY) {
+			return;
+		}
+		server->_relay(this, pkt, PCMD_RELAY);
+	}
+	else if(pcmd == PCMD_MEDIA) {
+		if(state != READY) {
+			return;
+		}
+		server->_receive_media(this, pkt);
+	}
+	else if(pcmd == PCMD_REPLICA) {
+		if(state != READY || pkt.size() < 2) {
+			return;
+		}
+		server->replica.ack(replica_peer, pkt[0] | (pkt[1] << 8));
+	}
+	else if(pcmd == PCMD_PING && pkt.size() == 2) {
+		uint8_t raw[4];
+		raw[0] = CMD_MAX;
+		raw[1] = PCMD_PONG;
+		raw[2] = pkt[0];
+		raw[3] = pkt[1];
+		put_udp(raw, 4);
+	}
+	else if(pcmd == PCMD_PONG && pkt.size() == 2) {
+		keepalive.pong(pkt[0] | (pkt[1] << 8), server->tick_time);
+	}
+}
+
 void NetGameServerConnection::handle_udp(DVector<uint8_t> &pkt,
 						IP_Address addr, int port) {
 
-	uint8_t id, secret, cmd, time;
+	// flags is the pcmd for protocol commands
+	uint8_t id, secret, flags;
+	int cmd, hdr;
+	bool proto;
+
+	if(server->secure) {
+		// Id and secret are in clear (authenticated) to find the client
+		if(!session.is_ready()) {
+			return;
+		}
+		DVector<uint8_t> raw = pkt;
+		DVector<uint8_t>::Read r = raw.read();
+		if(session.open(CHANNEL_UDP, r.ptr(), raw.size(), 2, pkt) != OK) {
+			return;
+		}
+	}
 
 	if(pkt.size() < 4) {
 		WARN_PRINT("Invalid UDP Packet!");
 		return;
 	}
 
-	id = pkt.get(0);
-	secret = pkt.get(1);
-	cmd = pkt.get(2);
-	time = pkt.get(3);
-
-	pkt.remove(0);
-	pkt.remove(0);
-	pkt.remove(0);
-	pkt.remove(0);
+	{
+		DVector<uint8_t>::Read r = pkt.read();
+		id = r[0];
+		secret = r[1];
+		hdr = NetGameCommand::read_header(r.ptr() + 2, pkt.size() - 2,
+						proto, cmd, flags);
+	}
+	if(hdr == 0) {
+		WARN_PRINT("Invalid UDP Packet!");
+		return;
+	}
+	NetGameCommand::strip(pkt, 2 + hdr);
 
 	// Invalid secret
 	if(secret != this->secret)
 		return;
 
-	// If the client is waiting first packets then set addr and port
-	// and reply back with his addr and port
-	if(state == WAIT_AUTH) {
-		udp_time = OS::get_singleton()->get_ticks_msec();
-		udp_port = port;
-		udp_host = addr;
-		server->udp_server->set_send_address(addr, port);
-		server->udp_server->put_packet_buffer(build_address_packet());
+	// If the client is waiting first packets then reply back with his
+	// addr, port and a cookie. Nothing is stored, the address is bound
+	// when the client echoes the cookie over TCP.
+	if(state == WAIT_AUTH && !udp_only) {
+		uint64_t now = server->tick_time;
+		udp_time = now;
+		if(server->handshake.allow(addr, now)) {
+			DVector<uint8_t> reply = build_address_packet(addr, port, now);
+			DVector<uint8_t>::Read r = reply.read();
+			_put_udp_to(addr, port, r.ptr(), reply.size());
+		}
 		return;
 	}
 	// If the client was already authed we need to verify that its
-	// IP and port are correct
-	else if(udp_port != port || udp_host != addr) {
-		WARN_PRINT("Illegal UDP packet received");
+	// IP and port are correct. A new address (NAT rebind, network
+	// switch) gets the same cookie challenge as the first one.
+	else if(!NetGameAddress::equals(udp_host, udp_port, addr, port)) {
+		uint64_t now = server->tick_time;
+		// UDP only mode, the cookie comes back from the new address
+		if(udp_only && proto && flags == PCMD_AUTH) {
+			_handle_rebind(pkt, addr, port, now);
+			return;
+		}
+		if(state == READY && server->handshake.allow(addr, now)) {
+			DVector<uint8_t> reply = build_address_packet(addr, port, now);
+			DVector<uint8_t>::Read r = reply.read();
+			_put_udp_to(addr, port, r.ptr(), reply.size());
+		}
 		return;
 	}
 
-	udp_time = OS::get_singleton()->get_ticks_msec();
-	if(cmd == CMD_MAX) {
-		// TODO handle udp protocol commands
+	udp_time = server->tick_time;
+	if(proto) {
+		_handle_udp_pcmd(pkt, flags);
 		return;
 	}
 
-	// Check auth, size, time
-	if(!authed || pkt.size() < 1 || !_is_valid_time(cmd, time)) {
+	// Check auth, size, order
+	bool timed = flags & UDP_FLAG_TIMED;
+	if(!authed || pkt.size() < (timed ? 3 : 1)) {
 		return;
 	}
 
-	if(time != 0) {
-		client_time[cmd] = time;
+	if(timed) {
+		if(sequence.receive(cmd, pkt[0] | (pkt[1] << 8)) != SEQ_NEW) {
+			return;
+		}
+		pkt.remove(0);
+		pkt.remove(0);
 	}
 
-	server->_queue_signal(SIGNAL_UDP_PACKET, id, pkt, cmd);
+	if(forward_peer != 0) {
+		server->bridge.send(forward_peer, BRIDGE_PACKET, id, cmd, pkt);
+		return;
+	}
+	server->_queue_packet(SIGNAL_UDP_PACKET, SIGNAL_UDP_MESSAGE, id, pkt, cmd);
 }
 
 DVector<uint8_t> NetGameServerConnection::build_pkt(QueuedPacket *qp) {
 	DVector<uint8_t> out;
-	uint8_t cmd = qp->cmd;
-	out.append(cmd);
 
-	if(qp->timed) {
-		out.append(server_time[cmd]);
-		server_time[cmd] += 1;
-		if(server_time[cmd] == 0) {
-			server_time[cmd] = 1;
-		}
+	if(qp->proto) {
+		out.append(CMD_MAX);
+		out.append(qp->cmd);
+	}
+	else if(qp->timed) {
+		uint16_t seq = sequence.next(qp->cmd);
+		NetGameCommand::write_header(out, qp->cmd, UDP_FLAG_TIMED);
+		out.append(seq & 0xFF);
+		out.append(seq >> 8);
 	}
 	else {
-		out.append(0);
+		NetGameCommand::write_header(out, qp->cmd, 0);
 	}
 	out.append_array(qp->packet);
 	return out;
 }
 
-bool NetGameServerConnection::_is_valid_time(uint8_t cmd, uint8_t time) {
-	return time == 0 || client_time[cmd] == 0 ||
-		(client_time[cmd] < time && (time - client_time[cmd]) < 128) ||
-		(time < client_time[cmd] && (client_time[cmd] - time) > 128);
+void NetGameServerConnection::_handle_rebind(const DVector<uint8_t> &pkt,
+				const IP_Address &addr, int port, uint64_t time) {
+	IP_Address host;
+	int host_port;
+
+	if(state != READY) {
+		return;
+	}
+	// The echoed address is only framing, the cookie is checked against
+	// the one the packet came from
+	DVector<uint8_t>::Read r = pkt.read();
+	int len = NetGameAddress::decode(r.ptr(), pkt.size(), host, host_port);
+	if(len == 0 || pkt.size() != len + COOKIE_SIZE ||
+			!server->handshake.check_cookie(COOKIE_UDP, addr, port,
+				id, secret, time, r.ptr() + len)) {
+		return;
+	}
+	server->_move_udp_peer(this, addr, port);
+	udp_host = addr;
+	udp_port = port;
+	udp_time = time;
+}
+
+bool NetGameServerConnection::_is_tcp_lost(uint64_t time) {
+	return !stream_peer->is_connected() ||
+		tcp_time + keepalive.get_tcp_timeout() <= time;
 }
 
-bool NetGameServerConnection::is_connected() {
-	int time = OS::get_singleton()->get_ticks_msec();
+/*
+ * Take over a new TCP socket for this client, the caller already checked
+ * the connection cookie
+ */
+bool NetGameServerConnection::resume(const Ref<StreamPeerTCP> &p,
+					const uint8_t *token) {
+	static const uint8_t zero[RESUME_TOKEN_SIZE] = { 0 };
+
+	if(state != READY || (suspended && !is_connected(server->tick_time)) ||
+			NetGameCrypto::equals(resume_token, zero, RESUME_TOKEN_SIZE) ||
+			!NetGameCrypto::equals(resume_token, token, RESUME_TOKEN_SIZE)) {
+		return false;
+	}
+
+	if(stream_peer->is_connected()) {
+		stream_peer->disconnect();
+	}
+	stream_peer = p;
+	tcp = Ref<PacketPeerStream>( memnew(PacketPeerStream) );
+	tcp->set_stream_peer(stream_peer);
+	suspended = false;
+	tcp_time = server->tick_time;
+	keepalive.sent_tcp(tcp_time);
+	udp_time = tcp_time;
+	_send_resume();
+	// Back from the suspend deadline to the ping ones
+	server->timers.schedule(&timer, server->tick_time);
+	return true;
+}
+
+bool NetGameServerConnection::is_connected(uint64_t time) {
+	if(udp_only) {
+		return state != DISCONNECTED &&
+			udp_time + keepalive.get_udp_timeout() > time;
+	}
+	if(suspended) {
+		return state != DISCONNECTED &&
+			suspend_time + server->resume_grace > time;
+	}
 	return state != DISCONNECTED
 		&& stream_peer->is_connected()
-		&& udp_time + TIMEOUT > time
-		&& tcp_time + TIMEOUT > time;
+		&& udp_time + keepalive.get_udp_timeout() > time
+		&& tcp_time + keepalive.get_tcp_timeout() > time;
 }
 
-DVector<uint8_t> NetGameServerConnection::build_address_packet() {
+DVector<uint8_t> NetGameServerConnection::build_address_packet(
+			const IP_Address &host, int port, uint64_t time) {
 	DVector<uint8_t> pkt;
-	pkt.append(CMD_MAX);
-	pkt.append(PCMD_AUTH);
-	pkt.append(udp_host.field[0]);
-	pkt.append(udp_host.field[1]);
-	pkt.append(udp_host.field[2]);
-	pkt.append(udp_host.field[3]);
-	pkt.append(udp_port>>8);
-	pkt.append(udp_port);
+	int len = NetGameAddress::get_size(host);
+
+	// [CMD_MAX][PCMD_AUTH][address][cookie]
+	pkt.resize(2 + len + COOKIE_SIZE);
+	{
+		DVector<uint8_t>::Write w = pkt.write();
+		w[0] = CMD_MAX;
+		w[1] = PCMD_AUTH;
+		NetGameAddress::encode(host, port, w.ptr() + 2);
+		server->handshake.make_cookie(COOKIE_UDP, host, port, id,
+					secret, time, w.ptr() + 2 + len);
+	}
 	return pkt;
 }
 
-Error NetGameServerConnection::enqueue_tcp(const DVector<uint8_t> &pkt, uint8_t cmd) {
+Error NetGameServerConnection::enqueue_tcp(const DVector<uint8_t> &pkt, int cmd) {
+	ERR_FAIL_INDEX_V(cmd, CMD_LIMIT, ERR_INVALID_PARAMETER);
 	if(tcp_queue.size() >= PKT_QUEUE_SIZE) {
 		WARN_PRINT("TCP QUEUE SIZE EXCEEDED");
 		return ERR_OUT_OF_MEMORY;
@@ -247,31 +843,180 @@ Error NetGameServerConnection::enqueue_tcp(const DVector<uint8_t> &pkt, uint8_t
 	return OK;
 }
 
-NetGameServerConnection::NetGameServerConnection(CID id, CSE s, Ref<StreamPeerTCP> p, NetGameServer *srv) {
-	int i;
+/*
+ * Protocol packet sent in order with the queued TCP packets (RPC)
+ */
+Error NetGameServerConnection::enqueue_pcmd(const DVector<uint8_t> &pkt,
+						uint8_t pcmd) {
+	if(tcp_queue.size() >= PKT_QUEUE_SIZE) {
+		WARN_PRINT("TCP QUEUE SIZE EXCEEDED");
+		return ERR_OUT_OF_MEMORY;
+	}
 
-	for(i = 0; i < 256; i++)
-	{
-		client_time[i] = 0;
-		server_time[i] = 1;
+	QueuedPacket *qp = (QueuedPacket *) memnew(QueuedPacket);
+	qp->id = id;
+	qp->packet = pkt;
+	qp->cmd = pcmd;
+	qp->proto = true;
+	out_mutex->lock();
+	tcp_queue.insert(tcp_queue.size(), qp);
+	out_mutex->unlock();
+	return OK;
+}
+
+Error NetGameServerConnection::put_tcp(const uint8_t *p_buf, int p_len) {
+	if(udp_only) {
+		DVector<uint8_t> pkt;
+		Error err = reliable.send(p_buf, p_len, server->tick_time, pkt);
+		if(err != OK) {
+			return err;
+		}
+		server->timers.schedule_before(&timer,
+				server->tick_time + RELIABLE_RTO);
+		return put_udp(pkt);
 	}
 
+	keepalive.sent_tcp(server->tick_time);
+	if(!server->secure) {
+		return tcp->put_packet(p_buf, p_len);
+	}
+
+	DVector<uint8_t> out;
+	Error err = session.seal(CHANNEL_TCP, p_buf, p_len, 0, out);
+	if(err != OK) {
+		return err;
+	}
+	return tcp->put_packet_buffer(out);
+}
+
+Error NetGameServerConnection::put_tcp(const DVector<uint8_t> &pkt) {
+	DVector<uint8_t>::Read r = pkt.read();
+	return put_tcp(r.ptr(), pkt.size());
+}
+
+Error NetGameServerConnection::put_udp(const uint8_t *p_buf, int p_len) {
+	keepalive.sent_udp(server->tick_time);
+	return _put_udp_to(udp_host, udp_port, p_buf, p_len);
+}
+
+Error NetGameServerConnection::_put_udp_to(const IP_Address &host, int port,
+					const uint8_t *p_buf, int p_len) {
+	server->udp_server->set_send_address(host, port);
+	if(!server->secure) {
+		return server->udp_server->put_packet(p_buf, p_len);
+	}
+
+	DVector<uint8_t> out;
+	Error err = session.seal(CHANNEL_UDP, p_buf, p_len, 0, out);
+	if(err != OK) {
+		return err;
+	}
+	return server->udp_server->put_packet_buffer(out);
+}
+
+Error NetGameServerConnection::put_udp(const DVector<uint8_t> &pkt) {
+	DVector<uint8_t>::Read r = pkt.read();
+	return put_udp(r.ptr(), pkt.size());
+}
+
+void NetGameServerConnection::_init(CID id, CSE s, NetGameServerCore *srv) {
 	this->id = id;
 	secret = s;
-	stream_peer = p;
-	tcp = Ref<PacketPeerStream>( memnew(PacketPeerStream) );
-	tcp->set_stream_peer(stream_peer);
 	state = WAIT_AUTH;
-	udp_ping = OS::get_singleton()->get_ticks_msec();
-	udp_time = udp_ping;
-	tcp_time = udp_ping;
-	tcp_ping = udp_ping;
+	udp_time = OS::get_singleton()->get_ticks_msec();
+	tcp_time = udp_time;
+	keepalive.configure(srv->keepalive_interval, srv->tcp_keepalive_interval,
+			srv->keepalive_timeout, srv->keepalive_min_timeout);
+	keepalive.reset(udp_time);
 	udp_port = 0;
 	authed = false;
+	auth_sent = false;
+	suspended = false;
+	suspend_time = 0;
+	udp_only = false;
+	disconnect_reason = DISCONNECT_NONE;
+	forward_peer = 0;
+	migrate_state = MIGRATE_NONE;
+	migrate_peer = 0;
+	migrate_id = 0;
+	memset(resume_token, 0, RESUME_TOKEN_SIZE);
 	server = srv;
+	timer.owner = this;
 	out_mutex = Mutex::create();
 }
 
+NetGameServerConnection::NetGameServerConnection(CID id, CSE s, Ref<StreamPeerTCP> p, NetGameServerCore *srv) {
+	_init(id, s, srv);
+	stream_peer = p;
+	tcp = Ref<PacketPeerStream>( memnew(PacketPeerStream) );
+	tcp->set_stream_peer(stream_peer);
+
+	// Secure mode, start the key exchange right away so that auth
+	// packets are already encrypted
+	if(server->secure) {
+		if(NetGameSession::generate_keypair(kx_priv, kx_pub) != OK) {
+			WARN_PRINT("Unable to generate session key");
+			state = DISCONNECTED;
+			return;
+		}
+		uint8_t raw[34];
+		raw[0] = CMD_MAX;
+		raw[1] = PCMD_KEY;
+		memcpy(raw + 2, kx_pub, 32);
+		tcp->put_packet(raw, 34);
+	}
+}
+
+/*
+ * UDP only client, its address was checked by the handshake cookie and,
+ * in secure mode, its key came with it
+ */
+NetGameServerConnection::NetGameServerConnection(CID id, CSE s,
+			const IP_Address &host, int port, const uint8_t *peer_key,
+			NetGameServerCore *srv) {
+	_init(id, s, srv);
+	udp_only = true;
+	udp_host = host;
+	udp_port = port;
+
+	if(server->secure) {
+		if(peer_key == NULL ||
+				NetGameSession::generate_keypair(kx_priv, kx_pub) != OK ||
+				session.setup(kx_priv, kx_pub, peer_key, true,
+					server->has_psk ? server->psk : NULL) != OK) {
+			WARN_PRINT("Unable to setup session");
+			state = DISCONNECTED;
+		}
+		memset(kx_priv, 0, 32);
+	}
+}
+
+/*
+ * Session exported by another process (see save_state), suspended until
+ * the client resumes it on this one
+ */
+NetGameServerConnection::NetGameServerConnection(const uint8_t *p_state,
+			NetGameServerCore *srv) {
+	_init(p_state[0], p_state[1], srv);
+	stream_peer = StreamPeerTCP::create_ref();
+	tcp = Ref<PacketPeerStream>( memnew(PacketPeerStream) );
+	tcp->set_stream_peer(stream_peer);
+
+	memcpy(resume_token, p_state + 2, RESUME_TOKEN_SIZE);
+	p_state += 2 + RESUME_TOKEN_SIZE;
+	udp_host.set_ipv6(p_state);
+	udp_port = (p_state[ADDRESS_SIZE] << 8) | p_state[ADDRESS_SIZE + 1];
+	if(server->secure) {
+		session.load_state(p_state + ADDRESS_SIZE + 2);
+	}
+
+	state = READY;
+	authed = true;
+	auth_sent = true;
+	suspended = true;
+	suspend_time = OS::get_singleton()->get_ticks_msec();
+}
+
 NetGameServerConnection::~NetGameServerConnection() {
 	// Clear the TCP queue
 	out_mutex->lock();
@@ -4,10 +4,22 @@
 #include "reference.h"
 #include "io/tcp_server.h"
 #include "io/packet_peer_udp.h"
-#include "modules/netgame/net_game_server.h"
+#include "modules/netgame/net_game_server_core.h"
 #include "modules/netgame/net_game_server_data.h"
+#include "modules/netgame/net_game_replica.h"
+#include "modules/netgame/net_game_session.h"
+#include "modules/netgame/net_game_reliable.h"
+#include "modules/netgame/net_game_keepalive.h"
+#include "modules/netgame/net_game_timer.h"
+#include "modules/netgame/net_game_sequence.h"
+#include "modules/netgame/net_game_command.h"
+#include "modules/netgame/net_game_address.h"
+#include "modules/netgame/net_game_transfer.h"
 
-class NetGameServer;
+// [id][secret][token][udp host][udp port]
+#define CONNECTION_STATE_SIZE (2 + RESUME_TOKEN_SIZE + ADDRESS_SIZE + 2)
+
+class NetGameServerCore;
 
 class NetGameServerConnection: public Reference {
 	OBJ_TYPE(NetGameServerConnection,Reference);
@@ -15,39 +27,95 @@ class NetGameServerConnection: public Reference {
 	Mutex *out_mutex;
 	Vector<QueuedPacket*> tcp_queue;
 	Ref<StreamPeerTCP> stream_peer;
-	uint8_t server_time[256];
-	uint8_t client_time[256];
-	int udp_time;
-	int tcp_time;
-	int udp_ping;
-	int tcp_ping;
+	uint64_t udp_time;
+	uint64_t tcp_time;
+	NetGameSession session;
+	uint8_t kx_priv[32];
+	uint8_t kx_pub[32];
+	uint8_t resume_token[RESUME_TOKEN_SIZE];
+	bool suspended;
+	uint64_t suspend_time;
+	NetGameReliable reliable;
 
 	Error _get_tcp_packet(DVector<uint8_t> &pkt);
-	bool _is_valid_time(uint8_t cmd, uint8_t time);
-	void _send_udp_ping();
+	void _send_udp_ping(uint64_t time);
 	void _send_tcp_ping();
+	void _send_auth();
+	void _send_resume();
+	bool _new_token();
+	bool _is_tcp_lost(uint64_t time);
+	void _check_alive(uint64_t time);
+	void _update_io(uint64_t time);
+	uint64_t _next_deadline(uint64_t time);
+	void _init(CID id, CSE s, NetGameServerCore *srv);
 	void _handle_tcp();
+	void _handle_tcp_packet(DVector<uint8_t> &pkt);
+	void _handle_rebind(const DVector<uint8_t> &pkt, const IP_Address &addr,
+				int port, uint64_t time);
 	void _handle_tcp_pcmd(DVector<uint8_t> &pkt, uint8_t pcmd);
+	void _handle_udp_pcmd(DVector<uint8_t> &pkt, uint8_t pcmd);
+	void _handle_key(const DVector<uint8_t> &pkt);
+	void _handle_stream(const DVector<uint8_t> &pkt);
+	void _pump_streams();
+	void _queue_events(const Vector<TransferEvent> &events);
+	void _migrate();
+	void _migrate_failed();
+	Error _put_udp_to(const IP_Address &host, int port,
+				const uint8_t *p_buf, int p_len);
 
 public:
 	Ref<PacketPeerStream> tcp;
-	NetGameServer *server;
+	NetGameServerCore *server;
 	CID id;
 	CSE secret;
 	IP_Address udp_host;
 	ClientState state;
 	int udp_port;
 	bool authed;
+	bool auth_sent;
+	bool udp_only;
+	DisconnectReason disconnect_reason;
+	NetGameKeepalive keepalive;
+	NetGameTimer timer;
+	NetGameSequence sequence;
+	NetGameReplicaPeer replica_peer;
+	NetGameTransfer transfer;
+	// Bridge peer getting the client packets, 0 for none
+	CID forward_peer;
+	MigrateState migrate_state;
+	CID migrate_peer;
+	// Id given by the peer, the client takes it there
+	CID migrate_id;
+	// PCMD_MIGRATE body: [new id][address with tcp port][udp port 2]
+	DVector<uint8_t> migrate_target;
+	Dictionary migrate_data;
 
-	void on_update();
+	bool on_update(uint64_t time);
+	void on_timer(uint64_t time);
 	void handle_udp(DVector<uint8_t> &pkt, IP_Address addr, int port);
-	Error enqueue_tcp(const DVector<uint8_t> &pkt, uint8_t cmd);
-	bool is_connected();
+	Error enqueue_tcp(const DVector<uint8_t> &pkt, int cmd);
+	Error enqueue_pcmd(const DVector<uint8_t> &pkt, uint8_t pcmd);
+	Error put_tcp(const uint8_t *p_buf, int p_len);
+	Error put_tcp(const DVector<uint8_t> &pkt);
+	Error put_udp(const uint8_t *p_buf, int p_len);
+	Error put_udp(const DVector<uint8_t> &pkt);
+	bool is_connected(uint64_t time);
+	bool resume(const Ref<StreamPeerTCP> &p, const uint8_t *token);
+	void send_welcome();
+	void send_disconnect(DisconnectReason reason);
+	bool is_flushed() const;
+	bool can_export() const;
+	int get_state_size() const;
+	void save_state(uint8_t *out) const;
 	DVector<uint8_t> build_pkt(QueuedPacket *qp);
-	DVector<uint8_t> build_address_packet();
+	DVector<uint8_t> build_address_packet(const IP_Address &host, int port,
+						uint64_t time);
 
 	NetGameServerConnection(CID id, CSE s, Ref<StreamPeerTCP> p,
-				NetGameServer *srv);
+				NetGameServerCore *srv);
+	NetGameServerConnection(CID id, CSE s, const IP_Address &host, int port,
+				const uint8_t *peer_key, NetGameServerCore *srv);
+	NetGameServerConnection(const uint8_t *p_state, NetGameServerCore *srv);
 	~NetGameServerConnection();
 };
 
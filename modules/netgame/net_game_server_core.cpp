@@ -0,0 +1,2304 @@
+
+#include <modules/netgame/net_game_server_core.h>
+#include "io/marshalls.h"
+
+/*
+ * PROCESS and FIXED queue the signals until poll(), THREADED emits them
+ * from the network thread
+ */
+void NetGameServerCore::set_signal_mode(SignalsMode p_mode) {
+	signal_mode = p_mode;
+}
+
+SignalsMode NetGameServerCore::get_signal_mode() const{
+	return signal_mode;
+}
+
+void NetGameServerCore::set_secure(bool p_secure) {
+	ERR_FAIL_COND(!quit);
+	secure = p_secure;
+}
+
+bool NetGameServerCore::is_secure() const {
+	return secure;
+}
+
+void NetGameServerCore::set_secure_key(const String &p_key) {
+	ERR_FAIL_COND(!quit);
+	has_psk = !p_key.empty();
+	if(has_psk) {
+		NetGameSession::derive_psk(p_key, psk);
+	}
+}
+
+void NetGameServerCore::set_handshake_rate(int p_rate) {
+	handshake.set_rate(p_rate);
+}
+
+int NetGameServerCore::get_handshake_rate() const {
+	return handshake.get_rate();
+}
+
+void NetGameServerCore::set_resume_grace(int p_msec) {
+	// Sent to clients in 16 bits
+	ERR_FAIL_COND(p_msec < 0 || p_msec > RESUME_GRACE_MAX);
+	resume_grace = p_msec;
+}
+
+int NetGameServerCore::get_resume_grace() const {
+	return resume_grace;
+}
+
+/*
+ * Applied to connected clients too, their timers fire on the next tick
+ * as deadlines may be shorter
+ */
+void NetGameServerCore::_update_keepalive() {
+	conn_mutex->lock();
+	for(int i = 0; i < connections.size(); i++) {
+		NetGameServerConnection *cd = connections.getv(i);
+		cd->keepalive.configure(keepalive_interval,
+				tcp_keepalive_interval, keepalive_timeout,
+				keepalive_min_timeout);
+		timers.schedule(&cd->timer, 0);
+	}
+	conn_mutex->unlock();
+}
+
+void NetGameServerCore::set_keepalive_interval(int p_msec) {
+	ERR_FAIL_COND(p_msec <= 0);
+	keepalive_interval = p_msec;
+	_update_keepalive();
+}
+
+int NetGameServerCore::get_keepalive_interval() const {
+	return keepalive_interval;
+}
+
+void NetGameServerCore::set_tcp_keepalive_interval(int p_msec) {
+	ERR_FAIL_COND(p_msec <= 0);
+	tcp_keepalive_interval = p_msec;
+	_update_keepalive();
+}
+
+int NetGameServerCore::get_tcp_keepalive_interval() const {
+	return tcp_keepalive_interval;
+}
+
+void NetGameServerCore::set_keepalive_timeout(int p_msec) {
+	ERR_FAIL_COND(p_msec <= 0);
+	keepalive_timeout = p_msec;
+	_update_keepalive();
+}
+
+int NetGameServerCore::get_keepalive_timeout() const {
+	return keepalive_timeout;
+}
+
+void NetGameServerCore::set_keepalive_min_timeout(int p_msec) {
+	ERR_FAIL_COND(p_msec <= 0);
+	keepalive_min_timeout = p_msec;
+	_update_keepalive();
+}
+
+int NetGameServerCore::get_keepalive_min_timeout() const {
+	return keepalive_min_timeout;
+}
+
+/*
+ * Per client policy (e.g. longer for clients known to be on mobile)
+ */
+Error NetGameServerCore::set_client_keepalive(int id, int interval,
+					int timeout) {
+	ERR_FAIL_COND_V(interval <= 0 || timeout <= 0, ERR_INVALID_PARAMETER);
+	conn_mutex->lock();
+	NetGameServerConnection *cd = _get_client(id);
+	if(cd == NULL) {
+		conn_mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	cd->keepalive.configure(interval, tcp_keepalive_interval, timeout,
+				keepalive_min_timeout);
+	timers.schedule(&cd->timer, 0);
+	conn_mutex->unlock();
+	return OK;
+}
+
+/*
+ * Smoothed RTT in msec, -1 until measured
+ */
+int NetGameServerCore::get_client_rtt(int id) {
+	conn_mutex->lock();
+	NetGameServerConnection *cd = _get_client(id);
+	int out = cd != NULL ? cd->keepalive.get_rtt() : -1;
+	conn_mutex->unlock();
+	return out;
+}
+
+/*
+ * Timed packets received from a client: received, lost, late and
+ * duplicate counts, for one command or all of them (-1)
+ */
+Dictionary NetGameServerCore::get_udp_stats(int id, int cmd) {
+	Dictionary out;
+	conn_mutex->lock();
+	NetGameServerConnection *cd = _get_client(id);
+	if(cd != NULL) {
+		out = cd->sequence.get_stats(cmd);
+	}
+	conn_mutex->unlock();
+	return out;
+}
+
+void NetGameServerCore::set_signal_target(Object *p_target) {
+	signal_target = p_target;
+}
+
+Object *NetGameServerCore::_get_signal_target() {
+	return signal_target != NULL ? signal_target : this;
+}
+
+/*
+ * Emit the queued signals, for at most max_usec (0 means all of them).
+ * Returns the number of signals emitted.
+ */
+int NetGameServerCore::poll(int max_usec) {
+	int count = 0;
+	uint64_t start = OS::get_singleton()->get_ticks_usec();
+	Object *target = _get_signal_target();
+
+	while(signal_queue.size() > 0) {
+		if(max_usec > 0 && count > 0 &&
+			OS::get_singleton()->get_ticks_usec() - start >= (uint64_t)max_usec) {
+			break;
+		}
+		// Only this thread removes from the queue
+		// it is safe to lock here
+		signal_mutex->lock();
+		QueuedSignal *qs = signal_queue.get(0);
+		signal_queue.remove(0);
+		signal_mutex->unlock();
+		if(qs->has_frame) {
+			target->emit_signal(qs->signal, qs->id, qs->rid,
+						qs->timestamp, qs->packet);
+		}
+		else if(qs->has_args) {
+			target->emit_signal(qs->signal, qs->id, qs->rid, qs->cmd,
+						qs->args);
+		}
+		else if(qs->has_msg) {
+			target->emit_signal(qs->signal, qs->id, qs->cmd, qs->msg);
+		}
+		else if(qs->has_pkt) {
+			target->emit_signal(qs->signal, qs->id, qs->cmd, qs->packet);
+		}
+		else {
+			target->emit_signal(qs->signal, qs->id);
+		}
+		memdelete(qs);
+		count++;
+	}
+	count += rpc.dispatch(OS::get_singleton()->get_ticks_msec());
+	return count;
+}
+
+void NetGameServerCore::_server_tick() {
+	if(quit) {
+		return;
+	}
+	// The clock is read once, everything in this tick uses it
+	uint64_t time = OS::get_singleton()->get_ticks_msec();
+	tick_time = time;
+
+	// Accept new connections
+	_check_connections(time);
+
+	// Handle incoming packets
+	_handle_udp(time);
+
+	// Update clients (timers, tcp packets)
+	_handle_tcp(time);
+
+	// Media frames held for the late packets
+	_media_tick(time);
+
+	// Sibling servers, after the clients queued their migrations
+	_bridge_tick(time);
+
+	// Send replicated state changes
+	_replicate(time);
+
+	// Cleanup disconnected clients
+	_remove_stale_clients();
+
+	// RPC results and timeouts, poll() does it in the other modes
+	if(signal_mode == THREADED) {
+		rpc.dispatch(time);
+	}
+}
+
+/**
+ * Main UDP/TCP server loop
+ */
+void NetGameServerCore::_thread_start(void*s) {
+	NetGameServerCore *self = (NetGameServerCore*) s;
+
+	while (!self->quit) {
+		self->_server_tick();
+		OS::get_singleton()->delay_usec(SERVER_SLEEP_USEC);
+	}
+
+	// Close all connections
+	self->_clear_pending();
+	self->_clear_clients();
+}
+
+void NetGameServerCore::_clear_queues() {
+	// Clear UDP queue
+	outbox.clear();
+
+	// Clear Signal queue
+	signal_mutex->lock();
+	while(signal_queue.size() > 0) {
+		QueuedSignal *qs = signal_queue.get(0);
+		signal_queue.remove(0);
+		memdelete(qs);
+	}
+	signal_mutex->unlock();
+}
+
+/***
+ * Run the expired client timers (timeouts, resends, pings), then the
+ * socket work of every client. Dead clients are removed at the end of
+ * the tick by _remove_stale_clients.
+ */
+void NetGameServerCore::_handle_tcp(uint64_t time) {
+	int i;
+
+	conn_mutex->lock();
+	expired.clear();
+	timers.advance(time, expired);
+	for (i = 0; i < expired.size(); i++) {
+		((NetGameServerConnection*)expired[i]->owner)->on_timer(time);
+	}
+
+	for (i = 0; i < connections.size(); i++) {
+		NetGameServerConnection *cd = connections.getv(i);
+		if(!cd->on_update(time)) {
+			stale.push_back(cd->id);
+		}
+		outbox.publish(cd->id, cd->state == READY);
+	}
+	conn_mutex->unlock();
+}
+
+/***
+ * Send the packets staged by the game threads. Packets for a client that
+ * left meanwhile (generation changed) are dropped.
+ */
+void NetGameServerCore::_flush_outbox() {
+	int i, j;
+
+	outgoing.clear();
+	outbox.take(outgoing);
+	if(outgoing.size() == 0) {
+		return;
+	}
+
+	conn_mutex->lock();
+	for(i = 0; i < outgoing.size(); i++) {
+		QueuedPacket *qp = outgoing[i];
+		if(qp->gen == OUTBOX_ALL) {
+			for(j = 0; j < connections.size(); j++) {
+				NetGameServerConnection *cd = connections.getv(j);
+				if(cd->state != READY) {
+					continue;
+				}
+				cd->put_udp(cd->build_pkt(qp));
+				if(recorder.is_valid() && !qp->proto) {
+					recorder->record(RECORD_SEND_UDP, qp->timed,
+							cd->id, qp->cmd, qp->packet);
+				}
+			}
+		}
+		else if(NetGameOutbox::get_generation(outbox.lookup(qp->id)) ==
+				qp->gen) {
+			NetGameServerConnection *cd = _get_client(qp->id);
+			if(cd != NULL) {
+				cd->put_udp(cd->build_pkt(qp));
+			}
+		}
+		memdelete(qp);
+	}
+	conn_mutex->unlock();
+	outgoing.clear();
+}
+
+/***
+ * Manage UDP packets
+ */
+void NetGameServerCore::_handle_udp(uint64_t time) {
+	DVector<uint8_t> raw;
+	NetGameServerConnection *cd;
+
+	// Flush packets queue
+	_flush_outbox();
+
+	// Handle incoming packets
+	int count = 0;
+	while(count++ < UDP_BATCH &&
+			udp_server->get_available_packet_count() > 0) {
+		const uint8_t *buf;
+		int len;
+
+		// Packets for unknown ids are dropped before any copy
+		if(udp_server->get_packet(&buf, len) != OK || len < 1) {
+			continue;
+		}
+		if(buf[0] == HANDSHAKE_ID) {
+			_handle_udp_handshake(buf, len,
+					udp_server->get_packet_address(),
+					udp_server->get_packet_port(), time);
+			continue;
+		}
+		// Locked, the client timer may be rescheduled
+		conn_mutex->lock();
+		cd = _get_client(buf[0]);
+		if(cd == NULL) {
+			conn_mutex->unlock();
+			continue;
+		}
+
+		raw.resize(len);
+		{
+			DVector<uint8_t>::Write w = raw.write();
+			memcpy(w.ptr(), buf, len);
+		}
+
+		cd->handle_udp(raw,
+				udp_server->get_packet_address(),
+				udp_server->get_packet_port());
+		conn_mutex->unlock();
+	}
+}
+
+/***
+ * UDP only handshake, stateless until the cookie comes back:
+ * hello    [0][0][CMD_MAX][PCMD_HELLO][padding to HELLO_SIZE]
+ *  -> [CMD_MAX][PCMD_COOKIE][cookie]
+ * echo     [0][0][CMD_MAX][PCMD_COOKIE][cookie]([client key] if secure)
+ *  -> [CMD_MAX][PCMD_WELCOME][id][secret]([server key] if secure)
+ * The hello is padded so that replies are never bigger than requests.
+ */
+void NetGameServerCore::_handle_udp_handshake(const uint8_t *buf, int len,
+					const IP_Address &addr, int port,
+					uint64_t time) {
+	if(!udp_only || draining || len < 4 || buf[2] != CMD_MAX) {
+		return;
+	}
+
+	if(buf[3] == PCMD_HELLO) {
+		if(len < HELLO_SIZE || !handshake.allow(addr, time)) {
+			return;
+		}
+		uint8_t raw[2 + COOKIE_SIZE];
+		raw[0] = CMD_MAX;
+		raw[1] = PCMD_COOKIE;
+		handshake.make_cookie(COOKIE_HELLO, addr, port, 0, 0, time,
+					raw + 2);
+		_put_udp_raw(addr, port, raw, sizeof(raw));
+	}
+	else if(buf[3] == PCMD_COOKIE) {
+		if(len != 4 + COOKIE_SIZE + (secure ? 32 : 0) ||
+				!handshake.check_cookie(COOKIE_HELLO, addr, port,
+							0, 0, time, buf + 4)) {
+			return;
+		}
+
+		// Lost welcome, the client echoes its cookie again
+		conn_mutex->lock();
+		CID *id = udp_peers.getptr(_udp_peer_key(addr, port));
+		if(id != NULL) {
+			NetGameServerConnection *cd = _get_client(*id);
+			if(cd != NULL && cd->state == WAIT_AUTH) {
+				cd->send_welcome();
+			}
+			conn_mutex->unlock();
+			return;
+		}
+		conn_mutex->unlock();
+
+		if(!handshake.allow(addr, time)) {
+			return;
+		}
+		_add_udp_client(addr, port, secure ? buf + 4 + COOKIE_SIZE : NULL);
+	}
+}
+
+void NetGameServerCore::_add_udp_client(const IP_Address &addr, int port,
+					const uint8_t *peer_key) {
+	conn_mutex->lock();
+	if(connections.size() + migrations_in.size() >= CMD_MAX) {
+		conn_mutex->unlock();
+		return;
+	}
+	NetGameServerConnection *cd = memnew(
+		NetGameServerConnection(_get_id(), _get_secret(), addr, port,
+					peer_key, this));
+	CID id = cd->id;
+	connections.insert(id, cd);
+	udp_peers.set(_udp_peer_key(addr, port), id);
+	timers.schedule(&cd->timer, 0);
+	cd->send_welcome();
+	conn_mutex->unlock();
+
+	_queue_signal(SIGNAL_CLIENT_CONNECT, id);
+}
+
+uint64_t NetGameServerCore::_udp_peer_key(const IP_Address &host, int port) {
+	return handshake.peer_key(host, port);
+}
+
+void NetGameServerCore::_move_udp_peer(NetGameServerConnection *cd,
+				const IP_Address &host, int port) {
+	udp_peers.erase(_udp_peer_key(cd->udp_host, cd->udp_port));
+	udp_peers.set(_udp_peer_key(host, port), cd->id);
+}
+
+/*
+ * Send a datagram as is (no session), for handshake replies
+ */
+Error NetGameServerCore::_put_udp_raw(const IP_Address &host, int port,
+				const uint8_t *p_buf, int p_len) {
+	udp_server->set_send_address(host, port);
+	return udp_server->put_packet(p_buf, p_len);
+}
+
+/***
+ * Send each ready client the replicated fields it has not acked yet
+ */
+void NetGameServerCore::_replicate(uint64_t time) {
+	int i;
+
+	if(replica_rate <= 0 || time < replica_time) {
+		return;
+	}
+	replica_time = time + 1000 / replica_rate;
+
+	uint32_t min_acked = replica.get_version();
+	DVector<uint8_t> pkt;
+
+	conn_mutex->lock();
+	for (i = 0; i < connections.size(); i++) {
+		NetGameServerConnection *cd = connections.getv(i);
+		if(cd->state != READY) {
+			continue;
+		}
+		if(replica.build_update(cd->replica_peer, pkt)) {
+			cd->put_udp(pkt);
+		}
+		min_acked = MIN(min_acked, cd->replica_peer.acked);
+	}
+	conn_mutex->unlock();
+
+	replica.collect(min_acked);
+}
+
+/***
+ * Free client and send disconnect signal
+ */
+void NetGameServerCore::_delete_client(NetGameServerConnection *cd) {
+	Vector<TransferEvent> streams;
+	int i;
+
+	conn_mutex->lock();
+	timers.cancel(&cd->timer);
+	outbox.unpublish(cd->id);
+	rpc.cancel_peer(cd->id);
+	cd->transfer.clear(streams);
+	interest.remove_client(cd->id);
+	inputs.remove_client(cd->id);
+	relay.remove_client(cd->id);
+	media.remove(cd->id);
+	if(cd->udp_only) {
+		udp_peers.erase(_udp_peer_key(cd->udp_host, cd->udp_port));
+	}
+	conn_mutex->unlock();
+	if(!quit) {
+		for(i = 0; i < streams.size(); i++) {
+			_queue_signal(streams[i].signal, cd->id, streams[i].sid,
+					streams[i].value, streams[i].arg);
+		}
+		_queue_signal(SIGNAL_CLIENT_DISCONNECT, cd->id);
+	}
+	memdelete(cd);
+}
+
+/**
+ * Remove the clients found dead in this tick
+ */
+void NetGameServerCore::_remove_stale_clients() {
+	int i = 0;
+
+	conn_mutex->lock();
+	for (i = 0; i < stale.size(); ++i) {
+		NetGameServerConnection *cd = _get_client(stale[i]);
+		if(cd != NULL) {
+			connections.erase(stale[i]);
+			_delete_client(cd);
+		}
+	}
+	stale.clear();
+	conn_mutex->unlock();
+}
+
+/***
+ * Remove all clients
+ */
+void NetGameServerCore::_clear_clients() {
+	int i = 0;
+
+	conn_mutex->lock();
+	for (i = 0; i < connections.size(); ++i) {
+		NetGameServerConnection *cd = connections.getv(i);
+		cd->send_disconnect(stop_reason);
+		_delete_client(cd);
+	}
+	connections.clear();
+	interest.clear();
+	inputs.clear();
+	relay.clear();
+	media.clear();
+	conn_mutex->unlock();
+}
+
+/***
+ * Accept new connections.
+ * A new TCP peer only gets a stateless cookie, it is promoted to a client
+ * (id, buffers, signals) once it echoes it back. Accepts are rate limited
+ * per IP and the number of pending peers is capped.
+ */
+void NetGameServerCore::_check_connections(uint64_t time) {
+	int i;
+
+	while (tcp_server->is_connection_available()) {
+		PendingPeer pp;
+		pp.peer = tcp_server->take_connection();
+		if(pp.peer.is_null()) {
+			break;
+		}
+		pp.host = pp.peer->get_connected_host();
+		pp.port = pp.peer->get_connected_port();
+		pp.time = time;
+		pp.read = 0;
+
+		if(draining || pending.size() >= PENDING_MAX ||
+				!handshake.allow(pp.host, time)) {
+			pp.peer->disconnect();
+			continue;
+		}
+
+		// Framed like PacketPeerStream: [len][CMD_MAX][PCMD_COOKIE][cookie]
+		uint8_t raw[6 + COOKIE_SIZE];
+		encode_uint32(2 + COOKIE_SIZE, raw);
+		raw[4] = CMD_MAX;
+		raw[5] = PCMD_COOKIE;
+		handshake.make_cookie(COOKIE_TCP, pp.host, pp.port, 0, 0, time,
+					raw + 6);
+		if(pp.peer->put_data(raw, sizeof(raw)) != OK) {
+			pp.peer->disconnect();
+			continue;
+		}
+		pending.push_back(pp);
+	}
+
+	for (i = 0; i < pending.size(); i++) {
+		if(!_update_pending(pending[i], time)) {
+			pending.remove(i);
+			i--;
+		}
+	}
+}
+
+/*
+ * Read the cookie echo of a pending peer, returns false when the peer
+ * leaves the pending list (promoted or dropped)
+ */
+bool NetGameServerCore::_update_pending(PendingPeer &pp, uint64_t time) {
+	if(!pp.peer->is_connected() || pp.time + PENDING_TIMEOUT < time) {
+		pp.peer->disconnect();
+		return false;
+	}
+
+	if(pp.peer->get_available_bytes() <= 0) {
+		return true;
+	}
+
+	// Framed packet, the length comes first
+	int want = 4;
+	if(pp.read >= 4) {
+		want += decode_uint32(pp.buf);
+		if(want != 6 + COOKIE_SIZE &&
+				want != 7 + COOKIE_SIZE + RESUME_TOKEN_SIZE) {
+			pp.peer->disconnect();
+			return false;
+		}
+	}
+
+	int got = 0;
+	pp.peer->get_partial_data(pp.buf + pp.read, want - pp.read, got);
+	pp.read += got;
+	if(pp.read < want || want == 4) {
+		return true;
+	}
+
+	if(pp.buf[4] != CMD_MAX ||
+			!handshake.check_cookie(COOKIE_TCP, pp.host, pp.port,
+						0, 0, time, pp.buf + 6)) {
+		pp.peer->disconnect();
+		return false;
+	}
+
+	if(pp.buf[5] == PCMD_COOKIE && want == 6 + COOKIE_SIZE) {
+		_add_client(pp.peer);
+	}
+	else if(pp.buf[5] == PCMD_RESUME && want != 6 + COOKIE_SIZE) {
+		// [cookie][id][token]
+		_resume_client(pp.peer, pp.buf[6 + COOKIE_SIZE],
+				pp.buf + 7 + COOKIE_SIZE);
+	}
+	else {
+		pp.peer->disconnect();
+	}
+	return false;
+}
+
+void NetGameServerCore::_add_client(const Ref<StreamPeerTCP> &peer) {
+	conn_mutex->lock();
+	if(connections.size() + migrations_in.size() >= CMD_MAX) {
+		conn_mutex->unlock();
+		WARN_PRINT("Server full, connection refused");
+		peer->disconnect();
+		return;
+	}
+	NetGameServerConnection *cd = memnew(
+		NetGameServerConnection(_get_id(), _get_secret(), peer, this));
+	connections.insert(cd->id, cd);
+	timers.schedule(&cd->timer, 0);
+	conn_mutex->unlock();
+
+	_queue_signal(SIGNAL_CLIENT_CONNECT, cd->id);
+}
+
+/*
+ * Give an existing client its new TCP socket (queues, sequences, groups
+ * and replication state are kept)
+ */
+void NetGameServerCore::_resume_client(const Ref<StreamPeerTCP> &peer, CID id,
+					const uint8_t *token) {
+	conn_mutex->lock();
+	NetGameServerConnection *cd = _get_client(id);
+	if(cd == NULL || !cd->resume(peer, token)) {
+		conn_mutex->unlock();
+		peer->disconnect();
+		return;
+	}
+	conn_mutex->unlock();
+
+	_queue_signal(SIGNAL_CLIENT_RESUME, id);
+}
+
+void NetGameServerCore::_clear_pending() {
+	int i;
+	for (i = 0; i < pending.size(); i++) {
+		pending[i].peer->disconnect();
+	}
+	pending.clear();
+}
+
+void NetGameServerCore::_queue_signal(const char *sig, CID id)
+{
+	// Game threads answer lifecycle signals with sends, the client state
+	// they look up must already be the new one
+	conn_mutex->lock();
+	NetGameServerConnection *cd = _get_client(id);
+	if(cd != NULL) {
+		outbox.publish(id, cd->state == READY);
+	}
+	conn_mutex->unlock();
+
+	if(recorder.is_valid()) {
+		recorder->record(RECORD_SIGNAL, NetGameRecorder::signal_index(sig), id, 0);
+	}
+	if(signal_mode == THREADED) {
+		_get_signal_target()->emit_signal(sig, id);
+	}
+	else {
+		if(signal_queue.size() >= SIG_QUEUE_SIZE * (connections.size()+1)) {
+			WARN_PRINT("SIGNAL QUEUE SIZE EXCEEDED");
+			return;
+		}
+		QueuedSignal *qs = (QueuedSignal *) memnew(QueuedSignal);
+		qs->id = id;
+		qs->signal = sig;
+		qs->cmd = -1;
+		qs->has_pkt = false;
+		qs->has_msg = false;
+		signal_mutex->lock();
+		signal_queue.insert(signal_queue.size(), qs);
+		signal_mutex->unlock();
+	}
+}
+
+void NetGameServerCore::_queue_signal(const char *sig, CID id,
+				const DVector<uint8_t> &pkt, int cmd)
+{
+	if(signal_mode == THREADED) {
+		_get_signal_target()->emit_signal(sig, id, cmd, pkt);
+	}
+	else {
+		QueuedSignal *qs = (QueuedSignal *) memnew(QueuedSignal);
+		qs->id = id;
+		qs->signal = sig;
+		qs->cmd = cmd;
+		qs->packet = pkt;
+		qs->has_pkt = true;
+		qs->has_msg = false;
+		signal_mutex->lock();
+		signal_queue.insert(signal_queue.size(), qs);
+		signal_mutex->unlock();
+	}
+}
+
+void NetGameServerCore::_queue_signal(const char *sig, CID id,
+				const Dictionary &msg, int cmd)
+{
+	if(signal_mode == THREADED) {
+		_get_signal_target()->emit_signal(sig, id, cmd, msg);
+	}
+	else {
+		QueuedSignal *qs = (QueuedSignal *) memnew(QueuedSignal);
+		qs->id = id;
+		qs->signal = sig;
+		qs->cmd = cmd;
+		qs->msg = msg;
+		qs->has_pkt = false;
+		qs->has_msg = true;
+		signal_mutex->lock();
+		signal_queue.insert(signal_queue.size(), qs);
+		signal_mutex->unlock();
+	}
+}
+
+void NetGameServerCore::_queue_signal(const char *sig, CID id, uint32_t rid,
+				int cmd, const Variant &args)
+{
+	if(signal_mode == THREADED) {
+		_get_signal_target()->emit_signal(sig, id, rid, cmd, args);
+	}
+	else {
+		QueuedSignal *qs = (QueuedSignal *) memnew(QueuedSignal);
+		qs->id = id;
+		qs->signal = sig;
+		qs->cmd = cmd;
+		qs->rid = rid;
+		qs->args = args;
+		qs->has_args = true;
+		signal_mutex->lock();
+		signal_queue.insert(signal_queue.size(), qs);
+		signal_mutex->unlock();
+	}
+}
+
+/*
+ * media_frame, the timestamp goes out as a float (an int would turn
+ * negative past 2^31)
+ */
+void NetGameServerCore::_queue_frame(CID id, int stream, uint32_t timestamp,
+				const DVector<uint8_t> &frame)
+{
+	if(signal_mode == THREADED) {
+		_get_signal_target()->emit_signal(SIGNAL_MEDIA_FRAME, id, stream,
+					(double)timestamp, frame);
+	}
+	else {
+		QueuedSignal *qs = (QueuedSignal *) memnew(QueuedSignal);
+		qs->id = id;
+		qs->signal = SIGNAL_MEDIA_FRAME;
+		qs->rid = stream;
+		qs->timestamp = timestamp;
+		qs->packet = frame;
+		qs->has_frame = true;
+		signal_mutex->lock();
+		signal_queue.insert(signal_queue.size(), qs);
+		signal_mutex->unlock();
+	}
+}
+
+/*
+ * Queue a received packet, decoding it first if its command has a
+ * registered message layout (invalid messages are dropped here).
+ * No msg_sig: never decoded (auth packets)
+ */
+void NetGameServerCore::_queue_packet(const char *sig, const char *msg_sig,
+				CID id, const DVector<uint8_t> &pkt, int cmd)
+{
+	if(recorder.is_valid()) {
+		recorder->record(RECORD_PACKET, NetGameRecorder::signal_index(sig),
+					id, cmd, pkt);
+	}
+	if(msg_sig == NULL || !schema.has_message(cmd)) {
+		_queue_signal(sig, id, pkt, cmd);
+		return;
+	}
+
+	Dictionary msg;
+	if(schema.decode(cmd, pkt, msg) != OK) {
+		WARN_PRINT("Invalid message received");
+		return;
+	}
+	_queue_signal(msg_sig, id, msg, cmd);
+}
+
+/*
+ * Lowest free id, the ones reserved for incoming migrations are skipped
+ */
+CID NetGameServerCore::_get_id() {
+	int i;
+
+	for(i = 1; i < 256; i++) {
+		if(connections.find(i) == -1 && migrations_in.find(i) == -1) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+CSE NetGameServerCore::_get_secret() {
+	return rand() % 256;
+}
+
+void NetGameServerCore::start(int tcp_port, int udp_port) {
+	stop();
+	udp_only = false;
+	handshake.reset();
+	// Wildcard, dual stack when the system has IPv6
+	tcp_server->listen(tcp_port, IP_Address("*"));
+	udp_server->listen(udp_port, IP_Address("*"));
+	_run();
+}
+
+/*
+ * Single UDP socket: handshake, auth, keepalive, disconnect and reliable
+ * packets (put_tcp_packet) all go over it, no per client socket
+ */
+void NetGameServerCore::start_udp_only(int udp_port) {
+	stop();
+	udp_only = true;
+	handshake.reset();
+	udp_server->listen(udp_port, IP_Address("*"));
+	_run();
+}
+
+bool NetGameServerCore::is_udp_only() const {
+	return udp_only;
+}
+
+/*
+ * Tick on a thread of our own, or on the reactor pool when there is one
+ */
+void NetGameServerCore::_run() {
+	tick_time = OS::get_singleton()->get_ticks_msec();
+	timers.reset(tick_time);
+	stale.clear();
+	quit = false;
+	if(reactor.is_valid()) {
+		reactor->_add_server(this);
+	}
+	else {
+		thread = Thread::create(_thread_start, this);
+	}
+}
+
+/*
+ * Clients are told the reason (DISCONNECT_RESTART makes them resume)
+ */
+void NetGameServerCore::stop(int reason) {
+	if (quit) {
+		return;
+	}
+	ERR_FAIL_INDEX(reason, DISCONNECT_RESTART + 1);
+	stop_reason = (DisconnectReason)reason;
+	quit = true;
+	if (thread != NULL) {
+		Thread::wait_to_finish(thread);
+		memdelete(thread);
+		thread = NULL;
+	}
+	else {
+		// No pool thread ticks us past this point, close from here
+		reactor->_remove_server(this);
+		_clear_pending();
+		_clear_clients();
+	}
+	tcp_server->stop();
+	udp_server->close();
+	_clear_queues();
+	rpc.clear();
+	udp_peers.clear();
+	bridge.clear();
+	migrations_in.clear();
+	draining = false;
+	stop_reason = DISCONNECT_SHUTDOWN;
+}
+
+bool NetGameServerCore::_is_drained() {
+	bool out = outbox.is_empty();
+
+	conn_mutex->lock();
+	for(int i = 0; out && i < connections.size(); i++) {
+		out = connections.getv(i)->is_flushed();
+	}
+	conn_mutex->unlock();
+	return out;
+}
+
+/*
+ * Refuse new clients and wait (at most timeout_msec) until every queued
+ * packet has been sent, or acked in UDP only mode. The server keeps
+ * running until stop.
+ */
+Error NetGameServerCore::drain(int timeout_msec) {
+	ERR_FAIL_COND_V(quit, ERR_UNCONFIGURED);
+	draining = true;
+
+	uint64_t end = OS::get_singleton()->get_ticks_msec() + timeout_msec;
+	while(!_is_drained()) {
+		if(OS::get_singleton()->get_ticks_msec() >= end) {
+			return ERR_TIMEOUT;
+		}
+		OS::get_singleton()->delay_usec(DRAIN_SLEEP_USEC);
+	}
+	return OK;
+}
+
+/*
+ * Resumable sessions (TCP mode), for import_sessions in a new process:
+ * [version][secure][count] then the state of each connection.
+ * Call stop(DISCONNECT_RESTART) right after.
+ */
+DVector<uint8_t> NetGameServerCore::export_sessions() {
+	DVector<uint8_t> out;
+	int i, count = 0, size = 3;
+
+	conn_mutex->lock();
+	for(i = 0; i < connections.size(); i++) {
+		NetGameServerConnection *cd = connections.getv(i);
+		if(cd->can_export()) {
+			size += cd->get_state_size();
+		}
+	}
+	out.resize(size);
+	{
+		DVector<uint8_t>::Write w = out.write();
+		int pos = 3;
+		for(i = 0; i < connections.size(); i++) {
+			NetGameServerConnection *cd = connections.getv(i);
+			if(!cd->can_export() ||
+					pos + cd->get_state_size() > size) {
+				continue;
+			}
+			cd->save_state(w.ptr() + pos);
+			pos += cd->get_state_size();
+			count++;
+		}
+		w[0] = EXPORT_VERSION;
+		w[1] = secure;
+		w[2] = count;
+	}
+	conn_mutex->unlock();
+	return out;
+}
+
+/*
+ * Sessions wait suspended for resume_grace msec, clients resume them as
+ * after a TCP loss (client_resume)
+ */
+Error NetGameServerCore::import_sessions(const DVector<uint8_t> &data) {
+	ERR_FAIL_COND_V(quit || udp_only, ERR_UNCONFIGURED);
+	ERR_FAIL_COND_V(resume_grace <= 0, ERR_UNCONFIGURED);
+	ERR_FAIL_COND_V(data.size() < 3, ERR_INVALID_DATA);
+
+	DVector<uint8_t>::Read r = data.read();
+	ERR_FAIL_COND_V(r[0] != EXPORT_VERSION, ERR_INVALID_DATA);
+	ERR_FAIL_COND_V((bool)r[1] != secure, ERR_INVALID_DATA);
+
+	int count = r[2];
+	int state_size = CONNECTION_STATE_SIZE +
+				(secure ? SESSION_STATE_SIZE : 0);
+	ERR_FAIL_COND_V(data.size() != 3 + count * state_size,
+			ERR_INVALID_DATA);
+
+	conn_mutex->lock();
+	for(int i = 0; i < count; i++) {
+		const uint8_t *state = r.ptr() + 3 + i * state_size;
+		if(state[0] == HANDSHAKE_ID || _get_client(state[0]) != NULL) {
+			WARN_PRINT("Imported client id already in use");
+			continue;
+		}
+		NetGameServerConnection *cd = memnew(
+			NetGameServerConnection(state, this));
+		connections.insert(cd->id, cd);
+		timers.schedule(&cd->timer, 0);
+	}
+	conn_mutex->unlock();
+	return OK;
+}
+
+void NetGameServerCore::set_reactor(const Ref<NetGameReactor> &p_reactor) {
+	ERR_FAIL_COND(!quit);
+	reactor = p_reactor;
+}
+
+Ref<NetGameReactor> NetGameServerCore::get_reactor() const {
+	return reactor;
+}
+
+/*
+ * The recorder itself can be started and stopped at any time
+ */
+void NetGameServerCore::set_recorder(const Ref<NetGameRecorder> &p_recorder) {
+	ERR_FAIL_COND(!quit);
+	recorder = p_recorder;
+}
+
+Ref<NetGameRecorder> NetGameServerCore::get_recorder() const {
+	return recorder;
+}
+
+NetGameServerConnection *NetGameServerCore::_get_client(int id) {
+	int index = connections.find(id);
+	if(index == -1) {
+		return NULL;
+	}
+	return connections.getv(index);
+}
+
+Error NetGameServerCore::put_tcp_packet(int id, const DVector<uint8_t> &pkt, int cmd) {
+	Error out;
+
+	ERR_FAIL_INDEX_V(cmd, CMD_LIMIT, ERR_INVALID_PARAMETER);
+	conn_mutex->lock();
+	NetGameServerConnection *cd = _get_client(id);
+	if(cd == NULL) {
+		conn_mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	if(cd->udp_only && pkt.size() + NetGameCommand::get_size(cmd) + 1 >
+				RELIABLE_MAX_SIZE) {
+		conn_mutex->unlock();
+		return ERR_INVALID_PARAMETER;
+	}
+	out = cd->enqueue_tcp(pkt, cmd);
+	conn_mutex->unlock();
+	if(out == OK && recorder.is_valid()) {
+		recorder->record(RECORD_SEND_TCP, 0, id, cmd, pkt);
+	}
+	return out;
+}
+
+/*
+ * No lock shared with other senders or the network thread, see
+ * NetGameOutbox
+ */
+Error NetGameServerCore::put_udp_packet(int id, const DVector<uint8_t> &pkt,
+					int cmd, bool timed) {
+	uint32_t word = outbox.lookup(id);
+
+	if(NetGameOutbox::get_state(word) == OUTBOX_NONE) {
+		return ERR_DOES_NOT_EXIST;
+	}
+	if(NetGameOutbox::get_state(word) != OUTBOX_READY) {
+		return ERR_CONNECTION_ERROR;
+	}
+	return _enqueue_udp(id, NetGameOutbox::get_generation(word), pkt,
+				cmd, timed);
+}
+
+/*
+ * Staged once, the network thread sends it to every ready client
+ */
+Error NetGameServerCore::broadcast_udp(const DVector<uint8_t> &pkt, int cmd,
+					bool timed) {
+	ERR_FAIL_INDEX_V(cmd, CMD_LIMIT, ERR_INVALID_PARAMETER);
+	return outbox.push(0, OUTBOX_ALL, pkt, cmd, timed);
+}
+
+Error NetGameServerCore::broadcast_tcp(const DVector<uint8_t> &pkt, int cmd) {
+	int i;
+	ERR_FAIL_INDEX_V(cmd, CMD_LIMIT, ERR_INVALID_PARAMETER);
+	conn_mutex->lock();
+	for(i=0; i<connections.size(); i++) {
+		NetGameServerConnection *cd = connections.getv(i);
+		if(cd->enqueue_tcp(pkt, cmd) == OK && recorder.is_valid()) {
+			recorder->record(RECORD_SEND_TCP, 0, cd->id, cmd, pkt);
+		}
+	}
+	conn_mutex->unlock();
+	return OK;
+}
+
+Error NetGameServerCore::register_message(int cmd, const Array &layout) {
+	ERR_FAIL_INDEX_V(cmd, CMD_LIMIT, ERR_INVALID_PARAMETER);
+	return schema.register_message(cmd, layout);
+}
+
+void NetGameServerCore::unregister_message(int cmd) {
+	schema.unregister_message(cmd);
+}
+
+Error NetGameServerCore::put_tcp_message(int id, int cmd, const Variant &args) {
+	DVector<uint8_t> pkt;
+	Error err = schema.encode(cmd, args, pkt);
+	if(err != OK) {
+		return err;
+	}
+	return put_tcp_packet(id, pkt, cmd);
+}
+
+Error NetGameServerCore::put_udp_message(int id, int cmd, const Variant &args,
+					bool timed) {
+	DVector<uint8_t> pkt;
+	Error err = schema.encode(cmd, args, pkt);
+	if(err != OK) {
+		return err;
+	}
+	return put_udp_packet(id, pkt, cmd, timed);
+}
+
+Error NetGameServerCore::broadcast_udp_message(int cmd, const Variant &args,
+					bool timed) {
+	DVector<uint8_t> pkt;
+	Error err = schema.encode(cmd, args, pkt);
+	if(err != OK) {
+		return err;
+	}
+	return broadcast_udp(pkt, cmd, timed);
+}
+
+Error NetGameServerCore::broadcast_udp_interest(const DVector<uint8_t> &pkt,
+					int cmd, const Vector3 &origin,
+					real_t radius, bool timed) {
+	Vector<CID> ids;
+	Error out;
+
+	conn_mutex->lock();
+	interest.query_radius(origin, radius, ids);
+	conn_mutex->unlock();
+	out = _enqueue_udp_list(ids, pkt, cmd, timed);
+	return out;
+}
+
+Error NetGameServerCore::multicast_to_group(const String &group,
+					const DVector<uint8_t> &pkt,
+					int cmd, bool timed) {
+	Vector<CID> ids;
+	Error out;
+
+	conn_mutex->lock();
+	interest.query_group(group, ids);
+	conn_mutex->unlock();
+	out = _enqueue_udp_list(ids, pkt, cmd, timed);
+	return out;
+}
+
+Error NetGameServerCore::set_client_position(int id, const Vector3 &pos) {
+	conn_mutex->lock();
+	if(_get_client(id) == NULL) {
+		conn_mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	interest.set_position(id, pos);
+	conn_mutex->unlock();
+	return OK;
+}
+
+Error NetGameServerCore::clear_client_position(int id) {
+	conn_mutex->lock();
+	if(_get_client(id) == NULL) {
+		conn_mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	interest.clear_position(id);
+	conn_mutex->unlock();
+	return OK;
+}
+
+Error NetGameServerCore::join_group(int id, const String &group) {
+	conn_mutex->lock();
+	if(_get_client(id) == NULL) {
+		conn_mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	interest.join_group(id, group);
+	conn_mutex->unlock();
+	return OK;
+}
+
+Error NetGameServerCore::leave_group(int id, const String &group) {
+	conn_mutex->lock();
+	if(_get_client(id) == NULL) {
+		conn_mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	interest.leave_group(id, group);
+	conn_mutex->unlock();
+	return OK;
+}
+
+void NetGameServerCore::set_interest_cell_size(real_t p_size) {
+	conn_mutex->lock();
+	interest.set_cell_size(p_size);
+	conn_mutex->unlock();
+}
+
+real_t NetGameServerCore::get_interest_cell_size() const {
+	return interest.get_cell_size();
+}
+
+/***
+ * Client to client relay, see NetGameRelay. Relayed packets are
+ * forwarded by the network thread as soon as they arrive, the game
+ * thread never sees them. Relaying is off until relay_rate is set.
+ */
+/*
+ * PCMD_RELAY: [target][cmd 2][pkt], PCMD_MEDIA: [target][stream packet].
+ * The receivers get [pcmd][from] and what follows the target.
+ */
+void NetGameServerCore::_relay(NetGameServerConnection *from,
+				const DVector<uint8_t> &pkt, uint8_t pcmd) {
+	Vector<CID> ids;
+	DVector<uint8_t> out;
+	int i, ofs, sent;
+	int cmd = -1;
+
+	// Called from handle_udp, conn_mutex is held
+	if(pkt.size() < 2) {
+		return;
+	}
+	DVector<uint8_t>::Read r = pkt.read();
+	if(r[0] == RELAY_TO_CLIENT) {
+		ids.push_back(r[1]);
+		ofs = 2;
+	}
+	else if(r[0] == RELAY_TO_GROUP && 2 + r[1] <= pkt.size()) {
+		String group;
+		group.parse_utf8((const char *)r.ptr() + 2, r[1]);
+		interest.query_group(group, ids);
+		// Only members can talk to a group
+		if(ids.find(from->id) == -1) {
+			return;
+		}
+		ofs = 2 + r[1];
+	}
+	else {
+		return;
+	}
+	if(pcmd == PCMD_RELAY) {
+		if(ofs + 2 > pkt.size()) {
+			return;
+		}
+		cmd = r[ofs] | (r[ofs + 1] << 8);
+		// Any 16 bit value can come in, no engine error for those
+		if(cmd >= CMD_LIMIT) {
+			relay.count_filtered(from->id);
+			return;
+		}
+	}
+	if(!relay.allow(from->id, cmd, tick_time)) {
+		return;
+	}
+
+	out.resize(3 + pkt.size() - ofs);
+	{
+		DVector<uint8_t>::Write w = out.write();
+		w[0] = CMD_MAX;
+		w[1] = pcmd;
+		w[2] = from->id;
+		memcpy(w.ptr() + 3, r.ptr() + ofs, pkt.size() - ofs);
+	}
+	sent = 0;
+	for(i = 0; i < ids.size(); i++) {
+		NetGameServerConnection *cd = _get_client(ids[i]);
+		if(cd == NULL || cd->state != READY ||
+				!relay.filter(from->id, cd->id)) {
+			continue;
+		}
+		cd->put_udp(out);
+		sent++;
+	}
+	relay.count(from->id, sent);
+}
+
+void NetGameServerCore::set_relay_rate(int p_rate) {
+	conn_mutex->lock();
+	relay.set_rate(p_rate);
+	conn_mutex->unlock();
+}
+
+int NetGameServerCore::get_relay_rate() const {
+	return relay.get_rate();
+}
+
+/*
+ * Packets per second this client may relay, -1 for the relay_rate
+ */
+Error NetGameServerCore::set_client_relay_rate(int id, int rate) {
+	ERR_FAIL_COND_V(rate < -1 || rate > RELAY_RATE_MAX,
+				ERR_INVALID_PARAMETER);
+	conn_mutex->lock();
+	if(_get_client(id) == NULL) {
+		conn_mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	relay.set_client_rate(id, rate);
+	conn_mutex->unlock();
+	return OK;
+}
+
+void NetGameServerCore::set_relay_cmd_allowed(int cmd, bool allowed) {
+	conn_mutex->lock();
+	relay.set_cmd_allowed(cmd, allowed);
+	conn_mutex->unlock();
+}
+
+bool NetGameServerCore::is_relay_cmd_allowed(int cmd) {
+	conn_mutex->lock();
+	bool out = relay.is_cmd_allowed(cmd);
+	conn_mutex->unlock();
+	return out;
+}
+
+/*
+ * Stop relaying the packets of one client to another (one way)
+ */
+Error NetGameServerCore::set_relay_blocked(int from, int to, bool blocked) {
+	conn_mutex->lock();
+	if(_get_client(from) == NULL || _get_client(to) == NULL) {
+		conn_mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	relay.set_blocked(from, to, blocked);
+	conn_mutex->unlock();
+	return OK;
+}
+
+Dictionary NetGameServerCore::get_relay_stats(int id) {
+	conn_mutex->lock();
+	Dictionary out = relay.get_stats(id);
+	conn_mutex->unlock();
+	return out;
+}
+
+/***
+ * Media streams, see NetGameMedia. Streams sent to other clients are
+ * relayed as they arrive (_relay), the server never unpacks them. Only
+ * the ones sent to the server are sequenced here and signalled as
+ * media_frame(id, stream, timestamp, frame), an empty frame is a lost one.
+ */
+void NetGameServerCore::_queue_media(const Vector<MediaFrame> &frames) {
+	int i;
+
+	for(i = 0; i < frames.size(); i++) {
+		const MediaFrame &f = frames[i];
+		_queue_frame(f.id, f.stream, f.timestamp, f.data);
+	}
+}
+
+/*
+ * Called from handle_udp, conn_mutex is held
+ */
+void NetGameServerCore::_receive_media(NetGameServerConnection *from,
+				const DVector<uint8_t> &pkt) {
+	Vector<MediaFrame> frames;
+	DVector<uint8_t>::Read r = pkt.read();
+
+	if(pkt.size() < 1) {
+		return;
+	}
+	if(r[0] != MEDIA_TO_SERVER) {
+		_relay(from, pkt, PCMD_MEDIA);
+		return;
+	}
+	if(!media.receive(from->id, r.ptr() + 1, pkt.size() - 1, tick_time,
+				frames)) {
+		WARN_PRINT("Invalid media packet");
+		return;
+	}
+	_queue_media(frames);
+}
+
+void NetGameServerCore::_media_tick(uint64_t time) {
+	Vector<MediaFrame> frames;
+
+	conn_mutex->lock();
+	media.release(time, frames);
+	_queue_media(frames);
+	conn_mutex->unlock();
+}
+
+void NetGameServerCore::set_media_jitter(int p_jitter) {
+	conn_mutex->lock();
+	media.set_jitter(p_jitter);
+	conn_mutex->unlock();
+}
+
+int NetGameServerCore::get_media_jitter() const {
+	return media.get_jitter();
+}
+
+Dictionary NetGameServerCore::get_media_stats(int id, int stream) {
+	conn_mutex->lock();
+	Dictionary out = media.get_stats(id, stream);
+	conn_mutex->unlock();
+	return out;
+}
+
+/***
+ * Cluster bridge, see NetGameBridge. Servers of one cluster share a
+ * bridge key, any of them can listen and the others connect to it.
+ * The links are run by the network thread.
+ */
+void NetGameServerCore::_bridge_tick(uint64_t time) {
+	int i;
+
+	bridge_events.clear();
+	bridge.poll(time, bridge_events);
+
+	conn_mutex->lock();
+	for(i = migrations_in.size() - 1; i >= 0; i--) {
+		if(migrations_in.getv(i).expire < time) {
+			migrations_in.erase(migrations_in.getk(i));
+		}
+	}
+	for(i = 0; i < bridge_events.size(); i++) {
+		const BridgeMessage &m = bridge_events[i];
+		NetGameServerConnection *cd;
+
+		switch(m.op) {
+		case BRIDGE_CONNECTED:
+			_queue_signal(SIGNAL_BRIDGE_CONNECT, m.peer);
+			break;
+		case BRIDGE_DISCONNECTED:
+			_bridge_lost(m.peer);
+			_queue_signal(SIGNAL_BRIDGE_DISCONNECT, m.peer);
+			break;
+		case BRIDGE_PACKET:
+			_queue_signal(SIGNAL_BRIDGE_PACKET, m.peer, m.id, m.cmd,
+					m.data);
+			break;
+		case BRIDGE_TO_CLIENT:
+			cd = _get_client(m.id);
+			if(cd != NULL && cd->state == READY) {
+				QueuedPacket qp;
+				qp.cmd = m.cmd;
+				qp.packet = m.data;
+				cd->put_udp(cd->build_pkt(&qp));
+			}
+			break;
+		case BRIDGE_MIGRATE_OFFER:
+			_migrate_offer(m, time);
+			break;
+		case BRIDGE_MIGRATE_ACCEPT:
+		case BRIDGE_MIGRATE_REJECT:
+			cd = _get_client(m.id);
+			if(cd == NULL || cd->migrate_state != MIGRATE_OFFERED ||
+					cd->migrate_peer != m.peer) {
+				break;
+			}
+			if(m.op == BRIDGE_MIGRATE_ACCEPT && m.data.size() == 1) {
+				cd->migrate_id = m.data[0];
+				cd->migrate_state = MIGRATE_ACCEPTED;
+			}
+			else {
+				cd->migrate_state = MIGRATE_NONE;
+				_queue_signal(SIGNAL_CLIENT_MIGRATE_FAILED, cd->id);
+			}
+			break;
+		case BRIDGE_MIGRATE:
+			_migrate_import(m);
+			break;
+		default:
+			break;
+		}
+	}
+	conn_mutex->unlock();
+	bridge_events.clear();
+}
+
+/*
+ * Migrations to that peer fail, its clients stop being forwarded
+ */
+void NetGameServerCore::_bridge_lost(CID peer) {
+	int i;
+
+	for(i = 0; i < connections.size(); i++) {
+		NetGameServerConnection *cd = connections.getv(i);
+		if(cd->forward_peer == peer) {
+			cd->forward_peer = 0;
+		}
+		if(cd->migrate_state != MIGRATE_NONE && cd->migrate_peer == peer) {
+			cd->migrate_state = MIGRATE_NONE;
+			_queue_signal(SIGNAL_CLIENT_MIGRATE_FAILED, cd->id);
+		}
+	}
+}
+
+/*
+ * Another server wants to hand us a client: keep an id for it until the
+ * session comes (resume_grace at most). Its current id if free here,
+ * else the lowest free one. Body: [secure], accepted with [id].
+ */
+void NetGameServerCore::_migrate_offer(const BridgeMessage &m,
+				uint64_t time) {
+	uint8_t nid = 0;
+
+	if(!udp_only && resume_grace > 0 && m.data.size() == 1 &&
+			(bool)m.data[0] == secure &&
+			connections.size() + migrations_in.size() < CMD_MAX) {
+		nid = m.id != HANDSHAKE_ID && _get_client(m.id) == NULL &&
+			migrations_in.find(m.id) == -1 ? m.id : _get_id();
+	}
+	if(nid == HANDSHAKE_ID) {
+		bridge.send(m.peer, BRIDGE_MIGRATE_REJECT, m.id, 0, NULL, 0);
+		return;
+	}
+	MigrationIn mi;
+	mi.peer = m.peer;
+	mi.expire = time + resume_grace;
+	migrations_in.insert(nid, mi);
+	bridge.send(m.peer, BRIDGE_MIGRATE_ACCEPT, m.id, 0, &nid, 1);
+}
+
+/*
+ * The session waits suspended for the client to resume it, like an
+ * imported one (import_sessions)
+ */
+void NetGameServerCore::_migrate_import(const BridgeMessage &m) {
+	int index = migrations_in.find(m.id);
+	int state_size = CONNECTION_STATE_SIZE +
+				(secure ? SESSION_STATE_SIZE : 0);
+	Variant data;
+
+	if(index == -1 || migrations_in.getv(index).peer != m.peer) {
+		return;
+	}
+	migrations_in.erase(m.id);
+
+	DVector<uint8_t>::Read r = m.data.read();
+	if(m.data.size() < state_size || r[0] != m.id) {
+		WARN_PRINT("Invalid migrated session");
+		return;
+	}
+	NetGameServerConnection *cd = memnew(
+		NetGameServerConnection(r.ptr(), this));
+	int len = cd->sequence.load_state(r.ptr() + state_size,
+					m.data.size() - state_size);
+	if(len == 0 || decode_variant(data, r.ptr() + state_size + len,
+				m.data.size() - state_size - len) != OK) {
+		WARN_PRINT("Invalid migrated session");
+		memdelete(cd);
+		return;
+	}
+	connections.insert(cd->id, cd);
+	timers.schedule(&cd->timer, 0);
+	_queue_signal(SIGNAL_CLIENT_MIGRATED, cd->id, (Dictionary)data, m.peer);
+}
+
+void NetGameServerCore::set_bridge_key(const String &p_key) {
+	bridge.set_key(p_key);
+}
+
+Error NetGameServerCore::bridge_listen(int port, const String &bind) {
+	ERR_FAIL_COND_V(quit, ERR_UNCONFIGURED);
+	return bridge.listen(port, IP_Address(bind));
+}
+
+/*
+ * Returns the peer id (bridge_connect once the key is checked), -1 on
+ * failure
+ */
+int NetGameServerCore::bridge_connect(const String &host, int port) {
+	ERR_FAIL_COND_V(quit, -1);
+	return bridge.connect_to(IP_Address(host), port);
+}
+
+void NetGameServerCore::bridge_disconnect(int peer) {
+	bridge.disconnect(peer);
+}
+
+Array NetGameServerCore::get_bridge_peers() {
+	return bridge.get_peers();
+}
+
+/*
+ * Batched with the other messages to that peer, it gets
+ * bridge_packet(peer, id, cmd, pkt)
+ */
+Error NetGameServerCore::bridge_send(int peer, const DVector<uint8_t> &pkt,
+				int cmd, int id) {
+	ERR_FAIL_INDEX_V(cmd, CMD_LIMIT, ERR_INVALID_PARAMETER);
+	ERR_FAIL_INDEX_V(id, 256, ERR_INVALID_PARAMETER);
+	return bridge.send(peer, BRIDGE_PACKET, id, cmd, pkt);
+}
+
+Error NetGameServerCore::bridge_broadcast(const DVector<uint8_t> &pkt,
+				int cmd, int id) {
+	ERR_FAIL_INDEX_V(cmd, CMD_LIMIT, ERR_INVALID_PARAMETER);
+	ERR_FAIL_INDEX_V(id, 256, ERR_INVALID_PARAMETER);
+	return bridge.broadcast(BRIDGE_PACKET, id, cmd, pkt);
+}
+
+/*
+ * The peer sends it to its client id as a UDP packet, without going
+ * through its game thread
+ */
+Error NetGameServerCore::bridge_send_to_client(int peer, int id,
+				const DVector<uint8_t> &pkt, int cmd) {
+	ERR_FAIL_INDEX_V(cmd, CMD_LIMIT, ERR_INVALID_PARAMETER);
+	ERR_FAIL_INDEX_V(id, 256, ERR_INVALID_PARAMETER);
+	return bridge.send(peer, BRIDGE_TO_CLIENT, id, cmd, pkt);
+}
+
+/*
+ * Packets from this client go to the peer (bridge_packet there) instead
+ * of this server's signals, 0 stops
+ */
+Error NetGameServerCore::set_client_forward(int id, int peer) {
+	ERR_FAIL_INDEX_V(peer, BRIDGE_PEERS_MAX + 1, ERR_INVALID_PARAMETER);
+	conn_mutex->lock();
+	NetGameServerConnection *cd = _get_client(id);
+	if(cd == NULL) {
+		conn_mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	cd->forward_peer = peer;
+	conn_mutex->unlock();
+	return OK;
+}
+
+/*
+ * Hand a ready TCP client over to the server behind the bridge peer,
+ * which clients reach at host, tcp_port and udp_port. Once the peer
+ * accepts, the packets already queued are sent, then the client resumes
+ * its session (keys, sequences) on the new server. It keeps its id if
+ * that one is free there, else it gets a new one. The new server gets
+ * client_migrated(id, peer, data) with the id used there, this one
+ * client_disconnect(id), or client_migrate_failed(id) when the peer
+ * refuses.
+ */
+Error NetGameServerCore::migrate_client(int id, int peer, const String &host,
+				int tcp_port, int udp_port,
+				const Dictionary &data) {
+	IP_Address addr = IP_Address(host);
+	uint8_t target[ADDRESS_WIRE_MAX + 2];
+	uint8_t offer = secure;
+
+	ERR_FAIL_COND_V(!addr.is_valid(), ERR_INVALID_PARAMETER);
+	ERR_FAIL_INDEX_V(tcp_port, 65536, ERR_INVALID_PARAMETER);
+	ERR_FAIL_INDEX_V(udp_port, 65536, ERR_INVALID_PARAMETER);
+	if(!bridge.is_ready(peer)) {
+		return ERR_UNAVAILABLE;
+	}
+
+	conn_mutex->lock();
+	NetGameServerConnection *cd = _get_client(id);
+	if(cd == NULL || !cd->can_export() ||
+			cd->migrate_state != MIGRATE_NONE) {
+		conn_mutex->unlock();
+		return cd == NULL ? ERR_DOES_NOT_EXIST : ERR_UNAVAILABLE;
+	}
+	int len = NetGameAddress::encode(addr, tcp_port, target);
+	target[len] = udp_port >> 8;
+	target[len + 1] = udp_port;
+	cd->migrate_target.resize(len + 2);
+	{
+		DVector<uint8_t>::Write w = cd->migrate_target.write();
+		memcpy(w.ptr(), target, len + 2);
+	}
+	cd->migrate_data = data;
+	cd->migrate_peer = peer;
+	cd->migrate_state = MIGRATE_OFFERED;
+	Error err = bridge.send(peer, BRIDGE_MIGRATE_OFFER, id, 0, &offer, 1);
+	if(err != OK) {
+		cd->migrate_state = MIGRATE_NONE;
+	}
+	conn_mutex->unlock();
+	return err;
+}
+
+/***
+ * Inputs sent by the clients with put_input for one simulation tick,
+ * see NetGameInputBuffer. The tick is echoed to the clients that sent
+ * inputs as the input ack, their prediction history drops the inputs up
+ * to it. Spectators get nothing.
+ */
+Array NetGameServerCore::get_inputs_for_tick(int tick) {
+	DVector<uint8_t> ack;
+	Vector<CID> ids;
+	int i;
+
+	conn_mutex->lock();
+	Array out = inputs.get_inputs(tick);
+	inputs.get_clients(ids);
+	conn_mutex->unlock();
+
+	if(ids.size() == 0) {
+		return out;
+	}
+	ack.resize(4);
+	{
+		DVector<uint8_t>::Write w = ack.write();
+		encode_uint32(tick, w.ptr());
+	}
+	for(i = 0; i < ids.size(); i++) {
+		uint32_t word = outbox.lookup(ids[i]);
+		if(NetGameOutbox::get_state(word) == OUTBOX_READY) {
+			outbox.push(ids[i], NetGameOutbox::get_generation(word), ack,
+					PCMD_INPUT_ACK, false, true);
+		}
+	}
+	return out;
+}
+
+Dictionary NetGameServerCore::get_input_stats(int id) {
+	conn_mutex->lock();
+	Dictionary out = inputs.get_stats(id);
+	conn_mutex->unlock();
+	return out;
+}
+
+/***
+ * Lag compensation, see NetGameRewind. Entities are tracked with
+ * rewind_add, moved with rewind_set_position and rewind_capture stores
+ * them once per physics step. Queries look at the world as the client
+ * saw it: half its round trip plus the interpolation delay ago.
+ * Game thread only.
+ */
+uint64_t NetGameServerCore::_rewind_time(int id) {
+	uint64_t now = OS::get_singleton()->get_ticks_msec();
+	int rtt = get_client_rtt(id);
+	uint64_t back = MAX(rtt, 0) / 2 + rewind_interp_delay;
+
+	return now > back ? now - back : 0;
+}
+
+Error NetGameServerCore::rewind_add(int eid, real_t radius) {
+	return rewind.add(eid, radius);
+}
+
+void NetGameServerCore::rewind_remove(int eid) {
+	rewind.remove(eid);
+}
+
+Error NetGameServerCore::rewind_set_position(int eid, const Vector3 &pos) {
+	return rewind.set_position(eid, pos);
+}
+
+void NetGameServerCore::rewind_capture() {
+	rewind.capture(OS::get_singleton()->get_ticks_msec());
+}
+
+/*
+ * Position of the entity as seen by the client, null if unknown
+ */
+Variant NetGameServerCore::rewind_get_position(int id, int eid) {
+	Vector3 pos;
+
+	if(!rewind.get_position(eid, _rewind_time(id), pos)) {
+		return Variant();
+	}
+	return pos;
+}
+
+/*
+ * First entity hit as {"id", "position"}, empty if none
+ */
+Dictionary NetGameServerCore::rewind_raycast(int id, const Vector3 &from,
+				const Vector3 &to) {
+	Dictionary out;
+	Vector3 point;
+
+	int eid = rewind.raycast(_rewind_time(id), from, to, point);
+	if(eid >= 0) {
+		out["id"] = eid;
+		out["position"] = point;
+	}
+	return out;
+}
+
+Array NetGameServerCore::rewind_query_sphere(int id, const Vector3 &center,
+				real_t radius) {
+	Vector<int> ids;
+	Array out;
+	int i;
+
+	rewind.query_sphere(_rewind_time(id), center, radius, ids);
+	for(i = 0; i < ids.size(); i++) {
+		out.push_back(ids[i]);
+	}
+	return out;
+}
+
+void NetGameServerCore::set_rewind_interp_delay(int p_msec) {
+	ERR_FAIL_COND(p_msec < 0);
+	rewind_interp_delay = p_msec;
+}
+
+int NetGameServerCore::get_rewind_interp_delay() const {
+	return rewind_interp_delay;
+}
+
+/*
+ * Enqueue the same payload for a list of clients.
+ * The payload buffer is shared (copy on write) by every queued packet,
+ * only the per client header is built when sending.
+ */
+Error NetGameServerCore::_enqueue_udp_list(const Vector<CID> &ids,
+				const DVector<uint8_t> &pkt, int cmd, bool timed) {
+	int i;
+	Error out = OK;
+
+	ERR_FAIL_INDEX_V(cmd, CMD_LIMIT, ERR_INVALID_PARAMETER);
+	for(i = 0; i < ids.size(); i++) {
+		uint32_t word = outbox.lookup(ids[i]);
+		if(NetGameOutbox::get_state(word) != OUTBOX_READY) {
+			continue;
+		}
+		if(_enqueue_udp(ids[i], NetGameOutbox::get_generation(word), pkt,
+					cmd, timed) != OK) {
+			out = ERR_OUT_OF_MEMORY;
+		}
+	}
+	return out;
+}
+
+/*
+ * Enqueue packet (the thread will send it)
+ */
+Error NetGameServerCore::_enqueue_udp(CID id, uint32_t gen,
+				const DVector<uint8_t> &pkt, int cmd, bool timed) {
+	ERR_FAIL_INDEX_V(cmd, CMD_LIMIT, ERR_INVALID_PARAMETER);
+	Error err = outbox.push(id, gen, pkt, cmd, timed);
+	if(err != OK) {
+		return err;
+	}
+	if(recorder.is_valid()) {
+		recorder->record(RECORD_SEND_UDP, timed, id, cmd, pkt);
+	}
+	return OK;
+}
+
+Error NetGameServerCore::replica_create(int oid, const Array &fields) {
+	return replica.create(oid, fields);
+}
+
+Error NetGameServerCore::replica_remove(int oid) {
+	return replica.remove(oid);
+}
+
+Error NetGameServerCore::replica_set(int oid, const String &field,
+					const Variant &value) {
+	return replica.set(oid, field, value);
+}
+
+Variant NetGameServerCore::replica_get(int oid, const String &field) {
+	return replica.get(oid, field);
+}
+
+void NetGameServerCore::set_replication_rate(int p_rate) {
+	replica_rate = p_rate;
+}
+
+int NetGameServerCore::get_replication_rate() const {
+	return replica_rate;
+}
+
+/***
+ * Call "method" on a client, the client answers with rpc_reply from its
+ * rpc_request handler. Sent in order with the TCP packets.
+ */
+Ref<NetGameCall> NetGameServerCore::rpc_call(int id, int method,
+					const Variant &args) {
+	DVector<uint8_t> body;
+	Ref<NetGameCall> call = rpc.begin(id, method, args,
+				OS::get_singleton()->get_ticks_msec(), body);
+	if(call->is_done()) {
+		return call;
+	}
+	Error err = _enqueue_pcmd(id, body, PCMD_CALL);
+	if(err != OK) {
+		rpc.fail(call, err);
+	}
+	return call;
+}
+
+Error NetGameServerCore::rpc_reply(int id, int rid, const Variant &result) {
+	DVector<uint8_t> body;
+	Error err = NetGameRPC::build_result(rid, result, body);
+	if(err != OK) {
+		return err;
+	}
+	return _enqueue_pcmd(id, body, PCMD_RESULT);
+}
+
+void NetGameServerCore::set_rpc_timeout(int p_msec) {
+	rpc.set_timeout(p_msec);
+}
+
+int NetGameServerCore::get_rpc_timeout() const {
+	return rpc.get_timeout();
+}
+
+/***
+ * Bulk transfers, see NetGameTransfer. Returns the stream id, or -1 when
+ * the client is not ready, the file can not be opened or too many
+ * streams are open.
+ */
+int NetGameServerCore::stream_file(int id, const String &path,
+					const String &name) {
+	DVector<uint8_t> body;
+	Error err;
+	int sid = -1;
+
+	conn_mutex->lock();
+	NetGameServerConnection *cd = _get_client(id);
+	if(cd != NULL && cd->state == READY) {
+		sid = cd->transfer.send_file(path, name, body, err);
+		if(sid >= 0 && _enqueue_pcmd(id, body, PCMD_STREAM) != OK) {
+			cd->transfer.cancel(sid, body);
+			sid = -1;
+		}
+	}
+	conn_mutex->unlock();
+	return sid;
+}
+
+int NetGameServerCore::stream_buffer(int id, const DVector<uint8_t> &buf,
+					const String &name) {
+	DVector<uint8_t> body;
+	Error err;
+	int sid = -1;
+
+	conn_mutex->lock();
+	NetGameServerConnection *cd = _get_client(id);
+	if(cd != NULL && cd->state == READY) {
+		sid = cd->transfer.send_buffer(buf, name, body, err);
+		if(sid >= 0 && _enqueue_pcmd(id, body, PCMD_STREAM) != OK) {
+			cd->transfer.cancel(sid, body);
+			sid = -1;
+		}
+	}
+	conn_mutex->unlock();
+	return sid;
+}
+
+/*
+ * Accept a "stream_offer" into path, offset resumes a partial file
+ */
+Error NetGameServerCore::accept_stream(int id, int sid, const String &path,
+					int offset) {
+	DVector<uint8_t> body;
+	Error err = ERR_DOES_NOT_EXIST;
+
+	conn_mutex->lock();
+	NetGameServerConnection *cd = _get_client(id);
+	if(cd != NULL) {
+		err = cd->transfer.accept(sid, path, offset, body);
+		if(err == OK) {
+			err = _enqueue_pcmd(id, body, PCMD_STREAM);
+		}
+	}
+	conn_mutex->unlock();
+	return err;
+}
+
+Error NetGameServerCore::cancel_stream(int id, int sid) {
+	DVector<uint8_t> body;
+	Error err = ERR_DOES_NOT_EXIST;
+
+	conn_mutex->lock();
+	NetGameServerConnection *cd = _get_client(id);
+	if(cd != NULL) {
+		err = cd->transfer.cancel(sid, body);
+		if(err == OK) {
+			err = _enqueue_pcmd(id, body, PCMD_STREAM);
+		}
+	}
+	conn_mutex->unlock();
+	return err;
+}
+
+Error NetGameServerCore::reject_stream(int id, int sid) {
+	DVector<uint8_t> body;
+	Error err = ERR_DOES_NOT_EXIST;
+
+	conn_mutex->lock();
+	NetGameServerConnection *cd = _get_client(id);
+	if(cd != NULL) {
+		err = cd->transfer.reject(sid, body);
+		if(err == OK) {
+			err = _enqueue_pcmd(id, body, PCMD_STREAM);
+		}
+	}
+	conn_mutex->unlock();
+	return err;
+}
+
+Error NetGameServerCore::_enqueue_pcmd(int id, const DVector<uint8_t> &pkt,
+					uint8_t pcmd) {
+	Error out;
+
+	conn_mutex->lock();
+	NetGameServerConnection *cd = _get_client(id);
+	if(cd == NULL) {
+		conn_mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	if(cd->state != READY) {
+		conn_mutex->unlock();
+		return ERR_CONNECTION_ERROR;
+	}
+	if(cd->udp_only && pkt.size() + 2 > RELIABLE_MAX_SIZE) {
+		conn_mutex->unlock();
+		return ERR_INVALID_PARAMETER;
+	}
+	out = cd->enqueue_pcmd(pkt, pcmd);
+	conn_mutex->unlock();
+	return out;
+}
+
+Error NetGameServerCore::auth_client(CID id) {
+	conn_mutex->lock();
+	NetGameServerConnection *conn = _get_client(id);
+	if(conn == NULL) {
+		conn_mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	if(conn->authed) {
+		conn_mutex->unlock();
+		return ERR_ALREADY_EXISTS;
+	}
+	// The network thread sends the id to the client
+	conn->authed = true;
+
+	conn_mutex->unlock();
+	return OK;
+}
+
+Error NetGameServerCore::kick_client(CID id, int reason) {
+	conn_mutex->lock();
+	NetGameServerConnection *conn = _get_client(id);
+	if(conn == NULL) {
+		conn_mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+
+	// The network thread notifies the client, closes its socket and
+	// removes it in its next tick (on_update), it alone writes to it
+	conn->state = DISCONNECTED;
+	conn->disconnect_reason = (DisconnectReason)reason;
+	conn_mutex->unlock();
+	return OK;
+}
+
+void NetGameServerCore::_bind_methods() {
+	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_CONNECT,PropertyInfo( Variant::INT,"id")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_READY,PropertyInfo( Variant::INT,"id")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_DISCONNECT,PropertyInfo( Variant::INT,"id")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_RESUME,PropertyInfo( Variant::INT,"id")));
+
+	ADD_SIGNAL(MethodInfo(SIGNAL_UDP_PACKET,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"cmd"), PropertyInfo(Variant::RAW_ARRAY,"pkt")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_TCP_PACKET,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"cmd"), PropertyInfo(Variant::RAW_ARRAY,"pkt")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_AUTH_PACKET,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"cmd"), PropertyInfo(Variant::RAW_ARRAY,"pkt")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_UDP_MESSAGE,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"cmd"), PropertyInfo(Variant::DICTIONARY,"msg")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_TCP_MESSAGE,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"cmd"), PropertyInfo(Variant::DICTIONARY,"msg")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_RPC_REQUEST,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"rid"), PropertyInfo(Variant::INT,"method"), PropertyInfo(Variant::NIL,"args")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_STREAM_OFFER,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"sid"), PropertyInfo(Variant::INT,"size"), PropertyInfo(Variant::STRING,"name")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_STREAM_PROGRESS,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"sid"), PropertyInfo(Variant::INT,"offset"), PropertyInfo(Variant::INT,"size")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_STREAM_COMPLETED,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"sid"), PropertyInfo(Variant::INT,"error"), PropertyInfo(Variant::INT,"offset")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_MEDIA_FRAME,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"stream"), PropertyInfo(Variant::REAL,"timestamp"), PropertyInfo(Variant::RAW_ARRAY,"frame")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_BRIDGE_CONNECT,PropertyInfo(Variant::INT,"peer")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_BRIDGE_DISCONNECT,PropertyInfo(Variant::INT,"peer")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_BRIDGE_PACKET,PropertyInfo(Variant::INT,"peer"), PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"cmd"), PropertyInfo(Variant::RAW_ARRAY,"pkt")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_MIGRATED,PropertyInfo(Variant::INT,"id"), PropertyInfo(Variant::INT,"peer"), PropertyInfo(Variant::DICTIONARY,"data")));
+	ADD_SIGNAL(MethodInfo(SIGNAL_CLIENT_MIGRATE_FAILED,PropertyInfo(Variant::INT,"id")));
+
+	BIND_CONSTANT(PROCESS);
+	BIND_CONSTANT(FIXED);
+	BIND_CONSTANT(THREADED);
+
+	BIND_CONSTANT(DISCONNECT_NONE);
+	BIND_CONSTANT(DISCONNECT_CLOSE);
+	BIND_CONSTANT(DISCONNECT_KICK);
+	BIND_CONSTANT(DISCONNECT_SHUTDOWN);
+	BIND_CONSTANT(DISCONNECT_RESTART);
+	BIND_CONSTANT(DISCONNECT_MIGRATE);
+
+	BIND_CONSTANT(MSG_BOOL);
+	BIND_CONSTANT(MSG_INT);
+	BIND_CONSTANT(MSG_UINT);
+	BIND_CONSTANT(MSG_FLOAT);
+	BIND_CONSTANT(MSG_VECTOR2);
+	BIND_CONSTANT(MSG_VECTOR3);
+	BIND_CONSTANT(MSG_STRING);
+
+	BIND_CONSTANT(REPLICA_BOOL);
+	BIND_CONSTANT(REPLICA_INT);
+	BIND_CONSTANT(REPLICA_FLOAT);
+	BIND_CONSTANT(REPLICA_VECTOR3);
+
+	ObjectTypeDB::bind_method(_MD("start", "tcp_port", "udp_port"), &NetGameServerCore::start);
+	ObjectTypeDB::bind_method(_MD("start_udp_only", "udp_port"), &NetGameServerCore::start_udp_only);
+	ObjectTypeDB::bind_method(_MD("is_udp_only"), &NetGameServerCore::is_udp_only);
+	ObjectTypeDB::bind_method(_MD("stop", "reason"), &NetGameServerCore::stop, DEFVAL(DISCONNECT_SHUTDOWN));
+	ObjectTypeDB::bind_method(_MD("drain:Error", "timeout_msec"), &NetGameServerCore::drain);
+	ObjectTypeDB::bind_method(_MD("export_sessions"), &NetGameServerCore::export_sessions);
+	ObjectTypeDB::bind_method(_MD("import_sessions:Error", "data"), &NetGameServerCore::import_sessions);
+	ObjectTypeDB::bind_method(_MD("put_udp_packet:Error", "id", "pkt", "cmd", "rt"),&NetGameServerCore::put_udp_packet,DEFVAL(0), DEFVAL(false));
+	ObjectTypeDB::bind_method(_MD("put_tcp_packet:Error", "id", "pkt", "cmd"),&NetGameServerCore::put_tcp_packet, DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("broadcast_udp:Error", "pkt", "cmd", "rt"),&NetGameServerCore::broadcast_udp,DEFVAL(0), DEFVAL(false));
+	ObjectTypeDB::bind_method(_MD("broadcast_tcp:Error", "pkt", "cmd"),&NetGameServerCore::broadcast_tcp, DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("register_message:Error", "cmd", "layout"),&NetGameServerCore::register_message);
+	ObjectTypeDB::bind_method(_MD("unregister_message", "cmd"),&NetGameServerCore::unregister_message);
+	ObjectTypeDB::bind_method(_MD("put_tcp_message:Error", "id", "cmd", "args"),&NetGameServerCore::put_tcp_message);
+	ObjectTypeDB::bind_method(_MD("put_udp_message:Error", "id", "cmd", "args", "rt"),&NetGameServerCore::put_udp_message,DEFVAL(false));
+	ObjectTypeDB::bind_method(_MD("broadcast_udp_message:Error", "cmd", "args", "rt"),&NetGameServerCore::broadcast_udp_message,DEFVAL(false));
+	ObjectTypeDB::bind_method(_MD("broadcast_udp_interest:Error", "pkt", "cmd", "origin", "radius", "rt"),&NetGameServerCore::broadcast_udp_interest,DEFVAL(false));
+	ObjectTypeDB::bind_method(_MD("multicast_to_group:Error", "group", "pkt", "cmd", "rt"),&NetGameServerCore::multicast_to_group,DEFVAL(0), DEFVAL(false));
+	ObjectTypeDB::bind_method(_MD("set_client_position:Error", "id", "pos"),&NetGameServerCore::set_client_position);
+	ObjectTypeDB::bind_method(_MD("clear_client_position:Error", "id"),&NetGameServerCore::clear_client_position);
+	ObjectTypeDB::bind_method(_MD("join_group:Error", "id", "group"),&NetGameServerCore::join_group);
+	ObjectTypeDB::bind_method(_MD("leave_group:Error", "id", "group"),&NetGameServerCore::leave_group);
+	ObjectTypeDB::bind_method(_MD("set_interest_cell_size","size"),&NetGameServerCore::set_interest_cell_size);
+	ObjectTypeDB::bind_method(_MD("get_interest_cell_size"),&NetGameServerCore::get_interest_cell_size);
+	ObjectTypeDB::bind_method(_MD("set_relay_rate","rate"),&NetGameServerCore::set_relay_rate);
+	ObjectTypeDB::bind_method(_MD("get_relay_rate"),&NetGameServerCore::get_relay_rate);
+	ObjectTypeDB::bind_method(_MD("set_client_relay_rate:Error","id","rate"),&NetGameServerCore::set_client_relay_rate);
+	ObjectTypeDB::bind_method(_MD("set_relay_cmd_allowed","cmd","allowed"),&NetGameServerCore::set_relay_cmd_allowed);
+	ObjectTypeDB::bind_method(_MD("is_relay_cmd_allowed","cmd"),&NetGameServerCore::is_relay_cmd_allowed);
+	ObjectTypeDB::bind_method(_MD("set_relay_blocked:Error","from","to","blocked"),&NetGameServerCore::set_relay_blocked);
+	ObjectTypeDB::bind_method(_MD("get_relay_stats","id"),&NetGameServerCore::get_relay_stats);
+	ObjectTypeDB::bind_method(_MD("set_media_jitter","msec"),&NetGameServerCore::set_media_jitter);
+	ObjectTypeDB::bind_method(_MD("get_media_jitter"),&NetGameServerCore::get_media_jitter);
+	ObjectTypeDB::bind_method(_MD("get_media_stats","id","stream"),&NetGameServerCore::get_media_stats);
+	ObjectTypeDB::bind_method(_MD("set_bridge_key","key"),&NetGameServerCore::set_bridge_key);
+	ObjectTypeDB::bind_method(_MD("bridge_listen:Error","port","bind"),&NetGameServerCore::bridge_listen,DEFVAL("*"));
+	ObjectTypeDB::bind_method(_MD("bridge_connect","host","port"),&NetGameServerCore::bridge_connect);
+	ObjectTypeDB::bind_method(_MD("bridge_disconnect","peer"),&NetGameServerCore::bridge_disconnect);
+	ObjectTypeDB::bind_method(_MD("get_bridge_peers"),&NetGameServerCore::get_bridge_peers);
+	ObjectTypeDB::bind_method(_MD("bridge_send:Error","peer","pkt","cmd","id"),&NetGameServerCore::bridge_send,DEFVAL(0),DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("bridge_broadcast:Error","pkt","cmd","id"),&NetGameServerCore::bridge_broadcast,DEFVAL(0),DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("bridge_send_to_client:Error","peer","id","pkt","cmd"),&NetGameServerCore::bridge_send_to_client,DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("set_client_forward:Error","id","peer"),&NetGameServerCore::set_client_forward);
+	ObjectTypeDB::bind_method(_MD("migrate_client:Error","id","peer","host","tcp_port","udp_port","data"),&NetGameServerCore::migrate_client,DEFVAL(Dictionary()));
+	ObjectTypeDB::bind_method(_MD("get_inputs_for_tick","tick"),&NetGameServerCore::get_inputs_for_tick);
+	ObjectTypeDB::bind_method(_MD("get_input_stats","id"),&NetGameServerCore::get_input_stats);
+	ObjectTypeDB::bind_method(_MD("rewind_add:Error","eid","radius"),&NetGameServerCore::rewind_add,DEFVAL(0.5));
+	ObjectTypeDB::bind_method(_MD("rewind_remove","eid"),&NetGameServerCore::rewind_remove);
+	ObjectTypeDB::bind_method(_MD("rewind_set_position:Error","eid","pos"),&NetGameServerCore::rewind_set_position);
+	ObjectTypeDB::bind_method(_MD("rewind_capture"),&NetGameServerCore::rewind_capture);
+	ObjectTypeDB::bind_method(_MD("rewind_get_position","id","eid"),&NetGameServerCore::rewind_get_position);
+	ObjectTypeDB::bind_method(_MD("rewind_raycast","id","from","to"),&NetGameServerCore::rewind_raycast);
+	ObjectTypeDB::bind_method(_MD("rewind_query_sphere","id","center","radius"),&NetGameServerCore::rewind_query_sphere);
+	ObjectTypeDB::bind_method(_MD("set_rewind_interp_delay","msec"),&NetGameServerCore::set_rewind_interp_delay);
+	ObjectTypeDB::bind_method(_MD("get_rewind_interp_delay"),&NetGameServerCore::get_rewind_interp_delay);
+	ObjectTypeDB::bind_method(_MD("replica_create:Error", "oid", "fields"),&NetGameServerCore::replica_create);
+	ObjectTypeDB::bind_method(_MD("replica_remove:Error", "oid"),&NetGameServerCore::replica_remove);
+	ObjectTypeDB::bind_method(_MD("replica_set:Error", "oid", "field", "value"),&NetGameServerCore::replica_set);
+	ObjectTypeDB::bind_method(_MD("replica_get", "oid", "field"),&NetGameServerCore::replica_get);
+	ObjectTypeDB::bind_method(_MD("set_replication_rate","rate"),&NetGameServerCore::set_replication_rate);
+	ObjectTypeDB::bind_method(_MD("get_replication_rate"),&NetGameServerCore::get_replication_rate);
+	ObjectTypeDB::bind_method(_MD("rpc_call:NetGameCall","id","method","args"),&NetGameServerCore::rpc_call,DEFVAL(Variant()));
+	ObjectTypeDB::bind_method(_MD("rpc_reply:Error","id","rid","result"),&NetGameServerCore::rpc_reply,DEFVAL(Variant()));
+	ObjectTypeDB::bind_method(_MD("set_rpc_timeout","msec"),&NetGameServerCore::set_rpc_timeout);
+	ObjectTypeDB::bind_method(_MD("get_rpc_timeout"),&NetGameServerCore::get_rpc_timeout);
+	ObjectTypeDB::bind_method(_MD("stream_file","id","path","name"),&NetGameServerCore::stream_file,DEFVAL(""));
+	ObjectTypeDB::bind_method(_MD("stream_buffer","id","buffer","name"),&NetGameServerCore::stream_buffer,DEFVAL(""));
+	ObjectTypeDB::bind_method(_MD("accept_stream:Error","id","sid","path","offset"),&NetGameServerCore::accept_stream,DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("cancel_stream:Error","id","sid"),&NetGameServerCore::cancel_stream);
+	ObjectTypeDB::bind_method(_MD("reject_stream:Error","id","sid"),&NetGameServerCore::reject_stream);
+	ObjectTypeDB::bind_method(_MD("auth_client", "id"),&NetGameServerCore::auth_client);
+	ObjectTypeDB::bind_method(_MD("kick_client", "id", "reason"),&NetGameServerCore::kick_client,DEFVAL(DISCONNECT_KICK));
+	ObjectTypeDB::bind_method(_MD("set_secure","enabled"),&NetGameServerCore::set_secure);
+	ObjectTypeDB::bind_method(_MD("is_secure"),&NetGameServerCore::is_secure);
+	ObjectTypeDB::bind_method(_MD("set_secure_key","key"),&NetGameServerCore::set_secure_key);
+	ObjectTypeDB::bind_method(_MD("set_handshake_rate","rate"),&NetGameServerCore::set_handshake_rate);
+	ObjectTypeDB::bind_method(_MD("get_handshake_rate"),&NetGameServerCore::get_handshake_rate);
+	ObjectTypeDB::bind_method(_MD("set_resume_grace","msec"),&NetGameServerCore::set_resume_grace);
+	ObjectTypeDB::bind_method(_MD("get_resume_grace"),&NetGameServerCore::get_resume_grace);
+	ObjectTypeDB::bind_method(_MD("set_keepalive_interval","msec"),&NetGameServerCore::set_keepalive_interval);
+	ObjectTypeDB::bind_method(_MD("get_keepalive_interval"),&NetGameServerCore::get_keepalive_interval);
+	ObjectTypeDB::bind_method(_MD("set_tcp_keepalive_interval","msec"),&NetGameServerCore::set_tcp_keepalive_interval);
+	ObjectTypeDB::bind_method(_MD("get_tcp_keepalive_interval"),&NetGameServerCore::get_tcp_keepalive_interval);
+	ObjectTypeDB::bind_method(_MD("set_keepalive_timeout","msec"),&NetGameServerCore::set_keepalive_timeout);
+	ObjectTypeDB::bind_method(_MD("get_keepalive_timeout"),&NetGameServerCore::get_keepalive_timeout);
+	ObjectTypeDB::bind_method(_MD("set_keepalive_min_timeout","msec"),&NetGameServerCore::set_keepalive_min_timeout);
+	ObjectTypeDB::bind_method(_MD("get_keepalive_min_timeout"),&NetGameServerCore::get_keepalive_min_timeout);
+	ObjectTypeDB::bind_method(_MD("set_client_keepalive:Error","id","interval","timeout"),&NetGameServerCore::set_client_keepalive);
+	ObjectTypeDB::bind_method(_MD("get_client_rtt","id"),&NetGameServerCore::get_client_rtt);
+	ObjectTypeDB::bind_method(_MD("get_udp_stats","id","cmd"),&NetGameServerCore::get_udp_stats,DEFVAL(-1));
+	ObjectTypeDB::bind_method(_MD("set_signal_mode","mode"),&NetGameServerCore::set_signal_mode);
+	ObjectTypeDB::bind_method(_MD("get_signal_mode"),&NetGameServerCore::get_signal_mode);
+	ObjectTypeDB::bind_method(_MD("poll","max_usec"),&NetGameServerCore::poll,DEFVAL(0));
+	ObjectTypeDB::bind_method(_MD("set_reactor","reactor:NetGameReactor"),&NetGameServerCore::set_reactor);
+	ObjectTypeDB::bind_method(_MD("get_reactor:NetGameReactor"),&NetGameServerCore::get_reactor);
+	ObjectTypeDB::bind_method(_MD("set_recorder","recorder:NetGameRecorder"),&NetGameServerCore::set_recorder);
+	ObjectTypeDB::bind_method(_MD("get_recorder:NetGameRecorder"),&NetGameServerCore::get_recorder);
+	ADD_PROPERTYNZ( PropertyInfo(Variant::INT,"signal_mode",PROPERTY_HINT_ENUM,"Process,Fixed,Threaded"),_SCS("set_signal_mode"),_SCS("get_signal_mode"));
+	ADD_PROPERTY( PropertyInfo(Variant::BOOL,"secure"),_SCS("set_secure"),_SCS("is_secure"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"handshake_rate",PROPERTY_HINT_RANGE,"0,1000,1"),_SCS("set_handshake_rate"),_SCS("get_handshake_rate"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"resume_grace",PROPERTY_HINT_RANGE,"0,60000,100"),_SCS("set_resume_grace"),_SCS("get_resume_grace"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"keepalive_interval",PROPERTY_HINT_RANGE,"50,10000,50"),_SCS("set_keepalive_interval"),_SCS("get_keepalive_interval"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"tcp_keepalive_interval",PROPERTY_HINT_RANGE,"100,30000,100"),_SCS("set_tcp_keepalive_interval"),_SCS("get_tcp_keepalive_interval"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"keepalive_timeout",PROPERTY_HINT_RANGE,"1000,120000,100"),_SCS("set_keepalive_timeout"),_SCS("get_keepalive_timeout"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"keepalive_min_timeout",PROPERTY_HINT_RANGE,"500,120000,100"),_SCS("set_keepalive_min_timeout"),_SCS("get_keepalive_min_timeout"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"replication_rate",PROPERTY_HINT_RANGE,"0,120,1"),_SCS("set_replication_rate"),_SCS("get_replication_rate"));
+	ADD_PROPERTY( PropertyInfo(Variant::REAL,"interest_cell_size",PROPERTY_HINT_RANGE,"1,4096,1"),_SCS("set_interest_cell_size"),_SCS("get_interest_cell_size"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"relay_rate",PROPERTY_HINT_RANGE,"0,1000,1"),_SCS("set_relay_rate"),_SCS("get_relay_rate"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"rpc_timeout",PROPERTY_HINT_RANGE,"100,120000,100"),_SCS("set_rpc_timeout"),_SCS("get_rpc_timeout"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"rewind_interp_delay",PROPERTY_HINT_RANGE,"0,1000,1"),_SCS("set_rewind_interp_delay"),_SCS("get_rewind_interp_delay"));
+	ADD_PROPERTY( PropertyInfo(Variant::INT,"media_jitter",PROPERTY_HINT_RANGE,"0,1000,1"),_SCS("set_media_jitter"),_SCS("get_media_jitter"));
+}
+
+NetGameServerCore::NetGameServerCore() {
+	signal_mode = PROCESS;
+	signal_target = NULL;
+	quit = true;
+	udp_only = false;
+	draining = false;
+	stop_reason = DISCONNECT_SHUTDOWN;
+	conn_mutex = Mutex::create();
+	signal_mutex = Mutex::create();
+	tcp_server = TCP_Server::create_ref();
+	udp_server = PacketPeerUDP::create_ref();
+	thread = NULL;
+	replica_rate = REPLICA_RATE;
+	rewind_interp_delay = REWIND_INTERP_DELAY;
+	replica_time = 0;
+	tick_time = 0;
+	secure = false;
+	has_psk = false;
+	resume_grace = RESUME_GRACE;
+	keepalive_interval = UDP_PING;
+	tcp_keepalive_interval = TCP_PING;
+	keepalive_timeout = TIMEOUT;
+	keepalive_min_timeout = KEEPALIVE_MIN_TIMEOUT;
+}
+
+NetGameServerCore::~NetGameServerCore() {
+	stop();
+
+	memdelete(conn_mutex);
+	memdelete(signal_mutex);
+}
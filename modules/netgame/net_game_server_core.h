@@ -0,0 +1,295 @@
+#ifndef NET_GAME_SERVER_CORE_H
+#define NET_GAME_SERVER_CORE_H
+
+#include <stdlib.h>
+#include "reference.h"
+#include "os/thread.h"
+#include "io/tcp_server.h"
+#include "io/packet_peer_udp.h"
+#include "modules/netgame/net_game_server_data.h"
+#include "modules/netgame/net_game_server_connection.h"
+#include "modules/netgame/net_game_interest.h"
+#include "modules/netgame/net_game_input.h"
+#include "modules/netgame/net_game_replica.h"
+#include "modules/netgame/net_game_schema.h"
+#include "modules/netgame/net_game_handshake.h"
+#include "modules/netgame/net_game_reactor.h"
+#include "modules/netgame/net_game_record.h"
+#include "modules/netgame/net_game_timer.h"
+#include "modules/netgame/net_game_outbox.h"
+#include "modules/netgame/net_game_rpc.h"
+#include "modules/netgame/net_game_rewind.h"
+#include "modules/netgame/net_game_relay.h"
+#include "modules/netgame/net_game_bridge.h"
+#include "modules/netgame/net_game_media.h"
+
+class NetGameServerConnection;
+
+class NetGameServerCore: public Reference {
+	OBJ_TYPE( NetGameServerCore, Reference );
+
+	// Client id kept for a session coming from a bridge peer
+	struct MigrationIn {
+		CID peer;
+		uint64_t expire;
+	};
+
+	// TCP peer that has not echoed its cookie yet (no id assigned)
+	struct PendingPeer {
+		Ref<StreamPeerTCP> peer;
+		IP_Address host;
+		int port;
+		uint64_t time;
+		int read;
+		uint8_t buf[7 + COOKIE_SIZE + RESUME_TOKEN_SIZE];
+	};
+
+	Mutex *conn_mutex;
+	Mutex *signal_mutex;
+	Ref<TCP_Server> tcp_server;
+	NetGameOutbox outbox;
+	Vector<QueuedPacket*> outgoing;
+	Vector<QueuedSignal*> signal_queue;
+	VMap<CID, NetGameServerConnection*> connections;
+	Vector<PendingPeer> pending;
+	Vector<NetGameTimer*> expired;
+	Vector<CID> stale;
+	HashMap<uint64_t, CID> udp_peers;
+	NetGameInterest interest;
+	Thread *thread;
+	Ref<NetGameReactor> reactor;
+	Ref<NetGameRecorder> recorder;
+	bool quit;
+	bool udp_only;
+	bool draining;
+	DisconnectReason stop_reason;
+	int replica_rate;
+	uint64_t replica_time;
+	NetGameRewind rewind;
+	int rewind_interp_delay;
+	VMap<CID, MigrationIn> migrations_in;
+	Vector<BridgeMessage> bridge_events;
+
+	CID _get_id();
+	CSE _get_secret();
+
+	void _run();
+	Error _enqueue_udp(CID id, uint32_t gen, const DVector<uint8_t> &pkt,
+				int cmd, bool timed);
+	Error _enqueue_pcmd(int id, const DVector<uint8_t> &pkt, uint8_t pcmd);
+	Error _enqueue_udp_list(const Vector<CID> &ids,
+				const DVector<uint8_t> &pkt, int cmd, bool timed);
+	void _check_connections(uint64_t time);
+	bool _update_pending(PendingPeer &pp, uint64_t time);
+	void _add_client(const Ref<StreamPeerTCP> &peer);
+	void _resume_client(const Ref<StreamPeerTCP> &peer, CID id,
+				const uint8_t *token);
+	void _clear_pending();
+	void _delete_client(NetGameServerConnection *cd);
+	void _clear_clients();
+	bool _is_drained();
+	void _remove_stale_clients();
+	void _flush_outbox();
+	void _handle_udp(uint64_t time);
+	void _handle_tcp(uint64_t time);
+	void _clear_queues();
+	void _replicate(uint64_t time);
+	uint64_t _rewind_time(int id);
+	void _queue_media(const Vector<MediaFrame> &frames);
+	void _media_tick(uint64_t time);
+	void _bridge_tick(uint64_t time);
+	void _bridge_lost(CID peer);
+	void _migrate_offer(const BridgeMessage &m, uint64_t time);
+	void _migrate_import(const BridgeMessage &m);
+
+	uint64_t _udp_peer_key(const IP_Address &host, int port);
+	void _handle_udp_handshake(const uint8_t *buf, int len,
+				const IP_Address &addr, int port, uint64_t time);
+	void _add_udp_client(const IP_Address &addr, int port,
+				const uint8_t *peer_key);
+	NetGameServerConnection *_get_client(int id);
+
+	Object *signal_target;
+
+	Object *_get_signal_target();
+
+protected:
+	static void _bind_methods();
+
+public:
+	Ref<PacketPeerUDP> udp_server;
+	NetGameReplicaServer replica;
+	NetGameSchema schema;
+	NetGameHandshake handshake;
+	NetGameTimerWheel timers;
+	NetGameRPC rpc;
+	NetGameInputBuffer inputs;
+	NetGameRelay relay;
+	NetGameBridge bridge;
+	NetGameMedia media;
+	uint64_t tick_time;
+	SignalsMode signal_mode;
+	bool secure;
+	bool has_psk;
+	uint8_t psk[32];
+	int resume_grace;
+	int keepalive_interval;
+	int tcp_keepalive_interval;
+	int keepalive_timeout;
+	int keepalive_min_timeout;
+
+	void _update_keepalive();
+
+	void start(int tcp_port, int udp_port);
+	void start_udp_only(int udp_port);
+	bool is_udp_only() const;
+	void stop(int reason=DISCONNECT_SHUTDOWN);
+	Error drain(int timeout_msec);
+	DVector<uint8_t> export_sessions();
+	Error import_sessions(const DVector<uint8_t> &data);
+	void set_signal_mode(SignalsMode p_mode);
+	SignalsMode get_signal_mode() const;
+	void set_signal_target(Object *p_target);
+	int poll(int max_usec=0);
+	void set_reactor(const Ref<NetGameReactor> &p_reactor);
+	Ref<NetGameReactor> get_reactor() const;
+	void set_recorder(const Ref<NetGameRecorder> &p_recorder);
+	Ref<NetGameRecorder> get_recorder() const;
+	void set_secure(bool p_secure);
+	bool is_secure() const;
+	void set_secure_key(const String &p_key);
+	void set_handshake_rate(int p_rate);
+	int get_handshake_rate() const;
+	void set_resume_grace(int p_msec);
+	int get_resume_grace() const;
+	void set_keepalive_interval(int p_msec);
+	int get_keepalive_interval() const;
+	void set_tcp_keepalive_interval(int p_msec);
+	int get_tcp_keepalive_interval() const;
+	void set_keepalive_timeout(int p_msec);
+	int get_keepalive_timeout() const;
+	void set_keepalive_min_timeout(int p_msec);
+	int get_keepalive_min_timeout() const;
+	Error set_client_keepalive(int id, int interval, int timeout);
+	int get_client_rtt(int id);
+	Dictionary get_udp_stats(int id, int cmd=-1);
+
+	void _queue_signal(const char *sig, CID id);
+	void _queue_signal(const char *sig, CID id,
+				const DVector<uint8_t> &pkt, int cmd=0);
+	void _queue_signal(const char *sig, CID id,
+				const Dictionary &msg, int cmd);
+	void _queue_packet(const char *sig, const char *msg_sig, CID id,
+				const DVector<uint8_t> &pkt, int cmd);
+	void _queue_signal(const char *sig, CID id, uint32_t rid, int cmd,
+				const Variant &args);
+	void _queue_frame(CID id, int stream, uint32_t timestamp,
+				const DVector<uint8_t> &frame);
+
+	Error put_tcp_packet(int id, const DVector<uint8_t> &pkt, int cmd=0);
+	Error broadcast_tcp(const DVector<uint8_t> &pkt, int cmd=0);
+	Error put_udp_packet(int id, const DVector<uint8_t> &pkt,
+				int cmd=0, bool timed=false);
+	Error broadcast_udp(const DVector<uint8_t> &pkt,
+				int cmd=0, bool timed=false);
+	Error register_message(int cmd, const Array &layout);
+	void unregister_message(int cmd);
+	Error put_tcp_message(int id, int cmd, const Variant &args);
+	Error put_udp_message(int id, int cmd, const Variant &args,
+				bool timed=false);
+	Error broadcast_udp_message(int cmd, const Variant &args,
+				bool timed=false);
+
+	Error broadcast_udp_interest(const DVector<uint8_t> &pkt, int cmd,
+				const Vector3 &origin, real_t radius,
+				bool timed=false);
+	Error multicast_to_group(const String &group,
+				const DVector<uint8_t> &pkt,
+				int cmd=0, bool timed=false);
+
+	Error set_client_position(int id, const Vector3 &pos);
+	Error clear_client_position(int id);
+	Error join_group(int id, const String &group);
+	Error leave_group(int id, const String &group);
+	void set_interest_cell_size(real_t p_size);
+	real_t get_interest_cell_size() const;
+
+	void set_relay_rate(int p_rate);
+	int get_relay_rate() const;
+	Error set_client_relay_rate(int id, int rate);
+	void set_relay_cmd_allowed(int cmd, bool allowed);
+	bool is_relay_cmd_allowed(int cmd);
+	Error set_relay_blocked(int from, int to, bool blocked);
+	Dictionary get_relay_stats(int id);
+
+	void set_media_jitter(int p_jitter);
+	int get_media_jitter() const;
+	Dictionary get_media_stats(int id, int stream);
+
+	void set_bridge_key(const String &p_key);
+	Error bridge_listen(int port, const String &bind="*");
+	int bridge_connect(const String &host, int port);
+	void bridge_disconnect(int peer);
+	Array get_bridge_peers();
+	Error bridge_send(int peer, const DVector<uint8_t> &pkt, int cmd=0,
+				int id=0);
+	Error bridge_broadcast(const DVector<uint8_t> &pkt, int cmd=0, int id=0);
+	Error bridge_send_to_client(int peer, int id, const DVector<uint8_t> &pkt,
+				int cmd=0);
+	Error set_client_forward(int id, int peer);
+	Error migrate_client(int id, int peer, const String &host, int tcp_port,
+				int udp_port, const Dictionary &data=Dictionary());
+
+	Array get_inputs_for_tick(int tick);
+	Dictionary get_input_stats(int id);
+
+	Error rewind_add(int eid, real_t radius=0.5);
+	void rewind_remove(int eid);
+	Error rewind_set_position(int eid, const Vector3 &pos);
+	void rewind_capture();
+	Variant rewind_get_position(int id, int eid);
+	Dictionary rewind_raycast(int id, const Vector3 &from, const Vector3 &to);
+	Array rewind_query_sphere(int id, const Vector3 &center, real_t radius);
+	void set_rewind_interp_delay(int p_msec);
+	int get_rewind_interp_delay() const;
+
+	Error replica_create(int oid, const Array &fields);
+	Error replica_remove(int oid);
+	Error replica_set(int oid, const String &field, const Variant &value);
+	Variant replica_get(int oid, const String &field);
+	void set_replication_rate(int p_rate);
+	int get_replication_rate() const;
+
+	Ref<NetGameCall> rpc_call(int id, int method, const Variant &args=Variant());
+	Error rpc_reply(int id, int rid, const Variant &result=Variant());
+	void set_rpc_timeout(int p_msec);
+	int get_rpc_timeout() const;
+
+	int stream_file(int id, const String &path, const String &name="");
+	int stream_buffer(int id, const DVector<uint8_t> &buf,
+				const String &name="");
+	Error accept_stream(int id, int sid, const String &path, int offset=0);
+	Error cancel_stream(int id, int sid);
+	Error reject_stream(int id, int sid);
+
+	Error auth_client(CID id);
+	Error kick_client(CID id, int reason=DISCONNECT_KICK);
+
+	Error _put_udp_raw(const IP_Address &host, int port,
+				const uint8_t *p_buf, int p_len);
+	void _move_udp_peer(NetGameServerConnection *cd,
+				const IP_Address &host, int port);
+	void _relay(NetGameServerConnection *from, const DVector<uint8_t> &pkt,
+			uint8_t pcmd);
+	void _receive_media(NetGameServerConnection *from,
+			const DVector<uint8_t> &pkt);
+
+	void _server_tick();
+	static void _thread_start(void*s);
+
+
+	NetGameServerCore();
+	~NetGameServerCore();
+};
+
+#endif
@@ -4,13 +4,29 @@
 #define SIGNAL_CLIENT_CONNECT "client_connect"
 #define SIGNAL_CLIENT_READY "client_ready"
 #define SIGNAL_CLIENT_DISCONNECT "client_disconnect"
+#define SIGNAL_CLIENT_RESUME "client_resume"
 #define SIGNAL_AUTH_PACKET "auth_packet"
 #define SIGNAL_TCP_PACKET "tcp_packet"
 #define SIGNAL_UDP_PACKET "udp_packet"
+#define SIGNAL_TCP_MESSAGE "tcp_message"
+#define SIGNAL_UDP_MESSAGE "udp_message"
+#define SIGNAL_RPC_REQUEST "rpc_request"
+#define SIGNAL_STREAM_OFFER "stream_offer"
+#define SIGNAL_STREAM_PROGRESS "stream_progress"
+#define SIGNAL_STREAM_COMPLETED "stream_completed"
+#define SIGNAL_RELAY_PACKET "relay_packet"
+#define SIGNAL_BRIDGE_CONNECT "bridge_connect"
+#define SIGNAL_BRIDGE_DISCONNECT "bridge_disconnect"
+#define SIGNAL_BRIDGE_PACKET "bridge_packet"
+#define SIGNAL_CLIENT_MIGRATED "client_migrated"
+#define SIGNAL_CLIENT_MIGRATE_FAILED "client_migrate_failed"
+#define SIGNAL_MEDIA_FRAME "media_frame"
 
 #define SERVER_SLEEP_USEC 50
 #define CLIENT_SLEEP_USEC 200
 
+#define UDP_BATCH 64
+
 #define PKT_QUEUE_SIZE 25
 #define SIG_QUEUE_SIZE 25
 
@@ -21,6 +37,46 @@
 #define CMD_MAX 255
 #define PCMD_PING 0
 #define PCMD_AUTH 1
+#define PCMD_REPLICA 2
+#define PCMD_KEY 3
+#define PCMD_COOKIE 4
+#define PCMD_RESUME 5
+#define PCMD_HELLO 6
+#define PCMD_WELCOME 7
+#define PCMD_RELIABLE 8
+#define PCMD_ACK 9
+#define PCMD_DISCONNECT 10
+#define PCMD_PONG 11
+#define PCMD_CALL 12
+#define PCMD_RESULT 13
+#define PCMD_STREAM 14
+#define PCMD_INPUT 15
+#define PCMD_INPUT_ACK 16
+#define PCMD_RELAY 17
+#define PCMD_MIGRATE 18
+#define PCMD_MEDIA 19
+
+// Second byte of a UDP packet (the pcmd when cmd is CMD_MAX), timed
+// packets carry a 16 bit sequence after it
+#define UDP_FLAG_TIMED 1
+
+#define COOKIE_SIZE 8
+#define RESUME_TOKEN_SIZE 16
+#define RESUME_GRACE 10000
+#define RESUME_GRACE_MAX 60000
+#define RESUME_SILENCE (TCP_PING * 2 + 1000)
+#define RESUME_RETRY 1000
+
+// UDP only handshake, id 0 is never given to a client
+#define HANDSHAKE_ID 0
+#define HELLO_SIZE 48
+#define HELLO_RETRY 500
+#define PENDING_MAX 64
+#define PENDING_TIMEOUT 5000
+
+// Session export for hot restart
+#define EXPORT_VERSION 3
+#define DRAIN_SLEEP_USEC 1000
 
 typedef uint8_t CID;
 typedef uint8_t CSE;
@@ -29,6 +85,23 @@ enum ClientState {
 	WAIT_AUTH, WAIT_ACK, READY, DISCONNECTED
 };
 
+// Reason sent with PCMD_DISCONNECT
+enum DisconnectReason {
+	DISCONNECT_NONE,
+	DISCONNECT_CLOSE,
+	DISCONNECT_KICK,
+	DISCONNECT_SHUTDOWN,
+	DISCONNECT_RESTART,
+	DISCONNECT_MIGRATE
+};
+
+// Session handed to another server through the bridge
+enum MigrateState {
+	MIGRATE_NONE,
+	MIGRATE_OFFERED,
+	MIGRATE_ACCEPTED
+};
+
 enum UDPSrvSig {
 	CLI_CONNECTING, CLI_CONNECT, CLI_DISCONNECT, CLI_UDP, CLI_TCP
 };
@@ -43,9 +116,14 @@ enum SignalsMode {
 
 struct QueuedPacket {
 	CID id;
-	uint8_t cmd;
+	uint32_t gen;
+	uint16_t cmd;
 	DVector<uint8_t> packet;
 	bool timed;
+	// Protocol packet, cmd is the pcmd
+	bool proto;
+
+	QueuedPacket() { id = 0; gen = 0; cmd = 0; timed = false; proto = false; }
 };
 
 struct QueuedSignal {
@@ -55,6 +133,18 @@ struct QueuedSignal {
 	int cmd;
 	DVector<uint8_t> packet;
 	bool has_pkt;
+	Dictionary msg;
+	bool has_msg;
+	// rpc_request and stream signals: [id][rid][cmd][args]
+	uint32_t rid;
+	Variant args;
+	bool has_args;
+	// media_frame: [id][rid (stream)][timestamp][packet], a double holds
+	// every uint32 timestamp
+	double timestamp;
+	bool has_frame;
+
+	QueuedSignal() { id = 0; cmd = -1; has_pkt = false; has_msg = false; rid = 0; has_args = false; timestamp = 0; has_frame = false; }
 };
 
 VARIANT_ENUM_CAST(SignalsMode);
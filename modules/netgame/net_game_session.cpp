@@ -0,0 +1,237 @@
+
+#include "modules/netgame/net_game_session.h"
+#include "io/marshalls.h"
+
+Error NetGameSession::generate_keypair(uint8_t priv[32], uint8_t pub[32]) {
+	Error err = NetGameCrypto::random_bytes(priv, 32);
+	if(err != OK) {
+		return err;
+	}
+	NetGameCrypto::x25519_base(pub, priv);
+	return OK;
+}
+
+/*
+ * Turn a passphrase in a 32 bytes key (HChaCha20 chained over the bytes)
+ */
+void NetGameSession::derive_psk(const String &key, uint8_t out[32]) {
+	CharString cs = key.utf8();
+	uint8_t block[16];
+	int i, j;
+
+	memset(out, 0, 32);
+	for(i = 0; i <= cs.length(); i += 16) {
+		memset(block, 0, 16);
+		for(j = 0; j < 16 && i + j < cs.length(); j++) {
+			block[j] = cs.get_data()[i + j];
+		}
+		NetGameCrypto::hchacha20(out, block, out);
+	}
+	// Length block
+	memset(block, 0, 16);
+	block[0] = cs.length() & 0xFF;
+	block[1] = (cs.length() >> 8) & 0xFF;
+	block[2] = (cs.length() >> 16) & 0xFF;
+	NetGameCrypto::hchacha20(out, block, out);
+}
+
+/*
+ * Derive the two direction keys from the shared secret, both public keys
+ * and the optional pre shared key (which also defeats active MITM).
+ */
+Error NetGameSession::setup(const uint8_t priv[32], const uint8_t own_pub[32],
+				const uint8_t peer_pub[32], bool is_server,
+				const uint8_t *psk) {
+	static const uint8_t label[16] = {
+		'n', 'e', 't', 'g', 'a', 'm', 'e', ' ',
+		's', 'e', 's', 's', 'i', 'o', 'n', 0 };
+	static const uint8_t zero[16] = { 0 };
+	uint8_t shared[32];
+	uint8_t k[32];
+	uint8_t block[64];
+	const uint8_t *srv_pub = is_server ? own_pub : peer_pub;
+	const uint8_t *cli_pub = is_server ? peer_pub : own_pub;
+	int i;
+
+	reset();
+
+	NetGameCrypto::x25519(shared, priv, peer_pub);
+	if(NetGameCrypto::equals(shared, zero, 16) &&
+			NetGameCrypto::equals(shared + 16, zero, 16)) {
+		// Small order point
+		return ERR_INVALID_DATA;
+	}
+
+	NetGameCrypto::hchacha20(shared, label, k);
+	NetGameCrypto::hchacha20(k, srv_pub, k);
+	NetGameCrypto::hchacha20(k, srv_pub + 16, k);
+	NetGameCrypto::hchacha20(k, cli_pub, k);
+	NetGameCrypto::hchacha20(k, cli_pub + 16, k);
+	if(psk != NULL) {
+		for(i = 0; i < 32; i++) {
+			k[i] ^= psk[i];
+		}
+		NetGameCrypto::hchacha20(k, zero, k);
+	}
+
+	NetGameCrypto::chacha20_block(k, 0, zero, block);
+	memcpy(tx_key, is_server ? block : block + 32, 32);
+	memcpy(rx_key, is_server ? block + 32 : block, 32);
+
+	memset(shared, 0, 32);
+	memset(k, 0, 32);
+	memset(block, 0, 64);
+	ready = true;
+	return OK;
+}
+
+bool NetGameSession::is_ready() const {
+	return ready;
+}
+
+void NetGameSession::reset() {
+	memset(tx_key, 0, CRYPTO_KEY_SIZE);
+	memset(rx_key, 0, CRYPTO_KEY_SIZE);
+	tx_counter[CHANNEL_TCP] = 0;
+	tx_counter[CHANNEL_UDP] = 0;
+	tcp_rx = 0;
+	udp_rx_max = 0;
+	udp_rx_window = 0;
+	ready = false;
+}
+
+/*
+ * Keys and counters, to move a ready session to another process
+ */
+void NetGameSession::save_state(uint8_t out[SESSION_STATE_SIZE]) const {
+	memcpy(out, tx_key, CRYPTO_KEY_SIZE);
+	memcpy(out + CRYPTO_KEY_SIZE, rx_key, CRYPTO_KEY_SIZE);
+	out += CRYPTO_KEY_SIZE * 2;
+	encode_uint64(tx_counter[CHANNEL_TCP] + SESSION_EXPORT_SKIP, out);
+	encode_uint64(tx_counter[CHANNEL_UDP] + SESSION_EXPORT_SKIP, out + 8);
+	encode_uint64(tcp_rx, out + 16);
+	encode_uint64(udp_rx_max, out + 24);
+	encode_uint64(udp_rx_window, out + 32);
+}
+
+void NetGameSession::load_state(const uint8_t in[SESSION_STATE_SIZE]) {
+	memcpy(tx_key, in, CRYPTO_KEY_SIZE);
+	memcpy(rx_key, in + CRYPTO_KEY_SIZE, CRYPTO_KEY_SIZE);
+	in += CRYPTO_KEY_SIZE * 2;
+	tx_counter[CHANNEL_TCP] = decode_uint64(in);
+	tx_counter[CHANNEL_UDP] = decode_uint64(in + 8);
+	tcp_rx = decode_uint64(in + 16);
+	udp_rx_max = decode_uint64(in + 24);
+	udp_rx_window = decode_uint64(in + 32);
+	ready = true;
+}
+
+void NetGameSession::_nonce(int channel, uint64_t counter,
+				uint8_t nonce[12]) const {
+	int i;
+	nonce[0] = channel;
+	nonce[1] = nonce[2] = nonce[3] = 0;
+	for(i = 0; i < 8; i++) {
+		nonce[4 + i] = (counter >> (i * 8)) & 0xFF;
+	}
+}
+
+bool NetGameSession::_check_replay(uint64_t counter) const {
+	if(counter > udp_rx_max || udp_rx_window == 0) {
+		return true;
+	}
+	uint64_t diff = udp_rx_max - counter;
+	if(diff >= SESSION_REPLAY_WINDOW) {
+		return false;
+	}
+	return !(udp_rx_window & ((uint64_t)1 << diff));
+}
+
+void NetGameSession::_update_replay(uint64_t counter) {
+	if(counter > udp_rx_max || udp_rx_window == 0) {
+		uint64_t shift = counter - udp_rx_max;
+		udp_rx_window = shift >= SESSION_REPLAY_WINDOW ? 0 :
+					udp_rx_window << shift;
+		udp_rx_window |= 1;
+		udp_rx_max = counter;
+	}
+	else {
+		udp_rx_window |= (uint64_t)1 << (udp_rx_max - counter);
+	}
+}
+
+Error NetGameSession::seal(int channel, const uint8_t *in, int len,
+				int header_len, DVector<uint8_t> &out) {
+	uint8_t nonce[CRYPTO_NONCE_SIZE];
+	int i;
+
+	ERR_FAIL_COND_V(!ready, ERR_UNCONFIGURED);
+	ERR_FAIL_COND_V(header_len > len, ERR_INVALID_PARAMETER);
+
+	uint64_t counter = tx_counter[channel]++;
+	int body = len - header_len;
+
+	out.resize(len + SESSION_OVERHEAD);
+	DVector<uint8_t>::Write w = out.write();
+	uint8_t *p = w.ptr();
+
+	memcpy(p, in, header_len);
+	for(i = 0; i < SESSION_COUNTER_SIZE; i++) {
+		p[header_len + i] = (counter >> (i * 8)) & 0xFF;
+	}
+	_nonce(channel, counter, nonce);
+	// Header and counter are authenticated
+	NetGameCrypto::aead_seal(tx_key, nonce, p,
+			header_len + SESSION_COUNTER_SIZE, in + header_len, body,
+			p + header_len + SESSION_COUNTER_SIZE,
+			p + header_len + SESSION_COUNTER_SIZE + body);
+	return OK;
+}
+
+Error NetGameSession::open(int channel, const uint8_t *in, int len,
+				int header_len, DVector<uint8_t> &out) {
+	uint8_t nonce[CRYPTO_NONCE_SIZE];
+	uint64_t counter = 0;
+	int i;
+
+	if(!ready || len < header_len + SESSION_OVERHEAD) {
+		return ERR_INVALID_DATA;
+	}
+
+	for(i = 0; i < SESSION_COUNTER_SIZE; i++) {
+		counter |= ((uint64_t)in[header_len + i]) << (i * 8);
+	}
+
+	// Cheap replay rejection before any crypto (TCP counters only grow,
+	// gaps are packets lost with a dead socket before a resume)
+	if(channel == CHANNEL_TCP ? counter < tcp_rx : !_check_replay(counter)) {
+		return ERR_ALREADY_EXISTS;
+	}
+
+	int body = len - header_len - SESSION_OVERHEAD;
+	out.resize(header_len + body);
+	DVector<uint8_t>::Write w = out.write();
+	uint8_t *p = w.ptr();
+
+	_nonce(channel, counter, nonce);
+	if(!NetGameCrypto::aead_open(rx_key, nonce, in,
+			header_len + SESSION_COUNTER_SIZE,
+			in + header_len + SESSION_COUNTER_SIZE, body,
+			in + header_len + SESSION_COUNTER_SIZE + body,
+			p + header_len)) {
+		return ERR_UNAUTHORIZED;
+	}
+	memcpy(p, in, header_len);
+
+	if(channel == CHANNEL_TCP) {
+		tcp_rx = counter + 1;
+	}
+	else {
+		_update_replay(counter);
+	}
+	return OK;
+}
+
+NetGameSession::NetGameSession() {
+	reset();
+}
@@ -0,0 +1,59 @@
+#ifndef NET_GAME_SESSION_H
+#define NET_GAME_SESSION_H
+
+#include "dvector.h"
+#include "ustring.h"
+#include "modules/netgame/net_game_crypto.h"
+
+#define SESSION_COUNTER_SIZE 8
+#define SESSION_OVERHEAD (SESSION_COUNTER_SIZE + CRYPTO_TAG_SIZE)
+#define SESSION_REPLAY_WINDOW 64
+#define SESSION_STATE_SIZE (CRYPTO_KEY_SIZE * 2 + 8 * 5)
+// Counters skipped by an exported session, so that packets still sent
+// by the old process never share a nonce with the new one
+#define SESSION_EXPORT_SKIP (1 << 20)
+
+#define CHANNEL_TCP 0
+#define CHANNEL_UDP 1
+
+/**
+ * Encrypted session (ChaCha20-Poly1305) keyed by an X25519 exchange.
+ * Sealed packets are: [clear header][counter (8)][ciphertext][tag (16)]
+ * The counter is the nonce, TCP must receive it in increasing order, UDP
+ * accepts it once within a sliding window.
+ */
+class NetGameSession {
+
+	uint8_t tx_key[CRYPTO_KEY_SIZE];
+	uint8_t rx_key[CRYPTO_KEY_SIZE];
+	uint64_t tx_counter[2];
+	uint64_t tcp_rx;
+	uint64_t udp_rx_max;
+	uint64_t udp_rx_window;
+	bool ready;
+
+	void _nonce(int channel, uint64_t counter, uint8_t nonce[12]) const;
+	bool _check_replay(uint64_t counter) const;
+	void _update_replay(uint64_t counter);
+
+public:
+	static Error generate_keypair(uint8_t priv[32], uint8_t pub[32]);
+	static void derive_psk(const String &key, uint8_t out[32]);
+
+	Error setup(const uint8_t priv[32], const uint8_t own_pub[32],
+			const uint8_t peer_pub[32], bool is_server,
+			const uint8_t *psk);
+	bool is_ready() const;
+	void reset();
+	void save_state(uint8_t out[SESSION_STATE_SIZE]) const;
+	void load_state(const uint8_t in[SESSION_STATE_SIZE]);
+
+	Error seal(int channel, const uint8_t *in, int len, int header_len,
+			DVector<uint8_t> &out);
+	Error open(int channel, const uint8_t *in, int len, int header_len,
+			DVector<uint8_t> &out);
+
+	NetGameSession();
+};
+
+#endif
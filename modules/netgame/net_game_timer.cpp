@@ -0,0 +1,215 @@
+#include "modules/netgame/net_game_timer.h"
+
+#define TIMER_L0_MASK (TIMER_L0_SIZE - 1)
+#define TIMER_LN_MASK (TIMER_LN_SIZE - 1)
+
+void NetGameTimerWheel::_init_head(NetGameTimer *head) {
+	head->prev = head;
+	head->next = head;
+}
+
+void NetGameTimerWheel::_link(NetGameTimer *head, NetGameTimer *t) {
+	t->prev = head->prev;
+	t->next = head;
+	head->prev->next = t;
+	head->prev = t;
+}
+
+void NetGameTimerWheel::_unlink(NetGameTimer *t) {
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->prev = NULL;
+	t->next = NULL;
+}
+
+/*
+ * Lowest level that can hold the delay, past timers go in the current
+ * slot and the ones beyond the span wait in the last slot reachable
+ */
+void NetGameTimerWheel::_place(NetGameTimer *t) {
+	uint64_t e = t->expire < now ? now : t->expire;
+	uint64_t delta = e - now;
+	int level;
+	int shift = TIMER_L0_BITS;
+
+	if(delta < TIMER_L0_SIZE) {
+		_link(&l0[e & TIMER_L0_MASK], t);
+		return;
+	}
+	for(level = 0; level < TIMER_LEVELS - 1; level++) {
+		if(delta < ((uint64_t)1 << (shift + TIMER_LN_BITS))) {
+			break;
+		}
+		shift += TIMER_LN_BITS;
+	}
+	if(delta >= TIMER_SPAN) {
+		e = now + TIMER_SPAN - 1;
+	}
+	_link(&ln[level][(e >> shift) & TIMER_LN_MASK], t);
+}
+
+/*
+ * Move every timer of a slot to the end of another list
+ */
+void NetGameTimerWheel::_splice(NetGameTimer *head, NetGameTimer *list) {
+	if(head->next == head) {
+		return;
+	}
+	head->next->prev = list->prev;
+	head->prev->next = list;
+	list->prev->next = head->next;
+	list->prev = head->prev;
+	_init_head(head);
+}
+
+/*
+ * Move a slot of an upper level down, the list is detached first since
+ * timers may land in the same slot again
+ */
+void NetGameTimerWheel::_cascade(NetGameTimer *head) {
+	NetGameTimer list;
+
+	_init_head(&list);
+	_splice(head, &list);
+	while(list.next != &list) {
+		NetGameTimer *t = list.next;
+		_unlink(t);
+		_place(t);
+	}
+}
+
+void NetGameTimerWheel::_expire_slot(NetGameTimer *head,
+				Vector<NetGameTimer*> &r_expired) {
+	NetGameTimer *t = head->next;
+
+	while(t != head) {
+		NetGameTimer *next = t->next;
+		if(t->expire <= now) {
+			_unlink(t);
+			count--;
+			r_expired.push_back(t);
+		}
+		t = next;
+	}
+}
+
+void NetGameTimerWheel::reset(uint64_t time) {
+	int i, j;
+
+	for(i = 0; i < TIMER_L0_SIZE; i++) {
+		while(l0[i].next != &l0[i]) {
+			_unlink(l0[i].next);
+		}
+	}
+	for(i = 0; i < TIMER_LEVELS; i++) {
+		for(j = 0; j < TIMER_LN_SIZE; j++) {
+			while(ln[i][j].next != &ln[i][j]) {
+				_unlink(ln[i][j].next);
+			}
+		}
+	}
+	now = time;
+	count = 0;
+}
+
+/*
+ * (Re)schedule a timer, it fires on the first advance() at or after
+ * "expire"
+ */
+void NetGameTimerWheel::schedule(NetGameTimer *t, uint64_t expire) {
+	if(t->is_scheduled()) {
+		_unlink(t);
+	}
+	else {
+		count++;
+	}
+	t->expire = expire;
+	_place(t);
+}
+
+/*
+ * Only moves a deadline earlier, for events that shorten it
+ */
+void NetGameTimerWheel::schedule_before(NetGameTimer *t, uint64_t expire) {
+	if(!t->is_scheduled() || t->expire > expire) {
+		schedule(t, expire);
+	}
+}
+
+void NetGameTimerWheel::cancel(NetGameTimer *t) {
+	if(!t->is_scheduled()) {
+		return;
+	}
+	_unlink(t);
+	count--;
+}
+
+/*
+ * Collect (and unschedule) every timer due at "time", returns how many
+ */
+int NetGameTimerWheel::advance(uint64_t time, Vector<NetGameTimer*> &r_expired) {
+	int before = r_expired.size();
+	int i, j;
+
+	if(time < now) {
+		return 0;
+	}
+
+	if(time - now >= TIMER_SPAN) {
+		// Long stall, gather everything and place it again
+		NetGameTimer list;
+		_init_head(&list);
+		for(i = 0; i < TIMER_L0_SIZE; i++) {
+			_splice(&l0[i], &list);
+		}
+		for(i = 0; i < TIMER_LEVELS; i++) {
+			for(j = 0; j < TIMER_LN_SIZE; j++) {
+				_splice(&ln[i][j], &list);
+			}
+		}
+		now = time;
+		_expire_slot(&list, r_expired);
+		while(list.next != &list) {
+			NetGameTimer *t = list.next;
+			_unlink(t);
+			_place(t);
+		}
+		now = time + 1;
+		return r_expired.size() - before;
+	}
+
+	while(now <= time) {
+		int idx = now & TIMER_L0_MASK;
+		if(idx == 0) {
+			// Upper levels first, they may feed the lower ones
+			for(i = TIMER_LEVELS - 1; i >= 0; i--) {
+				int shift = TIMER_L0_BITS + TIMER_LN_BITS * i;
+				if((now & (((uint64_t)1 << shift) - 1)) == 0) {
+					_cascade(&ln[i][(now >> shift) & TIMER_LN_MASK]);
+				}
+			}
+		}
+		_expire_slot(&l0[idx], r_expired);
+		now++;
+	}
+	return r_expired.size() - before;
+}
+
+int NetGameTimerWheel::get_count() const {
+	return count;
+}
+
+NetGameTimerWheel::NetGameTimerWheel() {
+	int i, j;
+
+	for(i = 0; i < TIMER_L0_SIZE; i++) {
+		_init_head(&l0[i]);
+	}
+	for(i = 0; i < TIMER_LEVELS; i++) {
+		for(j = 0; j < TIMER_LN_SIZE; j++) {
+			_init_head(&ln[i][j]);
+		}
+	}
+	now = 0;
+	count = 0;
+}
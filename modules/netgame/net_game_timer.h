@@ -0,0 +1,64 @@
+#ifndef NET_GAME_TIMER_H
+#define NET_GAME_TIMER_H
+
+#include "typedefs.h"
+#include "vector.h"
+
+// 1 msec slots, then 256 msec and 16 sec slots (about 17 minutes)
+#define TIMER_L0_BITS 8
+#define TIMER_LN_BITS 6
+#define TIMER_L0_SIZE (1 << TIMER_L0_BITS)
+#define TIMER_LN_SIZE (1 << TIMER_LN_BITS)
+#define TIMER_LEVELS 2
+#define TIMER_SPAN ((uint64_t)1 << (TIMER_L0_BITS + TIMER_LN_BITS * TIMER_LEVELS))
+
+/**
+ * Timer node, embedded in its owner (no allocation when scheduling)
+ */
+struct NetGameTimer {
+	NetGameTimer *prev;
+	NetGameTimer *next;
+	uint64_t expire;
+	void *owner;
+
+	bool is_scheduled() const { return next != NULL; }
+
+	NetGameTimer() { prev = NULL; next = NULL; expire = 0; owner = NULL; }
+};
+
+/**
+ * Hierarchical timer wheel with msec resolution.
+ * Scheduling and cancelling are O(1), advance() only costs the slots it
+ * crosses and the timers that expire (plus an occasional cascade of the
+ * upper levels). Timers may fire late by the tick length, never early,
+ * and owners are expected to check their own deadlines again and
+ * reschedule, so moving a deadline later needs no update.
+ * Not thread safe, the server core uses it under its connection lock.
+ */
+class NetGameTimerWheel {
+
+	NetGameTimer l0[TIMER_L0_SIZE];
+	NetGameTimer ln[TIMER_LEVELS][TIMER_LN_SIZE];
+	uint64_t now;
+	int count;
+
+	static void _init_head(NetGameTimer *head);
+	static void _link(NetGameTimer *head, NetGameTimer *t);
+	static void _unlink(NetGameTimer *t);
+	static void _splice(NetGameTimer *head, NetGameTimer *list);
+	void _place(NetGameTimer *t);
+	void _cascade(NetGameTimer *head);
+	void _expire_slot(NetGameTimer *head, Vector<NetGameTimer*> &r_expired);
+
+public:
+	void reset(uint64_t time);
+	void schedule(NetGameTimer *t, uint64_t expire);
+	void schedule_before(NetGameTimer *t, uint64_t expire);
+	void cancel(NetGameTimer *t);
+	int advance(uint64_t time, Vector<NetGameTimer*> &r_expired);
+	int get_count() const;
+
+	NetGameTimerWheel();
+};
+
+#endif
@@ -0,0 +1,432 @@
+#include "modules/netgame/net_game_transfer.h"
+#include "io/marshalls.h"
+
+int NetGameTransfer::_find_out(int sid) const {
+	int i;
+
+	for(i = 0; i < out.size(); i++) {
+		if(out[i]->sid == sid) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int NetGameTransfer::_find_in(int sid) const {
+	int i;
+
+	for(i = 0; i < in.size(); i++) {
+		if(in[i]->sid == sid) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void NetGameTransfer::_remove_out(int idx) {
+	OutStream *s = out[idx];
+
+	if(s->file != NULL) {
+		s->file->close();
+		memdelete(s->file);
+	}
+	memdelete(s);
+	out.remove(idx);
+}
+
+void NetGameTransfer::_remove_in(int idx) {
+	InStream *s = in[idx];
+
+	if(s->file != NULL) {
+		s->file->close();
+		memdelete(s->file);
+	}
+	memdelete(s);
+	in.remove(idx);
+}
+
+void NetGameTransfer::_event(Vector<TransferEvent> &r_events,
+				const char *sig, int sid, int value, const Variant &arg) {
+	TransferEvent ev;
+
+	ev.signal = sig;
+	ev.sid = sid;
+	ev.value = value;
+	ev.arg = arg;
+	r_events.push_back(ev);
+}
+
+/*
+ * [op][sid][value], with the protocol header when sent right away
+ */
+void NetGameTransfer::_control(TransferOp op, int sid, uint32_t value,
+				bool full, DVector<uint8_t> &r_pkt) {
+	int hdr = full ? 2 : 0;
+
+	r_pkt.resize(hdr + TRANSFER_HEADER + 4);
+	DVector<uint8_t>::Write w = r_pkt.write();
+	if(full) {
+		w[0] = CMD_MAX;
+		w[1] = PCMD_STREAM;
+	}
+	w[hdr] = op;
+	w[hdr + 1] = sid & 0xFF;
+	w[hdr + 2] = sid >> 8;
+	encode_uint32(value, w.ptr() + hdr + TRANSFER_HEADER);
+}
+
+/*
+ * Register a new outgoing stream, r_pkt gets the offer
+ */
+int NetGameTransfer::_open(OutStream *s, const String &name,
+				DVector<uint8_t> &r_pkt) {
+	CharString cname = name.utf8();
+	int nlen = MIN(cname.length(), TRANSFER_NAME_MAX);
+
+	s->sent = 0;
+	s->acked = 0;
+	s->accepted = false;
+	s->finished = false;
+
+	mutex->lock();
+	if(out.size() >= TRANSFER_MAX_STREAMS) {
+		mutex->unlock();
+		return -1;
+	}
+	s->sid = next_sid;
+	next_sid = (next_sid + 1) & 0xFFFF;
+	out.push_back(s);
+	mutex->unlock();
+
+	_control(TRANSFER_OFFER, s->sid, s->size, false, r_pkt);
+	int ofs = r_pkt.size();
+	r_pkt.resize(ofs + nlen);
+	DVector<uint8_t>::Write w = r_pkt.write();
+	memcpy(w.ptr() + ofs, cname.get_data(), nlen);
+	return s->sid;
+}
+
+/*
+ * Offer a file, it stays open (and is read chunk by chunk) until the
+ * stream ends. Returns the stream id, or -1 and r_err.
+ */
+int NetGameTransfer::send_file(const String &path, const String &name,
+				DVector<uint8_t> &r_pkt, Error &r_err) {
+	FileAccess *f = FileAccess::open(path, FileAccess::READ, &r_err);
+	if(f == NULL) {
+		return -1;
+	}
+
+	OutStream *s = memnew(OutStream);
+	s->file = f;
+	s->size = f->get_len();
+	int sid = _open(s, name, r_pkt);
+	if(sid < 0) {
+		f->close();
+		memdelete(f);
+		memdelete(s);
+		r_err = ERR_OUT_OF_MEMORY;
+		return -1;
+	}
+	r_err = OK;
+	return sid;
+}
+
+/*
+ * Offer a buffer, shared (not copied) until the stream ends
+ */
+int NetGameTransfer::send_buffer(const DVector<uint8_t> &buf,
+				const String &name, DVector<uint8_t> &r_pkt, Error &r_err) {
+	OutStream *s = memnew(OutStream);
+	s->file = NULL;
+	s->buffer = buf;
+	s->size = buf.size();
+	int sid = _open(s, name, r_pkt);
+	if(sid < 0) {
+		memdelete(s);
+		r_err = ERR_OUT_OF_MEMORY;
+		return -1;
+	}
+	r_err = OK;
+	return sid;
+}
+
+/*
+ * Accept an offered stream into path, from offset to resume a partial
+ * file (its first offset bytes are kept)
+ */
+Error NetGameTransfer::accept(int sid, const String &path, int offset,
+				DVector<uint8_t> &r_pkt) {
+	Error err;
+
+	mutex->lock();
+	int idx = _find_in(sid);
+	if(idx < 0 || in[idx]->file != NULL) {
+		mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	InStream *s = in[idx];
+	if(offset < 0 || (uint32_t)offset > s->size) {
+		mutex->unlock();
+		return ERR_INVALID_PARAMETER;
+	}
+	FileAccess *f = FileAccess::open(path,
+			offset > 0 ? FileAccess::READ_WRITE : FileAccess::WRITE, &err);
+	if(f == NULL) {
+		mutex->unlock();
+		return err;
+	}
+	if(offset > 0) {
+		f->seek(offset);
+	}
+	s->file = f;
+	s->received = offset;
+	s->acked = offset;
+	mutex->unlock();
+
+	_control(TRANSFER_ACCEPT, sid, offset, false, r_pkt);
+	return OK;
+}
+
+/*
+ * Stop sending, no "stream_completed" for streams cancelled here
+ */
+Error NetGameTransfer::cancel(int sid, DVector<uint8_t> &r_pkt) {
+	mutex->lock();
+	int idx = _find_out(sid);
+	if(idx < 0) {
+		mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	_remove_out(idx);
+	mutex->unlock();
+
+	_control(TRANSFER_CANCEL, sid, 0, false, r_pkt);
+	return OK;
+}
+
+/*
+ * Refuse an offer or stop receiving
+ */
+Error NetGameTransfer::reject(int sid, DVector<uint8_t> &r_pkt) {
+	mutex->lock();
+	int idx = _find_in(sid);
+	if(idx < 0) {
+		mutex->unlock();
+		return ERR_DOES_NOT_EXIST;
+	}
+	_remove_in(idx);
+	mutex->unlock();
+
+	_control(TRANSFER_REJECT, sid, 0, false, r_pkt);
+	return OK;
+}
+
+/*
+ * A PCMD_STREAM packet from the peer, r_pkts gets the replies (bodies,
+ * queued after the TCP packets like the game thread ones)
+ */
+void NetGameTransfer::handle(const DVector<uint8_t> &pkt,
+				Vector<DVector<uint8_t> > &r_pkts,
+				Vector<TransferEvent> &r_events) {
+	DVector<uint8_t> reply;
+	int idx;
+
+	if(pkt.size() < TRANSFER_HEADER + 4) {
+		return;
+	}
+	DVector<uint8_t>::Read r = pkt.read();
+	int op = r[0];
+	int sid = r[1] | (r[2] << 8);
+	uint32_t value = decode_uint32(r.ptr() + TRANSFER_HEADER);
+	const uint8_t *data = r.ptr() + TRANSFER_HEADER + 4;
+	int len = pkt.size() - TRANSFER_HEADER - 4;
+
+	mutex->lock();
+	if(op == TRANSFER_OFFER) {
+		if(_find_in(sid) >= 0 || in.size() >= TRANSFER_MAX_STREAMS) {
+			_control(TRANSFER_REJECT, sid, 0, false, reply);
+			r_pkts.push_back(reply);
+			mutex->unlock();
+			return;
+		}
+		InStream *s = memnew(InStream);
+		s->sid = sid;
+		s->file = NULL;
+		s->name.parse_utf8((const char *)data, len);
+		s->size = value;
+		s->received = 0;
+		s->acked = 0;
+		in.push_back(s);
+		_event(r_events, SIGNAL_STREAM_OFFER, sid, value, s->name);
+	}
+	else if(op == TRANSFER_DATA) {
+		idx = _find_in(sid);
+		if(idx < 0 || in[idx]->file == NULL) {
+			mutex->unlock();
+			return;
+		}
+		InStream *s = in[idx];
+		// Ordered channel, anything else is a broken peer
+		if(value != s->received || (uint32_t)len > s->size - s->received) {
+			_event(r_events, SIGNAL_STREAM_COMPLETED, sid,
+					ERR_INVALID_DATA, s->received);
+			_remove_in(idx);
+			_control(TRANSFER_REJECT, sid, 0, false, reply);
+			r_pkts.push_back(reply);
+			mutex->unlock();
+			return;
+		}
+		s->file->store_buffer(data, len);
+		s->received += len;
+		if(s->received - s->acked >= TRANSFER_ACK_BYTES ||
+				s->received == s->size) {
+			s->acked = s->received;
+			_control(TRANSFER_ACK, sid, s->received, false, reply);
+			r_pkts.push_back(reply);
+			_event(r_events, SIGNAL_STREAM_PROGRESS, sid, s->received,
+					s->size);
+		}
+		if(s->received == s->size) {
+			_event(r_events, SIGNAL_STREAM_COMPLETED, sid, OK, s->size);
+			_remove_in(idx);
+		}
+	}
+	else if(op == TRANSFER_CANCEL) {
+		idx = _find_in(sid);
+		if(idx >= 0) {
+			_event(r_events, SIGNAL_STREAM_COMPLETED, sid, ERR_SKIP,
+					in[idx]->received);
+			_remove_in(idx);
+		}
+	}
+	else if(op == TRANSFER_ACCEPT || op == TRANSFER_ACK ||
+			op == TRANSFER_REJECT) {
+		idx = _find_out(sid);
+		if(idx < 0) {
+			mutex->unlock();
+			return;
+		}
+		OutStream *s = out[idx];
+		if(op == TRANSFER_REJECT) {
+			_event(r_events, SIGNAL_STREAM_COMPLETED, sid, ERR_SKIP,
+					s->acked);
+			_remove_out(idx);
+		}
+		else if(op == TRANSFER_ACCEPT) {
+			if(s->accepted || value > s->size) {
+				mutex->unlock();
+				return;
+			}
+			s->accepted = true;
+			s->sent = value;
+			s->acked = value;
+			if(s->file != NULL) {
+				s->file->seek(value);
+			}
+		}
+		else if(s->accepted && value > s->acked && value <= s->sent) {
+			s->acked = value;
+			_event(r_events, SIGNAL_STREAM_PROGRESS, sid, s->acked,
+					s->size);
+			if(s->acked == s->size) {
+				_event(r_events, SIGNAL_STREAM_COMPLETED, sid, OK,
+						s->size);
+				_remove_out(idx);
+			}
+		}
+	}
+	mutex->unlock();
+}
+
+/*
+ * Next chunk to send, streams take turns. False when every stream is
+ * waiting (offer not accepted yet, window full or all sent).
+ */
+bool NetGameTransfer::pump(int chunk, DVector<uint8_t> &r_pkt,
+				Vector<TransferEvent> &r_events) {
+	int i;
+
+	mutex->lock();
+	for(i = 0; i < out.size(); i++) {
+		int idx = (next_out + i) % out.size();
+		OutStream *s = out[idx];
+		if(!s->accepted || s->finished ||
+				s->sent - s->acked >= TRANSFER_WINDOW) {
+			continue;
+		}
+
+		// Empty streams and streams resumed at the end still send one
+		// chunk, it completes them on the receiver
+		int len = MIN((uint32_t)chunk, s->size - s->sent);
+		int hdr = 2 + TRANSFER_HEADER + 4;
+		bool ok = true;
+		r_pkt.resize(hdr + len);
+		{
+			DVector<uint8_t>::Write w = r_pkt.write();
+			w[0] = CMD_MAX;
+			w[1] = PCMD_STREAM;
+			w[2] = TRANSFER_DATA;
+			w[3] = s->sid & 0xFF;
+			w[4] = s->sid >> 8;
+			encode_uint32(s->sent, w.ptr() + 2 + TRANSFER_HEADER);
+			if(s->file != NULL) {
+				ok = s->file->get_buffer(w.ptr() + hdr, len) == len;
+			}
+			else {
+				DVector<uint8_t>::Read r = s->buffer.read();
+				memcpy(w.ptr() + hdr, r.ptr() + s->sent, len);
+			}
+		}
+		if(!ok) {
+			_event(r_events, SIGNAL_STREAM_COMPLETED, s->sid,
+					ERR_FILE_CANT_READ, s->acked);
+			_control(TRANSFER_CANCEL, s->sid, 0, true, r_pkt);
+			_remove_out(idx);
+			next_out = idx;
+			mutex->unlock();
+			return true;
+		}
+		s->sent += len;
+		s->finished = s->sent == s->size;
+		next_out = idx + 1;
+		mutex->unlock();
+		return true;
+	}
+	mutex->unlock();
+	return false;
+}
+
+/*
+ * The peer left, every stream fails with ERR_CONNECTION_ERROR
+ */
+void NetGameTransfer::clear(Vector<TransferEvent> &r_events) {
+	mutex->lock();
+	while(out.size() > 0) {
+		_event(r_events, SIGNAL_STREAM_COMPLETED, out[0]->sid,
+				ERR_CONNECTION_ERROR, out[0]->acked);
+		_remove_out(0);
+	}
+	while(in.size() > 0) {
+		// Offers never accepted are just forgotten
+		if(in[0]->file != NULL) {
+			_event(r_events, SIGNAL_STREAM_COMPLETED, in[0]->sid,
+					ERR_CONNECTION_ERROR, in[0]->received);
+		}
+		_remove_in(0);
+	}
+	mutex->unlock();
+}
+
+NetGameTransfer::NetGameTransfer() {
+	mutex = Mutex::create();
+	next_sid = 0;
+	next_out = 0;
+}
+
+NetGameTransfer::~NetGameTransfer() {
+	Vector<TransferEvent> events;
+
+	clear(events);
+	memdelete(mutex);
+}
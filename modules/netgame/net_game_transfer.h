@@ -0,0 +1,113 @@
+#ifndef NET_GAME_TRANSFER_H
+#define NET_GAME_TRANSFER_H
+
+#include "os/mutex.h"
+#include "os/file_access.h"
+#include "vector.h"
+#include "dvector.h"
+#include "modules/netgame/net_game_server_data.h"
+
+// Chunk sizes on TCP and on the reliable UDP channel (UDP only mode)
+#define TRANSFER_CHUNK 16384
+#define TRANSFER_CHUNK_RELIABLE 1024
+// Unacked bytes per stream, the receiver acks every TRANSFER_ACK_BYTES
+#define TRANSFER_WINDOW 131072
+#define TRANSFER_ACK_BYTES 32768
+// Chunks sent per peer and tick, only once the TCP queue is empty
+#define TRANSFER_BURST 4
+#define TRANSFER_MAX_STREAMS 16
+#define TRANSFER_NAME_MAX 255
+// [op][sid 2], then [size 4][name] or [offset 4][data]
+#define TRANSFER_HEADER 3
+
+enum TransferOp {
+	TRANSFER_OFFER,
+	TRANSFER_ACCEPT,
+	TRANSFER_DATA,
+	TRANSFER_ACK,
+	TRANSFER_CANCEL,
+	TRANSFER_REJECT
+};
+
+struct TransferEvent {
+	const char *signal;
+	int sid;
+	int value;
+	Variant arg;
+};
+
+/**
+ * Bulk transfer streams to and from one peer, sent as PCMD_STREAM
+ * packets after the queued TCP packets. The sender reads each chunk
+ * from the source file when it is sent, the receiver writes it to the
+ * destination file as it arrives, so only the chunks in flight are in
+ * memory. A stream is offered with its size, and the receiver accepts it
+ * from an offset to resume a partial file.
+ * The game thread opens, accepts and cancels streams, the network thread
+ * calls handle() and pump(). Control packets are returned as bodies and
+ * queued as protocol packets, pump() returns whole packets
+ * ([CMD_MAX][PCMD_STREAM] included) sent right away. Signals are
+ * reported as events.
+ */
+class NetGameTransfer {
+
+	struct OutStream {
+		int sid;
+		FileAccess *file;
+		DVector<uint8_t> buffer;
+		uint32_t size;
+		uint32_t sent;
+		uint32_t acked;
+		bool accepted;
+		bool finished;
+	};
+
+	struct InStream {
+		int sid;
+		FileAccess *file;
+		String name;
+		uint32_t size;
+		uint32_t received;
+		uint32_t acked;
+	};
+
+	Mutex *mutex;
+	Vector<OutStream*> out;
+	Vector<InStream*> in;
+	int next_sid;
+	int next_out;
+
+	int _find_out(int sid) const;
+	int _find_in(int sid) const;
+	int _open(OutStream *s, const String &name, DVector<uint8_t> &r_pkt);
+	void _remove_out(int idx);
+	void _remove_in(int idx);
+	void _event(Vector<TransferEvent> &r_events, const char *sig, int sid,
+			int value, const Variant &arg);
+
+	static void _control(TransferOp op, int sid, uint32_t value, bool full,
+				DVector<uint8_t> &r_pkt);
+
+public:
+	// Game thread
+	int send_file(const String &path, const String &name,
+			DVector<uint8_t> &r_pkt, Error &r_err);
+	int send_buffer(const DVector<uint8_t> &buf, const String &name,
+			DVector<uint8_t> &r_pkt, Error &r_err);
+	Error accept(int sid, const String &path, int offset,
+			DVector<uint8_t> &r_pkt);
+	Error cancel(int sid, DVector<uint8_t> &r_pkt);
+	Error reject(int sid, DVector<uint8_t> &r_pkt);
+
+	// Network thread
+	void handle(const DVector<uint8_t> &pkt, Vector<DVector<uint8_t> > &r_pkts,
+			Vector<TransferEvent> &r_events);
+	bool pump(int chunk, DVector<uint8_t> &r_pkt,
+			Vector<TransferEvent> &r_events);
+	void clear(Vector<TransferEvent> &r_events);
+
+	NetGameTransfer();
+	~NetGameTransfer();
+};
+
+#endif
@@ -2,9 +2,18 @@
 #include "object_type_db.h"
 #include "net_game_server.h"
 #include "net_game_client.h"
+#include "net_game_reactor.h"
+#include "net_game_record.h"
+#include "net_game_rpc.h"
 
 void register_netgame_types() {
 
+        ObjectTypeDB::register_type<NetGameReactor>();
+        ObjectTypeDB::register_type<NetGameRecorder>();
+        ObjectTypeDB::register_type<NetGameReplay>();
+        ObjectTypeDB::register_type<NetGameCall>();
+        ObjectTypeDB::register_type<NetGameServerCore>();
+        ObjectTypeDB::register_type<NetGameClientCore>();
         ObjectTypeDB::register_type<NetGameServer>();
         ObjectTypeDB::register_type<NetGameClient>();
 }